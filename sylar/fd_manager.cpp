@@ -6,18 +6,15 @@
 
 namespace sylar {
 
-FdCtx::FdCtx(int fd)
+FdCtx::FdCtx()
     : m_isInit(false),
       m_isSocket(false),
       m_sysNonblock(false),
       m_userNonblock(false),
       m_isClsed(false),
-      m_fd(fd),
+      m_fd(-1),
       m_recvTimeout(-1),
-      m_sendTimeout(-1) {
-  init();
-}
-FdCtx::~FdCtx() {}
+      m_sendTimeout(-1) {}
 
 bool FdCtx::init() {
   if (m_isInit) {
@@ -63,39 +60,65 @@ uint64_t FdCtx::getTimeout(int type) {
   }
 }
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-  if (fd == -1) {
-    return nullptr;
-  }
-  RWMutexType::ReadLock lock(m_mutex);
-  if ((int)m_datas.size() <= fd) {
-    if (auto_create == false) {
+FdCtx* FdManager::slot(int fd, bool create) {
+  FdCtx* seg = m_segments[fd / SEGMENT_SIZE].load(std::memory_order_acquire);
+  if (!seg) {
+    if (!create) {
       return nullptr;
     }
-  } else {
-    if (m_datas[fd] || !auto_create) {
-      return m_datas[fd];
-    }
+    //持有锁时分配, 不会重复
+    seg = new FdCtx[SEGMENT_SIZE];
+    m_segments[fd / SEGMENT_SIZE].store(seg, std::memory_order_release);
+  }
+  return &seg[fd % SEGMENT_SIZE];
+}
+
+FdCtx* FdManager::get(int fd, bool auto_create) {
+  if (fd < 0 || fd >= MAX_FD) {
+    return nullptr;
   }
-  lock.unlock();
-  RWMutexType::WriteLock lock2(m_mutex);
-  FdCtx::ptr ctx(new FdCtx(fd));
-  if (fd >= (int)m_datas.size()) {
-    m_datas.resize(fd * 1.5);
+  FdCtx* ctx = slot(fd, false);
+  if (ctx && (ctx->getGeneration() & 1)) {
+    return ctx;
   }
-  m_datas[fd] = ctx;
+  if (!auto_create) {
+    return nullptr;
+  }
+  MutexType::Lock lock(m_mutex);
+  ctx = slot(fd, true);
+  uint32_t gen = ctx->m_generation.load(std::memory_order_relaxed);
+  if (gen & 1) {
+    return ctx;
+  }
+  ctx->m_fd = fd;
+  ctx->m_isInit = false;
+  ctx->init();
+  //字段初始化完成后才对get()可见
+  ctx->m_generation.store(gen + 1, std::memory_order_release);
   return ctx;
 }
 
 void FdManager::del(int fd) {
-  RWMutexType::WriteLock lock(m_mutex);
-  if ((int)m_datas.size() <= fd) {
+  if (fd < 0 || fd >= MAX_FD) {
+    return;
+  }
+  MutexType::Lock lock(m_mutex);
+  FdCtx* ctx = slot(fd, false);
+  if (!ctx) {
+    return;
+  }
+  uint32_t gen = ctx->m_generation.load(std::memory_order_relaxed);
+  if (!(gen & 1)) {
     return;
   }
-  m_datas[fd].reset();
+  //还拿着指针的一方通过isClose()或者代数发现句柄已经关闭
+  ctx->m_isClsed = true;
+  ctx->m_generation.store(gen + 1, std::memory_order_release);
 }
 
 FdManager::FdManager() {
-  m_datas.resize(64);
+  for (int i = 0; i < SEGMENT_COUNT; ++i) {
+    m_segments[i].store(nullptr, std::memory_order_relaxed);
+  }
 }
-}  // namespace sylar
\ No newline at end of file
+}  // namespace sylar
@@ -1,19 +1,28 @@
 #ifndef __FD_MANAGER_H__
 #define __FD_MANAGER_H__
 
+#include <stdint.h>
+#include <atomic>
 #include <memory>
-#include <vector>
 #include "mutex.h"
 #include "singleton.h"
 #include "thread.h"
 
 namespace sylar {
 
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+class FdManager;
+
+/**
+ * @brief 文件句柄上下文
+ * @details 内嵌在FdManager的槽位里, 地址一直有效, 句柄关闭后槽位给下一个
+ *          相同的句柄复用. 持有指针跨过挂起点时, 用getGeneration()判断
+ *          句柄是否已经被关闭或者复用
+ */
+class FdCtx {
+  friend class FdManager;
+
  public:
-  typedef std::shared_ptr<FdCtx> ptr;
-  FdCtx(int fd);
-  ~FdCtx();
+  FdCtx();
 
   bool init();
 
@@ -23,8 +32,6 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
 
   bool isClose() const { return m_isClsed; }
 
-  bool close();
-
   void setUserNonblock(bool v) { m_userNonblock = v; }
 
   bool getUserNonblock() const { return m_userNonblock; }
@@ -37,7 +44,16 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
 
   uint64_t getTimeout(int type);
 
+  /**
+   * @brief 槽位的代数, 句柄创建和关闭时各加一, 奇数表示正在使用
+   */
+  uint32_t getGeneration() const {
+    return m_generation.load(std::memory_order_acquire);
+  }
+
  private:
+  /// 代数, 只在FdManager持有锁时修改
+  std::atomic<uint32_t> m_generation{0};
   /// 是否初始化
   bool m_isInit : 1;
   /// 是否socket
@@ -56,22 +72,49 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
   uint64_t m_sendTimeout;
 };
 
+/**
+ * @brief 文件句柄管理
+ * @details 按句柄分段的只增长数组, 段在第一次用到时分配, 之后不会移动
+ *          也不会释放(退出时其他静态对象析构还可能关闭句柄).
+ *          get()不加锁也不增加引用计数, 只有创建和删除句柄时加锁.
+ *          超出MAX_FD的句柄不管理, hook直接调用系统函数
+ */
 class FdManager {
  public:
-  typedef RWMutex RWMutexType;
+  typedef Mutex MutexType;
+
+  /// 每段的槽位数
+  static const int SEGMENT_SIZE = 1024;
+  /// 段数
+  static const int SEGMENT_COUNT = 4096;
+  /// 能管理的最大句柄(不包含)
+  static const int MAX_FD = SEGMENT_SIZE * SEGMENT_COUNT;
 
   FdManager();
 
-  FdCtx::ptr get(int fd, bool auto_create = false);
+  /**
+   * @brief 获取句柄上下文
+   * @param[in] auto_create 不存在时是否创建
+   * @return 不存在或者超出范围时返回nullptr
+   */
+  FdCtx* get(int fd, bool auto_create = false);
 
   void del(int fd);
 
  private:
-  RWMutexType m_mutex;
-  std::vector<FdCtx::ptr> m_datas;
+  /**
+   * @brief 返回句柄所在的槽位, 段不存在时按create分配
+   */
+  FdCtx* slot(int fd, bool create);
+
+ private:
+  /// 保护句柄的创建和删除
+  MutexType m_mutex;
+  /// 段, 每段SEGMENT_SIZE个槽位
+  std::atomic<FdCtx*> m_segments[SEGMENT_COUNT];
 };
 
 typedef Singleton<FdManager> FdMgr;
 }  // namespace sylar
 
-#endif
\ No newline at end of file
+#endif
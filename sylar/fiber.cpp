@@ -1,9 +1,13 @@
 #include "fiber.h"
+#include <stdlib.h>
+#include <string.h>
 #include <atomic>
+#include <vector>
 #include "config.h"
 #include "log.h"
 #include "macro.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
 
 namespace sylar {
 
@@ -24,13 +28,56 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = Config::Lookup<uint32_t>(
     "fiber.stack_size", 128 * 1024, "fiber stack size");
 
-class MallocStackAllocator {
- public:
-  static void* Alloc(size_t size) { return malloc(size); }
-  static void Dealloc(void* vp, size_t size) { return free(vp); }
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_count =
+    Config::Lookup<uint32_t>("fiber.shared_stack.count", 4,
+                             "shared stacks per thread");
+
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack.size", 256 * 1024,
+                             "shared stack size");
+
+static std::atomic<uint64_t> s_shared_saved{0};
+
+/**
+ * @brief 共享栈, 同一时刻只属于一个协程
+ * */
+struct SharedStack {
+  void* stack = nullptr;
+  size_t size = 0;
+  Fiber* occupant = nullptr;
+};
+
+/**
+ * @brief 线程本地的共享栈, 协程第一次运行时轮流分配
+ * */
+struct SharedStackPool {
+  std::vector<SharedStack> stacks;
+  size_t next = 0;
+
+  SharedStackPool() {
+    size_t count = std::max<uint32_t>(g_fiber_shared_stack_count->getValue(), 1);
+    size_t size = g_fiber_shared_stack_size->getValue();
+    stacks.resize(count);
+    for (auto& i : stacks) {
+      i.size = size;
+      i.stack = MmapStackAllocator::GetInstance()->alloc(size);
+      SYLAR_ASSERT2(i.stack, "alloc shared stack");
+    }
+  }
+
+  ~SharedStackPool() {
+    for (auto& i : stacks) {
+      MmapStackAllocator::GetInstance()->dealloc(i.stack, i.size);
+    }
+  }
+
+  SharedStack* get() { return &stacks[next++ % stacks.size()]; }
 };
 
-using StackAllocater = MallocStackAllocator;
+static SharedStackPool* GetSharedStackPool() {
+  static thread_local SharedStackPool t_pool;
+  return &t_pool;
+}
 
 uint64_t Fiber::GetFiberId() {
   if (t_fiber) {
@@ -42,39 +89,43 @@ uint64_t Fiber::GetFiberId() {
 Fiber::Fiber() {
   m_state = EXEC;
   SetThis(this);
-  if (getcontext(&m_ctx)) {
+  if (!m_ctx.init()) {
     SYLAR_ASSERT2(false, "getcontext");
   }
   //  SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id = " << Fiber::GetFiberId();
   ++s_fiber_count;
   SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber main";
 }
-Fiber::Fiber(std::function<void()> cb, size_t stack_size, bool use_caller)
-    : m_id(++s_fiber_id), m_cb(cb) {
+Fiber::Fiber(std::function<void()> cb, size_t stack_size, bool use_caller,
+             bool shared_stack)
+    : m_id(++s_fiber_id), m_cb(cb), m_shared(shared_stack) {
   ++s_fiber_count;
+  if (m_shared) {
+    //上下文在第一次切入占到共享栈后才能构造
+    SYLAR_ASSERT2(!use_caller, "shared stack fiber can't use caller");
+    SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber shared id = " << m_id;
+    return;
+  }
   m_stacksize = stack_size ? stack_size : g_fiber_stack_size->getValue();
 
-  m_stack = StackAllocater ::Alloc(m_stacksize);
-  if (getcontext(&m_ctx)) {
-    SYLAR_ASSERT2(false, "getconnect");
-  }
-  m_ctx.uc_link = nullptr;
-  m_ctx.uc_stack.ss_sp = m_stack;
-  m_ctx.uc_stack.ss_size = m_stacksize;
-
-  if (!use_caller) {
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-  } else {
-    makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+  m_allocator = StackAllocator::GetDefault();
+  m_stack = m_allocator->alloc(m_stacksize);
+  SYLAR_ASSERT2(m_stack, "alloc fiber stack");
+  if (!m_ctx.make(m_stack, m_stacksize,
+                  use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc)) {
+    SYLAR_ASSERT2(false, "makecontext");
   }
   SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id = " << m_id;
 }
 
 Fiber::~Fiber() {
   --s_fiber_count;
-  if (m_stack) {
+  if (m_shared) {
+    SYLAR_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
+    releaseSharedStack();
+  } else if (m_stack) {
     SYLAR_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
-    StackAllocater::Dealloc(m_stack, m_stacksize);
+    m_allocator->dealloc(m_stack, m_stacksize);
   } else {
     SYLAR_ASSERT(!m_cb);
     SYLAR_ASSERT(m_state == EXEC);
@@ -90,31 +141,33 @@ Fiber::~Fiber() {
 //重置协程函数，并重置状态
 //INIT，TERM状态下调用
 void Fiber::reset(std::function<void()> cb) {
-  SYLAR_ASSERT(m_stack);
+  SYLAR_ASSERT(m_stack || m_shared);
   SYLAR_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
   m_cb = cb;
-  if (getcontext(&m_ctx)) {
-    SYLAR_ASSERT2(false, "getcontext");
+  m_priority = -1;
+  if (m_shared) {
+    releaseSharedStack();
+    m_state = INIT;
+    return;
+  }
+  if (!m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc)) {
+    SYLAR_ASSERT2(false, "makecontext");
   }
-  m_ctx.uc_link = nullptr;
-  m_ctx.uc_stack.ss_sp = m_stack;
-  m_ctx.uc_stack.ss_size = m_stacksize;
-
-  makecontext(&m_ctx, &Fiber::MainFunc, 0);
   m_state = INIT;
 }
 
 void Fiber::call() {
+  SYLAR_ASSERT(!m_shared);
   SetThis(this);
   m_state = EXEC;
-  if (swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
+  if (!t_threadFiber->m_ctx.swap(m_ctx)) {
     SYLAR_ASSERT2(false, "swapcontext");
   }
 }
 
 void Fiber::back() {
   SetThis(t_threadFiber.get());
-  if (swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
+  if (!m_ctx.swap(t_threadFiber->m_ctx)) {
     SYLAR_ASSERT2(false, "swapcontext");
   }
 }
@@ -123,19 +176,101 @@ void Fiber::back() {
 void Fiber::swapIn() {
   SetThis(this);
   SYLAR_ASSERT(m_state != EXEC);
+  if (m_shared) {
+    acquireSharedStack();
+  }
   m_state = EXEC;
-  if (swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
+  if (!Scheduler::GetMainFiber()->m_ctx.swap(m_ctx)) {
     SYLAR_ASSERT2(false, "swapcontext");
   }
+  if (m_shared && (m_state == TERM || m_state == EXCEPT)) {
+    releaseSharedStack();
+  }
 }
 /// 切换到后台执行
 void Fiber::swapOut() {
+  if (m_shared) {
+    //ucontext 拿不到切出时的栈指针, 取当前栈帧再留出swapcontext使用的余量
+    m_stackSp = (char*)__builtin_frame_address(0) - 1024;
+  }
   SetThis(Scheduler::GetMainFiber());
-  if (swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
+  if (!m_ctx.swap(Scheduler::GetMainFiber()->m_ctx)) {
     SYLAR_ASSERT2(false, "swapcontext");
   }
 }
 
+void Fiber::acquireSharedStack() {
+  if (!m_sharedStack) {
+    m_sharedStack = GetSharedStackPool()->get();
+    m_sharedThread = sylar::GetThreadId();
+  }
+  SYLAR_ASSERT2(m_sharedThread == sylar::GetThreadId(),
+                "shared stack fiber must run on its bound thread");
+
+  Fiber* occupant = m_sharedStack->occupant;
+  if (occupant != this) {
+    if (occupant) {
+      occupant->saveSharedStack();
+    }
+    m_sharedStack->occupant = this;
+    if (m_state != INIT && m_saveSize) {
+      char* top = (char*)m_sharedStack->stack + m_sharedStack->size;
+      memcpy(top - m_saveSize, m_saveBuf, m_saveSize);
+      s_shared_saved -= m_saveSize;
+      m_saveSize = 0;
+    }
+  }
+
+  if (m_state == INIT) {
+    m_stack = m_sharedStack->stack;
+    m_stacksize = m_sharedStack->size;
+    if (!m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc)) {
+      SYLAR_ASSERT2(false, "makecontext");
+    }
+  }
+}
+
+void Fiber::saveSharedStack() {
+  SYLAR_ASSERT(m_sharedStack && m_sharedStack->occupant == this);
+  m_sharedStack->occupant = nullptr;
+  if (m_state == INIT || m_state == TERM || m_state == EXCEPT) {
+    return;
+  }
+
+  char* bottom = (char*)m_sharedStack->stack;
+  char* top = bottom + m_sharedStack->size;
+  char* sp = (char*)m_ctx.getStackPointer();
+  if (!sp) {
+    sp = (char*)m_stackSp;
+  }
+  if (sp < bottom) {
+    sp = bottom;
+  }
+  size_t used = top - sp;
+
+  //按实际使用量分配, 过大的旧缓冲区也重新分配
+  if (m_saveCap < used || m_saveCap > used * 2 + 4096) {
+    free(m_saveBuf);
+    m_saveBuf = malloc(used);
+    SYLAR_ASSERT2(m_saveBuf, "malloc shared stack buffer");
+    m_saveCap = used;
+  }
+  memcpy(m_saveBuf, sp, used);
+  m_saveSize = used;
+  s_shared_saved += used;
+}
+
+void Fiber::releaseSharedStack() {
+  if (m_sharedStack && m_sharedStack->occupant == this) {
+    m_sharedStack->occupant = nullptr;
+  }
+  s_shared_saved -= m_saveSize;
+  free(m_saveBuf);
+  m_saveBuf = nullptr;
+  m_saveSize = 0;
+  m_saveCap = 0;
+}
+
 void Fiber::SetThis(Fiber* f) {
   t_fiber = f;
 }
@@ -169,6 +304,10 @@ uint64_t Fiber::TotalFibers() {
   return s_fiber_count;
 }
 
+uint64_t Fiber::TotalSharedStackSaved() {
+  return s_shared_saved;
+}
+
 void Fiber::MainFunc() {
   Fiber::ptr cur = GetThis();
   SYLAR_ASSERT(cur);
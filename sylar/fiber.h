@@ -1,14 +1,16 @@
 #ifndef __SYLAR_FIBER_H__
 #define __SYLAR_FIBER_H__
 
-#include <ucontext.h>
 #include <functional>
 #include <memory>
+#include "fiber_context.h"
 #include "thread.h"
 
 namespace sylar {
 
 class Scheduler;
+struct SharedStack;
+class StackAllocator;
 
 class Fiber : public std::enable_shared_from_this<Fiber> {
   friend class Scheduler;
@@ -35,8 +37,19 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
   Fiber();
 
  public:
+  /**
+   * @brief 构造函数
+   * @param[in] cb 协程执行函数
+   * @param[in] stack_size 栈大小, 0使用 fiber.stack_size
+   * @param[in] use_caller 是否在线程主协程上调度(call/back)
+   * @param[in] shared_stack 是否使用共享栈
+   * @details 共享栈协程运行在线程的几个共享栈上, 切出后被其它协程占用时
+   *          才把已使用的部分拷贝到按需分配的堆内存, 适合大量长期空闲的连接.
+   *          第一次运行后绑定在该线程上, 调度器只会在这个线程上执行它.
+   *          共享栈协程不能跨协程保存栈上变量的地址
+   * */
   Fiber(std::function<void()> cb, size_t stack_size = 0,
-        bool use_caller = false);
+        bool use_caller = false, bool shared_stack = false);
   ~Fiber();
   /// 重置协程函数，并重置状态
   /// INIT，TERM状态下调用
@@ -53,6 +66,18 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
 
   Status getState() const { return m_state; }
 
+  /// 是否使用共享栈
+  bool isSharedStack() const { return m_shared; }
+
+  /// 共享栈协程绑定的线程id, 未绑定返回-1
+  int getBoundThread() const { return m_sharedThread; }
+
+  /// 最后一次被调度的优先级(Scheduler::Priority), 没被调度过返回-1
+  int getPriority() const { return m_priority; }
+
+  /// 设置优先级, 之后不指定优先级的调度沿用
+  void setPriority(int v) { m_priority = v; }
+
  public:
   /// 设置当前的协程
   static void SetThis(Fiber* f);
@@ -75,6 +100,17 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
 
   static uint64_t GetFiberId();
 
+  /// 共享栈协程当前拷贝保存的栈总字节数
+  static uint64_t TotalSharedStackSaved();
+
+ private:
+  /// 切入前占用共享栈, 必要时保存原占用者并恢复自己的栈
+  void acquireSharedStack();
+  /// 把已使用的共享栈拷贝到m_saveBuf
+  void saveSharedStack();
+  /// 结束后释放共享栈
+  void releaseSharedStack();
+
  private:
   //协程ID
   uint64_t m_id = 0;
@@ -83,11 +119,29 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
   //协程状态
   Status m_state = INIT;
   //协程上下文
-  ucontext_t m_ctx;
+  FiberContext m_ctx;
   //协程栈
   void* m_stack = nullptr;
+  //分配协程栈的分配器
+  StackAllocator* m_allocator = nullptr;
   //协程执行函数
   std::function<void()> m_cb;
+  //是否使用共享栈
+  bool m_shared = false;
+  //绑定的线程id
+  int m_sharedThread = -1;
+  //调度优先级
+  int m_priority = -1;
+  //绑定的共享栈
+  SharedStack* m_sharedStack = nullptr;
+  //ucontext后端切出时记录的栈位置
+  void* m_stackSp = nullptr;
+  //保存的栈内容
+  void* m_saveBuf = nullptr;
+  //保存的栈大小
+  size_t m_saveSize = 0;
+  //m_saveBuf容量
+  size_t m_saveCap = 0;
 };
 
 }  // namespace sylar
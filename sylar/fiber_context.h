@@ -0,0 +1,118 @@
+/**
+ * @brief 协程上下文切换
+ * @details 编译期选择后端:
+ *          定义 SYLAR_FIBER_ASM_CONTEXT 时使用汇编实现(fiber_context_*.S),
+ *          只保存被调用者保存寄存器, 切换不进入内核;
+ *          否则使用 ucontext(swapcontext 每次都会调用 rt_sigprocmask)
+ * */
+#ifndef __SYLAR_FIBER_CONTEXT_H__
+#define __SYLAR_FIBER_CONTEXT_H__
+
+#include <stddef.h>
+
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+extern "C" {
+/**
+ * @brief 在栈顶构造初始上下文, 第一次切换进去时执行fn
+ * @param[in] stack_top 栈的最高地址
+ * @param[in] fn 入口函数, 不能返回
+ * @return 保存的栈指针
+ * */
+void* sylar_make_context(void* stack_top, void (*fn)());
+
+/**
+ * @brief 保存当前寄存器到栈上并把栈指针写入*from_sp, 然后切换到to_sp
+ * */
+void sylar_swap_context(void** from_sp, void* to_sp);
+}
+#else
+#include <ucontext.h>
+#endif
+
+namespace sylar {
+
+/**
+ * @brief 协程上下文
+ * */
+class FiberContext {
+ public:
+  /**
+   * @brief 后端名称
+   * */
+  static const char* GetBackend() {
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    return "asm";
+#else
+    return "ucontext";
+#endif
+  }
+
+  /**
+   * @brief 初始化线程主协程的上下文
+   * @return 成功返回true
+   * */
+  bool init() {
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    m_sp = nullptr;
+    return true;
+#else
+    return getcontext(&m_ctx) == 0;
+#endif
+  }
+
+  /**
+   * @brief 在[stack, stack + size)上构造入口为fn的上下文
+   * @return 成功返回true
+   * */
+  bool make(void* stack, size_t size, void (*fn)()) {
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    m_sp = sylar_make_context((char*)stack + size, fn);
+    return true;
+#else
+    if (getcontext(&m_ctx)) {
+      return false;
+    }
+    m_ctx.uc_link = nullptr;
+    m_ctx.uc_stack.ss_sp = stack;
+    m_ctx.uc_stack.ss_size = size;
+    makecontext(&m_ctx, fn, 0);
+    return true;
+#endif
+  }
+
+  /**
+   * @brief 切出时保存的栈指针, ucontext 后端无法得到时返回nullptr
+   * */
+  void* getStackPointer() const {
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    return m_sp;
+#else
+    return nullptr;
+#endif
+  }
+
+  /**
+   * @brief 保存当前上下文到this, 切换到to
+   * @return 成功返回true
+   * */
+  bool swap(FiberContext& to) {
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    sylar_swap_context(&m_sp, to.m_sp);
+    return true;
+#else
+    return swapcontext(&m_ctx, &to.m_ctx) == 0;
+#endif
+  }
+
+ private:
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+  /// 切出时保存的栈指针
+  void* m_sp = nullptr;
+#else
+  ucontext_t m_ctx;
+#endif
+};
+
+}  // namespace sylar
+
+#endif
@@ -1,6 +1,9 @@
 #include "hook.h"
 #include <dlfcn.h>
 #include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include "config.h"
@@ -32,6 +35,7 @@ static thread_local bool t_hook_enable = false;
   XX(send)           \
   XX(sendto)         \
   XX(sendmsg)        \
+  XX(sendfile)       \
   XX(close)          \
   XX(fcntl)          \
   XX(ioctl)          \
@@ -80,13 +84,47 @@ struct timer_info {
   int cancelled = 0;
 };
 
+typedef sylar::IOManager::IOUringRequest uring_req;
+
+/**
+ * @brief 构造io_uring请求
+ * @details do_io 只在socket上等待, read/write 等价于不带flags的recv/send,
+ *          统一使用socket操作码, 内核会在数据未就绪时自动挂起请求
+ * */
+static uring_req make_uring_req(uint8_t opcode, const void* addr, uint32_t len,
+                                uint32_t op_flags = 0, const void* addr2 = 0) {
+  uring_req req;
+  req.opcode = opcode;
+  req.addr = (uint64_t)addr;
+  req.len = len;
+  req.opFlags = op_flags;
+  req.addr2 = (uint64_t)addr2;
+  return req;
+}
+
+static msghdr make_msghdr(const struct iovec* iov, int iovcnt,
+                          const void* name = nullptr, socklen_t namelen = 0) {
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec*)iov;
+  msg.msg_iovlen = iovcnt;
+  msg.msg_name = (void*)name;
+  msg.msg_namelen = namelen;
+  return msg;
+}
+
+/**
+ * @brief hook IO的统一实现
+ * @param[in] req io_uring请求, 为空或者IOManager没有使用io_uring时用epoll等待
+ * */
 template <typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
-                     uint32_t event, int timeout_so, Args&&... args) {
+                     uint32_t event, int timeout_so, const uring_req* req,
+                     Args&&... args) {
   if (!sylar::t_hook_enable) {
     return fun(fd, std::forward<Args>(args)...);
   }
-  sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+  sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
   if (!ctx) {
     return fun(fd, std::forward<Args>(args)...);
   }
@@ -98,7 +136,10 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     return fun(fd, std::forward<Args>(args)...);
   }
   uint64_t to = ctx->getTimeout(timeout_so);
-  std::shared_ptr<timer_info> tinfo(new timer_info);
+  //挂起后句柄可能被关闭, 槽位被新的句柄复用
+  uint32_t gen = ctx->getGeneration();
+  //第一次调用就成功时不分配
+  std::shared_ptr<timer_info> tinfo;
 
 retry:
   ssize_t n = fun(fd, std::forward<Args>(args)...);
@@ -108,6 +149,32 @@ retry:
   if (n == -1 && errno == EAGAIN) {
     SYLAR_LOG_DEBUG(g_logger) << "do_io<" << hook_fun_name << ">";
     sylar::IOManager* iom = sylar::IOManager::GetThis();
+    int res = 0;
+    //先尝试一次系统调用, 只有数据未就绪时才提交到io_uring
+    if (req && iom->submitIO(fd, (sylar::IOManager::Event)(event), *req, to,
+                             res)) {
+      if (res >= 0) {
+        return res;
+      }
+      if (res == -ECANCELED) {
+        //被cancelEvent/close取消
+        if (ctx->getGeneration() != gen) {
+          errno = EBADF;
+          return -1;
+        }
+        goto retry;
+      }
+      if (res == -EAGAIN || res == -EINTR) {
+        //内核没有挂起请求, 这次改用epoll等待
+        req = nullptr;
+        goto retry;
+      }
+      errno = -res;
+      return -1;
+    }
+    if (!tinfo) {
+      tinfo.reset(new timer_info);
+    }
     sylar::Timer::ptr timer;
     std::weak_ptr<timer_info> winfo(tinfo);
     if (to != (uint64_t)-1) {
@@ -142,6 +209,11 @@ retry:
         errno = tinfo->cancelled;
         return -1;
       }
+      //被close()唤醒
+      if (ctx->getGeneration() != gen) {
+        errno = EBADF;
+        return -1;
+      }
       goto retry;
     }
   }
@@ -163,9 +235,10 @@ unsigned int sleep(unsigned int seconds) {
 
   iom->addTimer(
       seconds * 1000,
-      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread)) &
+      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread,
+                                           sylar::Scheduler::Priority)) &
                     sylar::IOManager::schedule,
-                iom, fiber, -1));
+                iom, fiber, -1, sylar::Scheduler::DEFAULT));
   sylar::Fiber::YieldToHold();
   return 0;
 }
@@ -179,9 +252,10 @@ int usleep(useconds_t usec) {
 
   iom->addTimer(
       usec / 1000,
-      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread)) &
+      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread,
+                                           sylar::Scheduler::Priority)) &
                     sylar::IOManager::schedule,
-                iom, fiber, -1));
+                iom, fiber, -1, sylar::Scheduler::DEFAULT));
   sylar::Fiber::YieldToHold();
   return 0;
 }
@@ -195,9 +269,10 @@ int nanosleep(const struct timespec* req, struct timespec* rem) {
   sylar::IOManager* iom = sylar::IOManager::GetThis();
   iom->addTimer(
       timeout_ms,
-      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread)) &
+      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread,
+                                           sylar::Scheduler::Priority)) &
                     sylar::IOManager::schedule,
-                iom, fiber, -1));
+                iom, fiber, -1, sylar::Scheduler::DEFAULT));
   sylar::Fiber::YieldToHold();
   return 0;
 }
@@ -214,12 +289,26 @@ int socket(int domain, int type, int protocol) {
   return fd;
 }
 
+static int connect_check_error(int fd) {
+  int error = 0;
+  socklen_t len = sizeof(int);
+  if (-1 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len)) {
+    return -1;
+  }
+  if (!error) {
+    return 0;
+  } else {
+    errno = error;
+    return -1;
+  }
+}
+
 int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
                          uint64_t timeout_ms) {
   if (!sylar::t_hook_enable) {
     return connect_f(fd, addr, addrlen);
   }
-  sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+  sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
   if (!ctx || ctx->isClose()) {
     errno = EBADF;
     return -1;
@@ -237,6 +326,15 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     return n;
   }
   sylar::IOManager* iom = sylar::IOManager::GetThis();
+  uring_req req = make_uring_req(IORING_OP_POLL_ADD, nullptr, 0, POLLOUT);
+  int res = 0;
+  if (iom->submitIO(fd, sylar::IOManager::WRITE, req, timeout_ms, res)) {
+    if (res == -ETIMEDOUT) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    return connect_check_error(fd);
+  }
   sylar::Timer::ptr timer;
   std::shared_ptr<timer_info> tinfo(new timer_info);
   std::weak_ptr<timer_info> winfo(tinfo);
@@ -271,17 +369,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     }
     SYLAR_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ",WRITE) errno";
   }
-  int error = 0;
-  socklen_t len = sizeof(int);
-  if (-1 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len)) {
-    return -1;
-  }
-  if (!error) {
-    return 0;
-  } else {
-    errno = error;
-    return -1;
-  }
+  return connect_check_error(fd);
 }
 
 int connect(int socket, const struct sockaddr* address, socklen_t address_len) {
@@ -290,8 +378,10 @@ int connect(int socket, const struct sockaddr* address, socklen_t address_len) {
 }
 
 int accept(int socket, struct sockaddr* address, socklen_t* address_len) {
+  uring_req req =
+      make_uring_req(IORING_OP_ACCEPT, address, 0, 0, address_len);
   int fd = do_io(socket, accept_f, "accept", sylar::IOManager::READ,
-                 SO_RCVTIMEO, address, address_len);
+                 SO_RCVTIMEO, &req, address, address_len);
   if (fd >= 0) {
     sylar::FdMgr::GetInstance()->get(fd, true);
   }
@@ -299,62 +389,86 @@ int accept(int socket, struct sockaddr* address, socklen_t* address_len) {
 }
 
 ssize_t read(int fd, void* buf, size_t count) {
-  return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf,
-               count);
+  uring_req req = make_uring_req(IORING_OP_RECV, buf, count);
+  return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, &req,
+               buf, count);
 }
 
 ssize_t readv(int fildes, const struct iovec* iov, int iovcnt) {
+  msghdr msg = make_msghdr(iov, iovcnt);
+  uring_req req = make_uring_req(IORING_OP_RECVMSG, &msg, 1);
   return do_io(fildes, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO,
-               iov, iovcnt);
+               &req, iov, iovcnt);
 }
 
 ssize_t recv(int socket, void* buffer, size_t length, int flags) {
+  uring_req req = make_uring_req(IORING_OP_RECV, buffer, length, flags);
   return do_io(socket, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO,
-               buffer, length, flags);
+               &req, buffer, length, flags);
 }
 
 ssize_t recvfrom(int socket, void* buffer, size_t length, int flags,
                  struct sockaddr* address, socklen_t* address_len) {
+  //需要回写地址长度时走epoll
+  uring_req req = make_uring_req(IORING_OP_RECV, buffer, length, flags);
   return do_io(socket, recvfrom_f, "recvfrom", sylar::IOManager::READ,
-               SO_RCVTIMEO, buffer, length, flags, address, address_len);
+               SO_RCVTIMEO, address ? nullptr : &req, buffer, length, flags,
+               address, address_len);
 }
 
 ssize_t recvmsg(int socket, struct msghdr* message, int flags) {
+  uring_req req = make_uring_req(IORING_OP_RECVMSG, message, 1, flags);
   return do_io(socket, recvmsg_f, "recvmsg", sylar::IOManager::READ,
-               SO_RCVTIMEO, message, flags);
+               SO_RCVTIMEO, &req, message, flags);
 }
 
 ssize_t write(int fd, const void* buf, size_t count) {
-  return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf,
-               count);
+  uring_req req = make_uring_req(IORING_OP_SEND, buf, count);
+  return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO,
+               &req, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+  msghdr msg = make_msghdr(iov, iovcnt);
+  uring_req req = make_uring_req(IORING_OP_SENDMSG, &msg, 1);
   return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO,
-               iov, iovcnt);
+               &req, iov, iovcnt);
 }
 
 ssize_t send(int socket, const void* buffer, size_t length, int flags) {
+  uring_req req = make_uring_req(IORING_OP_SEND, buffer, length, flags);
   return do_io(socket, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO,
-               buffer, length, flags);
+               &req, buffer, length, flags);
 }
 
 ssize_t sendto(int socket, const void* message, size_t length, int flags,
                const struct sockaddr* dest_addr, socklen_t dest_len) {
+  struct iovec iov;
+  iov.iov_base = (void*)message;
+  iov.iov_len = length;
+  msghdr msg = make_msghdr(&iov, 1, dest_addr, dest_len);
+  uring_req req = make_uring_req(IORING_OP_SENDMSG, &msg, 1, flags);
   return do_io(socket, sendto_f, "send_to", sylar::IOManager::WRITE,
-               SO_SNDTIMEO, message, length, flags, dest_addr, dest_len);
+               SO_SNDTIMEO, &req, message, length, flags, dest_addr, dest_len);
 }
 
 ssize_t sendmsg(int socket, const struct msghdr* message, int flags) {
+  uring_req req = make_uring_req(IORING_OP_SENDMSG, message, 1, flags);
   return do_io(socket, sendmsg_f, "sendmsg", sylar::IOManager::WRITE,
-               SO_SNDTIMEO, message, flags);
+               SO_SNDTIMEO, &req, message, flags);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
+  //io_uring没有sendfile, socket写满时用epoll等待
+  return do_io(out_fd, sendfile_f, "sendfile", sylar::IOManager::WRITE,
+               SO_SNDTIMEO, nullptr, in_fd, offset, count);
 }
 
 int close(int fd) {
   if (!sylar::t_hook_enable) {
-    return close(fd);
+    return close_f(fd);
   }
-  sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+  sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
   if (ctx) {
     auto iom = sylar::IOManager::GetThis();
     if (iom) {
@@ -372,7 +486,7 @@ int fcntl(int fildes, int cmd, ...) {
     case F_SETFL: {
       int arg = va_arg(va, int);
       va_end(va);
-      sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fildes);
+      sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fildes);
       if (!ctx || ctx->isClose() || ctx->isSocket()) {
         return fcntl_f(fildes, cmd, arg);
       }
@@ -387,7 +501,7 @@ int fcntl(int fildes, int cmd, ...) {
     case F_GETFL: {
       va_end(va);
       int arg = fcntl(fildes, cmd);
-      sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fildes);
+      sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fildes);
       if (!ctx || ctx->isClose() || !ctx->isSocket()) {
         return arg;
       }
@@ -443,7 +557,7 @@ int ioctl(int fildes, unsigned long int intrequest, ...) {
   va_end(va);
   if (FIONBIO == intrequest) {
     bool user_nonblock = !!*(int*)arg;
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fildes);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fildes);
     if (!ctx || ctx->isSocket() || ctx->isClose()) {
       return ioctl(fildes, intrequest, arg);
     }
@@ -464,7 +578,7 @@ int setsockopt(int socket, int level, int option_name, const void* option_value,
   }
   if (level == SOL_SOCKET) {
     if (option_name == SO_RCVTIMEO || option_name == SO_SNDTIMEO) {
-      sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(socket);
+      sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(socket);
       if (ctx) {
         const timeval* v = (const timeval*)option_value;
         ctx->setTimeout(option_name, v->tv_sec * 1000 + v->tv_usec / 1000);
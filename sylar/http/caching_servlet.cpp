@@ -0,0 +1,329 @@
+#include "caching_servlet.h"
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
+
+CachingServlet::CachingServlet(Servlet::ptr servlet, uint64_t default_ttl,
+                               uint64_t max_size,
+                               const std::vector<std::string>& vary,
+                               TimerManager* timer)
+    : Servlet("CachingServlet"),
+      m_servlet(servlet),
+      m_defaultTtl(default_ttl),
+      m_shardCapacity(max_size / SHARD_COUNT),
+      m_vary(vary),
+      m_timer(timer) {
+  m_streamBody = servlet->isStreamBody();
+  for (size_t i = 0; i < SHARD_COUNT; ++i) {
+    m_shards.push_back(Shard::ptr(new Shard));
+  }
+}
+
+uint64_t CachingServlet::ParseTtl(const std::string& cache_control,
+                                  uint64_t def) {
+  int64_t max_age = -1;
+  int64_t s_maxage = -1;
+  size_t pos = 0;
+  while (pos < cache_control.size()) {
+    size_t end = cache_control.find(',', pos);
+    if (end == std::string::npos) {
+      end = cache_control.size();
+    }
+    size_t begin = cache_control.find_first_not_of(" \t", pos);
+    if (begin < end) {
+      const char* p = cache_control.c_str() + begin;
+      size_t len = end - begin;
+      if ((len >= 8 && strncasecmp(p, "no-store", 8) == 0) ||
+          (len >= 8 && strncasecmp(p, "no-cache", 8) == 0) ||
+          (len >= 7 && strncasecmp(p, "private", 7) == 0)) {
+        return 0;
+      }
+      if (len > 8 && strncasecmp(p, "max-age=", 8) == 0) {
+        max_age = strtoll(p + 8, nullptr, 10);
+      } else if (len > 9 && strncasecmp(p, "s-maxage=", 9) == 0) {
+        s_maxage = strtoll(p + 9, nullptr, 10);
+      }
+    }
+    pos = end + 1;
+  }
+  //共享缓存优先使用s-maxage
+  if (s_maxage >= 0) {
+    return s_maxage * 1000;
+  }
+  if (max_age >= 0) {
+    return max_age * 1000;
+  }
+  return def;
+}
+
+int32_t CachingServlet::handle(sylar::http::HttpRequest::ptr request,
+                               sylar::http::HttpResponse::ptr response,
+                               sylar::http::HttpSession::ptr session) {
+  HttpMethod method = request->getMethod();
+  std::string cache_control = request->getHeader("cache-control");
+  if ((method != HttpMethod::GET && method != HttpMethod::HEAD) ||
+      !request->getHeader("authorization").empty() ||
+      strcasestr(cache_control.c_str(), "no-store")) {
+    return m_servlet->handle(request, response, session);
+  }
+  bool refresh = strcasestr(cache_control.c_str(), "no-cache") != nullptr;
+  std::string key = makeKey(request);
+  Shard::ptr shard = m_shards[std::hash<std::string>()(key) % SHARD_COUNT];
+  uint64_t now = sylar::GetCurrentMS();
+
+  //只有GET执行后端时登记, HEAD未命中时直接透传
+  Flight::ptr flight;
+  Flight::ptr waiting;
+  {
+    MutexType::Lock lock(shard->mutex);
+    Entry::ptr entry;
+    if (!refresh) {
+      entry = lookupLocked(*shard, key, now);
+    }
+    if (entry) {
+      lock.unlock();
+      ++m_hits;
+      Apply(entry, response, now, method == HttpMethod::HEAD);
+      return 0;
+    }
+    if (method == HttpMethod::GET) {
+      auto it = shard->flights.find(key);
+      if (it == shard->flights.end()) {
+        flight.reset(new Flight);
+        shard->flights[key] = flight;
+      } else if (!refresh && Scheduler::GetThis()) {
+        waiting = it->second;
+        waiting->waiters.emplace_back(Scheduler::GetThis(), Fiber::GetThis());
+      }
+    }
+  }
+
+  if (waiting) {
+    //唤醒可能在让出之前, 调度器会等协程让出后再执行
+    Fiber::YieldToHold();
+    if (waiting->result) {
+      ++m_coalesced;
+      Apply(waiting->result, response, sylar::GetCurrentMS(), false);
+      return 0;
+    }
+  }
+
+  ++m_misses;
+  int32_t rt = m_servlet->handle(request, response, session);
+  if (!flight) {
+    return rt;
+  }
+  Entry::ptr entry = rt == 0 ? makeEntry(response) : nullptr;
+  std::vector<std::pair<Scheduler*, Fiber::ptr> > waiters;
+  {
+    MutexType::Lock lock(shard->mutex);
+    if (entry) {
+      insertLocked(shard, key, entry);
+    }
+    flight->result = entry;
+    waiters.swap(flight->waiters);
+    shard->flights.erase(key);
+  }
+  for (auto& i : waiters) {
+    i.first->schedule(i.second);
+  }
+  return rt;
+}
+
+void CachingServlet::clear() {
+  for (auto& shard : m_shards) {
+    MutexType::Lock lock(shard->mutex);
+    for (auto& i : shard->nodes) {
+      if (i.second.timer) {
+        i.second.timer->cancel();
+      }
+    }
+    shard->nodes.clear();
+    shard->lru.clear();
+    shard->total = 0;
+  }
+}
+
+size_t CachingServlet::size() {
+  size_t rt = 0;
+  for (auto& shard : m_shards) {
+    MutexType::Lock lock(shard->mutex);
+    rt += shard->nodes.size();
+  }
+  return rt;
+}
+
+std::string CachingServlet::makeKey(HttpRequest::ptr req) const {
+  //HEAD和GET共用缓存, 键里不区分方法
+  std::string key = req->getPath();
+  key += '?';
+  key += req->getQuery();
+  for (auto& i : m_vary) {
+    key += '\n';
+    key += req->getHeader(i);
+  }
+  return key;
+}
+
+CachingServlet::Entry::ptr CachingServlet::makeEntry(
+    HttpResponse::ptr rsp) const {
+  if (rsp->isStream() || rsp->isWebsocket()) {
+    return nullptr;
+  }
+  switch (rsp->getStatus()) {
+    case HttpStatus::OK:
+    case HttpStatus::NON_AUTHORITATIVE_INFORMATION:
+    case HttpStatus::NO_CONTENT:
+    case HttpStatus::MOVED_PERMANENTLY:
+    case HttpStatus::NOT_FOUND:
+    case HttpStatus::GONE:
+      break;
+    default:
+      return nullptr;
+  }
+  if (!rsp->getHeader("set-cookie").empty()) {
+    return nullptr;
+  }
+  //Vary的头部都参与了键才能共用
+  std::string vary = rsp->getHeader("vary");
+  size_t pos = 0;
+  while (pos < vary.size()) {
+    size_t end = vary.find(',', pos);
+    if (end == std::string::npos) {
+      end = vary.size();
+    }
+    size_t begin = vary.find_first_not_of(" \t", pos);
+    size_t name_end = vary.find_last_not_of(" \t", end - 1);
+    if (begin < end && name_end != std::string::npos && name_end >= begin) {
+      std::string name = vary.substr(begin, name_end - begin + 1);
+      bool found = false;
+      for (auto& i : m_vary) {
+        if (strcasecmp(i.c_str(), name.c_str()) == 0) {
+          found = true;
+          break;
+        }
+      }
+      if (!found) {
+        return nullptr;
+      }
+    }
+    pos = end + 1;
+  }
+  uint64_t ttl = ParseTtl(rsp->getHeader("cache-control"), m_defaultTtl);
+  if (ttl == 0) {
+    return nullptr;
+  }
+
+  Entry::ptr entry(new Entry);
+  entry->status = rsp->getStatus();
+  entry->headers = rsp->getHeaders();
+  entry->body = rsp->getBody();
+  entry->created = sylar::GetCurrentMS();
+  entry->expire = entry->created + ttl;
+  entry->size = sizeof(Entry) + entry->body.size();
+  for (auto& i : entry->headers) {
+    entry->size += i.first.size() + i.second.size();
+  }
+  //太大的响应会把分片整个挤掉, 不缓存
+  if (entry->size > m_shardCapacity / 4) {
+    return nullptr;
+  }
+  return entry;
+}
+
+CachingServlet::Entry::ptr CachingServlet::lookupLocked(Shard& shard,
+                                                        const std::string& key,
+                                                        uint64_t now) {
+  auto it = shard.nodes.find(key);
+  if (it == shard.nodes.end()) {
+    return nullptr;
+  }
+  //定时器可能还没执行
+  if (it->second.entry->expire <= now) {
+    if (it->second.timer) {
+      it->second.timer->cancel();
+    }
+    EraseLocked(shard, it);
+    return nullptr;
+  }
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+  return it->second.entry;
+}
+
+void CachingServlet::insertLocked(Shard::ptr shard, const std::string& key,
+                                  Entry::ptr entry) {
+  auto it = shard->nodes.find(key);
+  if (it != shard->nodes.end()) {
+    if (it->second.timer) {
+      it->second.timer->cancel();
+    }
+    EraseLocked(*shard, it);
+  }
+  shard->lru.push_front(key);
+  Shard::Node& node = shard->nodes[key];
+  node.entry = entry;
+  node.lru = shard->lru.begin();
+  shard->total += entry->size + key.size();
+
+  TimerManager* timer = m_timer ? m_timer : IOManager::GetThis();
+  if (timer) {
+    node.timer = timer->addConditionTimer(
+        entry->expire - entry->created,
+        std::bind(&CachingServlet::OnExpire, shard.get(), key, entry->expire),
+        shard);
+  }
+
+  while (shard->total > m_shardCapacity && shard->lru.size() > 1) {
+    auto victim = shard->nodes.find(shard->lru.back());
+    if (victim->second.timer) {
+      victim->second.timer->cancel();
+    }
+    EraseLocked(*shard, victim);
+  }
+}
+
+void CachingServlet::EraseLocked(
+    Shard& shard, std::unordered_map<std::string, Shard::Node>::iterator it) {
+  shard.total -= it->second.entry->size + it->first.size();
+  shard.lru.erase(it->second.lru);
+  shard.nodes.erase(it);
+}
+
+void CachingServlet::OnExpire(Shard* shard, const std::string& key,
+                              uint64_t expire) {
+  MutexType::Lock lock(shard->mutex);
+  auto it = shard->nodes.find(key);
+  //已经被新的响应替换了
+  if (it == shard->nodes.end() || it->second.entry->expire != expire) {
+    return;
+  }
+  SYLAR_LOG_DEBUG(g_logger) << "CachingServlet expire key=" << key;
+  EraseLocked(*shard, it);
+}
+
+void CachingServlet::Apply(Entry::ptr entry, HttpResponse::ptr rsp,
+                           uint64_t now, bool head) {
+  rsp->setStatus(entry->status);
+  for (auto& i : entry->headers) {
+    rsp->setHeader(i.first, i.second);
+  }
+  rsp->setHeader("Age", std::to_string((now - entry->created) / 1000));
+  if (!head) {
+    rsp->setBody(entry->body);
+  } else if (!entry->body.empty() &&
+             rsp->getHeader("content-length").empty()) {
+    //HEAD只回复GET的长度, 不带消息体, 否则长连接上的下一个响应会错位
+    rsp->setHeader("Content-Length", std::to_string(entry->body.size()));
+  }
+}
+
+}  // namespace http
+}  // namespace sylar
@@ -0,0 +1,201 @@
+/**
+ * @file caching_servlet.h
+ * @brief 缓存响应的Servlet装饰器
+ */
+#ifndef __SYLAR_HTTP_CACHING_SERVLET_H__
+#define __SYLAR_HTTP_CACHING_SERVLET_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "servlet.h"
+#include "sylar/fiber.h"
+#include "sylar/mutex.h"
+#include "sylar/timer.h"
+
+namespace sylar {
+class Scheduler;
+
+namespace http {
+
+/**
+ * @brief 在内存中缓存被包装Servlet的响应
+ * @details - 只缓存GET, HEAD可以命中GET的缓存. 键是路径+查询串+
+ *            选定的请求头部(vary)的值
+ *          - 有效期取响应的Cache-Control: s-maxage/max-age, 没有时用默认值,
+ *            默认值为0时不缓存. no-store/no-cache/private、带Set-Cookie、
+ *            Vary了未选定头部以及流式的响应不缓存
+ *          - 请求带Authorization或者Cache-Control: no-store时直接透传,
+ *            no-cache时跳过缓存重新生成
+ *          - 按键分片的LRU, 每片各自加锁, 按响应体和头部的大小淘汰.
+ *            过期由TimerManager的条件定时器删除, 查找时也会检查
+ *          - 同一个键同时未命中时只有一个协程执行后端, 其余的协程挂起,
+ *            等结果出来后直接复用. 结果不能缓存时各自执行后端
+ *          用法: addServlet("/api/list",
+ *                    CachingServlet::ptr(new CachingServlet(slt, 1000)))
+ */
+class CachingServlet : public Servlet {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<CachingServlet> ptr;
+  typedef sylar::Mutex MutexType;
+
+  /**
+   * @brief 构造函数
+   * @param[in] servlet 被缓存的Servlet
+   * @param[in] default_ttl 响应没有max-age时的有效期(毫秒), 0表示不缓存
+   * @param[in] max_size 缓存的总大小(字节)
+   * @param[in] vary 参与生成键的请求头部
+   * @param[in] timer 删除过期缓存的定时器管理器,
+   *                  为空时使用插入时所在的IOManager
+   */
+  CachingServlet(Servlet::ptr servlet, uint64_t default_ttl = 0,
+                 uint64_t max_size = 64 * 1024 * 1024,
+                 const std::vector<std::string>& vary = {},
+                 TimerManager* timer = nullptr);
+
+  virtual int32_t handle(sylar::http::HttpRequest::ptr request,
+                         sylar::http::HttpResponse::ptr response,
+                         sylar::http::HttpSession::ptr session) override;
+
+  /**
+   * @brief 清空缓存
+   */
+  void clear();
+
+  /**
+   * @brief 缓存的条目数
+   */
+  size_t size();
+
+  /// 命中次数
+  uint64_t getHits() const { return m_hits; }
+  /// 未命中次数(执行了后端的次数)
+  uint64_t getMisses() const { return m_misses; }
+  /// 等待其他协程的结果并复用的次数
+  uint64_t getCoalesced() const { return m_coalesced; }
+
+  /**
+   * @brief 从Cache-Control中解析有效期
+   * @return 有效期(毫秒), 没有max-age时返回def, 禁止缓存时返回0
+   */
+  static uint64_t ParseTtl(const std::string& cache_control, uint64_t def);
+
+ private:
+  /**
+   * @brief 缓存的响应
+   */
+  struct Entry {
+    typedef std::shared_ptr<Entry> ptr;
+    HttpStatus status;
+    HttpResponse::MapType headers;
+    std::string body;
+    /// 生成时间(毫秒)
+    uint64_t created;
+    /// 过期时间(毫秒)
+    uint64_t expire;
+    /// 占用的大小
+    uint64_t size;
+  };
+
+  /**
+   * @brief 正在执行后端的请求
+   */
+  struct Flight {
+    typedef std::shared_ptr<Flight> ptr;
+    /// 等待结果的协程
+    std::vector<std::pair<Scheduler*, Fiber::ptr> > waiters;
+    /// 结果, 不能缓存时为空
+    Entry::ptr result;
+  };
+
+  /**
+   * @brief 一个分片
+   */
+  struct Shard {
+    typedef std::shared_ptr<Shard> ptr;
+    struct Node {
+      Entry::ptr entry;
+      /// 在lru中的位置
+      std::list<std::string>::iterator lru;
+      /// 过期定时器
+      Timer::ptr timer;
+    };
+    MutexType mutex;
+    /// 最近使用的在前面
+    std::list<std::string> lru;
+    std::unordered_map<std::string, Node> nodes;
+    std::unordered_map<std::string, Flight::ptr> flights;
+    /// 缓存内容的总大小
+    uint64_t total = 0;
+  };
+
+  /**
+   * @brief 生成缓存键
+   */
+  std::string makeKey(HttpRequest::ptr req) const;
+
+  /**
+   * @brief 后端的响应能否缓存, 能缓存时生成缓存条目
+   */
+  Entry::ptr makeEntry(HttpResponse::ptr rsp) const;
+
+  /**
+   * @brief 查找没过期的条目, 需要持有分片的锁
+   */
+  Entry::ptr lookupLocked(Shard& shard, const std::string& key, uint64_t now);
+
+  /**
+   * @brief 插入条目并淘汰, 需要持有分片的锁
+   */
+  void insertLocked(Shard::ptr shard, const std::string& key,
+                    Entry::ptr entry);
+
+  /**
+   * @brief 删除条目, 需要持有分片的锁
+   */
+  static void EraseLocked(
+      Shard& shard, std::unordered_map<std::string, Shard::Node>::iterator it);
+
+  /**
+   * @brief 定时器回调, 删除还没有被替换的过期条目
+   * @details 用条件定时器注册, 分片还在时才会调用
+   */
+  static void OnExpire(Shard* shard, const std::string& key, uint64_t expire);
+
+  /**
+   * @brief 用缓存条目填充响应
+   * @param[in] head 是否HEAD请求, 是则只填头部和Content-Length
+   */
+  static void Apply(Entry::ptr entry, HttpResponse::ptr rsp, uint64_t now,
+                    bool head);
+
+ private:
+  /// 分片数
+  static const size_t SHARD_COUNT = 16;
+  /// 被缓存的Servlet
+  Servlet::ptr m_servlet;
+  /// 默认有效期(毫秒)
+  uint64_t m_defaultTtl;
+  /// 每个分片的容量
+  uint64_t m_shardCapacity;
+  /// 参与生成键的请求头部
+  std::vector<std::string> m_vary;
+  /// 删除过期缓存的定时器管理器
+  TimerManager* m_timer;
+  /// 分片
+  std::vector<Shard::ptr> m_shards;
+
+  std::atomic<uint64_t> m_hits{0};
+  std::atomic<uint64_t> m_misses{0};
+  std::atomic<uint64_t> m_coalesced{0};
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
@@ -0,0 +1,527 @@
+#include "hpack.h"
+
+namespace sylar {
+namespace http {
+
+namespace {
+/**
+ * @brief Huffman码, 按RFC 7541附录B, 最后一个是EOS
+ */
+struct HuffmanCode {
+  uint32_t code;
+  uint8_t bits;
+};
+
+static const HuffmanCode s_huffman_codes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12}, {0x1ff9, 13}, {0x15, 6},
+    {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6}, {0x0, 5}, {0x1, 5}, {0x2, 5},
+    {0x19, 6}, {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6},
+    {0x5c, 7}, {0xfb, 8}, {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7},
+    {0x61, 7}, {0x62, 7}, {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7},
+    {0x68, 7}, {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7}, {0xfd, 8},
+    {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5}, {0x25, 6},
+    {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7}, {0x28, 6}, {0x29, 6},
+    {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5}, {0x9, 5},
+    {0x2d, 6}, {0x77, 7}, {0x78, 7}, {0x79, 7}, {0x7a, 7}, {0x7b, 7},
+    {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20}, {0x3fffd3, 22},
+    {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22},
+    {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23},
+    {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23}, {0xffffec, 24},
+    {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24},
+    {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23},
+    {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23}, {0x3fffd9, 22},
+    {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22},
+    {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22},
+    {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21}, {0x7fffea, 23},
+    {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21},
+    {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21},
+    {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21}, {0x7fffed, 23},
+    {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20},
+    {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23},
+    {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23}, {0x3ffffe0, 26},
+    {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22},
+    {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26},
+    {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27}, {0x7ffffdf, 27},
+    {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19},
+    {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27},
+    {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24}, {0x1fffe4, 21},
+    {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28},
+    {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20},
+    {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21}, {0x3fffe9, 22},
+    {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22},
+    {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24},
+    {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23}, {0x3ffffeb, 26},
+    {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27},
+    {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27},
+    {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27}, {0x7ffffee, 27},
+    {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30},
+};
+
+/**
+ * @brief Huffman解码状态机, 每次处理4位
+ * @details 状态是码树的节点. 最短的码有5位, 4位里最多解出一个符号
+ */
+class HuffmanDecoder {
+ public:
+  struct Entry {
+    /// 下一个状态
+    uint16_t next;
+    /// 解出的符号, 没有为-1
+    int16_t sym;
+    /// 遇到了EOS
+    bool fail;
+  };
+
+  HuffmanDecoder() {
+    struct Node {
+      uint16_t next[2];
+      int16_t sym;
+      uint8_t depth;
+      bool ones;
+    };
+    //先按码表建树, 0和1的子节点为0表示没有(根节点不会是子节点)
+    std::vector<Node> nodes(1, Node{{0, 0}, -1, 0, true});
+    for (int s = 0; s < 257; ++s) {
+      size_t n = 0;
+      for (int b = s_huffman_codes[s].bits - 1; b >= 0; --b) {
+        int bit = (s_huffman_codes[s].code >> b) & 1;
+        if (!nodes[n].next[bit]) {
+          nodes[n].next[bit] = nodes.size();
+          Node child{{0, 0}, -1, (uint8_t)(nodes[n].depth + 1),
+                     nodes[n].ones && bit};
+          nodes.push_back(child);
+        }
+        n = nodes[n].next[bit];
+      }
+      nodes[n].sym = s;
+    }
+    //剩下的位只能是EOS的前缀: 全1并且不超过7位
+    m_accept.resize(nodes.size());
+    m_table.resize(nodes.size() * 16);
+    for (size_t n = 0; n < nodes.size(); ++n) {
+      m_accept[n] = nodes[n].ones && nodes[n].depth <= 7;
+      if (nodes[n].sym >= 0) {
+        continue;
+      }
+      for (int nibble = 0; nibble < 16; ++nibble) {
+        Entry& e = m_table[n * 16 + nibble];
+        e.sym = -1;
+        e.fail = false;
+        size_t cur = n;
+        for (int b = 3; b >= 0; --b) {
+          cur = nodes[cur].next[(nibble >> b) & 1];
+          if (nodes[cur].sym == 256) {
+            e.fail = true;
+          } else if (nodes[cur].sym >= 0) {
+            e.sym = nodes[cur].sym;
+            cur = 0;
+          }
+        }
+        e.next = cur;
+      }
+    }
+  }
+
+  bool decode(const uint8_t* data, size_t len, std::string& out) const {
+    size_t state = 0;
+    for (size_t i = 0; i < len; ++i) {
+      for (int shift = 4; shift >= 0; shift -= 4) {
+        const Entry& e = m_table[state * 16 + ((data[i] >> shift) & 0x0f)];
+        if (e.fail) {
+          return false;
+        }
+        if (e.sym >= 0) {
+          out += (char)e.sym;
+        }
+        state = e.next;
+      }
+    }
+    return m_accept[state];
+  }
+
+ private:
+  std::vector<Entry> m_table;
+  std::vector<bool> m_accept;
+};
+
+static const HuffmanDecoder s_huffman_decoder;
+
+static const std::pair<std::string, std::string> s_static_table[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+static const uint64_t s_static_table_size =
+    sizeof(s_static_table) / sizeof(s_static_table[0]);
+
+/// 动态表中每个条目额外计算的大小
+static const size_t s_entry_overhead = 32;
+
+/**
+ * @brief 值经常变化的头部不加入动态表, 免得挤掉有用的条目
+ */
+static bool ShouldIndex(const std::string& name) {
+  static const char* s_skip[] = {":path",         "content-length", "date",
+                                 "etag",          "last-modified",  "age",
+                                 "content-range", "set-cookie",     "expires"};
+  for (auto i : s_skip) {
+    if (name == i) {
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+HPack::HPack(uint32_t max_table_size)
+    : m_maxSize(max_table_size), m_limit(max_table_size) {}
+
+void HPack::setMaxTableSize(uint32_t v) {
+  m_limit = v;
+  m_maxSize = v;
+  evict(m_maxSize);
+  m_sizeUpdate = true;
+}
+
+bool HPack::DecodeInt(const uint8_t*& pos, const uint8_t* end, int prefix,
+                      uint64_t& value) {
+  if (pos >= end) {
+    return false;
+  }
+  uint64_t mask = (1u << prefix) - 1;
+  value = *pos++ & mask;
+  if (value < mask) {
+    return true;
+  }
+  int shift = 0;
+  while (pos < end) {
+    uint8_t b = *pos++;
+    if (shift > 56) {
+      return false;
+    }
+    value += (uint64_t)(b & 0x7f) << shift;
+    shift += 7;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void HPack::EncodeInt(std::string& out, uint8_t first, int prefix,
+                      uint64_t value) {
+  uint64_t mask = (1u << prefix) - 1;
+  if (value < mask) {
+    out += (char)(first | value);
+    return;
+  }
+  out += (char)(first | mask);
+  value -= mask;
+  while (value >= 0x80) {
+    out += (char)(0x80 | (value & 0x7f));
+    value >>= 7;
+  }
+  out += (char)value;
+}
+
+bool HPack::HuffmanDecode(const uint8_t* data, size_t len, std::string& out) {
+  return s_huffman_decoder.decode(data, len, out);
+}
+
+void HPack::HuffmanEncode(const std::string& str, std::string& out) {
+  uint64_t bits = 0;
+  int nbits = 0;
+  for (unsigned char c : str) {
+    const HuffmanCode& code = s_huffman_codes[c];
+    bits = (bits << code.bits) | code.code;
+    nbits += code.bits;
+    while (nbits >= 8) {
+      nbits -= 8;
+      out += (char)(bits >> nbits);
+    }
+    bits &= (1ull << nbits) - 1;
+  }
+  if (nbits > 0) {
+    //用EOS的前缀(全1)填充
+    out += (char)((bits << (8 - nbits)) | (0xff >> nbits));
+  }
+}
+
+size_t HPack::HuffmanLength(const std::string& str) {
+  size_t bits = 0;
+  for (unsigned char c : str) {
+    bits += s_huffman_codes[c].bits;
+  }
+  return (bits + 7) / 8;
+}
+
+const std::pair<std::string, std::string>* HPack::get(uint64_t index) const {
+  if (index == 0) {
+    return nullptr;
+  }
+  if (index <= s_static_table_size) {
+    return &s_static_table[index - 1];
+  }
+  index -= s_static_table_size + 1;
+  if (index >= m_table.size()) {
+    return nullptr;
+  }
+  return &m_table[index];
+}
+
+uint64_t HPack::find(const std::string& name, const std::string& value,
+                     uint64_t& name_only) const {
+  name_only = 0;
+  for (uint64_t i = 0; i < s_static_table_size; ++i) {
+    if (s_static_table[i].first == name) {
+      if (s_static_table[i].second == value) {
+        return i + 1;
+      }
+      if (!name_only) {
+        name_only = i + 1;
+      }
+    }
+  }
+  for (uint64_t i = 0; i < m_table.size(); ++i) {
+    if (m_table[i].first == name) {
+      if (m_table[i].second == value) {
+        return s_static_table_size + i + 1;
+      }
+      if (!name_only) {
+        name_only = s_static_table_size + i + 1;
+      }
+    }
+  }
+  return 0;
+}
+
+void HPack::evict(size_t size) {
+  while (m_size > size && !m_table.empty()) {
+    auto& e = m_table.back();
+    m_size -= e.first.size() + e.second.size() + s_entry_overhead;
+    m_table.pop_back();
+  }
+}
+
+void HPack::add(const std::string& name, const std::string& value) {
+  size_t size = name.size() + value.size() + s_entry_overhead;
+  if (size > m_maxSize) {
+    //比整个表还大的条目让表清空
+    evict(0);
+    return;
+  }
+  evict(m_maxSize - size);
+  m_table.emplace_front(name, value);
+  m_size += size;
+}
+
+bool HPack::decodeString(const uint8_t*& pos, const uint8_t* end,
+                         std::string& out) {
+  if (pos >= end) {
+    return false;
+  }
+  bool huffman = *pos & 0x80;
+  uint64_t len = 0;
+  if (!DecodeInt(pos, end, 7, len) || len > (uint64_t)(end - pos)) {
+    return false;
+  }
+  if (huffman) {
+    if (!HuffmanDecode(pos, len, out)) {
+      return false;
+    }
+  } else {
+    out.assign((const char*)pos, len);
+  }
+  pos += len;
+  return true;
+}
+
+void HPack::EncodeString(std::string& out, const std::string& str) {
+  size_t len = HuffmanLength(str);
+  if (len < str.size()) {
+    EncodeInt(out, 0x80, 7, len);
+    HuffmanEncode(str, out);
+  } else {
+    EncodeInt(out, 0, 7, str.size());
+    out += str;
+  }
+}
+
+bool HPack::decode(const uint8_t* data, size_t len, HeaderList& headers,
+                   bool* too_large) {
+  const uint8_t* pos = data;
+  const uint8_t* end = data + len;
+  //大小更新只能出现在头部块开头
+  bool field_seen = false;
+  //解码出的头部列表大小, 超过上限后只解码不追加
+  uint64_t list_size = 0;
+  bool exceeded = false;
+  auto admit = [this, &list_size, &exceeded](const std::string& name,
+                                            const std::string& value) {
+    list_size += name.size() + value.size() + s_entry_overhead;
+    if (m_maxListSize && list_size > m_maxListSize) {
+      exceeded = true;
+    }
+    return !exceeded;
+  };
+  while (pos < end) {
+    uint8_t b = *pos;
+    if (b & 0x80) {
+      //1xxxxxxx 索引
+      uint64_t index = 0;
+      if (!DecodeInt(pos, end, 7, index)) {
+        return false;
+      }
+      const std::pair<std::string, std::string>* e = get(index);
+      if (!e) {
+        return false;
+      }
+      if (admit(e->first, e->second)) {
+        headers.push_back(*e);
+      }
+    } else if ((b & 0xe0) == 0x20) {
+      //001xxxxx 动态表大小更新
+      uint64_t size = 0;
+      if (field_seen || !DecodeInt(pos, end, 5, size) || size > m_limit) {
+        return false;
+      }
+      m_maxSize = size;
+      evict(size);
+      continue;
+    } else {
+      //01xxxxxx 加入动态表, 0000xxxx 不加入, 0001xxxx 永不加入
+      bool indexing = b & 0x40;
+      uint64_t index = 0;
+      if (!DecodeInt(pos, end, indexing ? 6 : 4, index)) {
+        return false;
+      }
+      std::string name;
+      std::string value;
+      if (index) {
+        const std::pair<std::string, std::string>* e = get(index);
+        if (!e) {
+          return false;
+        }
+        name = e->first;
+      } else if (!decodeString(pos, end, name)) {
+        return false;
+      }
+      if (!decodeString(pos, end, value)) {
+        return false;
+      }
+      if (indexing) {
+        add(name, value);
+      }
+      if (admit(name, value)) {
+        headers.emplace_back(std::move(name), std::move(value));
+      }
+    }
+    field_seen = true;
+  }
+  if (too_large) {
+    *too_large = exceeded;
+    return true;
+  }
+  return !exceeded;
+}
+
+void HPack::encode(const HeaderList& headers, std::string& out) {
+  if (m_sizeUpdate) {
+    EncodeInt(out, 0x20, 5, m_maxSize);
+    m_sizeUpdate = false;
+  }
+  for (auto& h : headers) {
+    uint64_t name_index = 0;
+    uint64_t index = find(h.first, h.second, name_index);
+    if (index) {
+      EncodeInt(out, 0x80, 7, index);
+      continue;
+    }
+    bool indexing = ShouldIndex(h.first) &&
+                    h.first.size() + h.second.size() + s_entry_overhead <=
+                        m_maxSize;
+    EncodeInt(out, indexing ? 0x40 : 0x00, indexing ? 6 : 4, name_index);
+    if (!name_index) {
+      EncodeString(out, h.first);
+    }
+    EncodeString(out, h.second);
+    if (indexing) {
+      add(h.first, h.second);
+    }
+  }
+}
+
+}  // namespace http
+}  // namespace sylar
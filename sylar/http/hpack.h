@@ -0,0 +1,151 @@
+/**
+ * @file hpack.h
+ * @brief HPACK头部压缩(RFC 7541)
+ */
+#ifndef __SYLAR_HTTP_HPACK_H__
+#define __SYLAR_HTTP_HPACK_H__
+
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief HPACK编解码上下文
+ * @details 一个连接上每个方向各一个, 解码和编码的动态表互相独立.
+ *          静态表按RFC 7541附录A, 动态表新条目在前, 超过大小时从后面淘汰
+ */
+class HPack {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<HPack> ptr;
+  /// 头部列表, 保持顺序, 名字都是小写
+  typedef std::vector<std::pair<std::string, std::string>> HeaderList;
+
+  /**
+   * @brief 构造函数
+   * @param[in] max_table_size 动态表大小上限(SETTINGS_HEADER_TABLE_SIZE)
+   */
+  HPack(uint32_t max_table_size = 4096);
+
+  /**
+   * @brief 解码一个完整的头部块
+   * @param[out] headers 解码出的头部, 追加在后面
+   * @param[out] too_large 解码出的头部超过setMaxListSize的上限时置为true,
+   *             之后的头部不再追加, 但整个块仍然解码完, 动态表保持一致
+   * @return 格式错误(COMPRESSION_ERROR)返回false, too_large为nullptr时
+   *         超过上限也返回false
+   */
+  bool decode(const uint8_t* data, size_t len, HeaderList& headers,
+              bool* too_large = nullptr);
+
+  /**
+   * @brief 编码头部块
+   * @details 能在表中完整找到的用索引, 其他的按需要加入动态表,
+   *          字符串在Huffman编码更短时使用Huffman
+   * @param[out] out 编码结果追加在后面
+   */
+  void encode(const HeaderList& headers, std::string& out);
+
+  /**
+   * @brief 设置动态表大小上限
+   * @details 解码方向: 我方通告的值. 编码方向: 对方通告的值,
+   *          下一个头部块开头会带上大小更新
+   */
+  void setMaxTableSize(uint32_t v);
+
+  /**
+   * @brief 设置解码出的头部列表大小上限(SETTINGS_MAX_HEADER_LIST_SIZE)
+   * @details 每个头部按名字+值+32计算, 0表示不限制. 引用动态表的索引
+   *          很短, 不限制时一个小的头部块可以展开成很大的头部列表
+   */
+  void setMaxListSize(uint64_t v) { m_maxListSize = v; }
+
+  /**
+   * @brief 动态表当前占用的大小(每个条目按名字+值+32计算)
+   */
+  size_t getTableSize() const { return m_size; }
+
+  /**
+   * @brief 解码N位前缀的整数
+   * @param[in,out] pos 当前位置, 成功后移到整数之后
+   * @return 数据不完整或者溢出时返回false
+   */
+  static bool DecodeInt(const uint8_t*& pos, const uint8_t* end, int prefix,
+                        uint64_t& value);
+
+  /**
+   * @brief 编码N位前缀的整数
+   * @param[in] first 第一个字节中前缀之外的标志位
+   */
+  static void EncodeInt(std::string& out, uint8_t first, int prefix,
+                        uint64_t value);
+
+  /**
+   * @brief Huffman解码
+   * @return 出现EOS, 填充超过7位或者填充不全为1时返回false
+   */
+  static bool HuffmanDecode(const uint8_t* data, size_t len, std::string& out);
+
+  /**
+   * @brief Huffman编码
+   */
+  static void HuffmanEncode(const std::string& str, std::string& out);
+
+  /**
+   * @brief Huffman编码后的长度
+   */
+  static size_t HuffmanLength(const std::string& str);
+
+ private:
+  /**
+   * @brief 按索引取表中的条目, 1-61是静态表, 之后是动态表
+   */
+  const std::pair<std::string, std::string>* get(uint64_t index) const;
+
+  /**
+   * @brief 查找条目
+   * @param[out] name_only 只有名字匹配的索引, 没有时为0
+   * @return 名字和值都匹配的索引, 没有时为0
+   */
+  uint64_t find(const std::string& name, const std::string& value,
+                uint64_t& name_only) const;
+
+  /**
+   * @brief 加入动态表, 超过大小时淘汰旧条目
+   */
+  void add(const std::string& name, const std::string& value);
+
+  /**
+   * @brief 淘汰到不超过size
+   */
+  void evict(size_t size);
+
+  bool decodeString(const uint8_t*& pos, const uint8_t* end,
+                    std::string& out);
+
+  static void EncodeString(std::string& out, const std::string& str);
+
+ private:
+  /// 动态表, 新条目在前
+  std::deque<std::pair<std::string, std::string>> m_table;
+  /// 动态表当前大小
+  size_t m_size = 0;
+  /// 动态表当前允许的大小, 由大小更新指令修改
+  size_t m_maxSize;
+  /// 设置允许的动态表大小上限
+  size_t m_limit;
+  /// 编码时下一个头部块开头需要发送大小更新
+  bool m_sizeUpdate = false;
+  /// 解码出的头部列表大小上限, 0表示不限制
+  uint64_t m_maxListSize = 0;
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
@@ -49,6 +49,67 @@ const char* HttpStatusToString(const HttpStatus& s) {
   }
 }
 
+namespace {
+/// 预先拼好的字节串, 序列化时直接追加
+struct Bytes {
+  const char* data;
+  size_t size;
+};
+
+#define SYLAR_BYTES(s) \
+  Bytes { s, sizeof(s) - 1 }
+
+/**
+ * @brief 返回HTTP/1.1的状态行, 编译期拼接好
+ */
+Bytes HttpStatusLine11(HttpStatus s) {
+  switch (s) {
+#define XX(code, name, msg) \
+  case HttpStatus::name:    \
+    return SYLAR_BYTES("HTTP/1.1 " #code " " #msg "\r\n");
+    HTTP_STATUS_MAP(XX);
+#undef XX
+    default:
+      return Bytes{nullptr, 0};
+  }
+}
+
+const Bytes s_connection_close = SYLAR_BYTES("connection: close\r\n");
+const Bytes s_connection_keepalive = SYLAR_BYTES("connection: keep-alive\r\n");
+const Bytes s_content_length = SYLAR_BYTES("content-length: ");
+const Bytes s_transfer_chunked =
+    SYLAR_BYTES("transfer-encoding: chunked\r\n");
+const Bytes s_set_cookie = SYLAR_BYTES("Set-Cookie: ");
+const Bytes s_crlf = SYLAR_BYTES("\r\n");
+
+#undef SYLAR_BYTES
+
+void Append(std::string& out, const Bytes& b) {
+  out.append(b.data, b.size);
+}
+
+void Append(std::string& out, StringView v) {
+  out.append(v.data(), v.size());
+}
+
+void AppendUint(std::string& out, uint64_t v) {
+  char buf[24];
+  char* p = buf + sizeof(buf);
+  do {
+    *--p = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  out.append(p, buf + sizeof(buf) - p);
+}
+
+void AppendVersion(std::string& out, uint8_t version) {
+  out += "HTTP/";
+  out += (char)('0' + (version >> 4));
+  out += '.';
+  out += (char)('0' + (version & 0x0F));
+}
+}  // namespace
+
 bool CaseInsensitiveLess::operator()(const std::string& lhs,
                                      const std::string& rhs) const {
   return strcasecmp(lhs.c_str(), rhs.c_str()) < 0;
@@ -58,8 +119,88 @@ HttpRequest::HttpRequest(uint8_t version, bool close)
     : m_method(HttpMethod::GET),
       m_version(version),
       m_close(close),
-      m_websocket(false),
-      m_path("/") {}
+      m_websocket(false) {
+  m_path.setView("/");
+}
+
+void HttpRequest::reset() {
+  m_method = HttpMethod::GET;
+  m_version = 0x11;
+  m_close = true;
+  m_websocket = false;
+  m_path.clear();
+  m_path.setView("/");
+  m_query.clear();
+  m_fragment.clear();
+  m_body.clear();
+  m_buffer.reset();
+  m_headerViews.clear();
+  m_headers.clear();
+  m_headersOwned = false;
+  m_params.clear();
+  m_cookies.clear();
+  m_servlet.reset();
+  m_servletOwner = nullptr;
+}
+
+void HttpRequest::materialize() {
+  m_path.str();
+  m_query.str();
+  m_fragment.str();
+  m_body.str();
+  initHeaders();
+  m_buffer.reset();
+}
+
+void HttpRequest::addHeaderView(StringView key, StringView val) {
+  if (m_headersOwned) {
+    m_headers[std::string(key.data(), key.size())] =
+        std::string(val.data(), val.size());
+  } else {
+    m_headerViews.push_back(std::make_pair(key, val));
+  }
+}
+
+void HttpRequest::initHeaders() const {
+  if (m_headersOwned) {
+    return;
+  }
+  for (auto& i : m_headerViews) {
+    m_headers[std::string(i.first.data(), i.first.size())] =
+        std::string(i.second.data(), i.second.size());
+  }
+  m_headerViews.clear();
+  m_headersOwned = true;
+}
+
+bool HttpRequest::findHeader(StringView key, StringView& val) const {
+  if (m_headersOwned) {
+    auto it = m_headers.find(std::string(key.data(), key.size()));
+    if (it == m_headers.end()) {
+      return false;
+    }
+    val = it->second;
+    return true;
+  }
+  for (auto it = m_headerViews.rbegin(); it != m_headerViews.rend(); ++it) {
+    if (it->first.size() == key.size() &&
+        strncasecmp(it->first.data(), key.data(), key.size()) == 0) {
+      val = it->second;
+      return true;
+    }
+  }
+  return false;
+}
+
+const HttpRequest::MapType& HttpRequest::getHeaders() const {
+  initHeaders();
+  return m_headers;
+}
+
+StringView HttpRequest::getHeaderView(StringView key, StringView def) const {
+  StringView val;
+  return findHeader(key, val) ? val : def;
+}
 
 std::shared_ptr<HttpResponse> HttpRequest::createResponse() {
   HttpResponse::ptr rsp(new HttpResponse(getVersion(), isClose()));
@@ -68,8 +209,8 @@ std::shared_ptr<HttpResponse> HttpRequest::createResponse() {
 
 std::string HttpRequest::getHeader(const std::string& key,
                                    const std::string& def) const {
-  auto it = m_headers.find(key);
-  return it == m_headers.end() ? def : it->second;
+  StringView val;
+  return findHeader(key, val) ? std::string(val.data(), val.size()) : def;
 }
 
 std::string HttpRequest::getParam(const std::string& key,
@@ -88,6 +229,7 @@ std::string HttpRequest::getCookie(const std::string& key,
 }
 
 void HttpRequest::setHeader(const std::string& key, const std::string& val) {
+  initHeaders();
   m_headers[key] = val;
 }
 
@@ -100,6 +242,7 @@ void HttpRequest::setCookie(const std::string& key, const std::string& val) {
 }
 
 void HttpRequest::delHeader(const std::string& key) {
+  initHeaders();
   m_headers.erase(key);
 }
 
@@ -112,12 +255,12 @@ void HttpRequest::delCookie(const std::string& key) {
 }
 
 bool HttpRequest::hasHeader(const std::string& key, std::string* val) {
-  auto it = m_headers.find(key);
-  if (it == m_headers.end()) {
+  StringView v;
+  if (!findHeader(key, v)) {
     return false;
   }
   if (val) {
-    *val = it->second;
+    val->assign(v.data(), v.size());
   }
   return true;
 }
@@ -147,30 +290,62 @@ bool HttpRequest::hasCookie(const std::string& key, std::string* val) {
   return true;
 }
 
-std::ostream& HttpRequest::dump(std::ostream& os) const {
+void HttpRequest::serializeHeader(std::string& out) const {
   //GET /uri HTTP/1.1
   //Host:www.baidu.com
   //
-  os << HttpMethodToString(m_method) << " " << m_path
-     << (m_query.empty() ? "" : "?") << m_query
-     << (m_fragment.empty() ? "" : "#") << m_fragment << " HTTP/"
-     << ((uint32_t)(m_version >> 4)) << "." << ((uint32_t)(m_version & 0x0F))
-     << "\r\n";
+  out += HttpMethodToString(m_method);
+  out += ' ';
+  Append(out, m_path.view());
+  if (!m_query.empty()) {
+    out += '?';
+    Append(out, m_query.view());
+  }
+  if (!m_fragment.empty()) {
+    out += '#';
+    Append(out, m_fragment.view());
+  }
+  out += ' ';
+  AppendVersion(out, m_version);
+  Append(out, s_crlf);
   if (!m_websocket) {
-    os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
+    Append(out, m_close ? s_connection_close : s_connection_keepalive);
   }
-  for (auto& i : m_headers) {
-    if (!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
-      continue;
+  if (m_headersOwned) {
+    for (auto& i : m_headers) {
+      if (!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
+        continue;
+      }
+      out += i.first;
+      out += ':';
+      out += i.second;
+      Append(out, s_crlf);
     }
-    os << i.first << ":" << i.second << "\r\n";
-  }
-  if (!m_body.empty()) {
-    os << "content-length: " << m_body.size() << "\r\n\r\n" << m_body;
   } else {
-    os << "\r\n";
+    for (auto& i : m_headerViews) {
+      if (!m_websocket && i.first.size() == 10 &&
+          strncasecmp(i.first.data(), "connection", 10) == 0) {
+        continue;
+      }
+      Append(out, i.first);
+      out += ':';
+      Append(out, i.second);
+      Append(out, s_crlf);
+    }
+  }
+  StringView body = m_body.view();
+  if (!body.empty()) {
+    Append(out, s_content_length);
+    AppendUint(out, body.size());
+    Append(out, s_crlf);
   }
-  return os;
+  Append(out, s_crlf);
+}
+
+std::ostream& HttpRequest::dump(std::ostream& os) const {
+  std::string header;
+  serializeHeader(header);
+  return os << header << m_body.view();
 }
 
 std::string HttpRequest::toString() const {
@@ -180,9 +355,9 @@ std::string HttpRequest::toString() const {
 }
 
 void HttpRequest::init() {
-  std::string conn = getHeader("connection");
+  StringView conn = getHeaderView("connection");
   if (!conn.empty()) {
-    if (strcasecmp(conn.c_str(), "keep-alive") == 0) {
+    if (conn.size() == 10 && strncasecmp(conn.data(), "keep-alive", 10) == 0) {
       m_close = false;
     } else {
       m_close = true;
@@ -226,7 +401,8 @@ HttpResponse::HttpResponse(uint8_t version, bool close)
     : m_status(HttpStatus::OK),
       m_version(version),
       m_close(close),
-      m_websocket(false) {}
+      m_websocket(false),
+      m_stream(false) {}
 
 std::string HttpResponse::getHeader(const std::string& key,
                                     const std::string& def) const {
@@ -242,28 +418,64 @@ void HttpResponse::delHeader(const std::string& key) {
   m_headers.erase(key);
 }
 
-std::ostream& HttpResponse::dump(std::ostream& os) const {
-  os << "HTTP/" << ((uint32_t)(m_version >> 4)) << ","
-     << ((uint32_t)(m_version & 0x0F)) << " " << (uint32_t)m_status << " "
-     << (m_reason.empty() ? HttpStatusToString(m_status) : m_reason) << "\r\n";
+void HttpResponse::serializeHeader(std::string& out) const {
+  Bytes line{nullptr, 0};
+  if (m_version == 0x11 && m_reason.empty()) {
+    line = HttpStatusLine11(m_status);
+  }
+  if (line.data) {
+    Append(out, line);
+  } else {
+    AppendVersion(out, m_version);
+    out += ' ';
+    AppendUint(out, (uint32_t)m_status);
+    out += ' ';
+    out += m_reason.empty() ? HttpStatusToString(m_status) : m_reason;
+    Append(out, s_crlf);
+  }
   for (auto& i : m_headers) {
     if (!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
       continue;
     }
-    os << i.first << ": " << i.second << "\r\n";
+    out += i.first;
+    out += ": ";
+    out += i.second;
+    Append(out, s_crlf);
   }
   for (auto& i : m_cookies) {
-    os << "Set-Cookie: " << i << "\r\n";
+    Append(out, s_set_cookie);
+    out += i;
+    Append(out, s_crlf);
   }
   if (!m_websocket) {
-    os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
+    Append(out, m_close ? s_connection_close : s_connection_keepalive);
   }
-  if (!m_body.empty()) {
-    os << "content-length: " << m_body.size() << "\r\n\r\n" << m_body;
-  } else {
-    os << "\r\n";
+  if (m_stream) {
+    //长度已知时用头部里的content-length, HTTP/1.0没有chunked,
+    //消息体以关闭连接结束
+    if (m_version >= 0x11 &&
+        m_headers.find("content-length") == m_headers.end()) {
+      Append(out, s_transfer_chunked);
+    }
+  } else if (!m_body.empty()) {
+    Append(out, s_content_length);
+    AppendUint(out, m_body.size());
+    Append(out, s_crlf);
+  } else if ((int)m_status >= 200 && m_status != HttpStatus::NO_CONTENT &&
+             m_status != HttpStatus::NOT_MODIFIED &&
+             m_headers.find("content-length") == m_headers.end()) {
+    //没有消息体也要给出长度, 否则keep-alive连接上对方会一直读到关闭
+    Append(out, s_content_length);
+    AppendUint(out, 0);
+    Append(out, s_crlf);
   }
-  return os;
+  Append(out, s_crlf);
+}
+
+std::ostream& HttpResponse::dump(std::ostream& os) const {
+  std::string header;
+  serializeHeader(header);
+  return os << header << m_body;
 }
 
 std::string HttpResponse::toString() const {
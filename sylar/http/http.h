@@ -2,6 +2,7 @@
 #define __SYLAR_HTTP_HTTP_H__
 
 #include <boost/lexical_cast.hpp>
+#include <boost/utility/string_view.hpp>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -224,10 +225,74 @@ T getAs(const MapType& m, const std::string& key, const T& def = T()) {
   return def;
 }
 
+/// 不持有内存的字符串片段
+typedef boost::string_view StringView;
+
+/**
+ * @brief 可以引用外部内存的字符串, 需要std::string时才拷贝
+ */
+class LazyString {
+ public:
+  /**
+     * @brief 返回内容, 不拷贝
+     */
+  StringView view() const { return m_owned ? StringView(m_str) : m_view; }
+
+  /**
+     * @brief 返回std::string, 第一次调用时从引用的内存拷贝
+     */
+  const std::string& str() const {
+    if (!m_owned) {
+      m_str.assign(m_view.data(), m_view.size());
+      m_owned = true;
+    }
+    return m_str;
+  }
+
+  /**
+     * @brief 引用外部内存, 调用方保证在使用期间有效
+     */
+  void setView(StringView v) {
+    m_view = v;
+    m_owned = false;
+  }
+
+  /**
+     * @brief 设置成自己持有的字符串
+     */
+  void assign(const std::string& v) {
+    m_str = v;
+    m_owned = true;
+  }
+
+  bool empty() const { return view().empty(); }
+
+  /**
+     * @brief 清空, 保留已分配的内存
+     */
+  void clear() {
+    m_view = StringView();
+    m_str.clear();
+    m_owned = false;
+  }
+
+ private:
+  /// 引用的外部内存
+  StringView m_view;
+  /// 自己持有的内容
+  mutable std::string m_str;
+  /// m_str是否有效
+  mutable bool m_owned = false;
+};
+
 class HttpResponse;
+class Servlet;
 
 /**
  * @brief HTTP请求结构
+ * @details 由HttpSession解析的请求, 路径/参数/头部/消息体都引用连接的接收缓存,
+ *          通过getXXXView()读取不会拷贝; getPath()等返回std::string的接口
+ *          在第一次调用时才拷贝
  */
 class HttpRequest {
  public:
@@ -235,6 +300,8 @@ class HttpRequest {
   typedef std::shared_ptr<HttpRequest> ptr;
   /// MAP结构
   typedef std::map<std::string, std::string, CaseInsensitiveLess> MapType;
+  /// 引用接收缓存的头部列表
+  typedef std::vector<std::pair<StringView, StringView>> HeaderViews;
   /**
      * @brief 构造函数
      * @param[in] version 版本
@@ -257,22 +324,48 @@ class HttpRequest {
   /**
      * @brief 返回HTTP请求的路径
      */
-  const std::string& getPath() const { return m_path; }
+  const std::string& getPath() const { return m_path.str(); }
 
   /**
      * @brief 返回HTTP请求的查询参数
      */
-  const std::string& getQuery() const { return m_query; }
+  const std::string& getQuery() const { return m_query.str(); }
+
+  /**
+     * @brief 返回HTTP请求的Fragment
+     */
+  const std::string& getFragment() const { return m_fragment.str(); }
 
   /**
      * @brief 返回HTTP请求的消息体
      */
-  const std::string& getBody() const { return m_body; }
+  const std::string& getBody() const { return m_body.str(); }
+
+  /**
+     * @brief 返回HTTP请求的路径, 不拷贝
+     */
+  StringView getPathView() const { return m_path.view(); }
+
+  /**
+     * @brief 返回HTTP请求的查询参数, 不拷贝
+     */
+  StringView getQueryView() const { return m_query.view(); }
+
+  /**
+     * @brief 返回HTTP请求的Fragment, 不拷贝
+     */
+  StringView getFragmentView() const { return m_fragment.view(); }
+
+  /**
+     * @brief 返回HTTP请求的消息体, 不拷贝
+     */
+  StringView getBodyView() const { return m_body.view(); }
 
   /**
      * @brief 返回HTTP请求的消息头MAP
+     * @details 第一次调用时由引用的头部构造, 之后头部的读写都通过MAP
      */
-  const MapType& getHeaders() const { return m_headers; }
+  const MapType& getHeaders() const;
 
   /**
      * @brief 返回HTTP请求的参数MAP
@@ -300,25 +393,76 @@ class HttpRequest {
      * @brief 设置HTTP请求的路径
      * @param[in] v 请求路径
      */
-  void setPath(const std::string& v) { m_path = v; }
+  void setPath(const std::string& v) {
+    m_path.assign(v);
+    m_servlet.reset();
+  }
 
   /**
      * @brief 设置HTTP请求的查询参数
      * @param[in] v 查询参数
      */
-  void setQuery(const std::string& v) { m_query = v; }
+  void setQuery(const std::string& v) { m_query.assign(v); }
 
   /**
      * @brief 设置HTTP请求的Fragment
      * @param[in] v fragment
      */
-  void setFragment(const std::string& v) { m_fragment = v; }
+  void setFragment(const std::string& v) { m_fragment.assign(v); }
 
   /**
      * @brief 设置HTTP请求的消息体
      * @param[in] v 消息体
      */
-  void setBody(const std::string& v) { m_body = v; }
+  void setBody(const std::string& v) { m_body.assign(v); }
+
+  /**
+     * @brief 引用方式设置路径, 内存需要在请求的生命周期内有效(见setBuffer)
+     */
+  void setPathView(StringView v) {
+    m_path.setView(v);
+    m_servlet.reset();
+  }
+
+  /**
+     * @brief 引用方式设置查询参数
+     */
+  void setQueryView(StringView v) { m_query.setView(v); }
+
+  /**
+     * @brief 引用方式设置Fragment
+     */
+  void setFragmentView(StringView v) { m_fragment.setView(v); }
+
+  /**
+     * @brief 引用方式设置消息体
+     */
+  void setBodyView(StringView v) { m_body.setView(v); }
+
+  /**
+     * @brief 引用方式添加头部, 同名头部后添加的生效
+     */
+  void addHeaderView(StringView key, StringView val);
+
+  /**
+     * @brief 设置引用的内存, 请求持有它直到reset
+     */
+  void setBuffer(std::shared_ptr<char> v) { m_buffer = v; }
+
+  /**
+     * @brief 返回引用的内存
+     */
+  const std::shared_ptr<char>& getBuffer() const { return m_buffer; }
+
+  /**
+     * @brief 把所有引用外部内存的字段拷贝成自己持有的
+     */
+  void materialize();
+
+  /**
+     * @brief 清空请求以便复用, 保留已分配的内存
+     */
+  void reset();
 
   /**
      * @brief 是否自动关闭
@@ -344,7 +488,10 @@ class HttpRequest {
      * @brief 设置HTTP请求的头部MAP
      * @param[in] v map
      */
-  void setHeaders(const MapType& v) { m_headers = v; }
+  void setHeaders(const MapType& v) {
+    m_headers = v;
+    m_headersOwned = true;
+  }
 
   /**
      * @brief 设置HTTP请求的参数MAP
@@ -367,6 +514,14 @@ class HttpRequest {
   std::string getHeader(const std::string& key,
                         const std::string& def = "") const;
 
+  /**
+     * @brief 获取HTTP请求的头部参数, 不拷贝
+     * @param[in] key 关键字
+     * @param[in] def 默认值
+     * @return 如果存在则返回对应值,否则返回默认值
+     */
+  StringView getHeaderView(StringView key, StringView def = StringView()) const;
+
   /**
      * @brief 获取HTTP请求的请求参数
      * @param[in] key 关键字
@@ -456,7 +611,18 @@ class HttpRequest {
      */
   template <class T>
   bool checkGetHeaderAs(const std::string& key, T& val, const T& def = T()) {
-    return checkGetAs(m_headers, key, val, def);
+    StringView v;
+    if (!findHeader(key, v)) {
+      val = def;
+      return false;
+    }
+    try {
+      val = boost::lexical_cast<T>(v.data(), v.size());
+      return true;
+    } catch (...) {
+      val = def;
+    }
+    return false;
   }
 
   /**
@@ -468,7 +634,9 @@ class HttpRequest {
      */
   template <class T>
   T getHeaderAs(const std::string& key, const T& def = T()) {
-    return getAs(m_headers, key, def);
+    T val;
+    checkGetHeaderAs(key, val, def);
+    return val;
   }
 
   /**
@@ -527,6 +695,13 @@ class HttpRequest {
     return getAs(m_cookies, key, def);
   }
 
+  /**
+     * @brief 序列化请求行和头部(包括结尾的空行), 追加到out
+     * @details 消息体不在其中, 用getBodyView()单独发送, 不需要拷贝
+     * @param[in, out] out 输出缓存, 可以在多个请求之间复用
+     */
+  void serializeHeader(std::string& out) const;
+
   /**
      * @brief 序列化输出到流中
      * @param[in, out] os 输出流
@@ -545,6 +720,32 @@ class HttpRequest {
   //  void initQueryParam();
   //  void initBodyParam();
   //  void initCookies();
+
+  /**
+     * @brief 分发器dispatch为这个请求匹配到的servlet, 没有匹配过返回nullptr
+     */
+  std::shared_ptr<Servlet> getServlet(const void* dispatch) const {
+    return m_servletOwner == dispatch ? m_servlet : nullptr;
+  }
+
+  /**
+     * @brief 记下分发器dispatch匹配到的servlet, 同一个请求只查找一次路由
+     */
+  void setServlet(const void* dispatch, std::shared_ptr<Servlet> v) {
+    m_servletOwner = dispatch;
+    m_servlet = v;
+  }
+ private:
+  /**
+     * @brief 查找头部, 同名时取最后一个
+     */
+  bool findHeader(StringView key, StringView& val) const;
+
+  /**
+     * @brief 由引用的头部构造m_headers
+     */
+  void initHeaders() const;
+
  private:
   /// HTTP方法
   HttpMethod m_method;
@@ -554,22 +755,32 @@ class HttpRequest {
   bool m_close;
   /// 是否为websocket
   bool m_websocket;
+  /// m_headers是否有效, 为false时头部在m_headerViews中
+  mutable bool m_headersOwned = false;
 
   //  uint8_t m_parserParamFlag;
   /// 请求路径
-  std::string m_path;
+  LazyString m_path;
   /// 请求参数
-  std::string m_query;
+  LazyString m_query;
   /// 请求fragment
-  std::string m_fragment;
+  LazyString m_fragment;
   /// 请求消息体
-  std::string m_body;
+  LazyString m_body;
+  /// 引用的内存
+  std::shared_ptr<char> m_buffer;
+  /// 引用接收缓存的头部
+  mutable HeaderViews m_headerViews;
   /// 请求头部MAP
-  MapType m_headers;
+  mutable MapType m_headers;
   /// 请求参数MAP
   MapType m_params;
   /// 请求Cookie MAP
   MapType m_cookies;
+  /// 匹配到的servlet, 修改路径时清空
+  std::shared_ptr<Servlet> m_servlet;
+  /// 匹配m_servlet的分发器
+  const void* m_servletOwner = nullptr;
 };
 
 /**
@@ -667,6 +878,18 @@ class HttpResponse {
      */
   void setWebsocket(bool v) { m_websocket = v; }
 
+  /**
+     * @brief 是否流式发送消息体
+     */
+  bool isStream() const { return m_stream; }
+
+  /**
+     * @brief 设置是否流式发送消息体
+     * @details 流式响应没有设置Content-Length头部时使用
+     *          Transfer-Encoding: chunked, 消息体通过HttpSession::sendChunk发送
+     */
+  void setStream(bool v) { m_stream = v; }
+
   /**
      * @brief 获取响应头部参数
      * @param[in] key 关键字
@@ -714,6 +937,14 @@ class HttpResponse {
     return getAs(m_headers, key, def);
   }
 
+  /**
+     * @brief 序列化状态行和头部(包括结尾的空行), 追加到out
+     * @details 常用状态行是预先拼好的. 消息体不在其中, 用getBody()单独发送,
+     *          不需要拷贝
+     * @param[in, out] out 输出缓存, 可以在多个响应之间复用
+     */
+  void serializeHeader(std::string& out) const;
+
   /**
      * @brief 序列化输出到流
      * @param[in, out] os 输出流
@@ -753,6 +984,8 @@ class HttpResponse {
   bool m_close;
   /// 是否为websocket
   bool m_websocket;
+  /// 是否流式发送消息体
+  bool m_stream;
   /// 响应消息体
   std::string m_body;
   /// 响应原因
@@ -0,0 +1,993 @@
+#include "http2_session.h"
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include "http_compress.h"
+#include "http_parser.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/scheduler.h"
+#include "sylar/util.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http2_max_concurrent_streams =
+    sylar::Config::Lookup("http2.max_concurrent_streams", (uint32_t)128,
+                          "http2 max concurrent streams per connection");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http2_initial_window_size =
+    sylar::Config::Lookup("http2.initial_window_size",
+                          (uint32_t)(1024 * 1024),
+                          "http2 receive window of each stream and "
+                          "of the connection");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http2_max_header_list_size =
+    sylar::Config::Lookup("http2.max_header_list_size",
+                          (uint32_t)(64 * 1024),
+                          "http2 max size of decoded request headers, "
+                          "name + value + 32 for each field");
+
+/// 帧头部长度
+static const size_t s_frame_head_size = 9;
+
+/// 接收的最大帧负载, 没有通告SETTINGS_MAX_FRAME_SIZE时是默认值
+static const size_t s_max_frame_size = 16384;
+
+/// 接收缓存大小, 小帧在缓存里批量解析
+static const size_t s_http2_buffer_size = 64 * 1024;
+
+/// 流量控制窗口的上限
+static const int64_t s_max_window = 0x7fffffff;
+
+/// HTTP/2客户端连接序言
+static const char s_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static void PutFrameHead(char* head, uint32_t len, uint8_t type,
+                         uint8_t flags, uint32_t id) {
+  head[0] = len >> 16;
+  head[1] = len >> 8;
+  head[2] = len;
+  head[3] = type;
+  head[4] = flags;
+  head[5] = (id >> 24) & 0x7f;
+  head[6] = id >> 16;
+  head[7] = id >> 8;
+  head[8] = id;
+}
+
+static void PutUint32(char* p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static uint32_t GetUint32(const char* p) {
+  const uint8_t* u = (const uint8_t*)p;
+  return ((uint32_t)u[0] << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+}
+
+/**
+ * @brief 只在HTTP/1上有意义的头部, HTTP/2里不能出现
+ */
+static bool IsConnectionHeader(const std::string& name) {
+  return name == "connection" || name == "keep-alive" ||
+         name == "proxy-connection" || name == "transfer-encoding" ||
+         name == "upgrade";
+}
+
+Http2Stream::Http2Stream(std::shared_ptr<Http2Session> conn, uint32_t id,
+                         Socket::ptr sock)
+    : HttpSession(sock, false), m_conn(conn), m_id(id), m_sendWindow(0) {}
+
+int64_t Http2Stream::readBody(void* buffer, size_t length) {
+  size_t n = std::min(length, m_body.size() - m_bodyPos);
+  memcpy(buffer, m_body.data() + m_bodyPos, n);
+  m_bodyPos += n;
+  return n;
+}
+
+int Http2Stream::sendResponseHeader(HttpResponse::ptr rsp, const void* data,
+                                    size_t length) {
+  rsp->setStream(true);
+  int rt = m_conn->sendHeaders(this, rsp, false);
+  if (rt <= 0 || length == 0) {
+    return rt;
+  }
+  return m_conn->sendData(this, data, length, false) > 0 ? 1 : -1;
+}
+
+int64_t Http2Stream::sendFile(int fd, off_t offset, uint64_t length) {
+  if (length == 0) {
+    return 1;
+  }
+  //DATA帧要加帧头, 不能sendfile, 读出来按帧发送
+  std::string buf(std::min<uint64_t>(length, s_http2_buffer_size), '\0');
+  uint64_t left = length;
+  while (left > 0) {
+    ssize_t n = pread(fd, &buf[0], std::min<uint64_t>(left, buf.size()),
+                      offset);
+    if (n <= 0) {
+      return -1;
+    }
+    if (m_conn->sendData(this, buf.data(), n, false) <= 0) {
+      return -1;
+    }
+    offset += n;
+    left -= n;
+  }
+  return length;
+}
+
+int Http2Stream::sendChunk(const void* data, size_t length) {
+  if (length == 0) {
+    return 1;
+  }
+  return m_conn->sendData(this, data, length, false) > 0 ? 1 : -1;
+}
+
+int Http2Stream::finishResponse() {
+  if (!m_headersSent || m_endSent) {
+    return 1;
+  }
+  return m_conn->sendData(this, nullptr, 0, true) > 0 ? 1 : -1;
+}
+
+void Http2Stream::close() {
+  if (!m_endSent && !m_reset) {
+    m_conn->resetStream(m_id, Http2FrameHead::CANCEL);
+  }
+}
+
+Http2Session::Http2Session(HttpSession::ptr conn,
+                           ServletDispatch::ptr dispatch,
+                           const std::string& server_name)
+    : m_conn(conn),
+      m_dispatch(dispatch),
+      m_serverName(server_name),
+      m_rbuf(s_http2_buffer_size),
+      m_localWindow(std::min<uint32_t>(g_http2_initial_window_size->getValue(),
+                                       s_max_window)),
+      m_maxStreams(g_http2_max_concurrent_streams->getValue()),
+      m_maxHeaderListSize(g_http2_max_header_list_size->getValue()) {
+  m_decoder.setMaxListSize(m_maxHeaderListSize);
+}
+
+bool Http2Session::IsUpgrade(HttpRequest::ptr req) {
+  if (strcasecmp(req->getHeader("upgrade").c_str(), "h2c") != 0) {
+    return false;
+  }
+  if (req->getHeader("http2-settings").empty()) {
+    return false;
+  }
+  std::string conn = req->getHeader("connection");
+  return strcasestr(conn.c_str(), "upgrade") != nullptr;
+}
+
+bool Http2Session::upgrade(HttpRequest::ptr req) {
+  if (!IsUpgrade(req)) {
+    return false;
+  }
+  std::string settings;
+  if (!Base64Decode(req->getHeader("http2-settings"), settings) ||
+      settings.size() % 6 != 0 ||
+      applySettings(settings.data(), settings.size()) !=
+          Http2FrameHead::NO_ERROR) {
+    return false;
+  }
+  static const char s_switching[] =
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+  if (m_conn->writeFixSize(s_switching, sizeof(s_switching) - 1) <= 0) {
+    return false;
+  }
+  m_upgradeRequest = req;
+  return true;
+}
+
+void Http2Session::run() {
+  //服务端的连接序言: SETTINGS, 再把连接窗口调到和流一样大
+  char settings[18];
+  settings[0] = 0;
+  settings[1] = Http2FrameHead::MAX_CONCURRENT_STREAMS;
+  PutUint32(settings + 2, m_maxStreams);
+  settings[6] = 0;
+  settings[7] = Http2FrameHead::INITIAL_WINDOW_SIZE;
+  PutUint32(settings + 8, m_localWindow);
+  settings[12] = 0;
+  settings[13] = Http2FrameHead::MAX_HEADER_LIST_SIZE;
+  PutUint32(settings + 14, m_maxHeaderListSize);
+  sendFrame(Http2FrameHead::SETTINGS, 0, 0, settings, sizeof(settings));
+  if (m_localWindow > 65535) {
+    char inc[4];
+    PutUint32(inc, m_localWindow - 65535);
+    sendFrame(Http2FrameHead::WINDOW_UPDATE, 0, 0, inc, sizeof(inc));
+  }
+
+  if (m_upgradeRequest) {
+    //升级请求是流1, 已经半关闭
+    Http2Stream::ptr stream(
+        new Http2Stream(shared_from_this(), 1, m_conn->getSocket()));
+    stream->m_request = m_upgradeRequest;
+    stream->m_body = m_upgradeRequest->getBody();
+    stream->m_remoteClosed = true;
+    m_upgradeRequest.reset();
+    {
+      MutexType::Lock lock(m_mutex);
+      stream->m_sendWindow = m_peerInitialWindow;
+      m_streams[1] = stream;
+    }
+    m_lastStreamId = 1;
+    dispatch(stream);
+  }
+
+  size_t len = sizeof(s_preface) - 1;
+  if (fill(len) && memcmp(&m_rbuf[m_rbegin], s_preface, len) == 0) {
+    m_rbegin += len;
+    while (handleFrame()) {
+    }
+  }
+
+  //读不到数据了, 窗口不会再更新, 还在等窗口的流都失败
+  std::vector<std::pair<Scheduler*, Fiber::ptr> > fibers;
+  {
+    MutexType::Lock lock(m_mutex);
+    m_closed = true;
+    for (auto it = m_streams.begin(); it != m_streams.end();) {
+      it->second->m_reset = true;
+      if (it->second->m_dispatched) {
+        ++it;
+      } else {
+        it = m_streams.erase(it);
+      }
+    }
+    wakeLocked(fibers);
+  }
+  Wake(fibers);
+  //流的协程还引用着连接, 等它们结束
+  while (true) {
+    {
+      MutexType::Lock lock(m_mutex);
+      if (m_streams.empty()) {
+        break;
+      }
+      m_closeWaiter = Fiber::GetThis();
+      m_closeScheduler = Scheduler::GetThis();
+    }
+    Fiber::YieldToHold();
+  }
+  m_conn->close();
+}
+
+bool Http2Session::fill(size_t size) {
+  if (m_rend - m_rbegin >= size) {
+    return true;
+  }
+  if (m_rbegin > 0) {
+    memmove(&m_rbuf[0], &m_rbuf[m_rbegin], m_rend - m_rbegin);
+    m_rend -= m_rbegin;
+    m_rbegin = 0;
+  }
+  while (m_rend < size) {
+    int64_t rt = m_conn->readRaw(&m_rbuf[m_rend], m_rbuf.size() - m_rend);
+    if (rt <= 0) {
+      return false;
+    }
+    m_rend += rt;
+  }
+  return true;
+}
+
+bool Http2Session::handleFrame() {
+  if (!fill(s_frame_head_size)) {
+    return false;
+  }
+  const char* head = &m_rbuf[m_rbegin];
+  uint32_t len = ((uint8_t)head[0] << 16) | ((uint8_t)head[1] << 8) |
+                 (uint8_t)head[2];
+  uint8_t type = head[3];
+  uint8_t flags = head[4];
+  uint32_t id = GetUint32(head + 5) & 0x7fffffff;
+  if (len > s_max_frame_size) {
+    return goaway(Http2FrameHead::FRAME_SIZE_ERROR);
+  }
+  if (!fill(s_frame_head_size + len)) {
+    return false;
+  }
+  //fill可能移动过数据, 负载在下一次fill之前都有效
+  const char* data = &m_rbuf[m_rbegin + s_frame_head_size];
+  m_rbegin += s_frame_head_size + len;
+
+  //头部块中间不能插入其他帧, 第一帧必须是SETTINGS
+  if (m_continuationId &&
+      (type != Http2FrameHead::CONTINUATION || id != m_continuationId)) {
+    return goaway(Http2FrameHead::PROTOCOL_ERROR);
+  }
+  if (!m_settingsReceived && type != Http2FrameHead::SETTINGS) {
+    return goaway(Http2FrameHead::PROTOCOL_ERROR);
+  }
+  switch (type) {
+    case Http2FrameHead::DATA:
+      return handleData(id, flags, data, len);
+    case Http2FrameHead::HEADERS:
+      return handleHeaders(id, flags, data, len);
+    case Http2FrameHead::PRIORITY:
+      if (id == 0) {
+        return goaway(Http2FrameHead::PROTOCOL_ERROR);
+      }
+      if (len != 5) {
+        resetStream(id, Http2FrameHead::FRAME_SIZE_ERROR);
+      }
+      return true;
+    case Http2FrameHead::RST_STREAM: {
+      if (id == 0 || id > m_lastStreamId) {
+        return goaway(Http2FrameHead::PROTOCOL_ERROR);
+      }
+      if (len != 4) {
+        return goaway(Http2FrameHead::FRAME_SIZE_ERROR);
+      }
+      std::vector<std::pair<Scheduler*, Fiber::ptr> > fibers;
+      {
+        MutexType::Lock lock(m_mutex);
+        auto it = m_streams.find(id);
+        if (it != m_streams.end()) {
+          it->second->m_reset = true;
+          if (!it->second->m_dispatched) {
+            m_streams.erase(it);
+          }
+          wakeLocked(fibers);
+        }
+      }
+      Wake(fibers);
+      return true;
+    }
+    case Http2FrameHead::SETTINGS:
+      if (id != 0) {
+        return goaway(Http2FrameHead::PROTOCOL_ERROR);
+      }
+      return handleSettings(flags, data, len);
+    case Http2FrameHead::PUSH_PROMISE:
+      //客户端不能推送
+      return goaway(Http2FrameHead::PROTOCOL_ERROR);
+    case Http2FrameHead::PING:
+      if (id != 0) {
+        return goaway(Http2FrameHead::PROTOCOL_ERROR);
+      }
+      if (len != 8) {
+        return goaway(Http2FrameHead::FRAME_SIZE_ERROR);
+      }
+      if (!(flags & Http2FrameHead::ACK)) {
+        return sendFrame(Http2FrameHead::PING, Http2FrameHead::ACK, 0, data,
+                         len) > 0;
+      }
+      return true;
+    case Http2FrameHead::GOAWAY:
+      if (id != 0) {
+        return goaway(Http2FrameHead::PROTOCOL_ERROR);
+      }
+      //已经发出的请求照常处理, 对方处理完会关闭连接
+      SYLAR_LOG_DEBUG(g_logger) << "http2 goaway received, client="
+                                << *m_conn->getSocket();
+      return true;
+    case Http2FrameHead::WINDOW_UPDATE:
+      return handleWindowUpdate(id, data, len);
+    case Http2FrameHead::CONTINUATION:
+      if (!m_continuationId) {
+        return goaway(Http2FrameHead::PROTOCOL_ERROR);
+      }
+      if (!appendHeaderBlock(data, len)) {
+        return false;
+      }
+      if (!(flags & Http2FrameHead::END_HEADERS)) {
+        return true;
+      }
+      m_continuationId = 0;
+      return handleHeaderBlock(id, m_continuationEnd);
+    default:
+      //未知类型的帧忽略
+      return true;
+  }
+}
+
+bool Http2Session::handleSettings(uint8_t flags, const char* data,
+                                  size_t len) {
+  if (flags & Http2FrameHead::ACK) {
+    return len == 0 || goaway(Http2FrameHead::FRAME_SIZE_ERROR);
+  }
+  if (len % 6 != 0) {
+    return goaway(Http2FrameHead::FRAME_SIZE_ERROR);
+  }
+  uint32_t error = applySettings(data, len);
+  if (error != Http2FrameHead::NO_ERROR) {
+    return goaway(error);
+  }
+  m_settingsReceived = true;
+  return sendFrame(Http2FrameHead::SETTINGS, Http2FrameHead::ACK, 0, nullptr,
+                   0) > 0;
+}
+
+uint32_t Http2Session::applySettings(const char* data, size_t len) {
+  uint32_t error = Http2FrameHead::NO_ERROR;
+  std::vector<std::pair<Scheduler*, Fiber::ptr> > fibers;
+  {
+    MutexType::Lock lock(m_mutex);
+    for (size_t i = 0; i + 6 <= len && error == Http2FrameHead::NO_ERROR;
+         i += 6) {
+      uint16_t id = ((uint8_t)data[i] << 8) | (uint8_t)data[i + 1];
+      uint32_t value = GetUint32(data + i + 2);
+      switch (id) {
+        case Http2FrameHead::HEADER_TABLE_SIZE:
+          //编码的动态表不超过默认大小, 对方允许更大也不用
+          m_encoder.setMaxTableSize(std::min<uint32_t>(value, 4096));
+          break;
+        case Http2FrameHead::ENABLE_PUSH:
+          if (value > 1) {
+            error = Http2FrameHead::PROTOCOL_ERROR;
+          }
+          break;
+        case Http2FrameHead::INITIAL_WINDOW_SIZE: {
+          if (value > s_max_window) {
+            error = Http2FrameHead::FLOW_CONTROL_ERROR;
+            break;
+          }
+          //已经打开的流按差值调整, 窗口可以变成负数
+          int64_t delta = (int64_t)value - m_peerInitialWindow;
+          for (auto& s : m_streams) {
+            s.second->m_sendWindow += delta;
+          }
+          m_peerInitialWindow = value;
+          break;
+        }
+        case Http2FrameHead::MAX_FRAME_SIZE:
+          if (value < 16384 || value > 16777215) {
+            error = Http2FrameHead::PROTOCOL_ERROR;
+            break;
+          }
+          m_peerMaxFrameSize = value;
+          break;
+        default:
+          break;
+      }
+    }
+    wakeLocked(fibers);
+  }
+  Wake(fibers);
+  return error;
+}
+
+bool Http2Session::handleHeaders(uint32_t id, uint8_t flags, const char* data,
+                                 size_t len) {
+  if (id == 0 || !(id & 1)) {
+    return goaway(Http2FrameHead::PROTOCOL_ERROR);
+  }
+  size_t pad = 0;
+  if (flags & Http2FrameHead::PADDED) {
+    if (len < 1) {
+      return goaway(Http2FrameHead::PROTOCOL_ERROR);
+    }
+    pad = (uint8_t)data[0];
+    ++data;
+    --len;
+  }
+  if (flags & Http2FrameHead::PRIORITY_FLAG) {
+    if (len < 5) {
+      return goaway(Http2FrameHead::PROTOCOL_ERROR);
+    }
+    data += 5;
+    len -= 5;
+  }
+  if (pad > len) {
+    return goaway(Http2FrameHead::PROTOCOL_ERROR);
+  }
+  m_headerBlock.clear();
+  m_headerBlockTooLarge = false;
+  if (!appendHeaderBlock(data, len - pad)) {
+    return false;
+  }
+  if (!(flags & Http2FrameHead::END_HEADERS)) {
+    m_continuationId = id;
+    m_continuationEnd = flags & Http2FrameHead::END_STREAM;
+    return true;
+  }
+  return handleHeaderBlock(id, flags & Http2FrameHead::END_STREAM);
+}
+
+bool Http2Session::appendHeaderBlock(const char* data, size_t len) {
+  m_headerBlock.append(data, len);
+  if (m_maxHeaderListSize && m_headerBlock.size() > m_maxHeaderListSize) {
+    //正常编码的头部块不比解码后大, 超过上限时头部列表也一定超过;
+    //哈夫曼编码最多膨胀到4倍, 再大就不缓存了, 动态表没法再保持一致
+    if (m_headerBlock.size() > (size_t)m_maxHeaderListSize * 4) {
+      return goaway(Http2FrameHead::ENHANCE_YOUR_CALM);
+    }
+    m_headerBlockTooLarge = true;
+  }
+  return true;
+}
+
+bool Http2Session::handleHeaderBlock(uint32_t id, bool end_stream) {
+  //被拒绝的流也要解码, 动态表才能和对方保持一致
+  HPack::HeaderList headers;
+  bool too_large = false;
+  bool ok = m_decoder.decode((const uint8_t*)m_headerBlock.data(),
+                             m_headerBlock.size(), headers, &too_large);
+  too_large = too_large || m_headerBlockTooLarge;
+  m_headerBlock.clear();
+  m_headerBlockTooLarge = false;
+  if (!ok) {
+    return goaway(Http2FrameHead::COMPRESSION_ERROR);
+  }
+
+  Http2Stream::ptr stream;
+  size_t count = 0;
+  {
+    MutexType::Lock lock(m_mutex);
+    auto it = m_streams.find(id);
+    if (it != m_streams.end()) {
+      stream = it->second;
+    }
+    count = m_streams.size();
+  }
+  if (stream) {
+    //消息体之后的尾部, 必须结束流
+    if (stream->m_remoteClosed) {
+      resetStream(id, Http2FrameHead::STREAM_CLOSED);
+      return true;
+    }
+    if (!end_stream) {
+      resetStream(id, Http2FrameHead::PROTOCOL_ERROR);
+      return true;
+    }
+    if (too_large) {
+      resetStream(id, Http2FrameHead::ENHANCE_YOUR_CALM);
+      return true;
+    }
+    for (auto& h : headers) {
+      if (h.first[0] != ':') {
+        stream->m_request->setHeader(h.first, h.second);
+      }
+    }
+    stream->m_remoteClosed = true;
+    dispatch(stream);
+    return true;
+  }
+  if (id <= m_lastStreamId) {
+    return goaway(Http2FrameHead::STREAM_CLOSED);
+  }
+  m_lastStreamId = id;
+  if (count >= m_maxStreams) {
+    resetStream(id, Http2FrameHead::REFUSED_STREAM);
+    return true;
+  }
+  //超过通告的SETTINGS_MAX_HEADER_LIST_SIZE, 头部不完整, 拒绝这个流
+  if (too_large) {
+    resetStream(id, Http2FrameHead::ENHANCE_YOUR_CALM);
+    return true;
+  }
+
+  HttpRequest::ptr req(new HttpRequest(0x20, false));
+  std::string method;
+  std::string path;
+  std::string authority;
+  bool regular = false;
+  for (auto& h : headers) {
+    const std::string& name = h.first;
+    if (name.empty()) {
+      ok = false;
+    } else if (name[0] == ':') {
+      //伪头部必须在普通头部之前
+      if (regular) {
+        ok = false;
+      } else if (name == ":method") {
+        method = h.second;
+      } else if (name == ":path") {
+        path = h.second;
+      } else if (name == ":authority") {
+        authority = h.second;
+      } else if (name != ":scheme") {
+        ok = false;
+      }
+    } else if (IsConnectionHeader(name)) {
+      ok = false;
+    } else {
+      regular = true;
+      //同名头部合并, cookie用"; "分隔(RFC 7540 8.1.2.5)
+      std::string old;
+      if (req->hasHeader(name, &old)) {
+        req->setHeader(name,
+                       old + (name == "cookie" ? "; " : ", ") + h.second);
+      } else {
+        req->setHeader(name, h.second);
+      }
+    }
+  }
+  HttpMethod m = CharsToHttpMethod(method.c_str());
+  if (!ok || m == HttpMethod::INVALID_METHOD || path.empty()) {
+    resetStream(id, Http2FrameHead::PROTOCOL_ERROR);
+    return true;
+  }
+  req->setMethod(m);
+  size_t pos = path.find('#');
+  if (pos != std::string::npos) {
+    req->setFragment(path.substr(pos + 1));
+    path.resize(pos);
+  }
+  pos = path.find('?');
+  if (pos != std::string::npos) {
+    req->setQuery(path.substr(pos + 1));
+    path.resize(pos);
+  }
+  req->setPath(path);
+  if (!authority.empty() && !req->hasHeader("host")) {
+    req->setHeader("host", authority);
+  }
+
+  stream.reset(new Http2Stream(shared_from_this(), id, m_conn->getSocket()));
+  stream->m_request = req;
+  stream->m_remoteClosed = end_stream;
+  {
+    MutexType::Lock lock(m_mutex);
+    stream->m_sendWindow = m_peerInitialWindow;
+    m_streams[id] = stream;
+  }
+  if (end_stream) {
+    dispatch(stream);
+  }
+  return true;
+}
+
+bool Http2Session::handleData(uint32_t id, uint8_t flags, const char* data,
+                              size_t len) {
+  if (id == 0) {
+    return goaway(Http2FrameHead::PROTOCOL_ERROR);
+  }
+  //流量控制按整个负载计算, 包括填充
+  uint32_t frame_len = len;
+  if (flags & Http2FrameHead::PADDED) {
+    if (len < 1 || (uint8_t)data[0] >= len) {
+      return goaway(Http2FrameHead::PROTOCOL_ERROR);
+    }
+    len -= 1 + (uint8_t)data[0];
+    ++data;
+  }
+  //连接窗口不管流的状态都要归还, 攒到一半再发WINDOW_UPDATE
+  m_recvUnacked += frame_len;
+  if (m_recvUnacked >= m_localWindow / 2) {
+    char inc[4];
+    PutUint32(inc, m_recvUnacked);
+    m_recvUnacked = 0;
+    if (sendFrame(Http2FrameHead::WINDOW_UPDATE, 0, 0, inc, sizeof(inc)) <=
+        0) {
+      return false;
+    }
+  }
+
+  Http2Stream::ptr stream;
+  {
+    MutexType::Lock lock(m_mutex);
+    auto it = m_streams.find(id);
+    if (it != m_streams.end()) {
+      stream = it->second;
+    }
+  }
+  if (!stream || stream->m_remoteClosed) {
+    if (id > m_lastStreamId) {
+      return goaway(Http2FrameHead::PROTOCOL_ERROR);
+    }
+    resetStream(id, Http2FrameHead::STREAM_CLOSED);
+    return true;
+  }
+  if (stream->m_body.size() + len >
+      HttpRequestParser::GetHttpRequestMaxBodySize()) {
+    resetStream(id, Http2FrameHead::CANCEL);
+    return true;
+  }
+  stream->m_body.append(data, len);
+  if (flags & Http2FrameHead::END_STREAM) {
+    stream->m_remoteClosed = true;
+    dispatch(stream);
+    return true;
+  }
+  stream->m_recvUnacked += frame_len;
+  if (stream->m_recvUnacked >= m_localWindow / 2) {
+    char inc[4];
+    PutUint32(inc, stream->m_recvUnacked);
+    stream->m_recvUnacked = 0;
+    return sendFrame(Http2FrameHead::WINDOW_UPDATE, 0, id, inc, sizeof(inc)) >
+           0;
+  }
+  return true;
+}
+
+bool Http2Session::handleWindowUpdate(uint32_t id, const char* data,
+                                      size_t len) {
+  if (len != 4) {
+    return goaway(Http2FrameHead::FRAME_SIZE_ERROR);
+  }
+  uint32_t inc = GetUint32(data) & 0x7fffffff;
+  uint32_t conn_error = Http2FrameHead::NO_ERROR;
+  uint32_t stream_error = Http2FrameHead::NO_ERROR;
+  std::vector<std::pair<Scheduler*, Fiber::ptr> > fibers;
+  {
+    MutexType::Lock lock(m_mutex);
+    if (id == 0) {
+      m_sendWindow += inc;
+      if (inc == 0) {
+        conn_error = Http2FrameHead::PROTOCOL_ERROR;
+      } else if (m_sendWindow > s_max_window) {
+        conn_error = Http2FrameHead::FLOW_CONTROL_ERROR;
+      }
+    } else {
+      auto it = m_streams.find(id);
+      if (it == m_streams.end()) {
+        //已经关闭的流上还可能收到, 忽略
+        if (id > m_lastStreamId) {
+          conn_error = Http2FrameHead::PROTOCOL_ERROR;
+        }
+      } else {
+        it->second->m_sendWindow += inc;
+        if (inc == 0) {
+          stream_error = Http2FrameHead::PROTOCOL_ERROR;
+        } else if (it->second->m_sendWindow > s_max_window) {
+          stream_error = Http2FrameHead::FLOW_CONTROL_ERROR;
+        }
+      }
+    }
+    wakeLocked(fibers);
+  }
+  Wake(fibers);
+  if (conn_error != Http2FrameHead::NO_ERROR) {
+    return goaway(conn_error);
+  }
+  if (stream_error != Http2FrameHead::NO_ERROR) {
+    resetStream(id, stream_error);
+  }
+  return true;
+}
+
+void Http2Session::dispatch(Http2Stream::ptr stream) {
+  stream->m_dispatched = true;
+  Scheduler::GetThis()->schedule(
+      std::bind(&Http2Session::handleStream, shared_from_this(), stream));
+}
+
+void Http2Session::handleStream(Http2Stream::ptr stream) {
+  HttpRequest::ptr req = stream->m_request;
+  //流式读取的servlet从stream读消息体, 其他的和HTTP/1一样放在请求里
+  if (!m_dispatch->isStreamRequest(req)) {
+    req->setBody(stream->m_body);
+    std::string().swap(stream->m_body);
+  }
+  HttpResponse::ptr rsp(new HttpResponse(0x20, false));
+  rsp->setHeader("Server", m_serverName);
+  m_dispatch->handle(req, rsp, stream);
+
+  if (rsp->isStream()) {
+    stream->finishResponse();
+  } else if (!stream->m_headersSent) {
+    HttpCompressorMgr::GetInstance()->compress(req, rsp);
+    const std::string& body = rsp->getBody();
+    bool has_body = !body.empty() && req->getMethod() != HttpMethod::HEAD;
+    if (sendHeaders(stream.get(), rsp, !has_body) > 0 && has_body) {
+      sendData(stream.get(), body.data(), body.size(), true);
+    }
+  }
+  removeStream(stream);
+}
+
+int Http2Session::sendHeaders(Http2Stream* stream, HttpResponse::ptr rsp,
+                              bool end_stream) {
+  HPack::HeaderList headers;
+  headers.emplace_back(":status", std::to_string((int)rsp->getStatus()));
+  bool has_length = false;
+  for (auto& i : rsp->getHeaders()) {
+    std::string name = i.first;
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    if (IsConnectionHeader(name)) {
+      continue;
+    }
+    has_length = has_length || name == "content-length";
+    headers.emplace_back(name, i.second);
+  }
+  if (!rsp->isStream() && !has_length) {
+    headers.emplace_back("content-length",
+                         std::to_string(rsp->getBody().size()));
+  }
+
+  std::string block;
+  std::string frames;
+  MutexType::Lock lock(m_mutex);
+  if (m_closed || stream->m_reset || stream->m_headersSent) {
+    return -1;
+  }
+  //动态表是连接上共享的, 编码顺序必须和发送顺序一致
+  m_encoder.encode(headers, block);
+  //超过对方的最大帧大小时拆出CONTINUATION
+  size_t pos = 0;
+  do {
+    size_t n = std::min<size_t>(block.size() - pos, m_peerMaxFrameSize);
+    uint8_t flags = 0;
+    if (pos + n == block.size()) {
+      flags |= Http2FrameHead::END_HEADERS;
+    }
+    if (pos == 0 && end_stream) {
+      flags |= Http2FrameHead::END_STREAM;
+    }
+    char head[s_frame_head_size];
+    PutFrameHead(head, n,
+                 pos == 0 ? Http2FrameHead::HEADERS
+                          : Http2FrameHead::CONTINUATION,
+                 flags, stream->m_id);
+    frames.append(head, sizeof(head));
+    frames.append(block, pos, n);
+    pos += n;
+  } while (pos < block.size());
+  stream->m_headersSent = true;
+  stream->m_endSent = end_stream;
+  return flushLocked(lock, frames.data(), frames.size(), nullptr, 0);
+}
+
+int64_t Http2Session::sendData(Http2Stream* stream, const void* data,
+                               size_t len, bool end_stream) {
+  const char* ptr = (const char*)data;
+  size_t left = len;
+  MutexType::Lock lock(m_mutex);
+  while (true) {
+    if (m_closed || stream->m_reset || stream->m_endSent) {
+      return -1;
+    }
+    int64_t n = std::min<int64_t>(std::min(m_sendWindow, stream->m_sendWindow),
+                                  std::min<int64_t>(m_peerMaxFrameSize, left));
+    if (left > 0 && n <= 0) {
+      //窗口用完, 挂起等WINDOW_UPDATE. 唤醒可能在让出之前, 调度器会等
+      //协程让出后再执行
+      stream->m_waiter = Fiber::GetThis();
+      stream->m_scheduler = Scheduler::GetThis();
+      lock.unlock();
+      Fiber::YieldToHold();
+      lock.lock();
+      continue;
+    }
+    m_sendWindow -= n;
+    stream->m_sendWindow -= n;
+    left -= n;
+    bool last = end_stream && left == 0;
+    stream->m_endSent = last;
+    char head[s_frame_head_size];
+    PutFrameHead(head, n, Http2FrameHead::DATA,
+                 last ? Http2FrameHead::END_STREAM : 0, stream->m_id);
+    if (flushLocked(lock, head, sizeof(head), ptr, n) <= 0) {
+      return -1;
+    }
+    ptr += n;
+    if (left == 0) {
+      break;
+    }
+  }
+  return len > 0 ? len : 1;
+}
+
+int Http2Session::sendFrame(uint8_t type, uint8_t flags, uint32_t id,
+                            const void* data, size_t len) {
+  char head[s_frame_head_size];
+  PutFrameHead(head, len, type, flags, id);
+  MutexType::Lock lock(m_mutex);
+  if (m_closed) {
+    return -1;
+  }
+  return flushLocked(lock, head, sizeof(head), data, len);
+}
+
+int Http2Session::flushLocked(MutexType::Lock& lock, const char* head,
+                              size_t head_len, const void* data, size_t len) {
+  if (m_sending) {
+    //另一方正在发送, 排队由它发出
+    m_sendQueue.append(head, head_len);
+    m_sendQueue.append((const char*)data, len);
+    return head_len + len;
+  }
+  m_sending = true;
+  lock.unlock();
+  iovec iovs[2];
+  iovs[0].iov_base = (void*)head;
+  iovs[0].iov_len = head_len;
+  iovs[1].iov_base = (void*)data;
+  iovs[1].iov_len = len;
+  int rt = m_conn->writevFixSize(iovs, len > 0 ? 2 : 1);
+  //发送期间其他协程排队的帧
+  std::string queue;
+  while (true) {
+    lock.lock();
+    if (rt <= 0 || m_sendQueue.empty()) {
+      m_sendQueue.clear();
+      m_sending = false;
+      if (rt <= 0) {
+        m_closed = true;
+      }
+      return rt;
+    }
+    queue.swap(m_sendQueue);
+    lock.unlock();
+    if (m_conn->writeFixSize(queue.data(), queue.size()) <= 0) {
+      rt = -1;
+    }
+    queue.clear();
+  }
+}
+
+void Http2Session::resetStream(uint32_t id, uint32_t code) {
+  char payload[4];
+  PutUint32(payload, code);
+  sendFrame(Http2FrameHead::RST_STREAM, 0, id, payload, sizeof(payload));
+  std::vector<std::pair<Scheduler*, Fiber::ptr> > fibers;
+  {
+    MutexType::Lock lock(m_mutex);
+    auto it = m_streams.find(id);
+    if (it == m_streams.end()) {
+      return;
+    }
+    it->second->m_reset = true;
+    if (!it->second->m_dispatched) {
+      m_streams.erase(it);
+    }
+    wakeLocked(fibers);
+  }
+  Wake(fibers);
+}
+
+bool Http2Session::goaway(uint32_t code) {
+  SYLAR_LOG_DEBUG(g_logger) << "http2 goaway error=" << code
+                            << " last_stream=" << m_lastStreamId
+                            << " client=" << *m_conn->getSocket();
+  char payload[8];
+  PutUint32(payload, m_lastStreamId);
+  PutUint32(payload + 4, code);
+  sendFrame(Http2FrameHead::GOAWAY, 0, 0, payload, sizeof(payload));
+  MutexType::Lock lock(m_mutex);
+  m_closed = true;
+  return false;
+}
+
+void Http2Session::removeStream(Http2Stream::ptr stream) {
+  //处理完还没结束的流(比如发送失败)要告诉对方
+  if (!stream->m_endSent && !stream->m_reset) {
+    resetStream(stream->m_id, Http2FrameHead::INTERNAL_ERROR);
+  }
+  Fiber::ptr waiter;
+  Scheduler* scheduler = nullptr;
+  {
+    MutexType::Lock lock(m_mutex);
+    m_streams.erase(stream->m_id);
+    if (m_streams.empty() && m_closeWaiter) {
+      waiter.swap(m_closeWaiter);
+      scheduler = m_closeScheduler;
+    }
+  }
+  if (waiter) {
+    scheduler->schedule(waiter);
+  }
+}
+
+void Http2Session::wakeLocked(
+    std::vector<std::pair<Scheduler*, Fiber::ptr> >& fibers) {
+  for (auto& i : m_streams) {
+    if (i.second->m_waiter) {
+      fibers.emplace_back(i.second->m_scheduler, i.second->m_waiter);
+      i.second->m_waiter.reset();
+    }
+  }
+}
+
+void Http2Session::Wake(
+    std::vector<std::pair<Scheduler*, Fiber::ptr> >& fibers) {
+  for (auto& i : fibers) {
+    i.first->schedule(i.second);
+  }
+  fibers.clear();
+}
+
+}  // namespace http
+}  // namespace sylar
@@ -0,0 +1,380 @@
+/**
+ * @file http2_session.h
+ * @brief HTTP/2连接(RFC 7540), 只支持明文的h2c
+ */
+#ifndef __SYLAR_HTTP_HTTP2_SESSION_H__
+#define __SYLAR_HTTP_HTTP2_SESSION_H__
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hpack.h"
+#include "http_session.h"
+#include "servlet.h"
+#include "sylar/fiber.h"
+#include "sylar/mutex.h"
+
+namespace sylar {
+class Scheduler;
+
+namespace http {
+
+/**
+ * @brief HTTP/2帧头部的常量
+ */
+struct Http2FrameHead {
+  /// 帧类型
+  enum TYPE {
+    DATA = 0x0,
+    HEADERS = 0x1,
+    PRIORITY = 0x2,
+    RST_STREAM = 0x3,
+    SETTINGS = 0x4,
+    PUSH_PROMISE = 0x5,
+    PING = 0x6,
+    GOAWAY = 0x7,
+    WINDOW_UPDATE = 0x8,
+    CONTINUATION = 0x9
+  };
+
+  /// 帧标志
+  enum FLAGS {
+    /// DATA/HEADERS: 流的最后一帧
+    END_STREAM = 0x1,
+    /// SETTINGS/PING: 确认
+    ACK = 0x1,
+    /// HEADERS/CONTINUATION: 头部块结束
+    END_HEADERS = 0x4,
+    /// DATA/HEADERS: 带填充
+    PADDED = 0x8,
+    /// HEADERS: 带优先级
+    PRIORITY_FLAG = 0x20
+  };
+
+  /// SETTINGS参数
+  enum SETTINGS_ID {
+    HEADER_TABLE_SIZE = 0x1,
+    ENABLE_PUSH = 0x2,
+    MAX_CONCURRENT_STREAMS = 0x3,
+    INITIAL_WINDOW_SIZE = 0x4,
+    MAX_FRAME_SIZE = 0x5,
+    MAX_HEADER_LIST_SIZE = 0x6
+  };
+
+  /// RST_STREAM/GOAWAY的错误码
+  enum ERROR_CODE {
+    NO_ERROR = 0x0,
+    PROTOCOL_ERROR = 0x1,
+    INTERNAL_ERROR = 0x2,
+    FLOW_CONTROL_ERROR = 0x3,
+    STREAM_CLOSED = 0x5,
+    FRAME_SIZE_ERROR = 0x6,
+    REFUSED_STREAM = 0x7,
+    CANCEL = 0x8,
+    COMPRESSION_ERROR = 0x9,
+    ENHANCE_YOUR_CALM = 0xb
+  };
+};
+
+class Http2Session;
+
+/**
+ * @brief HTTP/2的一个流, 作为HttpSession交给Servlet
+ * @details 请求的消息体在分发前已经收完. 流式响应的接口被改写成
+ *          HEADERS/DATA帧, 受连接和流两级流量控制, 窗口不够时协程挂起
+ *          等待WINDOW_UPDATE. Servlet不需要区分HTTP/1和HTTP/2
+ */
+class Http2Stream : public HttpSession {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<Http2Stream> ptr;
+
+  /**
+   * @brief 构造函数
+   * @param[in] conn 所属的连接
+   * @param[in] id 流ID
+   * @param[in] sock 连接的socket, 不托管, 只用来取地址
+   */
+  Http2Stream(std::shared_ptr<Http2Session> conn, uint32_t id,
+              Socket::ptr sock);
+
+  /**
+   * @brief 流ID
+   */
+  uint32_t getId() const { return m_id; }
+
+  /**
+   * @brief 读取缓存的消息体
+   */
+  int64_t readBody(void* buffer, size_t length) override;
+
+  /**
+   * @brief 发送HEADERS, data不为空时紧跟一个DATA
+   */
+  int sendResponseHeader(HttpResponse::ptr rsp, const void* data = nullptr,
+                         size_t length = 0) override;
+
+  /**
+   * @brief 用pread读出文件内容, 作为DATA发送
+   */
+  int64_t sendFile(int fd, off_t offset, uint64_t length) override;
+
+  int sendChunk(const void* data, size_t length) override;
+
+  /**
+   * @brief 发送带END_STREAM的空DATA
+   */
+  int finishResponse() override;
+
+  /**
+   * @brief 取消流(RST_STREAM CANCEL), 不关闭连接
+   */
+  void close() override;
+
+ private:
+  friend class Http2Session;
+  /// 所属的连接
+  std::shared_ptr<Http2Session> m_conn;
+  /// 流ID
+  uint32_t m_id;
+  /// 请求, 头部收完后创建
+  HttpRequest::ptr m_request;
+  /// 收到的消息体
+  std::string m_body;
+  /// 消息体已经读取的位置
+  size_t m_bodyPos = 0;
+  /// 发送窗口
+  int64_t m_sendWindow;
+  /// 已经接收还没有用WINDOW_UPDATE归还的字节数
+  uint32_t m_recvUnacked = 0;
+  /// 对方已经发送END_STREAM
+  bool m_remoteClosed = false;
+  /// 已经交给协程处理
+  bool m_dispatched = false;
+  /// 已经发送了头部
+  bool m_headersSent = false;
+  /// 已经发送了END_STREAM
+  bool m_endSent = false;
+  /// 被RST_STREAM重置或者连接已经断开
+  bool m_reset = false;
+  /// 等待发送窗口的协程
+  Fiber::ptr m_waiter;
+  /// 等待的协程所在的调度器
+  Scheduler* m_scheduler = nullptr;
+};
+
+/**
+ * @brief 服务端的HTTP/2连接
+ * @details run()在当前协程读取并处理帧. 每个流的请求收完后放到自己的
+ *          协程里, 通过ServletDispatch分发. 发送可以在多个协程中同时进行,
+ *          HPACK编码和排队在同一把锁里, 帧不会交错.
+ *          - SETTINGS/PING/WINDOW_UPDATE/RST_STREAM/GOAWAY在读协程处理
+ *          - 不支持服务端推送, PRIORITY被忽略
+ *          - 协议错误时发送GOAWAY后关闭连接
+ */
+class Http2Session : public std::enable_shared_from_this<Http2Session> {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<Http2Session> ptr;
+  typedef sylar::Mutex MutexType;
+
+  /**
+   * @brief 构造函数
+   * @param[in] conn HTTP/1的连接, 接收缓存中剩下的数据继续使用
+   * @param[in] dispatch Servlet分发器
+   * @param[in] server_name 响应的Server头部
+   */
+  Http2Session(HttpSession::ptr conn, ServletDispatch::ptr dispatch,
+               const std::string& server_name);
+
+  /**
+   * @brief 处理HTTP/1.1的Upgrade: h2c请求
+   * @details 回复101, 按HTTP2-Settings设置对方参数,
+   *          请求本身作为流1, 在run()开始后处理
+   * @param[in] req 升级请求, 消息体已经收完
+   * @return 请求不是合法的h2c升级时返回false, 什么也不发送
+   */
+  bool upgrade(HttpRequest::ptr req);
+
+  /**
+   * @brief 读取连接序言, 处理帧直到连接关闭
+   * @details 返回前等待所有流的协程结束
+   */
+  void run();
+
+  /**
+   * @brief 是否是h2c升级请求
+   */
+  static bool IsUpgrade(HttpRequest::ptr req);
+
+ private:
+  friend class Http2Stream;
+
+  /**
+   * @brief 读取并处理一帧
+   * @return 连接需要关闭时返回false
+   */
+  bool handleFrame();
+
+  bool handleSettings(uint8_t flags, const char* data, size_t len);
+
+  bool handleHeaders(uint32_t id, uint8_t flags, const char* data, size_t len);
+
+  bool handleData(uint32_t id, uint8_t flags, const char* data, size_t len);
+
+  bool handleWindowUpdate(uint32_t id, const char* data, size_t len);
+
+  /**
+   * @brief 追加HEADERS/CONTINUATION带来的头部块片段
+   * @details 超过头部列表上限时记下, 收完照常解码后拒绝这个流;
+   *          超过上限太多时才断开连接
+   */
+  bool appendHeaderBlock(const char* data, size_t len);
+
+  /**
+   * @brief 头部块收完, 解码并创建请求
+   */
+  bool handleHeaderBlock(uint32_t id, bool end_stream);
+
+  /**
+   * @brief 应用对方SETTINGS的参数
+   * @return 错误码, 没有错误返回NO_ERROR
+   */
+  uint32_t applySettings(const char* data, size_t len);
+
+  /**
+   * @brief 在新协程中处理一个流的请求
+   */
+  void dispatch(Http2Stream::ptr stream);
+
+  /**
+   * @brief 执行Servlet并发送非流式的响应
+   */
+  void handleStream(Http2Stream::ptr stream);
+
+  /**
+   * @brief 发送响应头部
+   * @param[in] end_stream HEADERS是否带END_STREAM
+   */
+  int sendHeaders(Http2Stream* stream, HttpResponse::ptr rsp,
+                  bool end_stream);
+
+  /**
+   * @brief 在流上发送DATA, 按窗口和最大帧大小分帧
+   * @details 窗口不够时挂起当前协程, 直到WINDOW_UPDATE或者流被重置
+   * @return 成功返回len(len为0时返回1), 失败返回-1
+   */
+  int64_t sendData(Http2Stream* stream, const void* data, size_t len,
+                   bool end_stream);
+
+  /**
+   * @brief 发送一帧
+   */
+  int sendFrame(uint8_t type, uint8_t flags, uint32_t id, const void* data,
+                size_t len);
+
+  /**
+   * @brief 发送已经持有锁的帧
+   * @details 没有其他发送时直接writev头部和负载, 否则排队由正在发送的一方
+   *          发出. 返回时仍持有锁
+   */
+  int flushLocked(MutexType::Lock& lock, const char* head, size_t head_len,
+                  const void* data, size_t len);
+
+  /**
+   * @brief 重置流
+   */
+  void resetStream(uint32_t id, uint32_t code);
+
+  /**
+   * @brief 发送GOAWAY, 之后run()结束
+   */
+  bool goaway(uint32_t code);
+
+  /**
+   * @brief 流处理完, 从连接上移除
+   */
+  void removeStream(Http2Stream::ptr stream);
+
+  /**
+   * @brief 唤醒等待发送窗口的协程, 需要持有锁
+   */
+  void wakeLocked(std::vector<std::pair<Scheduler*, Fiber::ptr> >& fibers);
+
+  /**
+   * @brief 调度wakeLocked取出的协程, 不能持有锁
+   */
+  static void Wake(std::vector<std::pair<Scheduler*, Fiber::ptr> >& fibers);
+
+  /**
+   * @brief 保证接收缓存中至少有size字节
+   */
+  bool fill(size_t size);
+
+ private:
+  /// HTTP/1的连接, 负责收发
+  HttpSession::ptr m_conn;
+  /// Servlet分发器
+  ServletDispatch::ptr m_dispatch;
+  /// Server头部
+  std::string m_serverName;
+  /// 接收缓存
+  std::vector<char> m_rbuf;
+  /// 接收缓存中未处理数据的起始位置
+  size_t m_rbegin = 0;
+  /// 接收缓存中数据的结束位置
+  size_t m_rend = 0;
+  /// 解码请求头部, 只在读协程中使用
+  HPack m_decoder;
+  /// 正在接收的头部块
+  std::string m_headerBlock;
+  /// 正在接收的头部块是否超过了上限
+  bool m_headerBlockTooLarge = false;
+  /// 正在接收头部块的流, 0表示没有
+  uint32_t m_continuationId = 0;
+  /// 正在接收的头部块是否带END_STREAM
+  bool m_continuationEnd = false;
+  /// 收到的最大流ID
+  uint32_t m_lastStreamId = 0;
+  /// 我方通告的流初始窗口
+  uint32_t m_localWindow;
+  /// 我方通告的最大并发流数
+  uint32_t m_maxStreams;
+  /// 我方通告的头部列表大小上限
+  uint32_t m_maxHeaderListSize;
+  /// 连接级别已经接收还没有归还的字节数
+  uint32_t m_recvUnacked = 0;
+  /// 是否已经收到对方的SETTINGS
+  bool m_settingsReceived = false;
+  /// 升级请求, 作为流1
+  HttpRequest::ptr m_upgradeRequest;
+
+  /// 保护下面的状态
+  MutexType m_mutex;
+  /// 正在处理的流
+  std::unordered_map<uint32_t, Http2Stream::ptr> m_streams;
+  /// 编码响应头部, 编码和排队在同一把锁里保证顺序
+  HPack m_encoder;
+  /// 连接的发送窗口
+  int64_t m_sendWindow = 65535;
+  /// 对方的SETTINGS_INITIAL_WINDOW_SIZE
+  int64_t m_peerInitialWindow = 65535;
+  /// 对方的SETTINGS_MAX_FRAME_SIZE
+  uint32_t m_peerMaxFrameSize = 16384;
+  /// 连接已经断开或者发送了GOAWAY
+  bool m_closed = false;
+  /// 是否有一方正在发送
+  bool m_sending = false;
+  /// 等待发送的帧
+  std::string m_sendQueue;
+  /// run()等待流结束的协程
+  Fiber::ptr m_closeWaiter;
+  /// run()所在的调度器
+  Scheduler* m_closeScheduler = nullptr;
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
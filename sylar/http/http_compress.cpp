@@ -0,0 +1,340 @@
+#include "http_compress.h"
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include <functional>
+#include <sstream>
+#include "sylar/config.h"
+#include "sylar/log.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
+
+static sylar::ConfigVar<bool>::ptr g_http_compress_enable =
+    sylar::Config::Lookup("http.compress.enable", true,
+                          "http response compression enable");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http_compress_min_size =
+    sylar::Config::Lookup("http.compress.min_size", (uint32_t)1024,
+                          "http response bodies smaller than this "
+                          "are sent uncompressed");
+
+static sylar::ConfigVar<int32_t>::ptr g_http_compress_level =
+    sylar::Config::Lookup("http.compress.level", (int32_t)6,
+                          "http response compression level");
+
+static sylar::ConfigVar<std::vector<std::string> >::ptr
+    g_http_compress_mime_types = sylar::Config::Lookup(
+        "http.compress.mime_types",
+        std::vector<std::string>{"text/", "application/json",
+                                 "application/javascript", "application/xml",
+                                 "image/svg+xml"},
+        "compressible content types, entries ending with / are prefixes");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_compress_cache_size =
+    sylar::Config::Lookup("http.compress.cache_size",
+                          (uint64_t)(16 * 1024 * 1024),
+                          "http compressed response cache size");
+
+static bool s_http_compress_enable = true;
+static uint32_t s_http_compress_min_size = 1024;
+static int32_t s_http_compress_level = 6;
+static uint64_t s_http_compress_cache_size = 16 * 1024 * 1024;
+
+namespace {
+struct _CompressIniter {
+  _CompressIniter() {
+    s_http_compress_enable = g_http_compress_enable->getValue();
+    s_http_compress_min_size = g_http_compress_min_size->getValue();
+    s_http_compress_level = g_http_compress_level->getValue();
+    s_http_compress_cache_size = g_http_compress_cache_size->getValue();
+
+    g_http_compress_enable->addListener(
+        [](const bool& ov, const bool& nv) { s_http_compress_enable = nv; });
+    g_http_compress_min_size->addListener(
+        [](const uint32_t& ov, const uint32_t& nv) {
+          s_http_compress_min_size = nv;
+        });
+    g_http_compress_level->addListener(
+        [](const int32_t& ov, const int32_t& nv) {
+          s_http_compress_level = nv;
+        });
+    g_http_compress_cache_size->addListener(
+        [](const uint64_t& ov, const uint64_t& nv) {
+          s_http_compress_cache_size = nv;
+        });
+  }
+};
+static _CompressIniter _init;
+}  // namespace
+
+std::string HttpCompressStats::toString() const {
+  std::stringstream ss;
+  ss << "responses=" << responses << " cache_hits=" << cacheHits
+     << " bytes_in=" << bytesIn << " bytes_out=" << bytesOut
+     << " bytes_saved=" << bytesSaved() << " cpu_us=" << cpuUs;
+  return ss.str();
+}
+
+/**
+ * @brief 当前线程消耗的CPU时间
+ */
+static uint64_t ThreadCpuUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+}
+
+HttpCompressor::HttpCompressor() {
+  m_mimeTypes = g_http_compress_mime_types->getValue();
+  //单例不会析构, 监听里可以直接用this
+  g_http_compress_mime_types->addListener(
+      [this](const std::vector<std::string>& ov,
+             const std::vector<std::string>& nv) {
+        RWMutexType::WriteLock lock(m_configMutex);
+        m_mimeTypes = nv;
+      });
+}
+
+HttpCompressor::Encoding HttpCompressor::Negotiate(
+    const std::string& accept_encoding) {
+  bool gzip = false;
+  bool deflate = false;
+  //"*"表示没有列出的编码都可以
+  bool any = false;
+  bool gzip_listed = false;
+  size_t pos = 0;
+  while (pos < accept_encoding.size()) {
+    size_t end = accept_encoding.find(',', pos);
+    if (end == std::string::npos) {
+      end = accept_encoding.size();
+    }
+    //编码[;q=值]
+    size_t begin = accept_encoding.find_first_not_of(" \t", pos);
+    size_t semi = accept_encoding.find(';', begin);
+    size_t name_end = std::min(semi, end);
+    while (name_end > begin && (accept_encoding[name_end - 1] == ' ' ||
+                                accept_encoding[name_end - 1] == '\t')) {
+      --name_end;
+    }
+    bool accepted = true;
+    if (semi < end) {
+      size_t q = accept_encoding.find("q=", semi);
+      if (q < end) {
+        accepted = strtod(accept_encoding.c_str() + q + 2, nullptr) > 0;
+      }
+    }
+    if (begin < name_end) {
+      std::string name = accept_encoding.substr(begin, name_end - begin);
+      if (strcasecmp(name.c_str(), "gzip") == 0 ||
+          strcasecmp(name.c_str(), "x-gzip") == 0) {
+        gzip = accepted;
+        gzip_listed = true;
+      } else if (name == "*") {
+        any = accepted;
+      } else if (strcasecmp(name.c_str(), "deflate") == 0) {
+        deflate = accepted;
+      }
+    }
+    pos = end + 1;
+  }
+  if (gzip || (any && !gzip_listed)) {
+    return GZIP;
+  }
+  return deflate ? DEFLATE : IDENTITY;
+}
+
+bool HttpCompressor::Compress(Encoding encoding, const void* data, size_t len,
+                              int level, std::string& out) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  //gzip在窗口位数上加16, deflate是zlib格式
+  int bits = encoding == GZIP ? 15 + 16 : 15;
+  if (deflateInit2(&zs, level, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) !=
+      Z_OK) {
+    return false;
+  }
+  out.resize(deflateBound(&zs, len));
+  zs.next_in = (Bytef*)data;
+  zs.avail_in = len;
+  zs.next_out = (Bytef*)&out[0];
+  zs.avail_out = out.size();
+  int rt = deflate(&zs, Z_FINISH);
+  out.resize(out.size() - zs.avail_out);
+  deflateEnd(&zs);
+  return rt == Z_STREAM_END;
+}
+
+bool HttpCompressor::isCompressible(const std::string& content_type) {
+  size_t len = content_type.find(';');
+  if (len == std::string::npos) {
+    len = content_type.size();
+  }
+  while (len > 0 && content_type[len - 1] == ' ') {
+    --len;
+  }
+  if (len == 0) {
+    return false;
+  }
+  RWMutexType::ReadLock lock(m_configMutex);
+  for (auto& i : m_mimeTypes) {
+    if (i.empty()) {
+      continue;
+    }
+    if (i.back() == '/' ? (len > i.size() &&
+                           strncasecmp(content_type.c_str(), i.c_str(),
+                                       i.size()) == 0)
+                        : (len == i.size() &&
+                           strncasecmp(content_type.c_str(), i.c_str(),
+                                       len) == 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool HttpCompressor::compress(HttpRequest::ptr req, HttpResponse::ptr rsp) {
+  if (!s_http_compress_enable || rsp->isStream()) {
+    return false;
+  }
+  const std::string& body = rsp->getBody();
+  int status = (int)rsp->getStatus();
+  if (body.size() < s_http_compress_min_size || status < 200 ||
+      status >= 300 || status == 204 || status == 206 ||
+      !rsp->getHeader("content-encoding").empty() ||
+      !isCompressible(rsp->getHeader("content-type"))) {
+    return false;
+  }
+  //内容随Accept-Encoding变化, 不压缩时也要告诉缓存
+  std::string vary = rsp->getHeader("vary");
+  if (vary.empty()) {
+    rsp->setHeader("Vary", "Accept-Encoding");
+  } else if (strcasestr(vary.c_str(), "accept-encoding") == nullptr) {
+    rsp->setHeader("Vary", vary + ", Accept-Encoding");
+  }
+  Encoding encoding = Negotiate(req->getHeader("accept-encoding"));
+  if (encoding == IDENTITY) {
+    return false;
+  }
+  const char* name = encoding == GZIP ? "gzip" : "deflate";
+
+  //有ETag时按路径和ETag缓存, 否则按响应体的哈希和长度,
+  //哈希可能冲突, 命中时还要和保存的原响应体比较
+  std::string etag = rsp->getHeader("etag");
+  std::string key = name;
+  bool by_hash = etag.empty();
+  if (!by_hash) {
+    key += " e " + req->getPath() + " " + etag;
+  } else {
+    key += " h " + std::to_string(std::hash<std::string>()(body)) + " " +
+           std::to_string(body.size());
+  }
+  Data data = get(key, by_hash ? &body : nullptr);
+  if (data) {
+    ++m_cacheHits;
+  } else {
+    uint64_t begin = ThreadCpuUs();
+    std::shared_ptr<std::string> out(new std::string);
+    bool ok = Compress(encoding, body.data(), body.size(),
+                       s_http_compress_level, *out);
+    m_cpuUs += ThreadCpuUs() - begin;
+    if (!ok) {
+      SYLAR_LOG_WARN(g_logger) << "http compress fail, body size="
+                               << body.size();
+      return false;
+    }
+    data = out;
+    put(key, data, by_hash ? Data(new std::string(body)) : nullptr);
+  }
+  //压缩后没有变小(比如已经压缩过的内容), 原样发送
+  if (data->size() >= body.size()) {
+    return false;
+  }
+  ++m_responses;
+  m_bytesIn += body.size();
+  m_bytesOut += data->size();
+
+  rsp->setBody(*data);
+  rsp->setHeader("Content-Encoding", name);
+  //消息体长度由发送时按新的消息体计算
+  rsp->delHeader("content-length");
+  //强ETag要区分编码, 弱ETag语义上等价可以不变
+  if (etag.size() >= 2 && etag[0] == '"' && etag.back() == '"') {
+    etag.insert(etag.size() - 1, std::string("-") + name);
+    rsp->setHeader("ETag", etag);
+  }
+  return true;
+}
+
+HttpCompressStats HttpCompressor::getStats() const {
+  HttpCompressStats stats;
+  stats.responses = m_responses;
+  stats.cacheHits = m_cacheHits;
+  stats.bytesIn = m_bytesIn;
+  stats.bytesOut = m_bytesOut;
+  stats.cpuUs = m_cpuUs;
+  return stats;
+}
+
+void HttpCompressor::resetStats() {
+  m_responses = 0;
+  m_cacheHits = 0;
+  m_bytesIn = 0;
+  m_bytesOut = 0;
+  m_cpuUs = 0;
+}
+
+void HttpCompressor::clearCache() {
+  MutexType::Lock lock(m_mutex);
+  m_lru.clear();
+  m_entries.clear();
+  m_total = 0;
+}
+
+HttpCompressor::Data HttpCompressor::get(const std::string& key,
+                                         const std::string* body) {
+  MutexType::Lock lock(m_mutex);
+  auto it = m_entries.find(key);
+  if (it == m_entries.end()) {
+    return nullptr;
+  }
+  if (body && (!it->second.source || *it->second.source != *body)) {
+    return nullptr;
+  }
+  m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+  return it->second.data;
+}
+
+void HttpCompressor::put(const std::string& key, Data data, Data source) {
+  uint64_t capacity = s_http_compress_cache_size;
+  uint64_t size = data->size() + (source ? source->size() : 0);
+  //太大的结果会把缓存整个挤掉, 不缓存
+  if (size > capacity / 8) {
+    return;
+  }
+  MutexType::Lock lock(m_mutex);
+  auto it = m_entries.find(key);
+  if (it != m_entries.end()) {
+    return;
+  }
+  m_lru.push_front(key);
+  Entry& e = m_entries[key];
+  e.data = data;
+  e.source = source;
+  e.lru = m_lru.begin();
+  m_total += size;
+  while (m_total > capacity && !m_lru.empty()) {
+    auto victim = m_entries.find(m_lru.back());
+    m_total -= victim->second.data->size();
+    if (victim->second.source) {
+      m_total -= victim->second.source->size();
+    }
+    m_entries.erase(victim);
+    m_lru.pop_back();
+  }
+}
+
+}  // namespace http
+}  // namespace sylar
@@ -0,0 +1,163 @@
+/**
+ * @file http_compress.h
+ * @brief HTTP响应压缩(gzip/deflate)
+ */
+#ifndef __SYLAR_HTTP_HTTP_COMPRESS_H__
+#define __SYLAR_HTTP_HTTP_COMPRESS_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "http.h"
+#include "sylar/mutex.h"
+#include "sylar/singleton.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief 压缩统计
+ */
+struct HttpCompressStats {
+  /// 压缩的响应数, 包括缓存命中
+  uint64_t responses = 0;
+  /// 缓存命中数
+  uint64_t cacheHits = 0;
+  /// 压缩前的字节数
+  uint64_t bytesIn = 0;
+  /// 压缩后的字节数
+  uint64_t bytesOut = 0;
+  /// 压缩消耗的CPU时间(微秒), 缓存命中不计
+  uint64_t cpuUs = 0;
+
+  /**
+   * @brief 节省的字节数
+   */
+  uint64_t bytesSaved() const { return bytesIn - bytesOut; }
+
+  std::string toString() const;
+};
+
+/**
+ * @brief 按Accept-Encoding压缩响应体
+ * @details 配置:
+ *          - http.compress.enable 是否启用
+ *          - http.compress.min_size 小于这个大小的响应体不压缩
+ *          - http.compress.level zlib压缩级别
+ *          - http.compress.mime_types 可以压缩的Content-Type,
+ *            以/结尾的是前缀, 比如"text/"
+ *          - http.compress.cache_size 压缩结果缓存的大小
+ *          压缩结果按ETag(没有时按响应体的哈希, 命中时再比较原响应体)缓存,
+ *          超过大小时按LRU淘汰, 相同的响应不会重复压缩. 流式响应不处理
+ */
+class HttpCompressor {
+ public:
+  typedef sylar::Mutex MutexType;
+  typedef sylar::RWMutex RWMutexType;
+  typedef std::shared_ptr<const std::string> Data;
+
+  /// 内容编码
+  enum Encoding {
+    /// 不压缩
+    IDENTITY,
+    /// gzip
+    GZIP,
+    /// deflate(zlib格式)
+    DEFLATE
+  };
+
+  HttpCompressor();
+
+  /**
+   * @brief 压缩响应体, 设置Content-Encoding和Vary, 修改强ETag
+   * @return 是否压缩
+   */
+  bool compress(HttpRequest::ptr req, HttpResponse::ptr rsp);
+
+  /**
+   * @brief 获取统计
+   */
+  HttpCompressStats getStats() const;
+
+  /**
+   * @brief 清空统计
+   */
+  void resetStats();
+
+  /**
+   * @brief 清空缓存
+   */
+  void clearCache();
+
+  /**
+   * @brief 从Accept-Encoding中选出编码, gzip优先, q=0的不选
+   */
+  static Encoding Negotiate(const std::string& accept_encoding);
+
+  /**
+   * @brief 压缩数据
+   * @param[in] level zlib压缩级别
+   * @param[out] out 压缩结果
+   */
+  static bool Compress(Encoding encoding, const void* data, size_t len,
+                       int level, std::string& out);
+
+ private:
+  /**
+   * @brief Content-Type是否在http.compress.mime_types中
+   */
+  bool isCompressible(const std::string& content_type);
+
+  /**
+   * @brief 查找压缩结果
+   * @param[in] body 按哈希缓存时的原响应体, 和缓存的不一致时不算命中
+   */
+  Data get(const std::string& key, const std::string* body);
+
+  /**
+   * @brief 缓存压缩结果
+   * @param[in] source 按哈希缓存时保存的原响应体, 按ETag缓存时为空
+   */
+  void put(const std::string& key, Data data, Data source);
+
+ private:
+  struct Entry {
+    /// 压缩结果
+    Data data;
+    /// 按哈希缓存时的原响应体, 哈希相同时用来确认内容一致
+    Data source;
+    /// 在m_lru中的位置
+    std::list<std::string>::iterator lru;
+  };
+
+  /// 保护m_mimeTypes
+  RWMutexType m_configMutex;
+  /// 可以压缩的Content-Type
+  std::vector<std::string> m_mimeTypes;
+
+  /// 保护缓存
+  MutexType m_mutex;
+  /// 最近使用的在前面
+  std::list<std::string> m_lru;
+  std::unordered_map<std::string, Entry> m_entries;
+  /// 缓存内容的总大小
+  uint64_t m_total = 0;
+
+  std::atomic<uint64_t> m_responses{0};
+  std::atomic<uint64_t> m_cacheHits{0};
+  std::atomic<uint64_t> m_bytesIn{0};
+  std::atomic<uint64_t> m_bytesOut{0};
+  std::atomic<uint64_t> m_cpuUs{0};
+};
+
+/// 响应压缩的单例
+typedef sylar::Singleton<HttpCompressor> HttpCompressorMgr;
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
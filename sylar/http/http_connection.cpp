@@ -131,10 +131,15 @@ HttpResponse::ptr HttpConnection::recvResponse() {
 }
 
 int HttpConnection::sendRequest(HttpRequest::ptr req) {
-  std::stringstream ss;
-  ss << *req;
-  std::string data = ss.str();
-  return writeFixSize(data.c_str(), data.size());
+  m_scratch.clear();
+  req->serializeHeader(m_scratch);
+  StringView body = req->getBodyView();
+  iovec iovs[2];
+  iovs[0].iov_base = &m_scratch[0];
+  iovs[0].iov_len = m_scratch.size();
+  iovs[1].iov_base = (void*)body.data();
+  iovs[1].iov_len = body.size();
+  return writevFixSize(iovs, body.empty() ? 1 : 2);
 }
 
 HttpResult::ptr HttpConnection::DoGet(
@@ -184,11 +184,16 @@ class HttpConnection : public SocketStream {
    */
   HttpResponse::ptr recvResponse();
 
+  /**
+   * @brief 发送HTTP请求, 头部和消息体分开用writev发送, 消息体不拷贝
+   */
   int sendRequest(HttpRequest::ptr req);
 
  private:
   uint64_t m_createTime = 0;
   uint64_t m_request = 0;
+  /// 序列化请求头部的缓存, 连接上的请求复用
+  std::string m_scratch;
 };
 
 /**
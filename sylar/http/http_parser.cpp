@@ -94,17 +94,17 @@ void on_request_uri(void* data, const char* at, size_t length) {}
 void on_request_fragement(void* data, const char* at, size_t length) {
   SYLAR_LOG_INFO(g_logger) << "on_request_fragment:" << std::string(at, length);
   HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-  parser->getData()->setFragment(std::string(at, length));
+  parser->getData()->setFragmentView(StringView(at, length));
 }
 
 void on_request_path(void* data, const char* at, size_t length) {
   HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-  parser->getData()->setPath(std::string(at, length));
+  parser->getData()->setPathView(StringView(at, length));
 }
 
 void on_request_query(void* data, const char* at, size_t length) {
   HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-  parser->getData()->setQuery(std::string(at, length));
+  parser->getData()->setQueryView(StringView(at, length));
 }
 
 void on_request_version(void* data, const char* at, size_t length) {
@@ -131,8 +131,8 @@ void on_request_http_field(void* data, const char* field, size_t flen,
     SYLAR_LOG_WARN(g_logger) << "invalid http request field length = 0";
     return;
   }
-  parser->getData()->setHeader(std::string(field, flen),
-                               std::string(value, vlen));
+  parser->getData()->addHeaderView(StringView(field, flen),
+                                   StringView(value, vlen));
 }
 
 HttpRequestParser::HttpRequestParser() : m_error(0) {
@@ -151,10 +151,26 @@ HttpRequestParser::HttpRequestParser() : m_error(0) {
 
 size_t HttpRequestParser::execute(char* data, size_t len) {
   size_t offset = http_parser_execute(&m_parser, data, len, 0);
+  //解析出的字段引用data, 移动数据前先拷贝出来
+  m_data->materialize();
   memmove(data, data + offset, (len - offset));
   return offset;
 }
 
+size_t HttpRequestParser::execute(const char* data, size_t len, size_t off) {
+  return http_parser_execute(&m_parser, data, len, off);
+}
+
+void HttpRequestParser::reset() {
+  if (m_data.unique()) {
+    m_data->reset();
+  } else {
+    m_data.reset(new sylar::http::HttpRequest);
+  }
+  http_parser_init(&m_parser);
+  m_error = 0;
+}
+
 bool HttpRequestParser::isFinished() {
   return http_parser_finish(&m_parser);
 }
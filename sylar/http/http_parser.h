@@ -28,6 +28,22 @@ class HttpRequestParser {
      */
   size_t execute(char* data, size_t len);
 
+  /**
+     * @brief 在同一块内存上继续解析, 不移动数据
+     * @details 解析出的路径/头部等引用data, data需要在请求使用期间有效
+     * @param[in] data 协议文本内存, 包含之前已解析的部分
+     * @param[in] len 协议文本内存长度
+     * @param[in] off 之前已解析的长度
+     * @return 本次解析的长度
+     */
+  size_t execute(const char* data, size_t len, size_t off);
+
+  /**
+     * @brief 重置解析状态以便解析下一个请求
+     * @details HttpRequest没有被其他地方持有时清空后复用, 否则重新创建
+     */
+  void reset();
+
   /**
    * @brief 是否解析完成
    * @return 是否解析完成
@@ -1,4 +1,6 @@
 #include "http_server.h"
+#include "http2_session.h"
+#include "http_compress.h"
 #include "http_session.h"
 #include "sylar/log.h"
 
@@ -16,8 +18,15 @@ HttpServer::HttpServer(bool keepalive, sylar::IOManager* worker,
 void HttpServer::handleClient(Socket::ptr client) {
   SYLAR_LOG_DEBUG(g_logger) << " handleClient " << *client;
   sylar::http::HttpSession::ptr session(new HttpSession(client));
+  //以连接序言开头的是HTTP/2, 不经过HTTP/1的解析
+  if (m_http2 && session->isHttp2Preface()) {
+    Http2Session::ptr h2(new Http2Session(session, m_dispatch, getName()));
+    h2->run();
+    return;
+  }
   do {
-    auto req = session->recvRequest();
+    //先只读头部, 匹配到的servlet不流式读取时再读整个消息体
+    auto req = session->recvRequest(false);
     if (!req) {
       SYLAR_LOG_DEBUG(g_logger)
           << "recv http request fail, errno = " << errno
@@ -25,6 +34,21 @@ void HttpServer::handleClient(Socket::ptr client) {
           << " keep_alive = " << m_isKeepalive;
       break;
     }
+    //Upgrade: h2c, 请求作为流1, 之后的请求都走HTTP/2
+    if (m_http2 && Http2Session::IsUpgrade(req)) {
+      if (!session->recvBody(req)) {
+        break;
+      }
+      Http2Session::ptr h2(new Http2Session(session, m_dispatch, getName()));
+      if (session->flushResponses() > 0 && h2->upgrade(req)) {
+        h2->run();
+        return;
+      }
+    }
+    if (!m_dispatch->isStreamRequest(req) && !session->recvBody(req)) {
+      session->flushResponses();
+      break;
+    }
     HttpResponse::ptr rsp(
         new HttpResponse(req->getVersion(), req->isClose() || !m_isKeepalive));
     rsp->setHeader("Server", getName());
@@ -35,7 +59,29 @@ void HttpServer::handleClient(Socket::ptr client) {
     //    SYLAR_LOG_INFO(g_logger) << " response : " << std::endl
     //                << *rsp;
 
-    session->sendResponse(rsp);
+    if (rsp->isStream()) {
+      //servlet已经发出了头部和消息体, 补上结尾
+      if (session->finishResponse() <= 0) {
+        break;
+      }
+    } else {
+      HttpCompressorMgr::GetInstance()->compress(req, rsp);
+      //流水线请求的响应按顺序攒起来, 一次writev发出
+      session->queueResponse(rsp);
+    }
+    //servlet没读完的消息体跳过, 才能看到下一个请求
+    if (!rsp->isClose() && m_isKeepalive && !session->discardBody()) {
+      session->flushResponses();
+      break;
+    }
+    if (rsp->isClose() || !m_isKeepalive || !session->hasBufferedRequest()) {
+      if (session->flushResponses() <= 0) {
+        break;
+      }
+    }
+    if (rsp->isClose()) {
+      break;
+    }
   } while (m_isKeepalive);
   session->close();
 }
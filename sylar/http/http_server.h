@@ -36,6 +36,13 @@ class HttpServer : public TcpServer {
    */
   void setServletDispatch(ServletDispatch::ptr v) { m_dispatch = v; }
 
+  /**
+   * @brief 是否支持HTTP/2(h2c prior knowledge和Upgrade: h2c)
+   */
+  bool isHttp2() const { return m_http2; }
+
+  void setHttp2(bool v) { m_http2 = v; }
+
  protected:
   virtual void handleClient(Socket::ptr client) override;
 
@@ -44,6 +51,8 @@ class HttpServer : public TcpServer {
   bool m_isKeepalive;
   /// Servlet分发器
   ServletDispatch::ptr m_dispatch;
+  /// 是否支持HTTP/2
+  bool m_http2 = true;
 };
 
 }  // namespace http
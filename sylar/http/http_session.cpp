@@ -1,4 +1,6 @@
 #include "http_session.h"
+#include <inttypes.h>
+#include <string.h>
 #include "http_parser.h"
 
 namespace sylar {
@@ -7,65 +9,452 @@ namespace http {
 HttpSession::HttpSession(Socket::ptr sock, bool owner)
     : SocketStream(sock, owner) {}
 
-HttpRequest::ptr HttpSession::recvRequest() {
-  HttpRequestParser::ptr parser(new HttpRequestParser);
+/// HTTP/2客户端连接序言
+static const char s_http2_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+bool HttpSession::isHttp2Preface() {
+  size_t len = sizeof(s_http2_preface) - 1;
+  if (!m_buffer) {
+    m_bufferSize = HttpRequestParser::GetHttpRequestBufferSize();
+    m_buffer.reset(new char[m_bufferSize], [](char* ptr) { delete[] ptr; });
+    m_begin = m_end = 0;
+  }
+  while (true) {
+    //已经读到的部分对不上就不是, HTTP/1请求的第一个字节就能区分
+    size_t n = std::min(m_end - m_begin, len);
+    if (memcmp(m_buffer.get() + m_begin, s_http2_preface, n) != 0) {
+      return false;
+    }
+    if (n == len) {
+      return true;
+    }
+    compactBuffer();
+    int rt = read(m_buffer.get() + m_end, m_bufferSize - m_end);
+    if (rt <= 0) {
+      return false;
+    }
+    m_end += rt;
+  }
+}
+
+/**
+ * @brief 把[m_begin, m_end)的数据移到一块可以改写的缓存的开头
+ * @details 缓存还被请求引用时换一块新的, 已经发出去的视图不受影响
+ */
+void HttpSession::compactBuffer() {
+  size_t left = m_end - m_begin;
+  if (!m_buffer.unique()) {
+    std::shared_ptr<char> buffer(new char[m_bufferSize],
+                                 [](char* ptr) { delete[] ptr; });
+    memcpy(buffer.get(), m_buffer.get() + m_begin, left);
+    m_buffer.swap(buffer);
+  } else if (m_begin > 0 && left > 0) {
+    memmove(m_buffer.get(), m_buffer.get() + m_begin, left);
+  }
+  m_begin = 0;
+  m_end = left;
+}
+
+void HttpSession::flushAndClose() {
+  //流水线里前面请求的响应还在队列里, 先发出去
+  flushResponses();
+  close();
+}
+
+HttpRequest::ptr HttpSession::recvRequest(bool read_body) {
+  //上一个请求没读完的消息体先跳过
+  if (m_bodyMode != BODY_NONE && !discardBody()) {
+    flushAndClose();
+    return nullptr;
+  }
+  //先重置解析器, 释放上一个请求对缓存的引用
+  if (m_parser) {
+    m_parser->reset();
+  } else {
+    m_parser.reset(new HttpRequestParser);
+  }
+  HttpRequestParser::ptr parser = m_parser;
   uint64_t buff_size = HttpRequestParser::GetHttpRequestBufferSize();
-  std::shared_ptr<char> buffer(new char[buff_size],
-                               [](char* ptr) { delete[] ptr; });
-  char* data = buffer.get();
-  int offset = 0;
-  do {
-    int len = read(data + offset, buff_size - offset);
-    if (len <= 0) {
-      close();
-      return nullptr;
+  //上一个请求之后多读到的数据属于下一个请求(流水线)
+  size_t left = m_end - m_begin;
+  if (!m_buffer || !m_buffer.unique() || m_bufferSize != buff_size) {
+    //上一个请求还被持有时, 它引用的缓存不能覆盖; 扩大过的缓存在这里恢复
+    uint64_t size = std::max<uint64_t>(buff_size, left);
+    std::shared_ptr<char> buffer(new char[size],
+                                 [](char* ptr) { delete[] ptr; });
+    if (left > 0) {
+      memcpy(buffer.get(), m_buffer.get() + m_begin, left);
     }
-    len += offset;
-    size_t nparse = parser->execute(data, len);
+    m_buffer.swap(buffer);
+    m_bufferSize = size;
+    m_begin = 0;
+    m_end = left;
+  } else {
+    compactBuffer();
+  }
+  char* data = m_buffer.get();
+  size_t nparse = 0;
+  if (m_end > 0) {
+    nparse = parser->execute(data, m_end, 0);
     if (parser->hasError()) {
-      close();
+      flushAndClose();
+      return nullptr;
+    }
+  }
+  while (!parser->isFinished()) {
+    //头部不能超过buff_size
+    if (m_end >= buff_size) {
+      flushAndClose();
       return nullptr;
     }
-    offset = len - nparse;
-    if (offset == (int)buff_size) {
-      close();
+    int rt = read(data + m_end, buff_size - m_end);
+    if (rt <= 0) {
+      flushAndClose();
       return nullptr;
     }
-    if (parser->isFinished()) {
-      break;
+    m_end += rt;
+    nparse += parser->execute(data, m_end, nparse);
+    if (parser->hasError()) {
+      flushAndClose();
+      return nullptr;
     }
-  } while (true);
-  int64_t length = parser->getContentLenght();
-  if (length > 0) {
+  }
+  //nparse是头部的长度, 之后是消息体
+  m_begin = nparse;
+  HttpRequest::ptr req = parser->getData();
+  req->setBuffer(m_buffer);
+  StringView te = req->getHeaderView("transfer-encoding");
+  if (te.size() >= 7 &&
+      strncasecmp(te.data() + te.size() - 7, "chunked", 7) == 0) {
+    m_bodyMode = BODY_CHUNKED;
+    m_bodyLeft = 0;
+    m_chunkData = false;
+  } else {
+    m_bodyLeft = parser->getContentLenght();
+    m_bodyMode = m_bodyLeft > 0 ? BODY_LENGTH : BODY_NONE;
+  }
+  req->init();
+  if (read_body && !recvBody(req)) {
+    flushAndClose();
+    return nullptr;
+  }
+  return req;
+}
+
+bool HttpSession::recvBody(HttpRequest::ptr req) {
+  uint64_t max_size = HttpRequestParser::GetHttpRequestMaxBodySize();
+  if (m_bodyMode == BODY_CHUNKED) {
     std::string body;
-    body.resize(length);
-
-    int len = 0;
-    if (length >= offset) {
-      memcpy(&body[0], data, offset);
-      len = offset;
-    } else {
-      memcpy(&body[0], data, length);
-      len = length;
-    }
-    length -= offset;
-    if (length > 0) {
-      if (readFixSize(&body[len], length) <= 0) {
-        close();
-        return nullptr;
+    char buf[4096];
+    int64_t rt = 0;
+    while ((rt = readBody(buf, sizeof(buf))) > 0) {
+      if (body.size() + rt > max_size) {
+        return false;
       }
+      body.append(buf, rt);
+    }
+    if (rt < 0) {
+      return false;
+    }
+    req->setBody(body);
+    return true;
+  }
+  if (m_bodyMode != BODY_LENGTH) {
+    return true;
+  }
+  uint64_t length = m_bodyLeft;
+  if (length > max_size) {
+    return false;
+  }
+  if (m_begin + length > m_bufferSize) {
+    //消息体放不下, 头部先拷贝出来, 换一块放得下消息体的缓存
+    req->materialize();
+    size_t left = m_end - m_begin;
+    std::shared_ptr<char> buffer(new char[length],
+                                 [](char* ptr) { delete[] ptr; });
+    memcpy(buffer.get(), m_buffer.get() + m_begin, left);
+    m_buffer.swap(buffer);
+    m_bufferSize = length;
+    m_begin = 0;
+    m_end = left;
+    req->setBuffer(m_buffer);
+  }
+  char* data = m_buffer.get();
+  size_t total = m_begin + length;
+  if (m_end < total) {
+    if (readFixSize(data + m_end, total - m_end) <= 0) {
+      return false;
+    }
+    m_end = total;
+  }
+  req->setBodyView(StringView(data + m_begin, length));
+  m_begin = total;
+  m_bodyLeft = 0;
+  m_bodyMode = BODY_NONE;
+  return true;
+}
+
+bool HttpSession::readLine(StringView& line) {
+  while (true) {
+    char* data = m_buffer.get();
+    char* pos = (char*)memmem(data + m_begin, m_end - m_begin, "\r\n", 2);
+    if (pos) {
+      line = StringView(data + m_begin, pos - data - m_begin);
+      m_begin = pos - data + 2;
+      return true;
+    }
+    compactBuffer();
+    if (m_end == m_bufferSize) {
+      return false;
+    }
+    int rt = read(m_buffer.get() + m_end, m_bufferSize - m_end);
+    if (rt <= 0) {
+      return false;
+    }
+    m_end += rt;
+  }
+}
+
+int64_t HttpSession::readBody(void* buffer, size_t length) {
+  if (m_bodyMode == BODY_NONE) {
+    return 0;
+  }
+  if (m_bodyLeft == 0) {
+    if (m_bodyMode == BODY_LENGTH) {
+      m_bodyMode = BODY_NONE;
+      return 0;
+    }
+    //chunk: 长度(16进制)[;扩展]\r\n 数据\r\n ... 0\r\n 尾部\r\n
+    StringView line;
+    if (m_chunkData) {
+      if (!readLine(line) || !line.empty()) {
+        return -1;
+      }
+      m_chunkData = false;
+    }
+    if (!readLine(line) || line.empty() ||
+        !isxdigit((unsigned char)line[0])) {
+      return -1;
+    }
+    uint64_t size = strtoull(std::string(line.data(), line.size()).c_str(),
+                             nullptr, 16);
+    if (size == 0) {
+      do {
+        if (!readLine(line)) {
+          return -1;
+        }
+      } while (!line.empty());
+      m_bodyMode = BODY_NONE;
+      return 0;
+    }
+    m_bodyLeft = size;
+    m_chunkData = true;
+  }
+  size_t len = std::min<uint64_t>(length, m_bodyLeft);
+  int64_t rt = m_end - m_begin;
+  if (rt > 0) {
+    //先用缓存里已经读到的
+    rt = std::min<int64_t>(rt, len);
+    memcpy(buffer, m_buffer.get() + m_begin, rt);
+    m_begin += rt;
+  } else {
+    //缓存空了直接读到调用方的内存, 不经过缓存
+    rt = read(buffer, len);
+    if (rt <= 0) {
+      return rt == 0 ? -1 : rt;
     }
-    parser->getData()->setBody(body);
   }
-  parser->getData()->init();
-  return parser->getData();
+  m_bodyLeft -= rt;
+  return rt;
+}
+
+int64_t HttpSession::readRaw(void* buffer, size_t length) {
+  size_t left = m_end - m_begin;
+  if (left > 0) {
+    size_t len = std::min(left, length);
+    memcpy(buffer, m_buffer.get() + m_begin, len);
+    m_begin += len;
+    return len;
+  }
+  return read(buffer, length);
+}
+
+bool HttpSession::discardBody() {
+  char buf[4096];
+  int64_t rt = 0;
+  while ((rt = readBody(buf, sizeof(buf))) > 0) {
+  }
+  return rt == 0;
 }
 
+bool HttpSession::hasBufferedRequest() const {
+  //缓存里可能还是当前请求没读完的消息体
+  if (m_bodyMode != BODY_NONE || m_end <= m_begin) {
+    return false;
+  }
+  return memmem(m_buffer.get() + m_begin, m_end - m_begin, "\r\n\r\n", 4) !=
+         nullptr;
+}
+
+/// 头部缓存超过这个大小, 发送后释放
+static const size_t s_max_keep_scratch = 64 * 1024;
+
 int HttpSession::sendResponse(HttpResponse::ptr rsp) {
-  std::stringstream ss;
-  ss << *rsp;
-  std::string data = ss.str();
-  return writeFixSize(data.c_str(), data.size());
+  m_scratch.clear();
+  rsp->serializeHeader(m_scratch);
+  const std::string& body = rsp->getBody();
+  iovec iovs[2];
+  iovs[0].iov_base = &m_scratch[0];
+  iovs[0].iov_len = m_scratch.size();
+  iovs[1].iov_base = (void*)body.c_str();
+  iovs[1].iov_len = body.size();
+  int rt = writevFixSize(iovs, body.empty() ? 1 : 2);
+  if (m_scratch.capacity() > s_max_keep_scratch) {
+    std::string().swap(m_scratch);
+  }
+  return rt;
+}
+
+int HttpSession::sendResponses(const std::vector<HttpResponse::ptr>& rsps) {
+  //先把所有头部写进缓存, 缓存扩容会让指针失效, 只记录结束位置
+  m_scratch.clear();
+  m_iovs.resize(rsps.size() * 2);
+  for (size_t i = 0; i < rsps.size(); ++i) {
+    rsps[i]->serializeHeader(m_scratch);
+    m_iovs[i * 2].iov_len = m_scratch.size();
+  }
+  size_t count = 0;
+  size_t begin = 0;
+  for (size_t i = 0; i < rsps.size(); ++i) {
+    //count <= i * 2, 写入的位置不会覆盖后面还没读的结束位置
+    size_t end = m_iovs[i * 2].iov_len;
+    iovec& header = m_iovs[count++];
+    header.iov_base = &m_scratch[begin];
+    header.iov_len = end - begin;
+    begin = end;
+    const std::string& body = rsps[i]->getBody();
+    if (!body.empty()) {
+      iovec& iov = m_iovs[count++];
+      iov.iov_base = (void*)body.c_str();
+      iov.iov_len = body.size();
+    }
+  }
+  int rt = writevFixSize(&m_iovs[0], count);
+  if (m_scratch.capacity() > s_max_keep_scratch) {
+    std::string().swap(m_scratch);
+  }
+  return rt;
+}
+
+int HttpSession::sendResponseHeader(HttpResponse::ptr rsp, const void* data,
+                                    size_t length) {
+  if (!m_pending.empty()) {
+    int rt = flushResponses();
+    if (rt <= 0) {
+      return rt;
+    }
+  }
+  rsp->setStream(true);
+  bool has_length = !rsp->getHeader("content-length").empty();
+  //HTTP/1.0不支持chunked, 不知道长度时消息体以关闭连接结束
+  m_chunked = !has_length && rsp->getVersion() >= 0x11;
+  if (!m_chunked && !has_length) {
+    rsp->setClose(true);
+  }
+  m_streaming = true;
+  m_scratch.clear();
+  rsp->serializeHeader(m_scratch);
+  char head[24];
+  iovec iovs[4];
+  size_t count = 0;
+  iovs[count].iov_base = &m_scratch[0];
+  iovs[count++].iov_len = m_scratch.size();
+  if (length > 0) {
+    count += chunkHead(iovs + count, head, sizeof(head), length);
+    iovs[count].iov_base = (void*)data;
+    iovs[count++].iov_len = length;
+    count += chunkTail(iovs + count);
+  }
+  return writevFixSize(iovs, count);
+}
+
+size_t HttpSession::chunkHead(iovec* iov, char* buf, size_t size,
+                              uint64_t length) {
+  if (!m_chunked) {
+    return 0;
+  }
+  iov->iov_base = buf;
+  iov->iov_len = snprintf(buf, size, "%" PRIx64 "\r\n", length);
+  return 1;
+}
+
+size_t HttpSession::chunkTail(iovec* iov) {
+  if (!m_chunked) {
+    return 0;
+  }
+  iov->iov_base = (void*)"\r\n";
+  iov->iov_len = 2;
+  return 1;
+}
+
+int HttpSession::sendChunk(const void* data, size_t length) {
+  if (length == 0) {
+    //长度为0的chunk表示结束, 这里不能发
+    return 1;
+  }
+  char head[24];
+  iovec iovs[3];
+  size_t count = chunkHead(iovs, head, sizeof(head), length);
+  iovs[count].iov_base = (void*)data;
+  iovs[count++].iov_len = length;
+  count += chunkTail(iovs + count);
+  return writevFixSize(iovs, count);
+}
+
+int64_t HttpSession::sendFile(int fd, off_t offset, uint64_t length) {
+  if (length == 0) {
+    return 1;
+  }
+  char head[24];
+  iovec iov;
+  if (chunkHead(&iov, head, sizeof(head), length)) {
+    int rt = writevFixSize(&iov, 1);
+    if (rt <= 0) {
+      return rt;
+    }
+  }
+  int64_t rt = sendFileFixSize(fd, offset, length);
+  if (rt > 0 && chunkTail(&iov)) {
+    int n = writevFixSize(&iov, 1);
+    if (n <= 0) {
+      return n;
+    }
+  }
+  return rt;
+}
+
+int HttpSession::finishResponse() {
+  if (!m_streaming) {
+    return 1;
+  }
+  m_streaming = false;
+  if (!m_chunked) {
+    return 1;
+  }
+  return writeFixSize("0\r\n\r\n", 5);
+}
+
+void HttpSession::queueResponse(HttpResponse::ptr rsp) {
+  m_pending.push_back(rsp);
+}
+
+int HttpSession::flushResponses() {
+  if (m_pending.empty()) {
+    return 1;
+  }
+  int rt = sendResponses(m_pending);
+  m_pending.clear();
+  return rt;
 }
 
 }  // namespace http
@@ -2,6 +2,7 @@
 #define __SYLAR_HTTP_SESSION_H__
 
 #include "http.h"
+#include "http_parser.h"
 #include "sylar/streams/socket_stream.h"
 
 namespace sylar {
@@ -23,12 +24,170 @@ class HttpSession : public SocketStream {
    */
   HttpSession(Socket::ptr sock, bool owner = true);
 
+  /**
+   * @brief 连接是否以HTTP/2的连接序言开始(h2c prior knowledge)
+   * @details 读到的数据留在接收缓存里, 不是HTTP/2时recvRequest照常解析,
+   *          是HTTP/2时序言也还在缓存中, 由readRaw读出
+   */
+  bool isHttp2Preface();
+
   /**
    * @brief 接收HTTP请求
+   * @details 请求的路径/头部/消息体引用连接的接收缓存, 请求持有该缓存.
+   *          上一个请求已经释放时, 缓存和请求对象都会被复用.
+   *          上一个请求没有读完的消息体会被跳过
+   * @param[in] read_body 是否读取整个消息体(包括chunked), 为false时
+   *            只读头部, 消息体用readBody()边读边处理
+   */
+  HttpRequest::ptr recvRequest(bool read_body = true);
+
+  /**
+   * @brief 读取整个消息体放到请求里, 用于recvRequest(false)之后
+   * @details 超过http.request.max_body_size返回失败
+   */
+  bool recvBody(HttpRequest::ptr req);
+
+  /**
+   * @brief 流式读取当前请求的消息体, chunked已经解码
+   * @param[out] buffer 数据
+   * @param[in] length 最多读取的长度
+   * @return
+   *      @retval >0 读到的长度
+   *      @retval =0 消息体已经读完
+   *      @retval <0 出错或者连接被关闭
+   */
+  virtual int64_t readBody(void* buffer, size_t length);
+
+  /**
+   * @brief 跳过当前请求剩下的消息体
+   */
+  bool discardBody();
+
+  /**
+   * @brief 接收缓存中是否已经有下一个请求的完整头部(流水线请求)
    */
-  HttpRequest::ptr recvRequest();
+  bool hasBufferedRequest() const;
 
   int sendResponse(HttpResponse::ptr rsp);
+
+  /**
+   * @brief 按顺序发送多个响应, 合并成一次writev
+   * @return 同writevFixSize
+   */
+  int sendResponses(const std::vector<HttpResponse::ptr>& rsps);
+
+  /**
+   * @brief 开始流式发送响应, 发出状态行和头部
+   * @details 响应设置了Content-Length头部时消息体原样发送, 否则使用
+   *          Transfer-Encoding: chunked. 消息体用sendChunk()/sendFile()发送,
+   *          最后调用finishResponse(). 排队中的响应会先发出去
+   * @param[in] data 和头部一起发送的第一段消息体, 可以为nullptr
+   * @param[in] length data的长度
+   */
+  virtual int sendResponseHeader(HttpResponse::ptr rsp,
+                                 const void* data = nullptr,
+                                 size_t length = 0);
+
+  /**
+   * @brief 用sendfile发送文件的一段作为消息体
+   * @return 同sendFileFixSize, length为0时返回1
+   */
+  virtual int64_t sendFile(int fd, off_t offset, uint64_t length);
+
+  /**
+   * @brief 发送一段消息体
+   * @return 同writevFixSize, length为0时不发送, 返回1
+   */
+  virtual int sendChunk(const void* data, size_t length);
+
+  /**
+   * @brief 结束流式响应, 发送最后的空chunk
+   * @return 同writeFixSize, 不需要发送时返回1
+   */
+  virtual int finishResponse();
+
+  /**
+   * @brief 是否正在流式发送响应
+   */
+  bool isStreaming() const { return m_streaming; }
+
+  /**
+   * @brief 把响应加入发送队列, 和后面的响应合并发送
+   */
+  void queueResponse(HttpResponse::ptr rsp);
+
+  /**
+   * @brief 发送队列中的响应
+   * @return 同writevFixSize, 队列为空时返回1
+   */
+  int flushResponses();
+
+  /**
+   * @brief 读取连接上的原始数据, 先取接收缓存中剩下的
+   * @details 协议升级(比如websocket, h2c)之后用来代替read, 握手请求之后
+   *          多读到的数据不会丢失
+   */
+  int64_t readRaw(void* buffer, size_t length);
+
+ private:
+  void compactBuffer();
+
+  /**
+   * @brief 读请求出错时关闭连接, 关闭前发出已经排队的响应
+   */
+  void flushAndClose();
+
+  /**
+   * @brief 流式响应使用chunked时填充chunk头部
+   * @return 填充的数据块个数
+   */
+  size_t chunkHead(iovec* iov, char* buf, size_t size, uint64_t length);
+
+  /**
+   * @brief 流式响应使用chunked时填充chunk结尾的\r\n
+   * @return 填充的数据块个数
+   */
+  size_t chunkTail(iovec* iov);
+
+  bool readLine(StringView& line);
+
+ private:
+  /// 消息体的读取方式
+  enum BodyMode {
+    /// 没有消息体或者已经读完
+    BODY_NONE,
+    /// Content-Length
+    BODY_LENGTH,
+    /// Transfer-Encoding: chunked
+    BODY_CHUNKED
+  };
+
+  /// 请求解析器, 连接上的请求复用
+  HttpRequestParser::ptr m_parser;
+  /// 接收缓存
+  std::shared_ptr<char> m_buffer;
+  /// 接收缓存大小
+  uint64_t m_bufferSize = 0;
+  /// 缓存中未处理数据的起始位置
+  size_t m_begin = 0;
+  /// 缓存中已读数据的结束位置
+  size_t m_end = 0;
+  /// 序列化响应头部的缓存, 连接上的响应复用
+  std::string m_scratch;
+  /// 发送用的数据块
+  std::vector<iovec> m_iovs;
+  /// 当前请求消息体的读取方式
+  BodyMode m_bodyMode = BODY_NONE;
+  /// 消息体(或当前chunk)剩余长度
+  uint64_t m_bodyLeft = 0;
+  /// 是否在chunk数据中, 之后还有\r\n
+  bool m_chunkData = false;
+  /// 是否正在流式发送响应
+  bool m_streaming = false;
+  /// 流式响应是否使用chunked
+  bool m_chunked = false;
+  /// 等待合并发送的响应
+  std::vector<HttpResponse::ptr> m_pending;
 };
 
 }  // namespace http
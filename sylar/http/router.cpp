@@ -0,0 +1,163 @@
+#include "router.h"
+#include <fnmatch.h>
+#include <string.h>
+
+namespace sylar {
+namespace http {
+
+RadixRouter::RadixRouter() : m_root(new Node) {}
+
+bool RadixRouter::add(const std::string& pattern, ServletPtr slt) {
+  return insert(pattern, slt, true);
+}
+
+bool RadixRouter::addGlob(const std::string& pattern, ServletPtr slt) {
+  //没有通配符, 或者只有末尾一个'*'
+  size_t pos = pattern.find_first_of("*?[");
+  if (pos == std::string::npos ||
+      (pos == pattern.size() - 1 && pattern[pos] == '*')) {
+    return insert(pattern, slt, false);
+  }
+  for (auto& i : m_globs) {
+    if (i.first == pattern) {
+      i.second = slt;
+      return true;
+    }
+  }
+  m_globs.push_back(std::make_pair(pattern, slt));
+  return true;
+}
+
+bool RadixRouter::insert(const std::string& pattern, ServletPtr slt,
+                         bool params) {
+  Node* node = m_root.get();
+  size_t len = pattern.size();
+  //pattern[i]是否是参数的开始
+  auto is_param = [&pattern, params](size_t i) {
+    return params && pattern[i] == ':' && (i == 0 || pattern[i - 1] == '/');
+  };
+  size_t i = 0;
+  while (i < len) {
+    if (is_param(i)) {
+      size_t j = pattern.find('/', i);
+      if (j == std::string::npos) {
+        j = len;
+      }
+      std::string name = pattern.substr(i + 1, j - i - 1);
+      if (!node->param) {
+        node->param.reset(new Node);
+        node->paramName = name;
+      } else if (node->paramName != name) {
+        return false;
+      }
+      node = node->param.get();
+      i = j;
+      continue;
+    }
+    if (pattern[i] == '*' && i == len - 1) {
+      node->wildcard = slt;
+      return true;
+    }
+    //普通片段到下一个参数或者末尾通配为止
+    size_t j = i + 1;
+    while (j < len && !is_param(j) && !(pattern[j] == '*' && j == len - 1)) {
+      ++j;
+    }
+    const char* str = pattern.c_str() + i;
+    size_t size = j - i;
+    size_t idx = node->indices.find(*str);
+    if (idx == std::string::npos) {
+      NodePtr child(new Node);
+      child->prefix.assign(str, size);
+      node->indices += *str;
+      node->children.push_back(child);
+      node = child.get();
+      i = j;
+      continue;
+    }
+    NodePtr child = node->children[idx];
+    size_t common = 0;
+    while (common < size && common < child->prefix.size() &&
+           child->prefix[common] == str[common]) {
+      ++common;
+    }
+    if (common < child->prefix.size()) {
+      //只有前面一部分相同, 把子节点拆成公共部分和剩下的部分
+      NodePtr mid(new Node);
+      mid->prefix = child->prefix.substr(0, common);
+      child->prefix.erase(0, common);
+      mid->indices += child->prefix[0];
+      mid->children.push_back(child);
+      node->children[idx] = mid;
+      child = mid;
+    }
+    node = child.get();
+    i += common;
+  }
+  node->servlet = slt;
+  return true;
+}
+
+RadixRouter::ServletPtr RadixRouter::Match(const Node* node, const char* path,
+                                           const char* end, Params* params) {
+  if (path == end && node->servlet) {
+    return node->servlet;
+  }
+  if (path < end) {
+    size_t idx = node->indices.find(*path);
+    if (idx != std::string::npos) {
+      const Node* child = node->children[idx].get();
+      size_t size = child->prefix.size();
+      if ((size_t)(end - path) >= size &&
+          memcmp(path, child->prefix.c_str(), size) == 0) {
+        ServletPtr rt = Match(child, path + size, end, params);
+        if (rt) {
+          return rt;
+        }
+      }
+    }
+    if (node->param && *path != '/') {
+      const char* seg = (const char*)memchr(path, '/', end - path);
+      if (!seg) {
+        seg = end;
+      }
+      size_t pos = params ? params->size() : 0;
+      ServletPtr rt = Match(node->param.get(), seg, end, params);
+      if (rt) {
+        //更深的参数已经加在后面, 插到前面保持路径中的顺序
+        if (params) {
+          params->insert(params->begin() + pos,
+                         std::make_pair(node->paramName,
+                                        std::string(path, seg - path)));
+        }
+        return rt;
+      }
+    }
+  }
+  if (node->wildcard) {
+    if (params) {
+      params->push_back(std::make_pair("*", std::string(path, end - path)));
+    }
+    return node->wildcard;
+  }
+  return nullptr;
+}
+
+RadixRouter::ServletPtr RadixRouter::match(const char* path, size_t size,
+                                           Params* params) const {
+  ServletPtr rt = Match(m_root.get(), path, path + size, params);
+  if (rt || m_globs.empty()) {
+    return rt;
+  }
+  //fnmatch需要以'\0'结尾的字符串
+  std::string str(path, size);
+  for (auto& i : m_globs) {
+    if (!fnmatch(i.first.c_str(), str.c_str(), 0)) {
+      return i.second;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace http
+}  // namespace sylar
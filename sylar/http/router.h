@@ -0,0 +1,104 @@
+/**
+ * @file router.h
+ * @brief 压缩前缀树路由
+ */
+#ifndef __SYLAR_HTTP_ROUTER_H__
+#define __SYLAR_HTTP_ROUTER_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sylar {
+namespace http {
+
+class Servlet;
+
+/**
+ * @brief 压缩前缀树(radix trie)路由
+ * @details 支持三种写法:
+ *          - 普通路径 /user/list, 精确匹配
+ *          - 参数 /user/:id/info, ":id"匹配'/'之间的一段, 记录为参数id
+ *          - 末尾通配 以'*'结尾, 匹配剩下的全部路径(可以为空), 记录为参数"*"
+ *          同一个位置的优先级: 普通 > 参数 > 通配, 匹配失败会回退.
+ *          不能放进树里的glob(中间有通配符的)按添加顺序用fnmatch兜底.
+ *          构建完成后只读, 多个线程可以不加锁同时查找
+ */
+class RadixRouter {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<RadixRouter> ptr;
+  /// 路由的目标
+  typedef std::shared_ptr<Servlet> ServletPtr;
+  /// 匹配到的参数, 按路径中出现的顺序
+  typedef std::vector<std::pair<std::string, std::string>> Params;
+
+  RadixRouter();
+
+  /**
+   * @brief 添加路由, 已经存在的同名路由会被替换
+   * @param[in] pattern 路由, 支持参数和末尾通配
+   * @param[in] slt 目标
+   * @return 同一位置的参数名和已有的不一致时返回false
+   */
+  bool add(const std::string& pattern, ServletPtr slt);
+
+  /**
+   * @brief 添加glob路由, ':'没有特殊含义
+   * @details 只有末尾一个'*'的放进树里, 其他的用fnmatch
+   */
+  bool addGlob(const std::string& pattern, ServletPtr slt);
+
+  /**
+   * @brief 查找路径对应的目标
+   * @param[in] path 请求路径
+   * @param[out] params 匹配到的参数, 可以为nullptr
+   * @return 没有匹配返回nullptr
+   */
+  ServletPtr match(const char* path, size_t size,
+                   Params* params = nullptr) const;
+
+  ServletPtr match(const std::string& path, Params* params = nullptr) const {
+    return match(path.c_str(), path.size(), params);
+  }
+
+ private:
+  struct Node;
+  typedef std::shared_ptr<Node> NodePtr;
+
+  /**
+   * @brief 树的节点, 节点表示的路径 = 祖先的prefix + 自己的prefix
+   */
+  struct Node {
+    /// 普通字符片段, 参数节点为空
+    std::string prefix;
+    /// 子节点prefix的首字符, 和children一一对应
+    std::string indices;
+    /// 普通子节点
+    std::vector<NodePtr> children;
+    /// 参数子节点
+    NodePtr param;
+    /// 参数名
+    std::string paramName;
+    /// 末尾通配的目标
+    ServletPtr wildcard;
+    /// 路径正好在这里结束的目标
+    ServletPtr servlet;
+  };
+
+  bool insert(const std::string& pattern, ServletPtr slt, bool params);
+
+  static ServletPtr Match(const Node* node, const char* path, const char* end,
+                          Params* params);
+
+ private:
+  /// 根节点, prefix为空
+  NodePtr m_root;
+  /// 不能放进树里的glob
+  std::vector<std::pair<std::string, ServletPtr>> m_globs;
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
@@ -1,9 +1,11 @@
 #include "servlet.h"
-#include <fnmatch.h>
+#include "sylar/log.h"
 
 namespace sylar {
 namespace http {
 
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
+
 FunctionServlet::FunctionServlet(callback cb)
     : Servlet("FunctionServlet"), m_cb(cb) {}
 
@@ -15,27 +17,35 @@ int32_t FunctionServlet::handle(sylar::http::HttpRequest::ptr request,
 
 ServletDispatch::ServletDispatch() : Servlet("ServletDispatch") {
   m_default.reset(new NotFounfServlet("sylar_lzh/1.0.0"));
+  m_router.reset(new RadixRouter);
 }
 
 int32_t ServletDispatch::handle(sylar::http::HttpRequest::ptr request,
                                 sylar::http::HttpResponse::ptr response,
                                 sylar::http::HttpSession::ptr session) {
-  auto slt = getMatchServlet(request->getPath());
+  auto slt = getMatchServlet(request);
   if (slt) {
     slt->handle(request, response, session);
   }
   return 0;
 }
 
+bool ServletDispatch::isStreamRequest(HttpRequest::ptr req) {
+  auto slt = getMatchServlet(req);
+  return slt && slt->isStreamBody();
+}
+
 void ServletDispatch::addServlet(const std::string& uri, Servlet::ptr slt) {
   RWMutexType::WriteLock lock(m_mutex);
   m_datas[uri] = slt;
+  rebuild();
 }
 
 void ServletDispatch::addServlet(const std::string& uri,
                                  FunctionServlet::callback cb) {
   RWMutexType::WriteLock lock(m_mutex);
   m_datas[uri].reset(new FunctionServlet(cb));
+  rebuild();
 }
 
 void ServletDispatch::addGlobServlet(const std::string& uri, Servlet::ptr slt) {
@@ -47,6 +57,7 @@ void ServletDispatch::addGlobServlet(const std::string& uri, Servlet::ptr slt) {
     }
   }
   m_globs.push_back(std::make_pair(uri, slt));
+  rebuild();
 }
 
 void ServletDispatch::addGlobServlet(const std::string& uri,
@@ -55,6 +66,12 @@ void ServletDispatch::addGlobServlet(const std::string& uri,
 }
 
 void ServletDispatch::delServlet(const std::string& uri) {
+  RWMutexType::WriteLock lock(m_mutex);
+  m_datas.erase(uri);
+  rebuild();
+}
+
+void ServletDispatch::delGlobServlet(const std::string& uri) {
   RWMutexType::WriteLock lock(m_mutex);
   for (auto it = m_globs.begin(); it != m_globs.end(); ++it) {
     if (it->first == uri) {
@@ -62,9 +79,21 @@ void ServletDispatch::delServlet(const std::string& uri) {
       break;
     }
   }
+  rebuild();
 }
 
-void ServletDispatch::delGlobServlet(const std::string& uri) {}
+void ServletDispatch::rebuild() {
+  RadixRouter::ptr router(new RadixRouter);
+  for (auto& i : m_datas) {
+    if (!router->add(i.first, i.second)) {
+      SYLAR_LOG_ERROR(g_logger) << "servlet route conflict: " << i.first;
+    }
+  }
+  for (auto& i : m_globs) {
+    router->addGlob(i.first, i.second);
+  }
+  std::atomic_store(&m_router, router);
+}
 
 Servlet::ptr ServletDispatch::getServlet(const std::string& uri) {
   RWMutexType::ReadLock lock(m_mutex);
@@ -82,18 +111,31 @@ Servlet::ptr ServletDispatch::getGlobServlet(const std::string& uri) {
   return nullptr;
 }
 
-Servlet::ptr ServletDispatch::getMatchServlet(const std::string& uri) {
-  RWMutexType::ReadLock lock(m_mutex);
-  auto mit = m_datas.find(uri);
-  if (mit != m_datas.end()) {
-    return mit->second;
+Servlet::ptr ServletDispatch::getMatchServlet(const std::string& uri,
+                                              RadixRouter::Params* params) {
+  RadixRouter::ptr router = std::atomic_load(&m_router);
+  Servlet::ptr slt = router->match(uri, params);
+  return slt ? slt : m_default;
+}
+
+Servlet::ptr ServletDispatch::getMatchServlet(HttpRequest::ptr req) {
+  //isStreamRequest和handle都要查, 同一个请求只查一次
+  Servlet::ptr slt = req->getServlet(this);
+  if (slt) {
+    return slt;
   }
-  for (auto it = m_globs.begin(); it != m_globs.end(); ++it) {
-    if (!fnmatch(it->first.c_str(), uri.c_str(), 0)) {
-      return it->second;
-    }
+  RadixRouter::Params params;
+  StringView path = req->getPathView();
+  RadixRouter::ptr router = std::atomic_load(&m_router);
+  slt = router->match(path.data(), path.size(), &params);
+  for (auto& i : params) {
+    req->setParam(i.first, i.second);
+  }
+  if (!slt) {
+    slt = m_default;
   }
-  return m_default;
+  req->setServlet(this, slt);
+  return slt;
 }
 
 NotFounfServlet::NotFounfServlet(const std::string& name)
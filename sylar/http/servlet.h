@@ -7,6 +7,7 @@
 #include <unordered_map>
 #include <vector>
 #include "http_session.h"
+#include "router.h"
 #include "sylar/mutex.h"
 
 namespace sylar {
@@ -47,9 +48,23 @@ class Servlet {
    */
   const std::string& getName() const { return m_name; }
 
+  /**
+   * @brief 是否自己流式读取请求消息体
+   * @details 为true时HttpServer只读请求头部, handle里用
+   *          HttpSession::readBody()读取消息体, 没读完的部分之后会被跳过
+   */
+  bool isStreamBody() const { return m_streamBody; }
+
+  /**
+   * @brief 设置是否自己流式读取请求消息体
+   */
+  void setStreamBody(bool v) { m_streamBody = v; }
+
  protected:
   /// 名称
   std::string m_name;
+  /// 是否自己流式读取请求消息体
+  bool m_streamBody = false;
 };
 
 class FunctionServlet : public Servlet {
@@ -124,6 +139,13 @@ class ServletDispatch : public Servlet {
                          sylar::http::HttpResponse::ptr response,
                          sylar::http::HttpSession::ptr session) override;
 
+  /**
+   * @brief 请求会不会由流式读取消息体的servlet处理
+   * @details 服务器在调用handle之前用它决定是否先读完消息体,
+   *          重写了handle的子类要让它和handle的分发保持一致
+   */
+  virtual bool isStreamRequest(HttpRequest::ptr req);
+
   void addServlet(const std::string& uri, Servlet::ptr slt);
 
   void addServlet(const std::string& uri, FunctionServlet::callback cb);
@@ -146,13 +168,29 @@ class ServletDispatch : public Servlet {
 
   /**
    * @brief 通过uri获取servlet
+   * @details 查找使用路由快照, 不加锁
    * @param uri uri
-   * @return 优先精准匹配，其次模糊匹配，最后返回默认值
+   * @param params 匹配到的路径参数, 可以为nullptr
+   * @return 优先精准匹配, 其次参数, 再次末尾通配, 最后按顺序fnmatch,
+   *         都没有匹配返回默认值
+   */
+  Servlet::ptr getMatchServlet(const std::string& uri,
+                               RadixRouter::Params* params = nullptr);
+
+  /**
+   * @brief 获取请求对应的servlet, 路径参数设置到请求的参数中
+   * @details 结果记在请求上, 之后对同一个请求直接返回
+   */
+  Servlet::ptr getMatchServlet(HttpRequest::ptr req);
+
+ private:
+  /**
+   * @brief 用m_datas和m_globs重新生成路由快照, 需要持有写锁
    */
-  Servlet::ptr getMatchServlet(const std::string& uri);
+  void rebuild();
 
  private:
-  /// 读写互斥量
+  /// 读写互斥量, 只保护修改
   RWMutexType m_mutex;
   /// 精准匹配servlet MAP
   /// uri(/sylar/xxx) -> servlet
@@ -162,6 +200,8 @@ class ServletDispatch : public Servlet {
   std::vector<std::pair<std::string, Servlet::ptr>> m_globs;
   /// 默认的servlet，所有路径都没匹配到时使用
   Servlet::ptr m_default;
+  /// 路由快照, 修改时整个替换, 用std::atomic_load/atomic_store访问
+  RadixRouter::ptr m_router;
 };
 
 /**
@@ -0,0 +1,455 @@
+#include "static_file_servlet.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <list>
+#include <unordered_map>
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/singleton.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
+
+static sylar::ConfigVar<uint64_t>::ptr g_static_file_cache_size =
+    sylar::Config::Lookup("http.static_file.cache_size",
+                          (uint64_t)(64 * 1024 * 1024),
+                          "static file memory cache size");
+
+static sylar::ConfigVar<uint64_t>::ptr g_static_file_cache_file_size =
+    sylar::Config::Lookup("http.static_file.cache_file_size",
+                          (uint64_t)(64 * 1024),
+                          "static files not larger than this are cached");
+
+namespace {
+/**
+ * @brief 小文件的内存缓存, 总大小超过http.static_file.cache_size时按LRU淘汰
+ * @details 内容读一次放在内存里, 不用mmap, 文件被截断时不会SIGBUS
+ */
+class StaticFileCache {
+ public:
+  typedef std::shared_ptr<const std::string> Data;
+  typedef sylar::Mutex MutexType;
+
+  /**
+   * @brief 返回文件内容, 没有缓存或者文件已经变化时重新读取
+   * @param[in] st 刚刚stat得到的文件信息
+   * @return 读取失败返回nullptr
+   */
+  Data get(const std::string& path, const struct stat& st) {
+    {
+      MutexType::Lock lock(m_mutex);
+      auto it = m_entries.find(path);
+      if (it != m_entries.end()) {
+        Entry& e = it->second;
+        if (e.size == st.st_size && e.ino == st.st_ino &&
+            e.mtime.tv_sec == st.st_mtim.tv_sec &&
+            e.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+          m_lru.splice(m_lru.begin(), m_lru, e.lru);
+          return e.data;
+        }
+        erase(it);
+      }
+    }
+    //读文件不持有锁
+    Data data = load(path, st.st_size);
+    if (!data) {
+      return nullptr;
+    }
+    uint64_t capacity = g_static_file_cache_size->getValue();
+    MutexType::Lock lock(m_mutex);
+    auto it = m_entries.find(path);
+    if (it != m_entries.end()) {
+      erase(it);
+    }
+    m_lru.push_front(path);
+    Entry& e = m_entries[path];
+    e.data = data;
+    e.size = st.st_size;
+    e.ino = st.st_ino;
+    e.mtime = st.st_mtim;
+    e.lru = m_lru.begin();
+    m_total += data->size();
+    while (m_total > capacity && !m_lru.empty()) {
+      erase(m_entries.find(m_lru.back()));
+    }
+    return data;
+  }
+
+ private:
+  struct Entry {
+    /// 文件内容
+    Data data;
+    /// 读取时的修改时间
+    struct timespec mtime;
+    /// 读取时的大小
+    off_t size;
+    /// 读取时的inode
+    ino_t ino;
+    /// 在m_lru中的位置
+    std::list<std::string>::iterator lru;
+  };
+
+  void erase(std::unordered_map<std::string, Entry>::iterator it) {
+    m_total -= it->second.data->size();
+    m_lru.erase(it->second.lru);
+    m_entries.erase(it);
+  }
+
+  static Data load(const std::string& path, off_t size) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return nullptr;
+    }
+    std::shared_ptr<std::string> data(new std::string(size, '\0'));
+    off_t offset = 0;
+    while (offset < size) {
+      ssize_t n = pread(fd, &(*data)[offset], size - offset, offset);
+      if (n <= 0) {
+        break;
+      }
+      offset += n;
+    }
+    ::close(fd);
+    //文件正在被修改, 这次不缓存
+    return offset == size ? data : nullptr;
+  }
+
+ private:
+  MutexType m_mutex;
+  /// 最近使用的在前面
+  std::list<std::string> m_lru;
+  std::unordered_map<std::string, Entry> m_entries;
+  /// 缓存内容的总大小
+  uint64_t m_total = 0;
+};
+
+typedef sylar::Singleton<StaticFileCache> StaticFileCacheMgr;
+
+/**
+ * @brief 解码%XX
+ */
+bool UrlDecode(const std::string& str, std::string& out) {
+  out.reserve(str.size());
+  for (size_t i = 0; i < str.size(); ++i) {
+    if (str[i] != '%') {
+      out += str[i];
+      continue;
+    }
+    if (i + 2 >= str.size() || !isxdigit((unsigned char)str[i + 1]) ||
+        !isxdigit((unsigned char)str[i + 2])) {
+      return false;
+    }
+    char c = (char)strtol(str.substr(i + 1, 2).c_str(), nullptr, 16);
+    if (c == '\0') {
+      return false;
+    }
+    out += c;
+    i += 2;
+  }
+  return true;
+}
+
+/**
+ * @brief 逗号分隔的ETag列表中是否有etag, 按弱比较(忽略W/)
+ */
+bool MatchETag(const std::string& list, const std::string& etag) {
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    size_t b = list.find_first_not_of(" \t", pos);
+    size_t e = list.find_last_not_of(" \t", end - 1);
+    if (b < end && e != std::string::npos && e >= b) {
+      std::string tag = list.substr(b, e - b + 1);
+      if (tag == "*") {
+        return true;
+      }
+      if (tag.compare(0, 2, "W/") == 0) {
+        tag.erase(0, 2);
+      }
+      if (tag == etag) {
+        return true;
+      }
+    }
+    pos = end + 1;
+  }
+  return false;
+}
+}  // namespace
+
+StaticFileServlet::StaticFileServlet(const std::string& prefix,
+                                     const std::string& root)
+    : Servlet("StaticFileServlet"), m_prefix(prefix), m_root(root) {
+  while (!m_root.empty() && m_root.back() == '/') {
+    m_root.pop_back();
+  }
+}
+
+std::string StaticFileServlet::MakeETag(const struct stat& st) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "\"%" PRIx64 "-%" PRIx64 "\"",
+           (uint64_t)st.st_size,
+           (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec);
+  return buf;
+}
+
+std::string StaticFileServlet::HttpDate(time_t t) {
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  char buf[64];
+  strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return buf;
+}
+
+time_t StaticFileServlet::ParseHttpDate(const std::string& str) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  const char* end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if (!end || *end) {
+    return -1;
+  }
+  return timegm(&tm);
+}
+
+int StaticFileServlet::ParseRange(const std::string& range, uint64_t size,
+                                  uint64_t& begin, uint64_t& end) {
+  if (range.compare(0, 6, "bytes=") != 0 ||
+      range.find(',') != std::string::npos) {
+    return 0;
+  }
+  std::string spec = range.substr(6);
+  size_t dash = spec.find('-');
+  if (dash == std::string::npos ||
+      spec.find_first_not_of("0123456789-") != std::string::npos ||
+      spec.find('-', dash + 1) != std::string::npos) {
+    return 0;
+  }
+  std::string first = spec.substr(0, dash);
+  std::string last = spec.substr(dash + 1);
+  if (first.empty()) {
+    //bytes=-n, 最后n个字节
+    if (last.empty()) {
+      return 0;
+    }
+    uint64_t n = strtoull(last.c_str(), nullptr, 10);
+    if (n == 0 || size == 0) {
+      return -1;
+    }
+    begin = n >= size ? 0 : size - n;
+    end = size;
+    return 1;
+  }
+  begin = strtoull(first.c_str(), nullptr, 10);
+  if (last.empty()) {
+    end = size;
+  } else {
+    uint64_t l = strtoull(last.c_str(), nullptr, 10);
+    if (l < begin) {
+      return 0;
+    }
+    end = std::min(l + 1, size);
+  }
+  if (begin >= size) {
+    return -1;
+  }
+  return 1;
+}
+
+const char* StaticFileServlet::GetContentType(const std::string& path) {
+  static const std::unordered_map<std::string, const char*> s_types = {
+      {"html", "text/html; charset=utf-8"},
+      {"htm", "text/html; charset=utf-8"},
+      {"css", "text/css; charset=utf-8"},
+      {"js", "application/javascript; charset=utf-8"},
+      {"json", "application/json"},
+      {"txt", "text/plain; charset=utf-8"},
+      {"xml", "application/xml"},
+      {"png", "image/png"},
+      {"jpg", "image/jpeg"},
+      {"jpeg", "image/jpeg"},
+      {"gif", "image/gif"},
+      {"svg", "image/svg+xml"},
+      {"ico", "image/x-icon"},
+      {"webp", "image/webp"},
+      {"wasm", "application/wasm"},
+      {"pdf", "application/pdf"},
+      {"mp4", "video/mp4"},
+      {"woff", "font/woff"},
+      {"woff2", "font/woff2"},
+  };
+  size_t pos = path.rfind('.');
+  if (pos != std::string::npos && path.find('/', pos) == std::string::npos) {
+    std::string ext = path.substr(pos + 1);
+    for (auto& c : ext) {
+      c = tolower(c);
+    }
+    auto it = s_types.find(ext);
+    if (it != s_types.end()) {
+      return it->second;
+    }
+  }
+  return "application/octet-stream";
+}
+
+bool StaticFileServlet::resolvePath(const std::string& uri,
+                                    std::string& path) const {
+  if (uri.compare(0, m_prefix.size(), m_prefix) != 0) {
+    return false;
+  }
+  std::string rel;
+  if (!UrlDecode(uri.substr(m_prefix.size()), rel)) {
+    return false;
+  }
+  //逐段检查, 不允许..跳出目录
+  size_t pos = 0;
+  while (pos <= rel.size()) {
+    size_t end = rel.find('/', pos);
+    if (end == std::string::npos) {
+      end = rel.size();
+    }
+    if (rel.compare(pos, end - pos, "..") == 0) {
+      return false;
+    }
+    pos = end + 1;
+  }
+  path = m_root;
+  if (rel.empty() || rel[0] != '/') {
+    path += '/';
+  }
+  path += rel;
+  return true;
+}
+
+bool StaticFileServlet::isNotModified(HttpRequest::ptr req,
+                                      const std::string& etag,
+                                      time_t mtime) const {
+  std::string inm = req->getHeader("if-none-match");
+  if (!inm.empty()) {
+    return MatchETag(inm, etag);
+  }
+  std::string ims = req->getHeader("if-modified-since");
+  if (!ims.empty()) {
+    time_t t = ParseHttpDate(ims);
+    return t != -1 && mtime <= t;
+  }
+  return false;
+}
+
+int32_t StaticFileServlet::handle(sylar::http::HttpRequest::ptr request,
+                                  sylar::http::HttpResponse::ptr response,
+                                  sylar::http::HttpSession::ptr session) {
+  HttpMethod method = request->getMethod();
+  if (method != HttpMethod::GET && method != HttpMethod::HEAD) {
+    response->setStatus(HttpStatus::METHOD_NOT_ALLOWED);
+    response->setHeader("Allow", "GET, HEAD");
+    return 0;
+  }
+  std::string path;
+  struct stat st;
+  if (!resolvePath(request->getPath(), path) || stat(path.c_str(), &st)) {
+    response->setStatus(HttpStatus::NOT_FOUND);
+    return 0;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    path += path.back() == '/' ? "index.html" : "/index.html";
+    if (stat(path.c_str(), &st)) {
+      response->setStatus(HttpStatus::NOT_FOUND);
+      return 0;
+    }
+  }
+  if (!S_ISREG(st.st_mode)) {
+    response->setStatus(HttpStatus::NOT_FOUND);
+    return 0;
+  }
+  response->setHeader("Content-Type", GetContentType(path));
+
+  //有.gz文件时选择哪个版本取决于Accept-Encoding
+  struct stat gzst;
+  if (m_gzip && !stat((path + ".gz").c_str(), &gzst) && S_ISREG(gzst.st_mode)) {
+    response->setHeader("Vary", "Accept-Encoding");
+    if (request->getHeader("accept-encoding").find("gzip") !=
+        std::string::npos) {
+      path += ".gz";
+      st = gzst;
+      response->setHeader("Content-Encoding", "gzip");
+    }
+  }
+
+  std::string etag = MakeETag(st);
+  response->setHeader("ETag", etag);
+  response->setHeader("Last-Modified", HttpDate(st.st_mtime));
+  response->setHeader("Accept-Ranges", "bytes");
+  if (isNotModified(request, etag, st.st_mtime)) {
+    response->setStatus(HttpStatus::NOT_MODIFIED);
+    return 0;
+  }
+
+  uint64_t size = st.st_size;
+  uint64_t begin = 0;
+  uint64_t end = size;
+  std::string range = request->getHeader("range");
+  std::string if_range = request->getHeader("if-range");
+  //If-Range不匹配时发送整个文件
+  if (!range.empty() &&
+      (if_range.empty() || if_range == etag ||
+       ParseHttpDate(if_range) == st.st_mtime)) {
+    int rt = ParseRange(range, size, begin, end);
+    if (rt < 0) {
+      response->setStatus(HttpStatus::RANGE_NOT_SATISFIABLE);
+      response->setHeader("Content-Range", "bytes */" + std::to_string(size));
+      return 0;
+    }
+    if (rt > 0) {
+      response->setStatus(HttpStatus::PARTIAL_CONTENT);
+      response->setHeader("Content-Range",
+                          "bytes " + std::to_string(begin) + "-" +
+                              std::to_string(end - 1) + "/" +
+                              std::to_string(size));
+    }
+  }
+  uint64_t length = end - begin;
+  response->setHeader("Content-Length", std::to_string(length));
+  if (method == HttpMethod::HEAD) {
+    if (session->sendResponseHeader(response) <= 0) {
+      response->setClose(true);
+    }
+    return 0;
+  }
+
+  if (size <= g_static_file_cache_file_size->getValue()) {
+    auto data = StaticFileCacheMgr::GetInstance()->get(path, st);
+    if (data) {
+      if (session->sendResponseHeader(response, data->c_str() + begin,
+                                      length) <= 0) {
+        response->setClose(true);
+      }
+      return 0;
+    }
+  }
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    SYLAR_LOG_WARN(g_logger) << "open " << path << " errno=" << errno
+                             << " errstr=" << strerror(errno);
+    response->setStatus(HttpStatus::NOT_FOUND);
+    response->delHeader("Content-Length");
+    return 0;
+  }
+  //文件被截短或发送失败时已经发出的长度和Content-Length对不上,
+  //只能关闭连接让对端知道响应不完整
+  if (session->sendResponseHeader(response) <= 0 ||
+      session->sendFile(fd, begin, length) <= 0) {
+    response->setClose(true);
+  }
+  ::close(fd);
+  return 0;
+}
+
+}  // namespace http
+}  // namespace sylar
@@ -0,0 +1,109 @@
+/**
+ * @file static_file_servlet.h
+ * @brief 静态文件Servlet
+ */
+#ifndef __SYLAR_HTTP_STATIC_FILE_SERVLET_H__
+#define __SYLAR_HTTP_STATIC_FILE_SERVLET_H__
+
+#include <sys/stat.h>
+#include "servlet.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief 把一个目录作为静态文件提供出去
+ * @details - 小文件(不超过http.static_file.cache_file_size)放在内存缓存里,
+ *            和头部一起writev发送; 大文件用sendfile直接从文件发到socket
+ *          - 强ETag和Last-Modified, 支持If-None-Match/If-Modified-Since(304)
+ *          - 单个Range(206/416), 支持If-Range
+ *          - 客户端接受gzip并且存在同名.gz文件时, 直接发送.gz文件
+ *          只处理GET和HEAD. 添加时用末尾通配, 比如
+ *          addGlobServlet("/static/" "*", StaticFileServlet("/static/", dir))
+ */
+class StaticFileServlet : public Servlet {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<StaticFileServlet> ptr;
+
+  /**
+   * @brief 构造函数
+   * @param[in] prefix 去掉的路径前缀, 剩下的部分是文件相对root的路径
+   * @param[in] root 文件目录
+   */
+  StaticFileServlet(const std::string& prefix, const std::string& root);
+
+  virtual int32_t handle(sylar::http::HttpRequest::ptr request,
+                         sylar::http::HttpResponse::ptr response,
+                         sylar::http::HttpSession::ptr session) override;
+
+  /**
+   * @brief 是否选择.gz文件
+   */
+  bool isGzip() const { return m_gzip; }
+
+  /**
+   * @brief 设置是否选择.gz文件
+   */
+  void setGzip(bool v) { m_gzip = v; }
+
+  /**
+   * @brief 返回文件的强ETag, 由大小和修改时间生成
+   */
+  static std::string MakeETag(const struct stat& st);
+
+  /**
+   * @brief 格式化HTTP日期, 比如 Sun, 06 Nov 1994 08:49:37 GMT
+   */
+  static std::string HttpDate(time_t t);
+
+  /**
+   * @brief 解析HTTP日期
+   * @return 失败返回-1
+   */
+  static time_t ParseHttpDate(const std::string& str);
+
+  /**
+   * @brief 解析Range头部, 只支持单个范围
+   * @param[in] range Range头部的值
+   * @param[in] size 文件大小
+   * @param[out] begin 起始位置
+   * @param[out] end 结束位置(不包含)
+   * @return
+   *      @retval 1 有效的范围
+   *      @retval 0 不能识别或者多个范围, 忽略Range发送整个文件
+   *      @retval -1 范围不能满足(416)
+   */
+  static int ParseRange(const std::string& range, uint64_t size,
+                        uint64_t& begin, uint64_t& end);
+
+  /**
+   * @brief 根据扩展名返回Content-Type
+   */
+  static const char* GetContentType(const std::string& path);
+
+ private:
+  /**
+   * @brief 把请求路径转成文件路径, 拒绝..和不在prefix下的路径
+   */
+  bool resolvePath(const std::string& uri, std::string& path) const;
+
+  /**
+   * @brief 条件请求是否命中(返回304)
+   */
+  bool isNotModified(HttpRequest::ptr req, const std::string& etag,
+                     time_t mtime) const;
+
+ private:
+  /// 路径前缀
+  std::string m_prefix;
+  /// 文件目录
+  std::string m_root;
+  /// 是否选择.gz文件
+  bool m_gzip = true;
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
@@ -0,0 +1,54 @@
+#include "ws_server.h"
+#include "sylar/log.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
+
+WSServer::WSServer(sylar::IOManager* worker, sylar::IOManager* accept_worker)
+    : TcpServer(worker, accept_worker) {
+  m_dispatch.reset(new WSServletDispatch);
+}
+
+void WSServer::handleClient(Socket::ptr client) {
+  SYLAR_LOG_DEBUG(g_logger) << "handleClient " << *client;
+  WSSession::ptr session(new WSSession(client));
+  do {
+    HttpRequest::ptr header = session->handleShake();
+    if (!header) {
+      break;
+    }
+    WSServlet::ptr servlet = m_dispatch->getWSServlet(header);
+    if (!servlet) {
+      //握手之前就能拒绝, 不需要升级连接
+      HttpResponse::ptr rsp(new HttpResponse(header->getVersion(), true));
+      rsp->setStatus(HttpStatus::NOT_FOUND);
+      session->sendResponse(rsp);
+      break;
+    }
+    if (session->acceptShake(header) <= 0) {
+      break;
+    }
+    if (servlet->onConnect(header, session)) {
+      session->sendClose(1008);
+      servlet->onClose(header, session);
+      break;
+    }
+    while (true) {
+      WSFrameMessage::ptr msg = session->recvMessage();
+      if (!msg) {
+        break;
+      }
+      if (servlet->handle(header, msg, session)) {
+        session->sendClose(1000);
+        break;
+      }
+    }
+    servlet->onClose(header, session);
+  } while (0);
+  session->close();
+}
+
+}  // namespace http
+}  // namespace sylar
@@ -0,0 +1,49 @@
+/**
+ * @file ws_server.h
+ * @brief WebSocket服务器
+ */
+#ifndef __SYLAR_HTTP_WS_SERVER_H__
+#define __SYLAR_HTTP_WS_SERVER_H__
+
+#include "sylar/tcp_server.h"
+#include "ws_servlet.h"
+#include "ws_session.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief WebSocket服务器, 每个连接握手后在一个协程里循环收消息
+ */
+class WSServer : public TcpServer {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<WSServer> ptr;
+
+  /**
+   * @brief 构造函数
+   * @param worker 工作调度器
+   * @param accept_worker 接收连接器
+   */
+  WSServer(sylar::IOManager* worker = sylar::IOManager::GetThis(),
+           sylar::IOManager* accept_worker = sylar::IOManager::GetThis());
+
+  /**
+   * @brief 获取WSServletDispatch
+   */
+  WSServletDispatch::ptr getWSServletDispatch() const { return m_dispatch; }
+
+  void setWSServletDispatch(WSServletDispatch::ptr v) { m_dispatch = v; }
+
+ protected:
+  virtual void handleClient(Socket::ptr client) override;
+
+ protected:
+  /// Servlet分发器
+  WSServletDispatch::ptr m_dispatch;
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
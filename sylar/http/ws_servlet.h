@@ -0,0 +1,134 @@
+/**
+ * @file ws_servlet.h
+ * @brief WebSocket Servlet
+ */
+#ifndef __SYLAR_HTTP_WS_SERVLET_H__
+#define __SYLAR_HTTP_WS_SERVLET_H__
+
+#include "servlet.h"
+#include "ws_session.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief WebSocket Servlet, 一个连接上依次调用onConnect, 每条消息handle,
+ *        最后onClose
+ */
+class WSServlet : public Servlet {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<WSServlet> ptr;
+
+  WSServlet(const std::string& name) : Servlet(name) {}
+
+  virtual ~WSServlet() {}
+
+  /**
+   * @brief 作为普通HTTP请求时不处理
+   */
+  virtual int32_t handle(sylar::http::HttpRequest::ptr request,
+                         sylar::http::HttpResponse::ptr response,
+                         sylar::http::HttpSession::ptr session) override {
+    return 0;
+  }
+
+  /**
+   * @brief 握手完成
+   * @return 非0时关闭连接
+   */
+  virtual int32_t onConnect(sylar::http::HttpRequest::ptr header,
+                            sylar::http::WSSession::ptr session) = 0;
+
+  /**
+   * @brief 连接关闭
+   */
+  virtual int32_t onClose(sylar::http::HttpRequest::ptr header,
+                          sylar::http::WSSession::ptr session) = 0;
+
+  /**
+   * @brief 处理一条消息
+   * @param[in] header 握手请求
+   * @return 非0时关闭连接
+   */
+  virtual int32_t handle(sylar::http::HttpRequest::ptr header,
+                         sylar::http::WSFrameMessage::ptr msg,
+                         sylar::http::WSSession::ptr session) = 0;
+};
+
+class FunctionWSServlet : public WSServlet {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<FunctionWSServlet> ptr;
+  /// 握手完成的回调
+  typedef std::function<int32_t(sylar::http::HttpRequest::ptr header,
+                                sylar::http::WSSession::ptr session)>
+      on_connect_cb;
+  /// 连接关闭的回调
+  typedef std::function<int32_t(sylar::http::HttpRequest::ptr header,
+                                sylar::http::WSSession::ptr session)>
+      on_close_cb;
+  /// 消息回调
+  typedef std::function<int32_t(sylar::http::HttpRequest::ptr header,
+                                sylar::http::WSFrameMessage::ptr msg,
+                                sylar::http::WSSession::ptr session)>
+      callback;
+
+  /**
+   * @brief 构造函数
+   * @param[in] cb 消息回调
+   * @param[in] connect_cb 握手完成的回调, 可以为空
+   * @param[in] close_cb 连接关闭的回调, 可以为空
+   */
+  FunctionWSServlet(callback cb, on_connect_cb connect_cb = nullptr,
+                    on_close_cb close_cb = nullptr);
+
+  virtual int32_t onConnect(sylar::http::HttpRequest::ptr header,
+                            sylar::http::WSSession::ptr session) override;
+  virtual int32_t onClose(sylar::http::HttpRequest::ptr header,
+                          sylar::http::WSSession::ptr session) override;
+  virtual int32_t handle(sylar::http::HttpRequest::ptr header,
+                         sylar::http::WSFrameMessage::ptr msg,
+                         sylar::http::WSSession::ptr session) override;
+
+ protected:
+  /// 消息回调
+  callback m_callback;
+  /// 握手完成的回调
+  on_connect_cb m_onConnect;
+  /// 连接关闭的回调
+  on_close_cb m_onClose;
+};
+
+/**
+ * @brief WebSocket Servlet分发器, 路由规则和ServletDispatch一样
+ */
+class WSServletDispatch : public ServletDispatch {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<WSServletDispatch> ptr;
+
+  WSServletDispatch();
+
+  using ServletDispatch::addServlet;
+  using ServletDispatch::addGlobServlet;
+
+  void addServlet(const std::string& uri, FunctionWSServlet::callback cb,
+                  FunctionWSServlet::on_connect_cb connect_cb = nullptr,
+                  FunctionWSServlet::on_close_cb close_cb = nullptr);
+
+  void addGlobServlet(const std::string& uri, FunctionWSServlet::callback cb,
+                      FunctionWSServlet::on_connect_cb connect_cb = nullptr,
+                      FunctionWSServlet::on_close_cb close_cb = nullptr);
+
+  /**
+   * @brief 获取握手请求对应的WSServlet, 路径参数设置到请求中
+   * @return 没有匹配或者匹配到的不是WSServlet时返回nullptr
+   */
+  WSServlet::ptr getWSServlet(HttpRequest::ptr req);
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
@@ -0,0 +1,625 @@
+#include "ws_session.h"
+#include <string.h>
+#include <zlib.h>
+#include "sylar/config.h"
+#include "sylar/endian.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
+
+static sylar::ConfigVar<uint32_t>::ptr g_websocket_message_max_size =
+    sylar::Config::Lookup("websocket.message.max_size",
+                          (uint32_t)(32 * 1024 * 1024),
+                          "websocket message max size");
+
+static sylar::ConfigVar<uint32_t>::ptr g_websocket_deflate_min_size =
+    sylar::Config::Lookup("websocket.deflate.min_size", (uint32_t)128,
+                          "websocket messages smaller than this "
+                          "are sent uncompressed");
+
+static sylar::ConfigVar<int32_t>::ptr g_websocket_deflate_level =
+    sylar::Config::Lookup("websocket.deflate.level", (int32_t)1,
+                          "websocket permessage-deflate compression level");
+
+/// 接收缓存大小, 小帧在缓存里批量解析
+static const size_t s_ws_buffer_size = 16 * 1024;
+
+/// 接收数据帧时每次扩大消息的字节数, 不按帧头声明的长度一次分配
+static const size_t s_ws_read_chunk = 64 * 1024;
+
+/// Sec-WebSocket-Accept计算用的GUID
+static const char* s_ws_guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+/// Z_SYNC_FLUSH的结尾, 发送时去掉, 接收时补上
+static const char s_deflate_tail[4] = {0, 0, (char)0xff, (char)0xff};
+
+void WSMask(void* data, size_t len, const uint8_t key[4], size_t offset) {
+  uint8_t* p = (uint8_t*)data;
+  //按offset转好的16字节掩码, 16和8都是4的倍数, 分块后对齐不变
+  uint8_t k[16];
+  for (size_t i = 0; i < sizeof(k); ++i) {
+    k[i] = key[(offset + i) & 3];
+  }
+  size_t i = 0;
+#if defined(__SSE2__)
+  __m128i mask = _mm_loadu_si128((const __m128i*)k);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+    _mm_storeu_si128((__m128i*)(p + i), _mm_xor_si128(v, mask));
+  }
+#elif defined(__ARM_NEON)
+  uint8x16_t mask = vld1q_u8(k);
+  for (; i + 16 <= len; i += 16) {
+    vst1q_u8(p + i, veorq_u8(vld1q_u8(p + i), mask));
+  }
+#endif
+  uint64_t mask64;
+  memcpy(&mask64, k, sizeof(mask64));
+  for (; i + 8 <= len; i += 8) {
+    uint64_t v;
+    memcpy(&v, p + i, sizeof(v));
+    v ^= mask64;
+    memcpy(p + i, &v, sizeof(v));
+  }
+  for (; i < len; ++i) {
+    p[i] ^= k[i & 3];
+  }
+}
+
+bool WSIsUtf8(const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+  const uint8_t* end = p + len;
+  while (p < end) {
+    if (end - p >= 8) {
+      uint64_t v;
+      memcpy(&v, p, sizeof(v));
+      if (!(v & 0x8080808080808080ull)) {
+        p += 8;
+        continue;
+      }
+    }
+    uint8_t c = *p;
+    if (c < 0x80) {
+      ++p;
+      continue;
+    }
+    //后续字节数, 第二个字节的范围排除过长编码, 代理区和超出范围的
+    size_t n = 0;
+    uint8_t lo = 0x80;
+    uint8_t hi = 0xbf;
+    if (c >= 0xc2 && c <= 0xdf) {
+      n = 1;
+    } else if (c >= 0xe0 && c <= 0xef) {
+      n = 2;
+      lo = c == 0xe0 ? 0xa0 : 0x80;
+      hi = c == 0xed ? 0x9f : 0xbf;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      n = 3;
+      lo = c == 0xf0 ? 0x90 : 0x80;
+      hi = c == 0xf4 ? 0x8f : 0xbf;
+    } else {
+      return false;
+    }
+    if ((size_t)(end - p) <= n || p[1] < lo || p[1] > hi) {
+      return false;
+    }
+    for (size_t i = 2; i <= n; ++i) {
+      if ((p[i] & 0xc0) != 0x80) {
+        return false;
+      }
+    }
+    p += n + 1;
+  }
+  return true;
+}
+
+WSSession::WSSession(Socket::ptr sock, bool owner)
+    : HttpSession(sock, owner), m_rbuf(s_ws_buffer_size) {}
+
+WSSession::~WSSession() {
+  if (m_deflate) {
+    deflateEnd(m_deflate);
+    delete m_deflate;
+  }
+  if (m_inflate) {
+    inflateEnd(m_inflate);
+    delete m_inflate;
+  }
+}
+
+HttpRequest::ptr WSSession::handleShake() {
+  HttpRequest::ptr req = recvRequest();
+  if (!req) {
+    SYLAR_LOG_DEBUG(g_logger) << "websocket recv handshake request fail";
+    return nullptr;
+  }
+  if (req->getMethod() != HttpMethod::GET ||
+      strcasecmp(req->getHeader("upgrade").c_str(), "websocket") ||
+      !strcasestr(req->getHeader("connection").c_str(), "upgrade") ||
+      req->getHeader("sec-websocket-version") != "13" ||
+      req->getHeader("sec-websocket-key").empty()) {
+    SYLAR_LOG_INFO(g_logger) << "invalid websocket handshake request: "
+                             << req->getPath();
+    HttpResponse::ptr rsp(new HttpResponse(req->getVersion(), true));
+    rsp->setStatus(HttpStatus::BAD_REQUEST);
+    rsp->setHeader("Sec-WebSocket-Version", "13");
+    sendResponse(rsp);
+    return nullptr;
+  }
+  req->setWebsocket(true);
+  return req;
+}
+
+int WSSession::acceptShake(HttpRequest::ptr req) {
+  HttpResponse::ptr rsp(new HttpResponse(req->getVersion(), false));
+  rsp->setStatus(HttpStatus::SWITCHING_PROTOCOLS);
+  rsp->setWebsocket(true);
+  rsp->setHeader("Upgrade", "websocket");
+  rsp->setHeader("Connection", "Upgrade");
+  rsp->setHeader("Sec-WebSocket-Accept",
+                 sylar::Base64Encode(sylar::Sha1Sum(
+                     req->getHeader("sec-websocket-key") + s_ws_guid)));
+  std::string ext;
+  if (negotiateDeflate(req->getHeader("sec-websocket-extensions"), ext)) {
+    rsp->setHeader("Sec-WebSocket-Extensions", ext);
+  }
+  return sendResponse(rsp);
+}
+
+/**
+ * @brief 去掉两边的空白和引号
+ */
+static std::string TrimToken(const std::string& str, size_t begin,
+                             size_t end) {
+  while (begin < end && strchr(" \t\"", str[begin])) {
+    ++begin;
+  }
+  while (end > begin && strchr(" \t\"", str[end - 1])) {
+    --end;
+  }
+  return str.substr(begin, end - begin);
+}
+
+bool WSSession::negotiateDeflate(const std::string& offers,
+                                 std::string& response) {
+  //permessage-deflate; client_max_window_bits, permessage-deflate
+  //按顺序选第一个能接受的
+  size_t pos = 0;
+  while (pos < offers.size()) {
+    size_t end = offers.find(',', pos);
+    if (end == std::string::npos) {
+      end = offers.size();
+    }
+    std::vector<std::string> params;
+    for (size_t b = pos; b < end;) {
+      size_t e = offers.find(';', b);
+      if (e == std::string::npos || e > end) {
+        e = end;
+      }
+      params.push_back(TrimToken(offers, b, e));
+      b = e + 1;
+    }
+    pos = end + 1;
+    if (params.empty() || params[0] != "permessage-deflate") {
+      continue;
+    }
+    bool ok = true;
+    bool reset = false;
+    int bits = 15;
+    std::string rsp = "permessage-deflate";
+    for (size_t i = 1; i < params.size() && ok; ++i) {
+      size_t eq = params[i].find('=');
+      std::string name = TrimToken(params[i], 0, std::min(eq, params[i].size()));
+      std::string value =
+          eq == std::string::npos
+              ? ""
+              : TrimToken(params[i], eq + 1, params[i].size());
+      if (name == "server_no_context_takeover") {
+        reset = true;
+        rsp += "; server_no_context_takeover";
+      } else if (name == "client_no_context_takeover") {
+        rsp += "; client_no_context_takeover";
+      } else if (name == "server_max_window_bits") {
+        //zlib的raw deflate不支持8
+        bits = atoi(value.c_str());
+        ok = bits >= 9 && bits <= 15;
+        rsp += "; server_max_window_bits=" + value;
+      } else if (name != "client_max_window_bits") {
+        //解压总是使用最大窗口, 客户端用多小的窗口都可以
+        ok = false;
+      }
+    }
+    if (!ok) {
+      continue;
+    }
+    m_deflate = new z_stream;
+    memset(m_deflate, 0, sizeof(z_stream));
+    if (deflateInit2(m_deflate, g_websocket_deflate_level->getValue(),
+                     Z_DEFLATED, -bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      delete m_deflate;
+      m_deflate = nullptr;
+      return false;
+    }
+    m_inflate = new z_stream;
+    memset(m_inflate, 0, sizeof(z_stream));
+    if (inflateInit2(m_inflate, -15) != Z_OK) {
+      delete m_inflate;
+      m_inflate = nullptr;
+      deflateEnd(m_deflate);
+      delete m_deflate;
+      m_deflate = nullptr;
+      return false;
+    }
+    m_deflateReset = reset;
+    response = rsp;
+    return true;
+  }
+  return false;
+}
+
+bool WSSession::deflateMessage(const void* data, size_t len,
+                               std::string& out) {
+  z_stream* zs = m_deflate;
+  zs->next_in = (Bytef*)data;
+  zs->avail_in = len;
+  out.resize(len / 2 + 64);
+  size_t used = 0;
+  do {
+    if (used == out.size()) {
+      out.resize(out.size() * 2);
+    }
+    zs->next_out = (Bytef*)&out[used];
+    zs->avail_out = out.size() - used;
+    int rt = deflate(zs, Z_SYNC_FLUSH);
+    if (rt != Z_OK && rt != Z_BUF_ERROR) {
+      SYLAR_LOG_ERROR(g_logger) << "websocket deflate error rt=" << rt;
+      return false;
+    }
+    used = out.size() - zs->avail_out;
+  } while (zs->avail_in > 0 || zs->avail_out == 0);
+  if (used >= 4 && memcmp(&out[used - 4], s_deflate_tail, 4) == 0) {
+    used -= 4;
+  }
+  out.resize(used);
+  if (m_deflateReset) {
+    deflateReset(zs);
+  }
+  return true;
+}
+
+bool WSSession::inflateMessage(const std::string& in, std::string& out) {
+  uint64_t max_size = g_websocket_message_max_size->getValue();
+  z_stream* zs = m_inflate;
+  const std::pair<const char*, size_t> parts[2] = {
+      {in.data(), in.size()}, {s_deflate_tail, sizeof(s_deflate_tail)}};
+  out.resize(std::min<uint64_t>(std::max<size_t>(in.size() * 4, 1024),
+                                max_size));
+  size_t used = 0;
+  for (auto& part : parts) {
+    zs->next_in = (Bytef*)part.first;
+    zs->avail_in = part.second;
+    while (zs->avail_in > 0 || zs->avail_out == 0) {
+      if (used == out.size()) {
+        //解压后超过上限, 防止压缩炸弹
+        if (out.size() >= max_size) {
+          return false;
+        }
+        out.resize(std::min<uint64_t>(out.size() * 2, max_size));
+      }
+      zs->next_out = (Bytef*)&out[used];
+      zs->avail_out = out.size() - used;
+      int rt = inflate(zs, Z_SYNC_FLUSH);
+      used = out.size() - zs->avail_out;
+      if (rt == Z_STREAM_END) {
+        inflateReset(zs);
+        break;
+      }
+      if (rt == Z_BUF_ERROR && zs->avail_out > 0) {
+        break;
+      }
+      if (rt != Z_OK && rt != Z_BUF_ERROR) {
+        SYLAR_LOG_INFO(g_logger) << "websocket inflate error rt=" << rt;
+        return false;
+      }
+    }
+  }
+  out.resize(used);
+  return true;
+}
+
+bool WSSession::fill(size_t size) {
+  if (m_rend - m_rbegin >= size) {
+    return true;
+  }
+  if (m_rbegin > 0) {
+    memmove(&m_rbuf[0], &m_rbuf[m_rbegin], m_rend - m_rbegin);
+    m_rend -= m_rbegin;
+    m_rbegin = 0;
+  }
+  while (m_rend < size) {
+    int64_t rt = readRaw(&m_rbuf[m_rend], m_rbuf.size() - m_rend);
+    if (rt <= 0) {
+      return false;
+    }
+    m_rend += rt;
+  }
+  return true;
+}
+
+bool WSSession::readPayload(char* data, size_t len) {
+  size_t n = std::min(len, m_rend - m_rbegin);
+  memcpy(data, &m_rbuf[m_rbegin], n);
+  m_rbegin += n;
+  data += n;
+  len -= n;
+  if (len == 0) {
+    return true;
+  }
+  if (len < m_rbuf.size() / 2) {
+    //剩下的不多, 读进缓存, 顺便读到后面的帧
+    if (!fill(len)) {
+      return false;
+    }
+    memcpy(data, &m_rbuf[m_rbegin], len);
+    m_rbegin += len;
+    return true;
+  }
+  //大的负载直接读到消息里
+  while (len > 0) {
+    int64_t rt = readRaw(data, len);
+    if (rt <= 0) {
+      return false;
+    }
+    data += rt;
+    len -= rt;
+  }
+  return true;
+}
+
+WSFrameMessage::ptr WSSession::fail(uint16_t code) {
+  SYLAR_LOG_INFO(g_logger) << "websocket protocol error, close code=" << code;
+  sendClose(code);
+  return nullptr;
+}
+
+WSFrameMessage::ptr WSSession::recvMessage() {
+  uint64_t max_size = g_websocket_message_max_size->getValue();
+  //正在接收的数据消息的操作码, -1表示还没有
+  int opcode = -1;
+  bool compressed = false;
+  std::string data;
+  while (true) {
+    if (!fill(2)) {
+      return nullptr;
+    }
+    const uint8_t* head = (const uint8_t*)&m_rbuf[m_rbegin];
+    bool fin = head[0] & 0x80;
+    bool rsv1 = head[0] & 0x40;
+    bool rsv23 = head[0] & 0x30;
+    int op = head[0] & 0x0f;
+    bool mask = head[1] & 0x80;
+    uint64_t len = head[1] & 0x7f;
+    size_t head_size =
+        2 + (len == 126 ? 2 : (len == 127 ? 8 : 0)) + (mask ? 4 : 0);
+    if (!fill(head_size)) {
+      return nullptr;
+    }
+    const char* pos = &m_rbuf[m_rbegin + 2];
+    if (len == 126) {
+      uint16_t v;
+      memcpy(&v, pos, sizeof(v));
+      len = sylar::byteswapOnLittleEndian(v);
+      pos += sizeof(v);
+    } else if (len == 127) {
+      uint64_t v;
+      memcpy(&v, pos, sizeof(v));
+      len = sylar::byteswapOnLittleEndian(v);
+      pos += sizeof(v);
+    }
+    uint8_t key[4] = {0, 0, 0, 0};
+    if (mask) {
+      memcpy(key, pos, sizeof(key));
+    }
+    m_rbegin += head_size;
+    //客户端发来的帧必须有掩码, 64位长度的最高位必须为0
+    if (!mask || rsv23 || (len >> 63)) {
+      return fail(1002);
+    }
+
+    if (op & 0x8) {
+      //控制帧可以夹在分片中间, 不能分片, 负载不超过125
+      if (!fin || rsv1 || len > 125) {
+        return fail(1002);
+      }
+      char payload[125];
+      if (!readPayload(payload, len)) {
+        return nullptr;
+      }
+      WSMask(payload, len, key);
+      if (op == WSFrameHead::PING) {
+        if (pong(std::string(payload, len)) <= 0) {
+          return nullptr;
+        }
+      } else if (op == WSFrameHead::CLOSE) {
+        //回复同样的状态码, 已经发送过CLOSE时不再发送
+        if (len == 1) {
+          return fail(1002);
+        }
+        uint16_t code = 1000;
+        if (len >= 2) {
+          memcpy(&code, payload, sizeof(code));
+          code = sylar::byteswapOnLittleEndian(code);
+        }
+        sendClose(code);
+        return nullptr;
+      } else if (op != WSFrameHead::PONG) {
+        return fail(1002);
+      }
+      continue;
+    }
+
+    if (op == WSFrameHead::CONTINUE) {
+      if (opcode < 0 || rsv1) {
+        return fail(1002);
+      }
+    } else if (op == WSFrameHead::TEXT_FRAME || op == WSFrameHead::BIN_FRAME) {
+      if (opcode >= 0 || (rsv1 && !m_inflate)) {
+        return fail(1002);
+      }
+      opcode = op;
+      compressed = rsv1;
+    } else {
+      return fail(1002);
+    }
+    //data.size()不会超过max_size, 用减法避免相加溢出
+    if (len > max_size - data.size()) {
+      return fail(1009);
+    }
+    //声明的长度可能很大而数据没有跟上, 按实际收到的扩大
+    for (uint64_t done = 0; done < len;) {
+      size_t n = std::min(len - done, (uint64_t)s_ws_read_chunk);
+      size_t offset = data.size();
+      data.resize(offset + n);
+      if (!readPayload(&data[offset], n)) {
+        return nullptr;
+      }
+      WSMask(&data[offset], n, key, done);
+      done += n;
+    }
+    if (!fin) {
+      continue;
+    }
+    WSFrameMessage::ptr msg(new WSFrameMessage(opcode));
+    if (compressed) {
+      if (!inflateMessage(data, msg->getData())) {
+        return fail(1009);
+      }
+    } else {
+      msg->getData().swap(data);
+    }
+    //文本消息合并, 解压之后整体检查, 字符可以跨分片
+    if (opcode == WSFrameHead::TEXT_FRAME &&
+        !WSIsUtf8(msg->getData().data(), msg->getData().size())) {
+      return fail(1007);
+    }
+    return msg;
+  }
+}
+
+int32_t WSSession::sendFrame(uint8_t opcode, bool fin, const void* data,
+                             size_t len) {
+  std::string zipped;
+  char head[10];
+  size_t head_size = 2;
+  {
+    MutexType::Lock lock(m_sendMutex);
+    if (m_closeSent) {
+      return -1;
+    }
+    bool rsv1 = false;
+    if (opcode == WSFrameHead::CLOSE) {
+      m_closeSent = true;
+    } else if (!(opcode & 0x8)) {
+      if (m_sendFragmented) {
+        opcode = WSFrameHead::CONTINUE;
+      } else if (fin && m_deflate &&
+                 len >= g_websocket_deflate_min_size->getValue()) {
+        //压缩上下文在消息之间保留, 压缩和排队要在同一把锁里保证顺序
+        if (!deflateMessage(data, len, zipped)) {
+          return -1;
+        }
+        data = zipped.data();
+        len = zipped.size();
+        rsv1 = true;
+      }
+      m_sendFragmented = !fin;
+    }
+    head[0] = (fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | opcode;
+    if (len < 126) {
+      head[1] = len;
+    } else if (len <= 0xffff) {
+      head[1] = 126;
+      uint16_t v = sylar::byteswapOnLittleEndian((uint16_t)len);
+      memcpy(head + 2, &v, sizeof(v));
+      head_size += sizeof(v);
+    } else {
+      head[1] = 127;
+      uint64_t v = sylar::byteswapOnLittleEndian((uint64_t)len);
+      memcpy(head + 2, &v, sizeof(v));
+      head_size += sizeof(v);
+    }
+    if (m_sending) {
+      //另一方正在发送, 排队由它发出
+      m_sendQueue.append(head, head_size);
+      m_sendQueue.append((const char*)data, len);
+      return head_size + len;
+    }
+    m_sending = true;
+  }
+  iovec iovs[2];
+  iovs[0].iov_base = head;
+  iovs[0].iov_len = head_size;
+  iovs[1].iov_base = (void*)data;
+  iovs[1].iov_len = len;
+  int rt = writevFixSize(iovs, len > 0 ? 2 : 1);
+  //发送期间其他协程排队的帧
+  std::string queue;
+  while (true) {
+    {
+      MutexType::Lock lock(m_sendMutex);
+      if (rt <= 0 || m_sendQueue.empty()) {
+        m_sendQueue.clear();
+        m_sending = false;
+        break;
+      }
+      queue.swap(m_sendQueue);
+    }
+    if (writeFixSize(queue.data(), queue.size()) <= 0) {
+      rt = -1;
+    }
+    queue.clear();
+  }
+  return rt;
+}
+
+int32_t WSSession::sendMessage(WSFrameMessage::ptr msg, bool fin) {
+  const std::string& data = msg->getData();
+  return sendFrame(msg->getOpcode(), fin, data.data(), data.size());
+}
+
+int32_t WSSession::sendMessage(const std::string& msg, int32_t opcode,
+                               bool fin) {
+  return sendFrame(opcode, fin, msg.data(), msg.size());
+}
+
+int32_t WSSession::ping(const std::string& data) {
+  return sendFrame(WSFrameHead::PING, true, data.data(),
+                   std::min<size_t>(data.size(), 125));
+}
+
+int32_t WSSession::pong(const std::string& data) {
+  return sendFrame(WSFrameHead::PONG, true, data.data(),
+                   std::min<size_t>(data.size(), 125));
+}
+
+int32_t WSSession::sendClose(uint16_t code, const std::string& reason) {
+  char payload[125];
+  uint16_t v = sylar::byteswapOnLittleEndian(code);
+  memcpy(payload, &v, sizeof(v));
+  size_t len = std::min<size_t>(reason.size(), sizeof(payload) - sizeof(v));
+  memcpy(payload + sizeof(v), reason.data(), len);
+  return sendFrame(WSFrameHead::CLOSE, true, payload, sizeof(v) + len);
+}
+
+}  // namespace http
+}  // namespace sylar
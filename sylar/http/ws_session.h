@@ -0,0 +1,220 @@
+/**
+ * @file ws_session.h
+ * @brief WebSocket连接(RFC 6455)
+ */
+#ifndef __SYLAR_HTTP_WS_SESSION_H__
+#define __SYLAR_HTTP_WS_SESSION_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "http_session.h"
+#include "sylar/mutex.h"
+
+struct z_stream_s;
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief WebSocket帧头部的常量
+ */
+struct WSFrameHead {
+  /// 操作码
+  enum OPCODE {
+    /// 数据分片帧
+    CONTINUE = 0,
+    /// 文本帧
+    TEXT_FRAME = 1,
+    /// 二进制帧
+    BIN_FRAME = 2,
+    /// 断开连接
+    CLOSE = 8,
+    /// PING
+    PING = 0x9,
+    /// PONG
+    PONG = 0xA
+  };
+};
+
+/**
+ * @brief WebSocket消息, 分片已经合并, permessage-deflate已经解压
+ */
+class WSFrameMessage {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<WSFrameMessage> ptr;
+
+  /**
+   * @brief 构造函数
+   * @param[in] opcode 操作码 WSFrameHead::OPCODE
+   * @param[in] data 消息内容
+   */
+  WSFrameMessage(int opcode = 0, const std::string& data = "")
+      : m_opcode(opcode), m_data(data) {}
+
+  int getOpcode() const { return m_opcode; }
+
+  void setOpcode(int v) { m_opcode = v; }
+
+  const std::string& getData() const { return m_data; }
+
+  std::string& getData() { return m_data; }
+
+  void setData(const std::string& v) { m_data = v; }
+
+ private:
+  /// 操作码
+  int m_opcode;
+  /// 消息内容
+  std::string m_data;
+};
+
+/**
+ * @brief 用掩码异或数据(掩码和解掩码是同一个操作)
+ * @details 有SSE2/NEON时每次处理16字节, 否则每次8字节
+ * @param[in,out] data 数据
+ * @param[in] len 数据长度
+ * @param[in] key 4字节掩码, 按内存中的字节顺序
+ * @param[in] offset data在整个负载中的偏移, 用来对齐掩码
+ */
+void WSMask(void* data, size_t len, const uint8_t key[4], size_t offset = 0);
+
+/**
+ * @brief 是否是合法的UTF-8(RFC 3629), 过长编码, 代理区和超出U+10FFFF的都不合法
+ * @details ASCII部分每次检查8字节
+ */
+bool WSIsUtf8(const void* data, size_t len);
+
+/**
+ * @brief 服务端的WebSocket连接
+ * @details 先用handleShake()接收升级请求, acceptShake()完成握手,
+ *          之后用recvMessage()/sendMessage()收发消息.
+ *          - recvMessage自动回复PING, 忽略PONG, 合并分片, 收到CLOSE时回复
+ *          - 客户端提供permessage-deflate时启用压缩, 压缩上下文在消息之间保留
+ *          - 发送可以在多个协程/线程中同时进行, 帧不会交错
+ */
+class WSSession : public HttpSession {
+ public:
+  /// 智能指针类型定义
+  typedef std::shared_ptr<WSSession> ptr;
+  typedef sylar::Mutex MutexType;
+
+  /**
+   * @brief 构造函数
+   * @param[in] sock socket
+   * @param[in] owner 是否托管
+   */
+  WSSession(Socket::ptr sock, bool owner = true);
+
+  ~WSSession();
+
+  /**
+   * @brief 接收并检查升级请求
+   * @details 不是合法的websocket升级请求时回复400
+   * @return 失败返回nullptr
+   */
+  HttpRequest::ptr handleShake();
+
+  /**
+   * @brief 回复101完成握手, 协商permessage-deflate
+   * @return 同sendResponse
+   */
+  int acceptShake(HttpRequest::ptr req);
+
+  /**
+   * @brief 接收一条完整的消息
+   * @return 连接关闭, 收到CLOSE或者协议错误时返回nullptr
+   */
+  WSFrameMessage::ptr recvMessage();
+
+  /**
+   * @brief 发送消息
+   * @param[in] msg 消息, 操作码为TEXT_FRAME/BIN_FRAME/PING/PONG/CLOSE
+   * @param[in] fin 是否最后一个分片. 为false时消息分片发送, 之后的
+   *            sendMessage作为后续分片(操作码被忽略), 直到fin为true.
+   *            分片发送的消息不压缩, 分片之间不能有其他数据消息
+   * @return 同writevFixSize
+   */
+  int32_t sendMessage(WSFrameMessage::ptr msg, bool fin = true);
+
+  int32_t sendMessage(const std::string& msg,
+                      int32_t opcode = WSFrameHead::TEXT_FRAME,
+                      bool fin = true);
+
+  int32_t ping(const std::string& data = "");
+
+  int32_t pong(const std::string& data = "");
+
+  /**
+   * @brief 发送CLOSE帧, 之后不能再发送消息
+   * @param[in] code 状态码, 比如1000正常关闭
+   */
+  int32_t sendClose(uint16_t code = 1000, const std::string& reason = "");
+
+  /**
+   * @brief 是否启用了permessage-deflate
+   */
+  bool isDeflate() const { return m_deflate != nullptr; }
+
+ private:
+  /**
+   * @brief 发送一帧, 需要时压缩
+   * @details 没有其他发送时直接writev头部和负载, 否则把帧排队,
+   *          由正在发送的一方发出
+   */
+  int32_t sendFrame(uint8_t opcode, bool fin, const void* data, size_t len);
+
+  /**
+   * @brief 保证接收缓存中至少有size字节
+   */
+  bool fill(size_t size);
+
+  /**
+   * @brief 读取负载, 先用接收缓存中的数据
+   */
+  bool readPayload(char* data, size_t len);
+
+  /**
+   * @brief 解析Sec-WebSocket-Extensions, 可以启用时返回回复的扩展参数
+   */
+  bool negotiateDeflate(const std::string& offers, std::string& response);
+
+  bool deflateMessage(const void* data, size_t len, std::string& out);
+
+  bool inflateMessage(const std::string& in, std::string& out);
+
+  /**
+   * @brief 协议错误, 发送CLOSE后返回nullptr
+   */
+  WSFrameMessage::ptr fail(uint16_t code);
+
+ private:
+  /// 接收缓存
+  std::vector<char> m_rbuf;
+  /// 接收缓存中未处理数据的起始位置
+  size_t m_rbegin = 0;
+  /// 接收缓存中数据的结束位置
+  size_t m_rend = 0;
+  /// 压缩上下文, 没有启用permessage-deflate时为nullptr
+  z_stream_s* m_deflate = nullptr;
+  /// 解压上下文
+  z_stream_s* m_inflate = nullptr;
+  /// 每条消息之后重置压缩上下文(server_no_context_takeover)
+  bool m_deflateReset = false;
+  /// 正在分片发送消息
+  bool m_sendFragmented = false;
+  /// 已经发送了CLOSE
+  bool m_closeSent = false;
+  /// 保护下面的发送状态
+  MutexType m_sendMutex;
+  /// 是否有一方正在发送
+  bool m_sending = false;
+  /// 等待发送的帧
+  std::string m_sendQueue;
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
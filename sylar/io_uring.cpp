@@ -0,0 +1,222 @@
+#include "io_uring.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "log.h"
+#include "macro.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
+
+static int io_uring_setup(uint32_t entries, io_uring_params* p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                          uint32_t flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 nullptr, 0);
+}
+
+static int io_uring_register(int fd, uint32_t opcode, void* arg,
+                             uint32_t nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static uint32_t LoadAcquire(const uint32_t* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void StoreRelease(uint32_t* p, uint32_t v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+IOUring::ptr IOUring::Create(uint32_t entries) {
+  IOUring::ptr ring(new IOUring);
+  if (!ring->init(entries)) {
+    return nullptr;
+  }
+  return ring;
+}
+
+IOUring::IOUring() {}
+
+IOUring::~IOUring() {
+  if (m_sqes) {
+    munmap(m_sqes, m_sqesSize);
+  }
+  if (m_cqRing && m_cqRing != m_sqRing) {
+    munmap(m_cqRing, m_cqRingSize);
+  }
+  if (m_sqRing) {
+    munmap(m_sqRing, m_sqRingSize);
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+}
+
+bool IOUring::init(uint32_t entries) {
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = entries * 4;
+  m_fd = io_uring_setup(entries, &p);
+  if (m_fd < 0) {
+    SYLAR_LOG_WARN(g_logger) << "io_uring_setup(" << entries
+                             << ") errno=" << errno
+                             << " errstr=" << strerror(errno);
+    return false;
+  }
+  if (!(p.features & IORING_FEAT_NODROP)) {
+    SYLAR_LOG_WARN(g_logger) << "io_uring lack IORING_FEAT_NODROP";
+    return false;
+  }
+
+  m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+  }
+  m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+  if (m_sqRing == MAP_FAILED) {
+    m_sqRing = nullptr;
+    return false;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    m_cqRing = m_sqRing;
+  } else {
+    m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    if (m_cqRing == MAP_FAILED) {
+      m_cqRing = nullptr;
+      return false;
+    }
+  }
+  m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  m_sqes = (io_uring_sqe*)sqes;
+
+  char* sq = (char*)m_sqRing;
+  m_sqHead = (uint32_t*)(sq + p.sq_off.head);
+  m_sqTail = (uint32_t*)(sq + p.sq_off.tail);
+  m_sqFlags = (uint32_t*)(sq + p.sq_off.flags);
+  m_sqArray = (uint32_t*)(sq + p.sq_off.array);
+  m_sqMask = *(uint32_t*)(sq + p.sq_off.ring_mask);
+  m_sqEntries = *(uint32_t*)(sq + p.sq_off.ring_entries);
+  m_sqLocalTail = *m_sqTail;
+
+  char* cq = (char*)m_cqRing;
+  m_cqHead = (uint32_t*)(cq + p.cq_off.head);
+  m_cqTail = (uint32_t*)(cq + p.cq_off.tail);
+  m_cqMask = *(uint32_t*)(cq + p.cq_off.ring_mask);
+  m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+  //检查用到的操作码
+  static const uint8_t s_ops[] = {
+      IORING_OP_POLL_ADD, IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL,
+      IORING_OP_READ,     IORING_OP_WRITE,        IORING_OP_READV,
+      IORING_OP_WRITEV,   IORING_OP_RECV,         IORING_OP_SEND,
+      IORING_OP_RECVMSG,  IORING_OP_SENDMSG,      IORING_OP_ACCEPT};
+  size_t probe_size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+  std::unique_ptr<char[]> buf(new char[probe_size]());
+  io_uring_probe* probe = (io_uring_probe*)buf.get();
+  if (io_uring_register(m_fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+    SYLAR_LOG_WARN(g_logger) << "io_uring probe errno=" << errno
+                             << " errstr=" << strerror(errno);
+    return false;
+  }
+  for (auto op : s_ops) {
+    if (op > probe->last_op ||
+        !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      SYLAR_LOG_WARN(g_logger) << "io_uring op " << (int)op << " unsupported";
+      return false;
+    }
+  }
+  return true;
+}
+
+io_uring_sqe* IOUring::getSqe(uint32_t count) {
+  if (m_sqLocalTail + count - LoadAcquire(m_sqHead) > m_sqEntries) {
+    submit();
+    if (m_sqLocalTail + count - LoadAcquire(m_sqHead) > m_sqEntries) {
+      return nullptr;
+    }
+  }
+  //多个SQE需要在数组中连续, 才能作为一个整体返回
+  if ((m_sqLocalTail & m_sqMask) + count > m_sqEntries) {
+    return nullptr;
+  }
+  io_uring_sqe* sqe = &m_sqes[m_sqLocalTail & m_sqMask];
+  memset(sqe, 0, sizeof(io_uring_sqe) * count);
+  for (uint32_t i = 0; i < count; ++i) {
+    m_sqArray[(m_sqLocalTail + i) & m_sqMask] = (m_sqLocalTail + i) & m_sqMask;
+  }
+  m_sqLocalTail += count;
+  return sqe;
+}
+
+int IOUring::submit() {
+  StoreRelease(m_sqTail, m_sqLocalTail);
+  uint32_t to_submit = m_sqLocalTail - LoadAcquire(m_sqHead);
+  if (to_submit == 0) {
+    return 0;
+  }
+  while (true) {
+    int rt = io_uring_enter(m_fd, to_submit, 0, 0);
+    if (rt >= 0) {
+      return rt;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EBUSY || errno == EAGAIN) {
+      //完成队列溢出, 等取走完成事件后再提交
+      io_uring_enter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+      return 0;
+    }
+    SYLAR_LOG_ERROR(g_logger) << "io_uring_enter(" << m_fd << ", " << to_submit
+                              << ") errno=" << errno
+                              << " errstr=" << strerror(errno);
+    return -1;
+  }
+}
+
+size_t IOUring::reap(
+    const std::function<void(uint64_t user_data, int res)>& cb) {
+  size_t count = 0;
+  MutexType::Lock lock(m_cqMutex);
+  while (true) {
+    uint32_t head = *m_cqHead;
+    uint32_t tail = LoadAcquire(m_cqTail);
+    while (head != tail) {
+      io_uring_cqe* cqe = &m_cqes[head & m_cqMask];
+      uint64_t user_data = cqe->user_data;
+      int res = cqe->res;
+      ++head;
+      StoreRelease(m_cqHead, head);
+      cb(user_data, res);
+      ++count;
+    }
+    if (LoadAcquire(m_sqFlags) & IORING_SQ_CQ_OVERFLOW) {
+      //把内核中溢出的完成事件刷到完成队列
+      io_uring_enter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+      continue;
+    }
+    if (LoadAcquire(m_cqTail) == head) {
+      break;
+    }
+  }
+  return count;
+}
+
+}  // namespace sylar
@@ -0,0 +1,104 @@
+/**
+ * @brief io_uring 的简单封装(直接使用系统调用, 不依赖liburing)
+ * */
+#ifndef __SYLAR_IO_URING_H__
+#define __SYLAR_IO_URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include "mutex.h"
+#include "noncopyable.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace sylar {
+
+/**
+ * @brief io_uring 实例
+ * @details 提交队列和完成队列分别由各自的互斥量保护, 可以多线程使用
+ * */
+class IOUring : Noncopyable {
+ public:
+  typedef std::shared_ptr<IOUring> ptr;
+  typedef Mutex MutexType;
+
+  /**
+   * @brief 创建io_uring
+   * @param[in] entries 提交队列长度
+   * @return 内核不支持或缺少需要的操作码时返回nullptr
+   * */
+  static IOUring::ptr Create(uint32_t entries);
+
+  ~IOUring();
+
+  /**
+   * @brief 返回io_uring的文件句柄, 有完成事件时可读
+   * */
+  int getFd() const { return m_fd; }
+
+  /**
+   * @brief 提交队列互斥量, getSqe/submit 前需要加锁
+   * */
+  MutexType& getSubmitMutex() { return m_sqMutex; }
+
+  /**
+   * @brief 取count个连续的空闲SQE, 已清零
+   * @details 空间不足时先提交已有的SQE
+   * @return 失败返回nullptr
+   * */
+  io_uring_sqe* getSqe(uint32_t count = 1);
+
+  /**
+   * @brief 提交所有已填充的SQE(一次io_uring_enter)
+   * @return 提交的数量, 失败返回-1
+   * */
+  int submit();
+
+  /**
+   * @brief 取出所有完成事件
+   * @param[in] cb 完成回调(user_data, res)
+   * @return 处理的完成事件数量
+   * */
+  size_t reap(const std::function<void(uint64_t user_data, int res)>& cb);
+
+ private:
+  IOUring();
+
+  /**
+   * @brief 映射队列并检查操作码
+   * */
+  bool init(uint32_t entries);
+
+ private:
+  int m_fd = -1;
+  MutexType m_sqMutex;
+  MutexType m_cqMutex;
+
+  void* m_sqRing = nullptr;
+  size_t m_sqRingSize = 0;
+  void* m_cqRing = nullptr;
+  size_t m_cqRingSize = 0;
+  io_uring_sqe* m_sqes = nullptr;
+  size_t m_sqesSize = 0;
+
+  uint32_t* m_sqHead = nullptr;
+  uint32_t* m_sqTail = nullptr;
+  uint32_t* m_sqFlags = nullptr;
+  uint32_t* m_sqArray = nullptr;
+  uint32_t m_sqMask = 0;
+  uint32_t m_sqEntries = 0;
+  /// 已填充但还没发布给内核的尾部
+  uint32_t m_sqLocalTail = 0;
+
+  uint32_t* m_cqHead = nullptr;
+  uint32_t* m_cqTail = nullptr;
+  uint32_t m_cqMask = 0;
+  io_uring_cqe* m_cqes = nullptr;
+};
+
+}  // namespace sylar
+
+#endif
@@ -1,9 +1,14 @@
 #include "iomanager.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
+#include <new>
+#include "config.h"
 #include "log.h"
 #include "macro.h"
 
@@ -11,6 +16,48 @@ namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
 
+/// 当前线程正在处理epoll_wait返回事件的IOManager
+static thread_local IOManager* t_polling = nullptr;
+
+static ConfigVar<std::string>::ptr g_iomanager_backend =
+    Config::Lookup("iomanager.backend", std::string("epoll"),
+                   "iomanager backend, epoll or io_uring");
+
+static ConfigVar<bool>::ptr g_iomanager_persistent_event =
+    Config::Lookup("iomanager.persistent_event", false,
+                   "iomanager keep fd registered for EPOLLIN|EPOLLOUT "
+                   "edge-triggered until close");
+
+static ConfigVar<uint32_t>::ptr g_iomanager_io_uring_entries =
+    Config::Lookup("iomanager.io_uring.entries", (uint32_t)256,
+                   "iomanager io_uring submission queue entries");
+
+/// user_data 低位标记, IOUringWaiter 至少8字节对齐
+static const uint64_t URING_TAG_TIMEOUT = 1;
+static const uint64_t URING_TAG_MASK = 7;
+
+/**
+ * @brief 在io_uring上等待完成的请求, 放在发起请求的协程栈上
+ * */
+struct IOManager::IOUringWaiter {
+  /// 等待的协程
+  Fiber::ptr fiber;
+  /// 协程所在的调度器
+  Scheduler* scheduler = nullptr;
+  /// 请求所属的事件上下文
+  FdContext* fdCtx = nullptr;
+  /// 请求的事件类型
+  Event event = NONE;
+  /// 请求结果
+  int res = 0;
+  /// 还没收到的完成事件数量(请求本身, 超时)
+  int remaining = 0;
+  /// 是否超时
+  bool timedOut = false;
+  /// 超时时间
+  __kernel_timespec ts;
+};
+
 IOManager::FdContext::EventContext& IOManager::FdContext::getContext(
     IOManager::Event event) {
   switch (event) {
@@ -28,6 +75,7 @@ void IOManager::FdContext::resetContext(EventContext& ctx) {
   ctx.scheduler = nullptr;
   ctx.fiber.reset();
   ctx.cb = nullptr;
+  ctx.priority = Scheduler::DEFAULT;
 }
 
 void IOManager::FdContext::triggerEvent(IOManager::Event event) {
@@ -36,70 +84,137 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
   events = (Event)(events & ~event);  ///取反
   EventContext& ctx = getContext(event);
   if (ctx.cb) {
-    ctx.scheduler->schedule(&ctx.cb);
+    ctx.scheduler->schedule(&ctx.cb, -1, ctx.priority);
   } else {
-    ctx.scheduler->schedule(&ctx.fiber);
+    ctx.scheduler->schedule(&ctx.fiber, -1, ctx.priority);
   }
   ctx.scheduler = nullptr;
+  ctx.priority = Scheduler::DEFAULT;
   return;
 }
 
 IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
     : Scheduler(threads, use_caller, name) {
+  const std::string& backend = g_iomanager_backend->getValue();
+  if (backend == "io_uring") {
+    m_uring = IOUring::Create(g_iomanager_io_uring_entries->getValue());
+    if (!m_uring) {
+      SYLAR_LOG_WARN(g_logger) << "io_uring unavailable, fallback to epoll";
+    }
+  } else if (backend != "epoll") {
+    SYLAR_LOG_WARN(g_logger) << "unknown iomanager.backend=" << backend
+                             << ", use epoll";
+  }
+  m_persistent = g_iomanager_persistent_event->getValue();
+
   m_epfd = epoll_create(5000);
   SYLAR_ASSERT(m_epfd > 0);
 
-  int rt = pipe(m_trickleFds);
-  SYLAR_ASSERT(!rt);
+  m_pollerFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  SYLAR_ASSERT(m_pollerFd >= 0);
 
   epoll_event event;
   memset(&event, 0, sizeof(epoll_event));
   event.events = EPOLLIN | EPOLLET;
-  event.data.fd = m_trickleFds[0];
+  event.data.fd = m_pollerFd;
 
-  rt = fcntl(m_trickleFds[0], F_SETFL, O_NONBLOCK);
+  int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_pollerFd, &event);
   SYLAR_ASSERT(!rt);
 
-  rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_trickleFds[0], &event);
-  SYLAR_ASSERT(!rt);
-  contextResize(32);
+  void* mem = nullptr;
+  if (posix_memalign(&mem, alignof(Parker), sizeof(Parker) * getWorkerCount())) {
+    throw std::bad_alloc();
+  }
+  m_parkers = (Parker*)mem;
+  for (size_t i = 0; i < getWorkerCount(); ++i) {
+    new (&m_parkers[i]) Parker;
+    //阻塞读取, 线程休眠在read上
+    m_parkers[i].eventFd = eventfd(0, EFD_CLOEXEC);
+    SYLAR_ASSERT(m_parkers[i].eventFd >= 0);
+  }
+
+  if (m_uring) {
+    //完成队列有数据时io_uring句柄可读
+    event.data.fd = m_uring->getFd();
+    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_uring->getFd(), &event);
+    SYLAR_ASSERT(!rt);
+  }
+  for (int i = 0; i < FD_SEGMENT_COUNT; ++i) {
+    m_fdSegments[i].store(nullptr, std::memory_order_relaxed);
+  }
   Scheduler::Start();
 }
 
 IOManager::~IOManager() {
   Stop();
   close(m_epfd);
-  close(m_trickleFds[0]);
-  close(m_trickleFds[1]);
+  close(m_pollerFd);
+  for (size_t i = 0; i < getWorkerCount(); ++i) {
+    close(m_parkers[i].eventFd);
+    m_parkers[i].~Parker();
+  }
+  free(m_parkers);
 
-  for (size_t i = 0; i < m_fdContexts.size(); i++) {
-    if (m_fdContexts[i]) {
-      delete m_fdContexts[i];
-    }
+  for (int i = 0; i < FD_SEGMENT_COUNT; ++i) {
+    FreeSegment(m_fdSegments[i].load(std::memory_order_relaxed));
+  }
+}
+
+IOManager::FdContext* IOManager::AllocSegment(int base) {
+  static_assert(sizeof(FdContext) % 64 == 0,
+                "FdContext must fill whole cache lines");
+  void* mem = nullptr;
+  //C++11的new不保证超过16字节的对齐
+  if (posix_memalign(&mem, alignof(FdContext),
+                     sizeof(FdContext) * FD_SEGMENT_SIZE)) {
+    throw std::bad_alloc();
+  }
+  FdContext* segment = (FdContext*)mem;
+  for (int i = 0; i < FD_SEGMENT_SIZE; ++i) {
+    new (&segment[i]) FdContext;
+    segment[i].fd = base + i;
+  }
+  return segment;
+}
+
+void IOManager::FreeSegment(FdContext* segment) {
+  if (!segment) {
+    return;
+  }
+  for (int i = 0; i < FD_SEGMENT_SIZE; ++i) {
+    segment[i].~FdContext();
   }
+  free(segment);
 }
 
-void IOManager::contextResize(size_t size) {
-  m_fdContexts.resize(size);
-  for (size_t i = 0; i < m_fdContexts.size(); i++) {
-    if (!m_fdContexts[i]) {
-      m_fdContexts[i] = new FdContext;
-      m_fdContexts[i]->fd = i;
+IOManager::FdContext* IOManager::getFdContext(int fd, bool create) {
+  if (fd < 0 || fd >= FD_SEGMENT_SIZE * FD_SEGMENT_COUNT) {
+    return nullptr;
+  }
+  std::atomic<FdContext*>& slot = m_fdSegments[fd / FD_SEGMENT_SIZE];
+  FdContext* segment = slot.load(std::memory_order_acquire);
+  if (!segment) {
+    if (!create) {
+      return nullptr;
+    }
+    //多个线程同时分配时只保留一个
+    FdContext* fresh = AllocSegment(fd / FD_SEGMENT_SIZE * FD_SEGMENT_SIZE);
+    if (slot.compare_exchange_strong(segment, fresh,
+                                     std::memory_order_acq_rel,
+                                     std::memory_order_acquire)) {
+      segment = fresh;
+    } else {
+      FreeSegment(fresh);
     }
   }
+  return &segment[fd % FD_SEGMENT_SIZE];
 }
 
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-  FdContext* fd_ctx = nullptr;
-  RWMutexType::ReadLock lock(m_mutex);
-  if ((int)m_fdContexts.size() > fd) {
-    fd_ctx = m_fdContexts[fd];
-    lock.unlock();
-  } else {
-    lock.unlock();
-    RWMutexType::WriteLock lock2(m_mutex);
-    contextResize(fd * 1.5);
-    fd_ctx = m_fdContexts[fd];
+  FdContext* fd_ctx = getFdContext(fd);
+  if (!fd_ctx) {
+    SYLAR_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+    return -1;
   }
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
   if (fd_ctx->events & event) {
@@ -109,56 +224,68 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     SYLAR_ASSERT(!(fd_ctx->events & event));
   }
 
-  int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-  epoll_event epevent;
-  epevent.events = EPOLLET | fd_ctx->events | event;
-  epevent.data.ptr = fd_ctx;
+  if (m_persistent) {
+    if (!fd_ctx->registered) {
+      epoll_event epevent;
+      epevent.events = EPOLLET | EPOLLIN | EPOLLOUT;
+      epevent.data.ptr = fd_ctx;
+      int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &epevent);
+      if (rt) {
+        SYLAR_LOG_ERROR(g_logger)
+            << "epoll_ctl(" << m_epfd << "):" << EPOLL_CTL_ADD << "," << fd
+            << "," << epevent.events << "):" << rt << "(" << errno << ") ("
+            << strerror(errno) << ")";
+        return -1;
+      }
+      fd_ctx->registered = true;
+    }
+  } else {
+    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    epoll_event epevent;
+    epevent.events = EPOLLET | fd_ctx->events | event;
+    epevent.data.ptr = fd_ctx;
 
-  int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-  if (rt) {
-    SYLAR_LOG_ERROR(g_logger)
-        << "epoll_ctl(" << m_epfd << "):" << op << "," << fd << ","
-        << epevent.events << "):" << rt << "(" << errno << ") ("
-        << strerror(errno) << ")";
-    return -1;
+    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    if (rt) {
+      SYLAR_LOG_ERROR(g_logger)
+          << "epoll_ctl(" << m_epfd << "):" << op << "," << fd << ","
+          << epevent.events << "):" << rt << "(" << errno << ") ("
+          << strerror(errno) << ")";
+      return -1;
+    }
   }
   ++m_pendingEventCount;
   fd_ctx->events = (Event)(fd_ctx->events | event);
   FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
   SYLAR_ASSERT(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
   event_ctx.scheduler = Scheduler::GetThis();
+  event_ctx.priority = Scheduler::GetCurrentPriority();
   if (cb) {
     event_ctx.cb.swap(cb);
   } else {
     event_ctx.fiber = Fiber::GetThis();
     SYLAR_ASSERT(event_ctx.fiber->getState() == Fiber::EXEC);
   }
+  if (fd_ctx->ready & event) {
+    //上次的边沿通知没有人等待, 句柄可能已经就绪, 直接唤醒去重试
+    fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+    fd_ctx->triggerEvent(event);
+    --m_pendingEventCount;
+  }
   return 0;
 }
 
 bool IOManager::delEvent(int fd, Event event) {
-  RWMutexType::ReadLock lock(m_mutex);
-  if ((int)m_fdContexts.size() <= fd) {
+  FdContext* fd_ctx = getFdContext(fd, false);
+  if (!fd_ctx) {
     return false;
   }
-  FdContext* fd_ctx = m_fdContexts[fd];
-  lock.unlock();
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
   if (!(fd_ctx->events & event)) {
     return false;
   }
   Event new_events = (Event)(fd_ctx->events & ~event);
-  int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-  epoll_event epevent;
-  epevent.events = EPOLLET | new_events;
-  epevent.data.ptr = fd_ctx;
-
-  int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-  if (rt) {
-    SYLAR_LOG_ERROR(g_logger)
-        << "epoll_ctl(" << m_epfd << "):" << op << "," << fd << ","
-        << epevent.events << "):" << rt << "(" << errno << ") ("
-        << strerror(errno) << ")";
+  if (!m_persistent && !updateEpoll(fd_ctx, new_events)) {
     return false;
   }
   --m_pendingEventCount;
@@ -169,28 +296,19 @@ bool IOManager::delEvent(int fd, Event event) {
 }
 
 bool IOManager::cancelEvent(int fd, Event event) {
-  RWMutexType::ReadLock lock(m_mutex);
-  if ((int)m_fdContexts.size() <= fd) {
+  FdContext* fd_ctx = getFdContext(fd, false);
+  if (!fd_ctx) {
     return false;
   }
-  FdContext* fd_ctx = m_fdContexts[fd];
-  lock.unlock();
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+  if (cancelIOUring(fd_ctx, event)) {
+    return true;
+  }
   if (!(fd_ctx->events & event)) {
     return false;
   }
   Event new_events = (Event)(fd_ctx->events & ~event);
-  int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-  epoll_event epevent;
-  epevent.events = EPOLLET | new_events;
-  epevent.data.ptr = fd_ctx;
-
-  int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-  if (rt) {
-    SYLAR_LOG_ERROR(g_logger)
-        << "epoll_ctl(" << m_epfd << "):" << op << "," << fd << ","
-        << epevent.events << "):" << rt << "(" << errno << ") ("
-        << strerror(errno) << ")";
+  if (!m_persistent && !updateEpoll(fd_ctx, new_events)) {
     return false;
   }
   fd_ctx->triggerEvent(event);
@@ -199,52 +317,237 @@ bool IOManager::cancelEvent(int fd, Event event) {
 }
 
 bool IOManager::cancelAll(int fd) {
-  RWMutexType::ReadLock lock(m_mutex);
-  if ((int)m_fdContexts.size() <= fd) {
+  FdContext* fd_ctx = getFdContext(fd, false);
+  if (!fd_ctx) {
     return false;
   }
-  FdContext* fd_ctx = m_fdContexts[fd];
-  lock.unlock();
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-  if (fd_ctx->events) {
+  bool cancelled = cancelIOUring(fd_ctx, READ);
+  cancelled = cancelIOUring(fd_ctx, WRITE) || cancelled;
+  if (fd_ctx->registered) {
+    //常驻注册的句柄在关闭前移除, 句柄号复用时重新注册
+    updateEpoll(fd_ctx, NONE);
+    fd_ctx->registered = false;
+    fd_ctx->ready = NONE;
+  } else if (!fd_ctx->events) {
+    return cancelled;
+  } else if (!updateEpoll(fd_ctx, NONE)) {
     return false;
   }
-  int op = EPOLL_CTL_DEL;
+  if (fd_ctx->events & READ) {
+    fd_ctx->triggerEvent(READ);
+    --m_pendingEventCount;
+  }
+  if (fd_ctx->events & WRITE) {
+    fd_ctx->triggerEvent(WRITE);
+    --m_pendingEventCount;
+  }
+  SYLAR_ASSERT(fd_ctx->events == 0);
+  return true;
+}
+
+bool IOManager::updateEpoll(FdContext* fd_ctx, Event new_events) {
+  int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
   epoll_event epevent;
-  epevent.events = 0;
+  epevent.events = EPOLLET | new_events;
   epevent.data.ptr = fd_ctx;
 
-  int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+  int rt = epoll_ctl(m_epfd, op, fd_ctx->fd, &epevent);
   if (rt) {
     SYLAR_LOG_ERROR(g_logger)
-        << "epoll_ctl(" << m_epfd << "):" << op << "," << fd << ","
+        << "epoll_ctl(" << m_epfd << "):" << op << "," << fd_ctx->fd << ","
         << epevent.events << "):" << rt << "(" << errno << ") ("
         << strerror(errno) << ")";
     return false;
   }
-  if (fd_ctx->events & READ) {
-    fd_ctx->triggerEvent(READ);
-    --m_pendingEventCount;
+  return true;
+}
+
+bool IOManager::submitIO(int fd, Event event, const IOUringRequest& req,
+                         uint64_t timeout_ms, int& res) {
+  if (!m_uring) {
+    return false;
   }
-  if (fd_ctx->events & WRITE) {
-    fd_ctx->triggerEvent(WRITE);
-    --m_pendingEventCount;
+  Fiber::ptr fiber = Fiber::GetThis();
+  if (fiber->isSharedStack()) {
+    return false;
+  }
+  FdContext* fd_ctx = getFdContext(fd);
+  if (!fd_ctx) {
+    return false;
+  }
+
+  IOUringWaiter waiter;
+  waiter.scheduler = Scheduler::GetThis();
+  waiter.fdCtx = fd_ctx;
+  waiter.event = event;
+  waiter.remaining = timeout_ms != (uint64_t)-1 ? 2 : 1;
+  waiter.ts.tv_sec = timeout_ms / 1000;
+  waiter.ts.tv_nsec = timeout_ms % 1000 * 1000000;
+  {
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    IOUringWaiter*& slot =
+        event == READ ? fd_ctx->uringRead : fd_ctx->uringWrite;
+    SYLAR_ASSERT(!slot);
+
+    IOUring::MutexType::Lock lock2(m_uring->getSubmitMutex());
+    io_uring_sqe* sqe = m_uring->getSqe(waiter.remaining);
+    if (!sqe) {
+      return false;
+    }
+    sqe->opcode = req.opcode;
+    sqe->fd = fd;
+    sqe->addr = req.addr;
+    sqe->len = req.len;
+    sqe->off = req.off;
+    sqe->rw_flags = req.opFlags;
+    sqe->addr2 = req.addr2;
+    sqe->user_data = (uint64_t)&waiter;
+    if (timeout_ms != (uint64_t)-1) {
+      sqe->flags |= IOSQE_IO_LINK;
+      io_uring_sqe* tsqe = sqe + 1;
+      tsqe->opcode = IORING_OP_LINK_TIMEOUT;
+      tsqe->fd = -1;
+      tsqe->addr = (uint64_t)&waiter.ts;
+      tsqe->len = 1;
+      tsqe->user_data = (uint64_t)&waiter | URING_TAG_TIMEOUT;
+    }
+    waiter.fiber = fiber;
+    slot = &waiter;
+    ++m_pendingEventCount;
+    m_uring->submit();
+  }
+  fiber.reset();
+  Fiber::YieldToHold();
+
+  res = waiter.res;
+  if (waiter.timedOut && res == -ECANCELED) {
+    res = -ETIMEDOUT;
   }
-  SYLAR_ASSERT(fd_ctx->events == 0);
   return true;
 }
 
+bool IOManager::cancelIOUring(FdContext* fd_ctx, Event event) {
+  if (!m_uring) {
+    return false;
+  }
+  IOUringWaiter*& slot =
+      event == READ ? fd_ctx->uringRead : fd_ctx->uringWrite;
+  if (!slot) {
+    return false;
+  }
+  IOUring::MutexType::Lock lock(m_uring->getSubmitMutex());
+  io_uring_sqe* sqe = m_uring->getSqe();
+  if (!sqe) {
+    SYLAR_LOG_ERROR(g_logger) << "cancelIOUring fd=" << fd_ctx->fd
+                              << " event=" << event << " no sqe";
+    return false;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = (uint64_t)slot;
+  //取消请求自身的完成事件不需要处理
+  sqe->user_data = 0;
+  slot = nullptr;
+  m_uring->submit();
+  return true;
+}
+
+void IOManager::reapIOUring() {
+  m_uring->reap([this](uint64_t user_data, int res) {
+    IOUringWaiter* waiter = (IOUringWaiter*)(user_data & ~URING_TAG_MASK);
+    if (!waiter) {
+      return;
+    }
+    if (user_data & URING_TAG_TIMEOUT) {
+      waiter->timedOut = res == -ETIME;
+    } else {
+      waiter->res = res;
+      FdContext* fd_ctx = waiter->fdCtx;
+      FdContext::MutexType::Lock lock(fd_ctx->mutex);
+      IOUringWaiter*& slot =
+          waiter->event == READ ? fd_ctx->uringRead : fd_ctx->uringWrite;
+      if (slot == waiter) {
+        slot = nullptr;
+      }
+    }
+    if (--waiter->remaining > 0) {
+      return;
+    }
+    //调度之后waiter所在的协程栈随时可能被释放
+    Fiber::ptr fiber;
+    fiber.swap(waiter->fiber);
+    Scheduler* scheduler = waiter->scheduler;
+    --m_pendingEventCount;
+    scheduler->schedule(&fiber);
+  });
+}
+
 IOManager* IOManager::GetThis() {
   return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
 
-void IOManager::trickle() {
-  if (!hasIdleThreads()) {
+void IOManager::trickle(int index) {
+  if (index >= 0) {
+    wakeWorker(index);
+    return;
+  }
+  //处理完事件的线程自己会去执行任务, 多出来的任务由它在run()中接力唤醒
+  if (t_polling == this) {
     return;
   }
-  int rt = write(m_trickleFds[1], "T", 1);
-  SYLAR_ASSERT(rt == 1);
+  if (!wakeParked() && m_poller >= 0) {
+    wakePoller();
+  }
+}
+
+void IOManager::wakeWorker(int index) {
+  Parker& parker = m_parkers[index];
+  int state = parker.state;
+  if (state == PARKED) {
+    if (!parker.notified.exchange(true)) {
+      int rt = eventfd_write(parker.eventFd, 1);
+      SYLAR_ASSERT(rt == 0);
+    }
+  } else if (state == POLLING) {
+    wakePoller();
+  }
 }
+
+bool IOManager::wakeParked() {
+  size_t count = getWorkerCount();
+  size_t start = m_nextWake++ % count;
+  Parker* target = nullptr;
+  for (size_t n = 0; n < count; ++n) {
+    Parker& parker = m_parkers[(start + n) % count];
+    if (parker.state != PARKED) {
+      continue;
+    }
+    //已经叫过的线程醒来后还有任务会接力唤醒, 不再多叫一个
+    if (parker.notified) {
+      return true;
+    }
+    if (!target) {
+      target = &parker;
+    }
+  }
+  if (!target) {
+    return false;
+  }
+  if (!target->notified.exchange(true)) {
+    int rt = eventfd_write(target->eventFd, 1);
+    SYLAR_ASSERT(rt == 0);
+  }
+  return true;
+}
+
+void IOManager::wakePoller() {
+  if (!m_pollerNotified.exchange(true)) {
+    int rt = eventfd_write(m_pollerFd, 1);
+    SYLAR_ASSERT(rt == 0);
+  }
+}
+
 bool IOManager::stopping(uint64_t& timeout) {
   timeout = getNextTimer();
   return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
@@ -260,6 +563,8 @@ void IOManager::idle() {
   std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr) {
     delete[] ptr;
   });  /// 通过智能指针加了一个析构的方法
+  int index = getCurrentWorkerIndex();
+  Parker& self = m_parkers[index];
 
   while (true) {
     uint64_t next_timeout = 0;
@@ -267,6 +572,47 @@ void IOManager::idle() {
       SYLAR_LOG_INFO(g_logger) << "name=" << getName() << " idle stopping exit";
       break;
     }
+    //同一时间只有一个线程在epoll_wait中, 其它线程在自己的eventfd上休眠
+    int expected = -1;
+    bool poller = m_poller.compare_exchange_strong(expected, index);
+    self.state = poller ? POLLING : PARKED;
+    //设置状态之后再检查一次, 放入任务的一方没看到休眠状态时这里能看到任务
+    if (hasTask(index) || (m_stopping && stopping())) {
+      self.state = ACTIVE;
+      if (poller) {
+        m_poller = -1;
+        wakeParked();
+      }
+      Fiber::ptr cur = Fiber::GetThis();
+      auto raw_ptr = cur.get();
+      cur.reset();
+      raw_ptr->swapOut();
+      continue;
+    }
+    if (!poller) {
+      eventfd_t value = 0;
+      while (eventfd_read(self.eventFd, &value) != 0 && errno == EINTR)
+        ;
+      ++m_wakeups;
+      self.notified = false;
+      self.state = ACTIVE;
+      bool has_task = hasTask(index);
+      if (has_task && m_poller < 0) {
+        //自己去执行任务, 接着叫醒下一个线程接替epoll_wait
+        wakeParked();
+      } else if (!has_task && m_poller >= 0 && !m_stopping) {
+        //醒来后没有任务, 也没有空出来的epoll_wait要接替
+        ++m_futileWakeups;
+      }
+      Fiber::ptr cur = Fiber::GetThis();
+      auto raw_ptr = cur.get();
+      cur.reset();
+      raw_ptr->swapOut();
+      continue;
+    }
+
+    //成为poller之后再取超时时间, 之前插入的定时器不会因为没人叫醒而延迟
+    next_timeout = getNextTimer();
     int rt = 0;
     do {
       static const int MAX_TIMEOUT = 3000;
@@ -282,20 +628,36 @@ void IOManager::idle() {
         break;
       }
     } while (true);
+    self.state = ACTIVE;
+    m_poller = -1;
+    t_polling = this;
+    bool woken = false;
+    bool handled = false;
     std::vector<std::function<void()>> cbs;
+    /// 定时器已取出但回调还没放进队列时, 其它线程不能判定为可以停止,
+    /// 否则绑定在那些线程上的共享栈协程将无法再被执行
+    ++m_activeThreadCount;
     listExpiredCb(cbs);
     if (!cbs.empty()) {
       //      SYLAR_LOG_INFO(g_logger) << "on timer cbs.size = " << cbs.size();
+      handled = true;
       schedule(cbs.begin(), cbs.end());
       cbs.clear();
     }
+    --m_activeThreadCount;
 
     for (int i = 0; i < rt; i++) {
       epoll_event& event = events[i];
-      if (event.data.fd == m_trickleFds[0]) {
-        uint8_t dummy;
-        while (read(m_trickleFds[0], &dummy, 1) == 1)
-          ;
+      if (event.data.fd == m_pollerFd) {
+        m_pollerNotified = false;
+        eventfd_t value = 0;
+        eventfd_read(m_pollerFd, &value);
+        woken = true;
+        continue;
+      }
+      handled = true;
+      if (m_uring && event.data.fd == m_uring->getFd()) {
+        reapIOUring();
         continue;
       }
       FdContext* fd_ctx = (FdContext*)event.data.ptr;
@@ -311,6 +673,23 @@ void IOManager::idle() {
       if (event.events & EPOLLOUT) {
         real_events |= WRITE;
       }
+      if (m_persistent) {
+        if (event.events & (EPOLLERR | EPOLLHUP)) {
+          real_events = READ | WRITE;
+        }
+        //没有人等待的就绪状态记下来, 下次addEvent时直接唤醒
+        fd_ctx->ready =
+            (Event)(fd_ctx->ready | (real_events & ~fd_ctx->events));
+        if (real_events & fd_ctx->events & READ) {
+          fd_ctx->triggerEvent(READ);
+          --m_pendingEventCount;
+        }
+        if (real_events & fd_ctx->events & WRITE) {
+          fd_ctx->triggerEvent(WRITE);
+          --m_pendingEventCount;
+        }
+        continue;
+      }
       if ((fd_ctx->events & real_events) == NONE) {
         continue;
       }
@@ -336,6 +715,18 @@ void IOManager::idle() {
         --m_pendingEventCount;
       }
     }
+    t_polling = nullptr;
+    bool has_task = hasTask(index);
+    if (woken) {
+      ++m_wakeups;
+      if (!has_task && !handled && !m_stopping) {
+        ++m_futileWakeups;
+      }
+    }
+    //自己去执行任务, 叫醒一个休眠的线程接替epoll_wait
+    if (has_task) {
+      wakeParked();
+    }
     Fiber::ptr cur = Fiber::GetThis();
     auto raw_ptr = cur.get();
     cur.reset();
@@ -344,7 +735,10 @@ void IOManager::idle() {
 }
 
 void IOManager::onTimerInsertedAtFront() {
-  trickle();
+  //只有epoll_wait中的线程等待定时器, 没有时下一个进入的线程会重新取超时时间
+  if (m_poller >= 0) {
+    wakePoller();
+  }
 }
 
 }  // namespace sylar
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef __SYLAR_IOMANAGER_H__
 #define __SYLAR_IOMANAGER_H__
 
+#include <atomic>
+#include "io_uring.h"
 #include "scheduler.h"
 #include "timer.h"
 
@@ -20,8 +22,32 @@ class IOManager : public Scheduler, public TimerManager {
     WRITE = 0x4,
   };
 
+  /**
+   * @brief io_uring 请求, 字段与 io_uring_sqe 中同名字段含义相同
+   * */
+  struct IOUringRequest {
+    /// 操作码(IORING_OP_*)
+    uint8_t opcode = 0;
+    /// 缓冲区/iovec/msghdr/sockaddr 地址
+    uint64_t addr = 0;
+    /// 长度/iovec数量
+    uint32_t len = 0;
+    /// 文件偏移
+    uint64_t off = 0;
+    /// msg_flags/accept_flags/poll32_events
+    uint32_t opFlags = 0;
+    /// accept 的地址长度指针
+    uint64_t addr2 = 0;
+  };
+
  private:
-  struct FdContext {
+  struct IOUringWaiter;
+
+  /**
+   * @brief 句柄的事件上下文
+   * @details 按缓存行对齐, 大小也是缓存行的整数倍, 两个句柄不会共用一行
+   * */
+  struct alignas(64) FdContext {
     typedef Mutex MutexType;
 
     struct EventContext {
@@ -31,6 +57,8 @@ class IOManager : public Scheduler, public TimerManager {
       Fiber::ptr fiber;
       /// 事件的回调函数
       std::function<void()> cb;
+      /// 添加事件时任务的优先级, 事件触发后按这个优先级调度
+      Scheduler::Priority priority = Scheduler::DEFAULT;
     };
     /**
      * @brief 获取事件上下文
@@ -59,11 +87,25 @@ class IOManager : public Scheduler, public TimerManager {
     EventContext write;
     /// 当前的事件
     Event events = NONE;
+    /// 常驻注册模式下, 没有人等待时收到的就绪事件
+    Event ready = NONE;
+    /// 常驻注册模式下, 是否已经注册到epoll
+    bool registered = false;
+    /// io_uring 上等待完成的读请求
+    IOUringWaiter* uringRead = nullptr;
+    /// io_uring 上等待完成的写请求
+    IOUringWaiter* uringWrite = nullptr;
     /// 事件的Mutex
     MutexType mutex;
   };
 
  public:
+  /**
+   * @brief 构造函数
+   * @details 配置iomanager.persistent_event为true时, 句柄第一次等待时注册
+   *          EPOLLIN|EPOLLOUT边沿触发, 直到cancelAll(close)才移除,
+   *          等待和唤醒都不再调用epoll_ctl. 这种模式下句柄需要通过hook的close关闭
+   * */
   IOManager(size_t threads = 1, bool use_caller = true,
             const std::string& name = "");
 
@@ -98,30 +140,153 @@ class IOManager : public Scheduler, public TimerManager {
    * */
   bool cancelAll(int fd);
 
+  /**
+   * @brief 是否使用io_uring后端
+   * */
+  bool isIOUring() const { return !!m_uring; }
+
+  /**
+   * @brief 通过io_uring执行请求, 当前协程挂起直到请求完成
+   * @param[in] fd socket句柄
+   * @param[in] event 请求对应的事件类型, 用于cancelEvent/cancelAll
+   * @param[in] req 请求
+   * @param[in] timeout_ms 超时时间, -1表示不超时
+   * @param[out] res 请求结果, 失败为-errno, 超时为-ETIMEDOUT
+   * @return 没有使用io_uring或者无法提交时返回false, 调用方应使用epoll等待
+   * @attention 共享栈协程的栈在切出后会被覆盖, 不能把栈上的缓冲区交给内核,
+   *            这种情况也返回false
+   * */
+  bool submitIO(int fd, Event event, const IOUringRequest& req,
+                uint64_t timeout_ms, int& res);
+
   /**
    * @brief 返回当前的IOManager
    * */
   static IOManager* GetThis();
 
+  /**
+   * @brief 空闲线程被唤醒的次数
+   * */
+  uint64_t getWakeups() const { return m_wakeups; }
+
+  /**
+   * @brief 醒来后既没有任务可执行也不需要接替epoll_wait的唤醒次数
+   * */
+  uint64_t getFutileWakeups() const { return m_futileWakeups; }
+
  protected:
-  void trickle() override;
+  void trickle(int index = TRICKLE_ANY) override;
   bool stopping() override;
   void idle() override;
   void onTimerInsertedAtFront() override;
-  void contextResize(size_t size);
   bool stopping(uint64_t& timeout);
 
+ private:
+  /// 空闲线程的休眠状态
+  enum ParkState {
+    /// 在执行任务
+    ACTIVE = 0,
+    /// 在自己的eventfd上休眠
+    PARKED = 1,
+    /// 在epoll_wait中等待IO事件和定时器
+    POLLING = 2,
+  };
+
+  /**
+   * @brief 工作线程的休眠信息, 每个线程独占一个缓存行
+   * @details 同一时间只有一个空闲线程在epoll_wait中, 其它空闲线程阻塞
+   *          读取自己的eventfd, 唤醒时只叫醒一个线程
+   * */
+  struct alignas(64) Parker {
+    /// 休眠时阻塞读取的eventfd
+    int eventFd = -1;
+    /// 休眠状态 ParkState
+    std::atomic<int> state = {ACTIVE};
+    /// 已经写过eventfd但线程还没醒来, 重复的唤醒合并掉
+    std::atomic<bool> notified = {false};
+  };
+
+  /**
+   * @brief 叫醒下标为index的工作线程, 线程不在休眠时什么都不做
+   * */
+  void wakeWorker(int index);
+
+  /**
+   * @brief 叫醒一个在eventfd上休眠的线程
+   * @return 有没有休眠的线程, 包括已经叫过还没醒来的
+   * */
+  bool wakeParked();
+
+  /**
+   * @brief 叫醒epoll_wait中的线程
+   * */
+  void wakePoller();
+
+  /// 每段的事件上下文数
+  static const int FD_SEGMENT_SIZE = 1024;
+  /// 段数, 能管理的句柄范围和FdManager相同
+  static const int FD_SEGMENT_COUNT = 4096;
+
+  /**
+   * @brief 取fd对应的事件上下文, 不加锁
+   * @param[in] create 所在的段不存在时是否分配
+   * @return fd超出范围或者段不存在时返回nullptr
+   * */
+  FdContext* getFdContext(int fd, bool create = true);
+
+  /**
+   * @brief 分配一段按缓存行对齐的事件上下文
+   * @param[in] base 段中第一个上下文的句柄
+   * */
+  static FdContext* AllocSegment(int base);
+
+  /**
+   * @brief 释放AllocSegment分配的段
+   * */
+  static void FreeSegment(FdContext* segment);
+
+  /**
+   * @brief 修改epoll中注册的事件, 需要持有fd_ctx->mutex
+   * @param[in] new_events 新的事件, NONE表示从epoll中删除
+   * */
+  bool updateEpoll(FdContext* fd_ctx, Event new_events);
+
+  /**
+   * @brief 取消fd在io_uring上等待的请求, 需要持有fd_ctx->mutex
+   * @return 是否有请求被取消
+   * */
+  bool cancelIOUring(FdContext* fd_ctx, Event event);
+
+  /**
+   * @brief 处理io_uring的所有完成事件
+   * */
+  void reapIOUring();
+
  private:
   /// epoll 文件句柄
   int m_epfd = 0;
-  /// pipe 文件句柄
-  int m_trickleFds[2];
+  /// 叫醒epoll_wait中线程的eventfd
+  int m_pollerFd = -1;
+  /// 已经写过m_pollerFd还没读出
+  std::atomic<bool> m_pollerNotified = {false};
+  /// epoll_wait中的工作线程下标, -1表示没有
+  std::atomic<int> m_poller = {-1};
+  /// 每个工作线程的休眠信息, 下标和工作线程下标相同
+  Parker* m_parkers = nullptr;
+  /// 下次从哪个线程开始找休眠的线程, 让唤醒分散到各个线程
+  std::atomic<uint32_t> m_nextWake = {0};
+  /// 唤醒次数
+  std::atomic<uint64_t> m_wakeups = {0};
+  /// 无效唤醒次数
+  std::atomic<uint64_t> m_futileWakeups = {0};
   /// 当前等待执行的事件数量
   std::atomic<size_t> m_pendingEventCount = {0};
-  /// IOManager的Mutex
-  RWMutexType m_mutex;
-  /// socket事件上下文的容器
-  std::vector<FdContext*> m_fdContexts;
+  /// 事件上下文, 按句柄分段, 段分配后不会移动, 直到析构才释放
+  std::atomic<FdContext*> m_fdSegments[FD_SEGMENT_COUNT];
+  /// io_uring, 为空时只使用epoll
+  IOUring::ptr m_uring;
+  /// 句柄是否常驻注册EPOLLIN|EPOLLOUT, 就绪状态缓存在FdContext中
+  bool m_persistent = false;
 };
 
 }  // namespace sylar
@@ -1,4 +1,7 @@
 #include "log.h"
+#include <sched.h>
+#include <string.h>
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <map>
@@ -46,6 +49,11 @@ LogLevel::Level LogLevel::FromString(const std::string& str) {
 
 LogEventWrap::LogEventWrap(LogEvent::ptr e) : m_event(e) {}
 
+LogEventWrap::LogEventWrap(std::shared_ptr<Logger> logger,
+                           LogLevel::Level level, const char* file,
+                           int32_t line)
+    : m_event(LogEvent::Create(logger, level, file, line)) {}
+
 LogEventWrap::~LogEventWrap() {
   m_event->getLogger()->log(m_event->getLevel(), m_event);
 }
@@ -57,18 +65,71 @@ void LogEvent::format(const char* fmt, ...) {
   va_end(al);
 }
 void LogEvent::format(const char* fmt, va_list al) {
-  char* buf = nullptr;
-  int len = vasprintf(&buf, fmt, al);
-  if (len != -1) {
-    m_ss << std::string(buf, len);
-    free(buf);
+  char buf[LogStream::kInlineSize];
+  va_list ap;
+  va_copy(ap, al);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len < 0) {
+    return;
+  }
+  if ((size_t)len < sizeof(buf)) {
+    m_ss.write(buf, len);
+    return;
   }
+  std::string str(len + 1, '\0');
+  vsnprintf(&str[0], str.size(), fmt, al);
+  m_ss.write(str.c_str(), len);
 }
 
-std::stringstream& LogEventWrap::getSS() {
+LogStream& LogEventWrap::getSS() {
   return m_event->getSS();
 }
 
+LogStream::Buffer::Buffer() {
+  setp(m_inline, m_inline + kInlineSize);
+}
+
+void LogStream::Buffer::reset() {
+  //偶尔的超长日志不应该让每个缓存的事件一直占着大块内存
+  if (m_heap.capacity() > kInlineSize * 128) {
+    std::string().swap(m_heap);
+  }
+  setp(m_inline, m_inline + kInlineSize);
+}
+
+LogStream::Buffer::int_type LogStream::Buffer::overflow(int_type ch) {
+  size_t used = pptr() - pbase();
+  size_t cap = std::max(used * 2, kInlineSize * 2);
+  if (pbase() == m_inline) {
+    m_heap.resize(cap);
+    memcpy(&m_heap[0], m_inline, used);
+  } else {
+    m_heap.resize(cap);
+  }
+  setp(&m_heap[0], &m_heap[0] + cap);
+  pbump(used);
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+LogStream::LogStream() : std::ostream(nullptr) {
+  rdbuf(&m_buf);
+}
+
+void LogStream::reset() {
+  m_buf.reset();
+  clear();
+  //上一条日志设置的格式不能带到下一条, 恢复成新流的默认值
+  flags(std::ios_base::dec | std::ios_base::skipws);
+  precision(6);
+  width(0);
+  fill(' ');
+}
+
 void LogAppender::setFormatter(LogFormatter::ptr val) {
   MutexType::Lock lock(m_mutex);
   m_formatter = val;
@@ -89,7 +150,7 @@ class MessageFormatItem : public LogFormatter::FormatItem {
   MessageFormatItem(const std::string& str = "") {}
   void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
               LogEvent::ptr event) override {
-    os << event->getContent();
+    os.write(event->getContentData(), event->getContentSize());
   }
 };
 
@@ -234,6 +295,61 @@ LogEvent::LogEvent(std::shared_ptr<Logger> Logger, LogLevel::Level level,
       m_logger(Logger),
       m_level(level) {}
 
+void LogEvent::reset(std::shared_ptr<Logger> logger, LogLevel::Level level,
+                     const char* file, int32_t line, uint32_t threadId,
+                     uint32_t fiberId, uint64_t time,
+                     const std::string& thread_name) {
+  m_file = file;
+  m_line = line;
+  m_threadId = threadId;
+  m_fiberId = fiberId;
+  m_time = time;
+  m_elapse = 0;
+  m_thread_name = thread_name;
+  m_ss.reset();
+  m_logger = logger;
+  m_level = level;
+}
+
+/// 每个线程缓存的日志事件个数
+static const size_t s_event_cache_size = 16;
+
+/// 线程退出时缓存先于静态对象析构, 之后的日志不再使用缓存
+static thread_local bool t_event_cache_destroyed = false;
+
+struct LogEventCache {
+  ~LogEventCache() { t_event_cache_destroyed = true; }
+  std::vector<LogEvent::ptr> events;
+};
+
+LogEvent::ptr LogEvent::Create(std::shared_ptr<Logger> logger,
+                               LogLevel::Level level, const char* file,
+                               int32_t line) {
+  static thread_local LogEventCache t_cache;
+  LogEvent::ptr event;
+  if (!t_event_cache_destroyed) {
+    for (auto& i : t_cache.events) {
+      //只有缓存自己持有的事件才能复用
+      if (i.use_count() == 1) {
+        //与其他线程释放引用配对, 它对事件的读取都已完成
+        std::atomic_thread_fence(std::memory_order_acquire);
+        event = i;
+        break;
+      }
+    }
+  }
+  if (!event) {
+    event.reset(new LogEvent);
+    if (!t_event_cache_destroyed &&
+        t_cache.events.size() < s_event_cache_size) {
+      t_cache.events.push_back(event);
+    }
+  }
+  event->reset(logger, level, file, line, GetThreadId(), GetFiberId(), time(0),
+               Thread::GetName());
+  return event;
+}
+
 Logger::Logger(const std::string& name)
     : m_name(name), m_level(LogLevel::DEBUG) {
   /// 设置日志格式化器的格式
@@ -385,11 +501,202 @@ bool FileLogAppender::reopen() {
   return !!m_filestream;
 }
 
+AsyncLogAppender::AsyncLogAppender(LogAppender::ptr appender, size_t capacity,
+                                   OverflowPolicy policy,
+                                   LogLevel::Level overflow_level)
+    : m_appender(appender), m_policy(policy), m_overflowLevel(overflow_level) {
+  size_t size = 2;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  m_mask = size - 1;
+  m_slots.reset(new Slot[size]);
+  for (size_t i = 0; i < size; ++i) {
+    m_slots[i].seq.store(i, std::memory_order_relaxed);
+  }
+  for (auto& i : m_dropped) {
+    i.store(0, std::memory_order_relaxed);
+  }
+  m_thread.reset(
+      new Thread(std::bind(&AsyncLogAppender::run, this), "log_async"));
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+  m_stopping = true;
+  m_sem.notify();
+  m_thread->join();
+}
+
+void AsyncLogAppender::log(Logger::ptr logger, LogLevel::Level level,
+                           LogEvent::ptr event) {
+  if (level < m_level) {
+    return;
+  }
+  if (push(logger, level, event)) {
+    return;
+  }
+  if (m_policy == DROP || (m_policy == DROP_LOW && level < m_overflowLevel)) {
+    if (level <= LogLevel::FATAL) {
+      m_dropped[level].fetch_add(1, std::memory_order_relaxed);
+    }
+    return;
+  }
+  //后台线程写出需要时间, 让出cpu等待空位
+  while (!push(logger, level, event)) {
+    wakeup();
+    sched_yield();
+  }
+}
+
+bool AsyncLogAppender::push(const Logger::ptr& logger, LogLevel::Level level,
+                            const LogEvent::ptr& event) {
+  size_t pos = m_tail.load(std::memory_order_relaxed);
+  Slot* slot = nullptr;
+  while (true) {
+    slot = &m_slots[pos & m_mask];
+    size_t seq = slot->seq.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (m_tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      //上一圈的日志还没被取走, 队列满
+      return false;
+    } else {
+      pos = m_tail.load(std::memory_order_relaxed);
+    }
+  }
+  slot->logger = logger;
+  slot->level = level;
+  slot->event = event;
+  slot->seq.store(pos + 1, std::memory_order_release);
+  //与后台线程设置m_sleeping后检查队列配对, 保证不会漏掉唤醒
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  wakeup();
+  return true;
+}
+
+void AsyncLogAppender::wakeup() {
+  if (m_sleeping.load(std::memory_order_relaxed) && m_sleeping.exchange(false)) {
+    m_sem.notify();
+  }
+}
+
+void AsyncLogAppender::run() {
+  struct Item {
+    Logger::ptr logger;
+    LogLevel::Level level;
+    LogEvent::ptr event;
+  };
+  static const size_t s_batch = 256;
+  std::vector<Item> batch;
+  batch.reserve(s_batch);
+  while (true) {
+    while (batch.size() < s_batch) {
+      Slot& slot = m_slots[m_head & m_mask];
+      if (slot.seq.load(std::memory_order_acquire) != m_head + 1) {
+        break;
+      }
+      batch.push_back(
+          {std::move(slot.logger), slot.level, std::move(slot.event)});
+      slot.seq.store(m_head + m_mask + 1, std::memory_order_release);
+      ++m_head;
+    }
+    if (!batch.empty()) {
+      //被包装的Appender没有自己的格式时跟随日志器的格式
+      LogFormatter::ptr fmt = getFormatter();
+      if (fmt) {
+        MutexType::Lock lock(m_appender->m_mutex);
+        if (!m_appender->m_hasFormatter) {
+          m_appender->m_formatter = fmt;
+        }
+      }
+      for (auto& i : batch) {
+        m_appender->log(i.logger, i.level, i.event);
+      }
+      m_written.fetch_add(batch.size(), std::memory_order_release);
+      batch.clear();
+      continue;
+    }
+    if (m_stopping) {
+      break;
+    }
+    m_sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Slot& slot = m_slots[m_head & m_mask];
+    if (slot.seq.load(std::memory_order_acquire) == m_head + 1 || m_stopping) {
+      m_sleeping = false;
+      continue;
+    }
+    m_sem.wait();
+  }
+}
+
+void AsyncLogAppender::flush() {
+  size_t target = m_tail.load(std::memory_order_acquire);
+  while (m_written.load(std::memory_order_acquire) < target) {
+    wakeup();
+    sched_yield();
+  }
+}
+
+uint64_t AsyncLogAppender::getDropCount() const {
+  uint64_t count = 0;
+  for (auto& i : m_dropped) {
+    count += i.load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+uint64_t AsyncLogAppender::getDropCount(LogLevel::Level level) const {
+  if (level > LogLevel::FATAL) {
+    return 0;
+  }
+  return m_dropped[level].load(std::memory_order_relaxed);
+}
+
+std::string AsyncLogAppender::toYamlString() {
+  YAML::Node node = YAML::Load(m_appender->toYamlString());
+  node["async"] = true;
+  node["capacity"] = m_mask + 1;
+  node["overflow"] = PolicyToString(m_policy);
+  if (m_policy == DROP_LOW) {
+    node["overflow_level"] = LogLevel::ToString(m_overflowLevel);
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+const char* AsyncLogAppender::PolicyToString(OverflowPolicy policy) {
+  switch (policy) {
+    case DROP:
+      return "drop";
+    case DROP_LOW:
+      return "drop_low";
+    default:
+      return "block";
+  }
+}
+
+AsyncLogAppender::OverflowPolicy AsyncLogAppender::PolicyFromString(
+    const std::string& str) {
+  if (str == "drop") {
+    return DROP;
+  }
+  if (str == "drop_low") {
+    return DROP_LOW;
+  }
+  return BLOCK;
+}
+
 void StdoutLogAppender::log(std::shared_ptr<Logger> logger,
                             LogLevel::Level level, LogEvent::ptr event) {
   if (level >= m_level) {
     MutexType::Lock lock(m_mutex);
-    std::cout << m_formatter->format(logger, level, event);
+    m_formatter->format(std::cout, logger, level, event);
   }
 }
 std::string StdoutLogAppender::toYamlString() {
@@ -600,10 +907,20 @@ struct LogAppenderDefine {
   LogLevel::Level m_level = LogLevel::UNKNOW;
   std::string formatter;
   std::string file;
+  /// 是否用AsyncLogAppender包装
+  bool async = false;
+  /// 异步队列容量
+  uint32_t capacity = 8192;
+  /// 异步队列满时的策略 block/drop/drop_low
+  std::string overflow = "block";
+  /// drop_low策略下不丢弃的最低级别
+  LogLevel::Level overflow_level = LogLevel::WARN;
 
   bool operator==(const LogAppenderDefine& oth) const {
     return type == oth.type && m_level == oth.m_level &&
-           formatter == oth.formatter && file == oth.file;
+           formatter == oth.formatter && file == oth.file &&
+           async == oth.async && capacity == oth.capacity &&
+           overflow == oth.overflow && overflow_level == oth.overflow_level;
   }
 };
 
@@ -665,6 +982,19 @@ class LexicalCast<std::string, std::set<LogDefine>> {
             std::cout << "log config error: name is invalid," << a << std::endl;
             continue;
           }
+          if (a["async"].IsDefined()) {
+            lad.async = a["async"].as<bool>();
+          }
+          if (a["capacity"].IsDefined()) {
+            lad.capacity = a["capacity"].as<uint32_t>();
+          }
+          if (a["overflow"].IsDefined()) {
+            lad.overflow = a["overflow"].as<std::string>();
+          }
+          if (a["overflow_level"].IsDefined()) {
+            lad.overflow_level =
+                LogLevel::FromString(a["overflow_level"].as<std::string>());
+          }
           ld.appenders.push_back(lad);
         }
       }
@@ -704,6 +1034,12 @@ class LexicalCast<std::set<LogDefine>, std::string> {
         if (!a.formatter.empty()) {
           na["formatter"] = a.formatter;
         }
+        if (a.async) {
+          na["async"] = true;
+          na["capacity"] = a.capacity;
+          na["overflow"] = a.overflow;
+          na["overflow_level"] = LogLevel::ToString(a.overflow_level);
+        }
 
         n["appenders"].push_back(na);
       }
@@ -760,6 +1096,14 @@ struct LogIniter {
                         << std::endl;
             }
           }
+          if (a.async) {
+            sylar::LogAppender::ptr inner = ap;
+            ap.reset(new AsyncLogAppender(
+                inner, a.capacity,
+                AsyncLogAppender::PolicyFromString(a.overflow),
+                a.overflow_level));
+            ap->setLevel(a.m_level);
+          }
           logger->addAppender(ap);
         }
       }
@@ -3,6 +3,7 @@
 
 #include <stdarg.h>
 #include <stdint.h>
+#include <atomic>
 #include <fstream>
 #include <list>
 #include <map>
@@ -18,13 +19,9 @@
  * @brief 使用流式方式将日志级别level的日志写入到logger
  * */
 
-#define SYLAR_LOG_LEVEL(logger, level)                                \
-  if (logger->getLevel() <= level)                                    \
-  sylar::LogEventWrap(                                                \
-      sylar::LogEvent::ptr(new sylar::LogEvent(                       \
-          logger, level, __FILE__, __LINE__, 0, sylar::GetThreadId(), \
-          sylar::GetFiberId(), time(0), sylar::Thread::GetName())))   \
-      .getSS()
+#define SYLAR_LOG_LEVEL(logger, level) \
+  if (logger->getLevel() <= level)     \
+  sylar::LogEventWrap(logger, level, __FILE__, __LINE__).getSS()
 
 #define SYLAR_LOG_DEBUG(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::DEBUG)
 #define SYLAR_LOG_INFO(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::INFO)
@@ -36,13 +33,10 @@
  * 使用格式化的方式将日志级别level的日志写入到logger
  * */
 
-#define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...)                  \
-  if (logger->getLevel() <= level)                                    \
-  sylar::LogEventWrap(                                                \
-      sylar::LogEvent::ptr(new sylar::LogEvent(                       \
-          logger, level, __FILE__, __LINE__, 0, sylar::GetThreadId(), \
-          sylar::GetFiberId(), time(0), sylar::Thread::GetName())))   \
-      .getEvent()                                                     \
+#define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...)           \
+  if (logger->getLevel() <= level)                             \
+  sylar::LogEventWrap(logger, level, __FILE__, __LINE__)       \
+      .getEvent()                                              \
       ->format(fmt, __VA_ARGS__)
 
 #define SYLAR_LOG_FMT_DEBUG(logger, fmt, ...) \
@@ -102,6 +96,59 @@ class LogLevel {
   static LogLevel::Level FromString(const std::string& str);
 };
 
+/**
+ * @brief 日志内容流
+ * @details 先写入内置的定长缓冲区, 超出后才改用堆内存, 可以清空后重复使用
+ */
+class LogStream : public std::ostream {
+ public:
+  /// 内置缓冲区大小
+  static const size_t kInlineSize = 512;
+
+  LogStream();
+
+  /**
+   * @brief 返回内容起始地址
+   */
+  const char* data() const { return m_buf.pbase(); }
+
+  /**
+   * @brief 返回内容长度
+   */
+  size_t size() const { return m_buf.pptr() - m_buf.pbase(); }
+
+  /**
+   * @brief 返回内容
+   */
+  std::string str() const { return std::string(data(), size()); }
+
+  /**
+   * @brief 清空内容和错误状态, 过大的堆内存会被释放
+   */
+  void reset();
+
+ private:
+  class Buffer : public std::streambuf {
+    friend class LogStream;
+
+   public:
+    Buffer();
+    void reset();
+
+   protected:
+    int_type overflow(int_type ch) override;
+
+   private:
+    /// 内置缓冲区
+    char m_inline[kInlineSize];
+    /// 超出内置缓冲区后使用的内存
+    std::string m_heap;
+  };
+
+ private:
+  Buffer m_buf;
+};
+
 /**
  * @brief 日志事件
  */
@@ -109,6 +156,19 @@ class LogEvent {
  public:
   typedef std::shared_ptr<LogEvent> ptr;
 
+  /**
+   * @brief 获取当前线程可复用的日志事件并初始化
+   * @details 每个线程缓存少量事件, 没有被其他地方(如异步Appender)持有的
+   *          事件会被直接复用, 都被占用时才从堆上分配
+   * @param[in] logger 日志器
+   * @param[in] level 日志级别
+   * @param[in] file 文件名
+   * @param[in] line 文件行号
+   */
+  static LogEvent::ptr Create(std::shared_ptr<Logger> logger,
+                              LogLevel::Level level, const char* file,
+                              int32_t line);
+
   /**
      * @brief 构造函数
      * @param[in] logger 日志器
@@ -157,10 +217,18 @@ class LogEvent {
      * @brief 返回日志内容
      */
   std::string getContent() const { return m_ss.str(); }
+  /**
+     * @brief 返回日志内容起始地址, 不拷贝
+     */
+  const char* getContentData() const { return m_ss.data(); }
+  /**
+     * @brief 返回日志内容长度
+     */
+  size_t getContentSize() const { return m_ss.size(); }
   /**
      * @brief 返回日志内容字符串流
      */
-  std::stringstream& getSS() { return m_ss; }
+  LogStream& getSS() { return m_ss; }
   /**
      * @brief 返回日志器
      */
@@ -178,6 +246,15 @@ class LogEvent {
      */
   void format(const char* fmt, va_list al);
 
+ private:
+  LogEvent() {}
+  /**
+   * @brief 复用时重新初始化
+   */
+  void reset(std::shared_ptr<Logger> logger, LogLevel::Level level,
+             const char* file, int32_t line, uint32_t threadId,
+             uint32_t fiberId, uint64_t time, const std::string& thread_name);
+
  private:
   /// 文件名
   const char* m_file = nullptr;
@@ -194,11 +271,11 @@ class LogEvent {
   /// 线程名
   std::string m_thread_name;
   /// 日志内容流
-  std::stringstream m_ss;
+  LogStream m_ss;
   /// 日志器
   std::shared_ptr<Logger> m_logger;
   /// 日志等级
-  LogLevel::Level m_level;
+  LogLevel::Level m_level = LogLevel::UNKNOW;
 };
 
 /**
@@ -211,6 +288,15 @@ class LogEventWrap {
      * @param[in] e 日志事件
      */
   LogEventWrap(LogEvent::ptr e);
+  /**
+     * @brief 构造函数, 使用当前线程可复用的日志事件
+     * @param[in] logger 日志器
+     * @param[in] level 日志级别
+     * @param[in] file 文件名
+     * @param[in] line 文件行号
+     */
+  LogEventWrap(std::shared_ptr<Logger> logger, LogLevel::Level level,
+               const char* file, int32_t line);
   /**
      * @brief 析构函数
      */
@@ -223,7 +309,7 @@ class LogEventWrap {
   /**
      * @brief 获取日志内容流
      */
-  std::stringstream& getSS();
+  LogStream& getSS();
 
  private:
   /**
@@ -320,6 +406,7 @@ class LogFormatter {
 /// 日志输出地
 class LogAppender {
   friend class Logger;
+  friend class AsyncLogAppender;
 
  public:
   typedef std::shared_ptr<LogAppender> ptr;
@@ -515,6 +602,128 @@ class FileLogAppender : public LogAppender {
   std::ofstream m_filestream;
   uint64_t m_lastTime = 0;
 };
+/**
+ * @brief 异步输出的Appender, 包装任意Appender
+ * @details 调用线程只把日志事件放入有界无锁环形队列(多生产者单消费者),
+ *          后台线程批量取出后交给被包装的Appender格式化并写出
+ */
+class AsyncLogAppender : public LogAppender {
+ public:
+  typedef std::shared_ptr<AsyncLogAppender> ptr;
+
+  /**
+   * @brief 队列满时的处理策略
+   */
+  enum OverflowPolicy {
+    /// 等待队列有空位
+    BLOCK = 0,
+    /// 丢弃新的日志
+    DROP = 1,
+    /// 丢弃低于overflow_level的日志, 其余等待
+    DROP_LOW = 2,
+  };
+
+  /**
+   * @brief 构造函数
+   * @param[in] appender 被包装的Appender
+   * @param[in] capacity 队列容量, 向上取整到2的幂
+   * @param[in] policy 队列满时的处理策略
+   * @param[in] overflow_level DROP_LOW策略下不丢弃的最低级别
+   */
+  AsyncLogAppender(LogAppender::ptr appender, size_t capacity = 8192,
+                   OverflowPolicy policy = BLOCK,
+                   LogLevel::Level overflow_level = LogLevel::WARN);
+
+  /**
+   * @brief 析构函数, 写完队列中剩余的日志后退出后台线程
+   */
+  ~AsyncLogAppender();
+
+  void log(Logger::ptr logger, LogLevel::Level level,
+           LogEvent::ptr event) override;
+  std::string toYamlString() override;
+
+  /**
+   * @brief 等待当前已入队的日志全部写出
+   */
+  void flush();
+
+  /**
+   * @brief 返回丢弃的日志总数
+   */
+  uint64_t getDropCount() const;
+
+  /**
+   * @brief 返回某个级别丢弃的日志数
+   */
+  uint64_t getDropCount(LogLevel::Level level) const;
+
+  LogAppender::ptr getAppender() const { return m_appender; }
+
+  OverflowPolicy getOverflowPolicy() const { return m_policy; }
+
+  /**
+   * @brief 将策略转成配置文本 block/drop/drop_low
+   */
+  static const char* PolicyToString(OverflowPolicy policy);
+
+  /**
+   * @brief 将配置文本转成策略, 不认识的返回BLOCK
+   */
+  static OverflowPolicy PolicyFromString(const std::string& str);
+
+ private:
+  /**
+   * @brief 队列槽位
+   */
+  struct Slot {
+    /// 序号, 等于入队位置时可写, 等于入队位置+1时可读
+    std::atomic<size_t> seq;
+    Logger::ptr logger;
+    LogLevel::Level level;
+    LogEvent::ptr event;
+  };
+
+  bool push(const Logger::ptr& logger, LogLevel::Level level,
+            const LogEvent::ptr& event);
+  /**
+   * @brief 唤醒睡眠中的后台线程
+   */
+  void wakeup();
+  /**
+   * @brief 后台线程
+   */
+  void run();
+
+ private:
+  /// 被包装的Appender
+  LogAppender::ptr m_appender;
+  /// 环形队列
+  std::unique_ptr<Slot[]> m_slots;
+  /// 容量-1
+  size_t m_mask;
+  /// 队列满时的处理策略
+  OverflowPolicy m_policy;
+  /// DROP_LOW策略下不丢弃的最低级别
+  LogLevel::Level m_overflowLevel;
+  /// 生产者的入队位置
+  std::atomic<size_t> m_tail{0};
+  /// 消费者的出队位置, 只有后台线程修改
+  size_t m_head = 0;
+  /// 已写出的日志数
+  std::atomic<size_t> m_written{0};
+  /// 后台线程是否在等待信号量
+  std::atomic<bool> m_sleeping{false};
+  /// 是否停止
+  std::atomic<bool> m_stopping{false};
+  /// 各级别丢弃的日志数
+  std::atomic<uint64_t> m_dropped[LogLevel::FATAL + 1];
+  /// 后台线程睡眠用的信号量
+  Semaphore m_sem;
+  /// 后台线程
+  Thread::ptr m_thread;
+};
+
 /**
  * @brief 日志器管理类
  */
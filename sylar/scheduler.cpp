@@ -1,7 +1,13 @@
 #include "scheduler.h"
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
 #include <list>
 #include <memory>
+#include <thread>
 #include <vector>
+#include "config.h"
 #include "fiber.h"
 #include "hook.h"
 #include "log.h"
@@ -11,13 +17,53 @@ namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
 
+static sylar::ConfigVar<uint32_t>::ptr g_scheduler_idle_spin =
+    sylar::Config::Lookup("scheduler.idle_spin", (uint32_t)64,
+                          "scheduler idle spin rounds before futex parking");
+
+static sylar::ConfigVar<std::vector<int> >::ptr g_scheduler_priority_weights =
+    sylar::Config::Lookup("scheduler.priority_weights",
+                          std::vector<int>{8, 4, 1},
+                          "scheduler tasks taken per round for interactive, "
+                          "normal and background priority");
+
 static thread_local Scheduler* t_scheduler = nullptr;
 
 static thread_local Fiber* t_sheduler_fiber = nullptr;
 
+/// 当前线程在t_scheduler中的工作线程下标
+static thread_local int t_worker_index = -1;
+
+/// 当前线程正在执行的任务的优先级
+static thread_local int t_priority = Scheduler::DEFAULT;
+
+/// 一次从注入队列取出的最多任务数
+static const size_t MAX_INJECT_BATCH = 32;
+
+/// LIFO槽连续执行的上限
+static const int MAX_LIFO_STREAK = 3;
+
+/// 每取这么多次任务先看一次注入队列, 本地一直有任务时注入队列也不会被饿死
+static const uint32_t INJECT_CHECK_INTERVAL = 61;
+
+static uint32_t RandomNext() {
+  static thread_local uint32_t t_seed = 0;
+  if (t_seed == 0) {
+    t_seed = (uint32_t)sylar::GetThreadId() * 2654435761u | 1;
+  }
+  t_seed ^= t_seed << 13;
+  t_seed ^= t_seed >> 17;
+  t_seed ^= t_seed << 5;
+  return t_seed;
+}
+
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     : m_name(name) {
   SYLAR_ASSERT(threads > 0);
+  const std::vector<int>& weights = g_scheduler_priority_weights->getValue();
+  for (int i = 0; i < PRIORITY_COUNT; ++i) {
+    m_weights[i] = (size_t)i < weights.size() && weights[i] > 0 ? weights[i] : 1;
+  }
   if (use_caller) {
     sylar::Fiber::GetThis();
     --threads;
@@ -34,6 +80,11 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     m_rootThread = -1;
   }
   m_threadCount = threads;
+  m_workers.resize(m_threadCount + (use_caller ? 1 : 0));
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    m_workers[i] = new Worker;
+    m_workers[i]->index = i;
+  }
 }
 
 Scheduler::~Scheduler() {
@@ -41,6 +92,14 @@ Scheduler::~Scheduler() {
   if (GetThis() == this) {
     t_scheduler = nullptr;
   }
+  for (auto i : m_workers) {
+    delete i;
+  }
+  for (auto& i : m_inject) {
+    while (InjectNode* node = popInjectNode(i)) {
+      delete node;
+    }
+  }
 }
 
 Scheduler* Scheduler::GetThis() {
@@ -51,6 +110,10 @@ Fiber* Scheduler::GetMainFiber() {
   return t_sheduler_fiber;
 }
 
+Scheduler::Priority Scheduler::GetCurrentPriority() {
+  return (Priority)t_priority;
+}
+
 void Scheduler::Start() {
   MutexType::Lock lock(m_mutex);
   if (!m_stopping) {
@@ -61,8 +124,12 @@ void Scheduler::Start() {
 
   m_threads.resize(m_threadCount);
   for (size_t i = 0; i < m_threadCount; ++i) {
-    m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this),
-                                  m_name + "_" + std::to_string(i)));
+    m_threads[i].reset(new Thread(
+        [this, i]() {
+          t_worker_index = i;
+          run();
+        },
+        m_name + "_" + std::to_string(i)));
     m_threadIds.push_back(m_threads[i]->getId());
   }
   lock.unlock();
@@ -93,11 +160,10 @@ void Scheduler::Stop() {
     SYLAR_ASSERT(GetThis() != this);
   }
   m_stopping = true;
-  for (size_t i = 0; i < m_threadCount; i++) {
-    trickle();
-  }
-  if (m_rootFiber) {
-    trickle();
+  //和空闲线程设置休眠状态之后的检查配对, 休眠的线程都能被叫醒
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  for (size_t i = 0; i < m_workers.size(); i++) {
+    trickle(i);
   }
   if (m_rootFiber) {
     if (!stopping()) {
@@ -123,49 +189,73 @@ void Scheduler::run() {
   setThis();
   if (sylar::GetThreadId() != m_rootThread) {
     t_sheduler_fiber = Fiber::GetThis().get();
+  } else {
+    t_worker_index = m_threadCount;
   }
+  Worker* self = m_workers[t_worker_index];
+  {
+    //和pushPending互斥, 暂存的任务要么在这里取走, 要么直接放入专属队列
+    MutexType::Lock lock(m_mutex);
+    self->threadId = sylar::GetThreadId();
+    auto it = m_pending.find(self->threadId);
+    if (it != m_pending.end()) {
+      Worker::MutexType::Lock wlock(self->mutex);
+      for (auto& i : it->second) {
+        auto& q = self->pinned[i.priority];
+        q.push_back(FiberAndThread());
+        std::swap(q.back(), i);
+      }
+      m_pending.erase(it);
+    }
+  }
+
   Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
   Fiber::ptr cb_fiber;
   FiberAndThread ft;
   while (true) {
     ft.reset();
-    /// 指示任务队列是否还有未处理的任务。
-    bool trickle_me = false;
-    /// 指示是否有线程处于忙碌状态。
-    bool is_active = false;
-    {
-      MutexType::Lock lock(m_mutex);
-      auto it = m_fibers.begin();
-      while (it != m_fibers.end()) {
-        if (it->thread != -1 && it->thread != sylar::GetThreadId()) {
-          ++it;
-          trickle_me = true;
-          continue;
-        }
-        SYLAR_ASSERT(it->fiber || it->cb);
-        if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
-          ++it;
-          continue;
-        }
-        ft = *it;
-        m_fibers.erase(it++);
-        ++m_activeThreadCount;
-        is_active = true;
+    ++m_activeThreadCount;
+    if (!popTask(self, ft)) {
+      --m_activeThreadCount;
+      if (idle_fiber->getState() == Fiber::TERM) {
+        SYLAR_LOG_INFO(g_logger) << "idle fiber term";
+        //依次唤醒还在休眠的线程退出
+        trickle();
         break;
       }
-      trickle_me |= it != m_fibers.end();
+      ++m_idleThreadCount;
+      idle_fiber->swapIn();
+      --m_idleThreadCount;
+      if (idle_fiber->getState() != Fiber::TERM &&
+          idle_fiber->getState() != Fiber::EXCEPT) {
+        idle_fiber->m_state = Fiber::HOLD;
+      }
+      continue;
     }
-    if (trickle_me) {
+
+    if (ft.fiber && ft.fiber->getState() == Fiber::EXEC) {
+      //协程已被唤醒但还没切出, 放回队尾稍后再试
+      pushTask(ft, false);
+      --m_activeThreadCount;
+      continue;
+    }
+    //还有别的线程能取走的任务时唤醒空闲线程来窃取,
+    //专属任务在放入时已经唤醒了对应线程
+    if (m_taskCount > m_pinnedCount) {
       trickle();
     }
 
     if (ft.fiber && (ft.fiber->getState() != Fiber::TERM &&
                      ft.fiber->getState() != Fiber::EXCEPT)) {
+      //之后IO事件和定时器唤醒时沿用这次的优先级
+      ft.fiber->setPriority(ft.priority);
+      t_priority = ft.priority;
       ft.fiber->swapIn();
+      t_priority = DEFAULT;
       --m_activeThreadCount;
 
       if (ft.fiber->getState() == Fiber::READY) {
-        schedule(ft.fiber);
+        pushTask(ft, false);
       } else if (ft.fiber->getState() != Fiber::TERM &&
                  ft.fiber->getState() != Fiber::EXCEPT) {
         ft.fiber->m_state = Fiber::HOLD;
@@ -177,11 +267,16 @@ void Scheduler::run() {
       } else {
         cb_fiber.reset(new Fiber(ft.cb));
       }
+      cb_fiber->setPriority(ft.priority);
+      t_priority = ft.priority;
       ft.reset();
       cb_fiber->swapIn();
+      t_priority = DEFAULT;
       --m_activeThreadCount;
       if (cb_fiber->getState() == Fiber::READY) {
-        schedule(cb_fiber);
+        FiberAndThread ready(&cb_fiber, -1);
+        ready.priority = ready.fiber->getPriority();
+        pushTask(ready, false);
         cb_fiber.reset();
       } else if (cb_fiber->getState() == Fiber::EXCEPT ||
                  cb_fiber->getState() == Fiber::TERM) {
@@ -191,38 +286,375 @@ void Scheduler::run() {
         cb_fiber.reset();
       }
     } else {
-      if (is_active) {
-        --m_activeThreadCount;
-        continue;
+      --m_activeThreadCount;
+    }
+  }
+  self->threadId = -1;
+  t_worker_index = -1;
+}
+
+Scheduler::Worker* Scheduler::getWorker(int thread) {
+  for (auto i : m_workers) {
+    if (i->threadId == thread) {
+      return i;
+    }
+  }
+  return nullptr;
+}
+
+Scheduler::Worker* Scheduler::getCurrentWorker() {
+  if (t_scheduler != this || t_worker_index < 0) {
+    return nullptr;
+  }
+  return m_workers[t_worker_index];
+}
+
+int Scheduler::getCurrentWorkerIndex() const {
+  return t_scheduler == this ? t_worker_index : -1;
+}
+
+bool Scheduler::hasTask(int index) {
+  if (m_taskCount == 0) {
+    return false;
+  }
+  if (m_injectCount > 0) {
+    return true;
+  }
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    Worker* w = m_workers[i];
+    Worker::MutexType::Lock lock(w->mutex);
+    //LIFO槽和专属队列只有自己能取
+    if ((int)i == index && (w->lifo.fiber || w->lifo.cb)) {
+      return true;
+    }
+    for (int c = 0; c < PRIORITY_COUNT; ++c) {
+      if (!w->tasks[c].empty() || ((int)i == index && !w->pinned[c].empty())) {
+        return true;
       }
-      if (idle_fiber->getState() == Fiber::TERM) {
-        SYLAR_LOG_INFO(g_logger) << "idle fiber term";
+    }
+  }
+  return false;
+}
+
+int Scheduler::pushTask(FiberAndThread& ft, bool lifo) {
+  int need_trickle = m_taskCount++ == 0 ? TRICKLE_ANY : TRICKLE_NONE;
+  Worker* cur = getCurrentWorker();
+  if (ft.thread != -1) {
+    Worker* w = (cur && cur->threadId == ft.thread) ? cur : getWorker(ft.thread);
+    if (w) {
+      Worker::MutexType::Lock lock(w->mutex);
+      auto& q = w->pinned[ft.priority];
+      q.push_back(FiberAndThread());
+      std::swap(q.back(), ft);
+      ++m_pinnedCount;
+      //只有目标线程能执行, 直接唤醒它
+      return w != cur ? w->index : TRICKLE_NONE;
+    }
+    int index = pushPending(ft);
+    if (index != TRICKLE_ANY) {
+      return index;
+    }
+  }
+  if (cur) {
+    Worker::MutexType::Lock lock(cur->mutex);
+    if (lifo && ft.fiber) {
+      std::swap(cur->lifo, ft);
+      if (!ft.fiber && !ft.cb) {
+        return need_trickle;
+      }
+    }
+    //换出来的可能是LIFO槽里原来的任务, 按它自己的优先级入队
+    auto& q = cur->tasks[ft.priority];
+    q.push_back(FiberAndThread());
+    std::swap(q.back(), ft);
+    return need_trickle;
+  }
+
+  InjectNode* node = new InjectNode;
+  std::swap(node->task, ft);
+  ++m_injectCount;
+  ++m_inject[node->task.priority].count;
+  PushInject(m_inject[node->task.priority], node);
+  return TRICKLE_ANY;
+}
+
+int Scheduler::pushPending(FiberAndThread& ft) {
+  MutexType::Lock lock(m_mutex);
+  //加锁前工作线程可能刚开始运行
+  if (Worker* w = getWorker(ft.thread)) {
+    Worker::MutexType::Lock wlock(w->mutex);
+    auto& q = w->pinned[ft.priority];
+    q.push_back(FiberAndThread());
+    std::swap(q.back(), ft);
+    ++m_pinnedCount;
+    return w->index;
+  }
+  if (std::find(m_threadIds.begin(), m_threadIds.end(), ft.thread) ==
+      m_threadIds.end()) {
+    SYLAR_LOG_ERROR(g_logger) << m_name << " schedule to thread " << ft.thread
+                              << " which is not a worker, run on any thread";
+    ft.thread = -1;
+    return TRICKLE_ANY;
+  }
+  //不计入注入队列, 空闲线程不会为了它空转
+  auto& q = m_pending[ft.thread];
+  q.push_back(FiberAndThread());
+  std::swap(q.back(), ft);
+  ++m_pinnedCount;
+  return TRICKLE_NONE;
+}
+
+bool Scheduler::popTask(Worker* self, FiberAndThread& ft) {
+  //定期先看注入队列, 本地一直有任务时注入队列也不会被饿死
+  bool inject = ++self->ticks % INJECT_CHECK_INTERVAL == 0 && m_injectCount > 0;
+  {
+    Worker::MutexType::Lock lock(self->mutex);
+    if (!inject && !hasHigherInject(self) && popLocal(self, ft)) {
+      return true;
+    }
+  }
+  if (m_taskCount == 0) {
+    return false;
+  }
+  popInject(self);
+  {
+    Worker::MutexType::Lock lock(self->mutex);
+    if (popLocal(self, ft)) {
+      return true;
+    }
+  }
+  if (!steal(self)) {
+    return false;
+  }
+  Worker::MutexType::Lock lock(self->mutex);
+  return popLocal(self, ft);
+}
+
+bool Scheduler::hasHigherInject(Worker* self) {
+  for (int c = 0; c < PRIORITY_COUNT; ++c) {
+    if (m_inject[c].count > 0) {
+      return true;
+    }
+    if (((self->lifo.fiber || self->lifo.cb) && self->lifo.priority == c) ||
+        !self->pinned[c].empty() || !self->tasks[c].empty()) {
+      return false;
+    }
+  }
+  return false;
+}
+
+bool Scheduler::popLocal(Worker* self, FiberAndThread& ft) {
+  bool has_lifo = self->lifo.fiber || self->lifo.cb;
+  bool has[PRIORITY_COUNT];
+  bool any = false;
+  for (int c = 0; c < PRIORITY_COUNT; ++c) {
+    has[c] = (has_lifo && self->lifo.priority == c) ||
+             !self->pinned[c].empty() || !self->tasks[c].empty();
+    any = any || has[c];
+  }
+  if (!any) {
+    return false;
+  }
+  //按优先级从高到低找这一轮还有份额的
+  int c = 0;
+  while (c < PRIORITY_COUNT && !(has[c] && self->credits[c] > 0)) {
+    ++c;
+  }
+  if (c == PRIORITY_COUNT) {
+    //有任务的优先级份额都用完了, 开始新的一轮
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+      self->credits[i] = m_weights[i];
+    }
+    c = 0;
+    while (!has[c]) {
+      ++c;
+    }
+  }
+  --self->credits[c];
+
+  auto& pinned = self->pinned[c];
+  auto& tasks = self->tasks[c];
+  if (has_lifo && self->lifo.priority == c &&
+      (self->lifoStreak < MAX_LIFO_STREAK || (pinned.empty() && tasks.empty()))) {
+    ++self->lifoStreak;
+    std::swap(ft, self->lifo);
+    --m_taskCount;
+    return true;
+  }
+  self->lifoStreak = 0;
+  if (!pinned.empty()) {
+    std::swap(ft, pinned.front());
+    pinned.pop_front();
+    --m_pinnedCount;
+    --m_taskCount;
+    return true;
+  }
+  std::swap(ft, tasks.front());
+  tasks.pop_front();
+  --m_taskCount;
+  return true;
+}
+
+bool Scheduler::popInject(Worker* self) {
+  if (m_injectConsumer.test_and_set(std::memory_order_acquire)) {
+    return false;
+  }
+  std::vector<InjectNode*> nodes;
+  for (auto& i : m_inject) {
+    for (size_t batch = 0; batch < MAX_INJECT_BATCH; ++batch) {
+      InjectNode* node = popInjectNode(i);
+      if (!node) {
         break;
       }
-      ++m_idleThreadCount;
-      idle_fiber->swapIn();
-      --m_idleThreadCount;
-      if (idle_fiber->getState() != Fiber::TERM &&
-          idle_fiber->getState() != Fiber::EXCEPT) {
-        idle_fiber->m_state = Fiber::HOLD;
+      nodes.push_back(node);
+    }
+  }
+  m_injectConsumer.clear(std::memory_order_release);
+
+  Worker::MutexType::Lock lock(self->mutex);
+  for (auto node : nodes) {
+    FiberAndThread& task = node->task;
+    auto& q = self->tasks[task.priority];
+    q.push_back(FiberAndThread());
+    std::swap(q.back(), task);
+    delete node;
+  }
+  return !nodes.empty();
+}
+
+bool Scheduler::steal(Worker* self) {
+  size_t count = m_workers.size();
+  if (count <= 1) {
+    return false;
+  }
+  size_t start = RandomNext() % count;
+  std::vector<FiberAndThread> stolen;
+  int priority = NORMAL;
+  for (size_t n = 0; n < count && stolen.empty(); ++n) {
+    Worker* victim = m_workers[(start + n) % count];
+    if (victim == self) {
+      continue;
+    }
+    Worker::MutexType::Lock lock(victim->mutex);
+    for (int c = 0; c < PRIORITY_COUNT; ++c) {
+      auto& q = victim->tasks[c];
+      size_t size = q.size();
+      if (size == 0) {
+        continue;
+      }
+      size_t take = (size + 1) / 2;
+      stolen.resize(take);
+      for (size_t i = 0; i < take; ++i) {
+        std::swap(stolen[i], q.front());
+        q.pop_front();
       }
+      priority = c;
+      break;
+    }
+  }
+  if (stolen.empty()) {
+    return false;
+  }
+  Worker::MutexType::Lock lock(self->mutex);
+  auto& q = self->tasks[priority];
+  for (auto& i : stolen) {
+    q.push_back(FiberAndThread());
+    std::swap(q.back(), i);
+  }
+  return true;
+}
+
+void Scheduler::PushInject(InjectQueue& queue, InjectNode* node) {
+  node->next.store(nullptr, std::memory_order_relaxed);
+  InjectNode* prev = queue.head.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node, std::memory_order_release);
+}
+
+Scheduler::InjectNode* Scheduler::popInjectNode(InjectQueue& queue) {
+  InjectNode* tail = queue.tail;
+  InjectNode* next = tail->next.load(std::memory_order_acquire);
+  if (tail == &queue.stub) {
+    if (!next) {
+      return nullptr;
     }
+    queue.tail = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next) {
+    queue.tail = next;
+    --m_injectCount;
+    --queue.count;
+    return tail;
+  }
+  if (tail != queue.head.load(std::memory_order_acquire)) {
+    //生产者正在入队, 下次再取
+    return nullptr;
   }
+  PushInject(queue, &queue.stub);
+  next = tail->next.load(std::memory_order_acquire);
+  if (next) {
+    queue.tail = next;
+    --m_injectCount;
+    --queue.count;
+    return tail;
+  }
+  return nullptr;
 }
 
-void Scheduler::trickle() {
-  SYLAR_LOG_INFO(g_logger) << "trickle";
+void Scheduler::Unpark(Worker* worker) {
+  int expected = PARKED;
+  if (worker->parkState.compare_exchange_strong(expected, NOTIFIED)) {
+    syscall(SYS_futex, (int*)&worker->parkState, FUTEX_WAKE_PRIVATE, 1,
+            nullptr, nullptr, 0);
+  }
+}
+
+void Scheduler::trickle(int index) {
+  if (index >= 0) {
+    Unpark(m_workers[index]);
+    return;
+  }
+  Worker* target = nullptr;
+  for (auto i : m_workers) {
+    int state = i->parkState;
+    //已经叫过的线程醒来后还有任务会接力唤醒
+    if (state == NOTIFIED) {
+      return;
+    }
+    if (state == PARKED && !target) {
+      target = i;
+    }
+  }
+  if (target) {
+    Unpark(target);
+  }
 }
 
 bool Scheduler::stopping() {
-  MutexType::Lock lock(m_mutex);
-  return m_autoStop && m_stopping && m_fibers.empty() &&
+  return m_autoStop && m_stopping && m_taskCount == 0 &&
          m_activeThreadCount == 0;
 }
 
 void Scheduler::idle() {
   SYLAR_LOG_INFO(g_logger) << "idle";
+  int index = getCurrentWorkerIndex();
+  Worker* self = m_workers[index];
   while (!stopping()) {
+    //任务很快就来时不用进内核
+    uint32_t spin = g_scheduler_idle_spin->getValue();
+    for (uint32_t i = 0; i < spin && !hasTask(index); ++i) {
+      std::this_thread::yield();
+    }
+    self->parkState = PARKED;
+    //设置状态之后再检查一次, 放入任务的一方没看到休眠状态时这里能看到任务
+    if (!hasTask(index) && !(m_stopping && stopping())) {
+      while (self->parkState == PARKED) {
+        syscall(SYS_futex, (int*)&self->parkState, FUTEX_WAIT_PRIVATE, PARKED,
+                nullptr, nullptr, 0);
+      }
+    }
+    self->parkState = RUNNING;
     sylar::Fiber::YieldToHold();
   }
 }
@@ -1,7 +1,10 @@
 #ifndef __SYLAR_SCHEDULER_H__
 #define __SYLAR_SCHEDULER_H__
 
+#include <atomic>
+#include <deque>
 #include <list>
+#include <map>
 #include <memory>
 #include <vector>
 #include "fiber.h"
@@ -14,6 +17,26 @@ class Scheduler {
  public:
   typedef std::shared_ptr<Scheduler> ptr;
   typedef Mutex MutexType;
+
+  /**
+   * @brief 任务的优先级, 数值越小越先执行
+   * @details 每个优先级有自己的队列, 工作线程按权重轮流取, 低优先级
+   *          不会被饿死. 协程记住最后一次调度的优先级, IO事件或定时器
+   *          唤醒时沿用
+   * */
+  enum Priority {
+    /// 不指定: 协程沿用自己的优先级, 函数沿用当前任务的优先级, 都没有时为NORMAL
+    DEFAULT = -1,
+    /// 延迟敏感, 如健康检查, RPC处理
+    INTERACTIVE = 0,
+    /// 普通任务
+    NORMAL = 1,
+    /// 后台批处理
+    BACKGROUND = 2,
+  };
+  /// 优先级数量
+  static const int PRIORITY_COUNT = 3;
+
   /**
    * @brief 构造函数
    * @param[in] threads 线程数量
@@ -31,38 +54,62 @@ class Scheduler {
 
   static Fiber* GetMainFiber();
 
+  /**
+   * @brief 当前线程正在执行的任务的优先级, 不在执行任务时返回DEFAULT
+   * */
+  static Priority GetCurrentPriority();
+
   void Start();
   void Stop();
 
+  /**
+   * @brief 调度协程或函数
+   * @param[in] fc 协程或函数
+   * @param[in] thread 执行的线程id, -1表示任意线程
+   * @param[in] priority 优先级
+   * @details 工作线程内调度的协程放进本线程的LIFO槽优先执行,
+   *          指定线程的任务直接放入该线程的队列, 线程还没开始运行时暂存,
+   *          其它情况放入无锁的全局注入队列
+   * */
   template <class FiberOrCb>
-  void schedule(FiberOrCb fc, int thread = -1) {
-    bool need_trickle = false;
-    {
-      MutexType::Lock lock(m_mutex);
-      need_trickle = scheduleNoLock(fc, thread);
-    }
-    if (need_trickle) {
-      trickle();
+  void schedule(FiberOrCb fc, int thread = -1, Priority priority = DEFAULT) {
+    int index = scheduleNoLock(fc, thread, priority);
+    if (index != TRICKLE_NONE) {
+      trickle(index);
     }
   }
 
   template <class InputIterator>
   void schedule(InputIterator begin, InputIterator end) {
     bool need_trickle = false;
-    {
-      MutexType::Lock lock(m_mutex);
-      while (begin != end) {
-        need_trickle = scheduleNoLock(&*begin) || need_trickle;
-        ++begin;
+    while (begin != end) {
+      int index = scheduleNoLock(&*begin);
+      if (index >= 0) {
+        trickle(index);
+      } else if (index == TRICKLE_ANY) {
+        need_trickle = true;
       }
+      ++begin;
     }
     if (need_trickle) {
-      trickle();
+      trickle(TRICKLE_ANY);
     }
   }
 
  protected:
-  virtual void trickle();
+  /// 不需要唤醒
+  static const int TRICKLE_NONE = -2;
+  /// 唤醒任意一个空闲线程
+  static const int TRICKLE_ANY = -1;
+
+  /**
+   * @brief 唤醒空闲线程
+   * @param[in] index 要唤醒的工作线程下标, 专属任务放入其它线程时使用;
+   *                  TRICKLE_ANY表示任选一个空闲线程
+   * @details 基类的空闲线程自旋一会后在futex上休眠, 这里叫醒一个;
+   *          已经有线程被叫醒还没醒来时不再重复叫
+   * */
+  virtual void trickle(int index = TRICKLE_ANY);
   void run();
   virtual bool stopping();
   virtual void idle();
@@ -72,15 +119,48 @@ class Scheduler {
    * */
   bool hasIdleThreads() { return m_idleThreadCount > 0; }
 
+  /**
+   * @brief 工作线程数, 包括use_caller时的调用线程
+   * */
+  size_t getWorkerCount() const { return m_workers.size(); }
+
+  /**
+   * @brief 当前线程在本调度器中的工作线程下标, 不是本调度器的线程返回-1
+   * */
+  int getCurrentWorkerIndex() const;
+
+  /**
+   * @brief 是否有下标为index的工作线程可以执行的任务
+   * @details 空闲线程设置休眠状态之后再检查一次, 放入任务的一方先放任务
+   *          再看休眠状态, 两边至少有一方能看到对方, 唤醒不会丢失
+   * */
+  bool hasTask(int index);
+
  private:
+  /**
+   * @return 需要唤醒的工作线程下标, 或者TRICKLE_NONE/TRICKLE_ANY
+   * */
   template <class FiberOrCb>
-  bool scheduleNoLock(FiberOrCb fc, int thread = -1) {
-    bool need_trickle = m_fibers.empty();
+  int scheduleNoLock(FiberOrCb fc, int thread = -1,
+                     Priority priority = DEFAULT) {
     FiberAndThread ft(fc, thread);
-    if (ft.fiber || ft.cb) {
-      m_fibers.push_back(ft);
+    if (ft.fiber && ft.thread == -1) {
+      //共享栈协程只能回到占用共享栈的线程上执行
+      ft.thread = ft.fiber->getBoundThread();
     }
-    return need_trickle;
+    if (!ft.fiber && !ft.cb) {
+      return TRICKLE_NONE;
+    }
+    if (priority == DEFAULT && ft.fiber) {
+      priority = (Priority)ft.fiber->getPriority();
+    }
+    if (priority == DEFAULT) {
+      priority = GetCurrentPriority();
+    }
+    //没有指定或者超出范围时按NORMAL
+    ft.priority =
+        priority < INTERACTIVE || priority > BACKGROUND ? NORMAL : priority;
+    return pushTask(ft, true);
   }
 
  private:
@@ -89,6 +169,8 @@ class Scheduler {
     std::function<void()> cb;
     //线程id
     int thread;
+    //优先级
+    int priority = NORMAL;
 
     FiberAndThread(Fiber::ptr f, int thr) : fiber(f), thread(thr) {}
 
@@ -105,15 +187,147 @@ class Scheduler {
       fiber = nullptr;
       cb = nullptr;
       thread = -1;
+      priority = NORMAL;
     }
   };
 
+  /**
+   * @brief 全局注入队列节点(Vyukov 无锁多生产者单消费者队列)
+   * */
+  struct InjectNode {
+    std::atomic<InjectNode*> next = {nullptr};
+    FiberAndThread task;
+  };
+
+  /**
+   * @brief 一个优先级的注入队列
+   * */
+  struct InjectQueue {
+    InjectQueue() : head(&stub), tail(&stub) {}
+    /// 队列头(生产者)
+    std::atomic<InjectNode*> head;
+    /// 队列尾(消费者)
+    InjectNode* tail;
+    /// 哨兵节点
+    InjectNode stub;
+    /// 队列中的任务数
+    std::atomic<size_t> count = {0};
+  };
+
+  /// 基类空闲线程的休眠状态
+  enum ParkState {
+    /// 在执行任务或者自旋
+    RUNNING = 0,
+    /// 在futex上休眠
+    PARKED = 1,
+    /// 已经被叫醒还没醒来
+    NOTIFIED = 2,
+  };
+
+  /**
+   * @brief 每个工作线程的本地队列
+   * */
+  struct Worker {
+    typedef SpinLock MutexType;
+    MutexType mutex;
+    /// 可以被其它线程窃取的任务, 按优先级分开
+    std::deque<FiberAndThread> tasks[PRIORITY_COUNT];
+    /// 只能在本线程执行的任务, 按优先级分开
+    std::deque<FiberAndThread> pinned[PRIORITY_COUNT];
+    /// 最近唤醒的协程, 在同优先级中优先执行, 不会被窃取
+    FiberAndThread lifo;
+    /// 连续从LIFO槽取任务的次数, 防止饿死本地队列
+    int lifoStreak = 0;
+    /// 每个优先级这一轮还能取的任务数, 都用完或者没任务时按权重补满
+    int credits[PRIORITY_COUNT] = {0};
+    /// 取任务的次数, 用于定期先看注入队列
+    uint32_t ticks = 0;
+    /// 线程id, 线程开始运行前为-1
+    std::atomic<int> threadId = {-1};
+    /// 在m_workers中的下标
+    int index = 0;
+    /// 休眠状态 ParkState, 同时作为futex等待的字
+    std::atomic<int> parkState = {RUNNING};
+  };
+
+  /**
+   * @brief 叫醒在futex上休眠的工作线程, 已经叫过或者没在休眠时什么都不做
+   * */
+  static void Unpark(Worker* worker);
+
+  /**
+   * @brief 放入任务
+   * @param[in] lifo 当前工作线程调度的协程是否放入LIFO槽
+   * @return 需要唤醒的工作线程下标, 或者TRICKLE_NONE/TRICKLE_ANY
+   * */
+  int pushTask(FiberAndThread& ft, bool lifo);
+
+  /**
+   * @brief 取出一个任务: 本地队列(按优先级加权轮流, 同优先级中LIFO槽,
+   *        专属队列, 普通队列), 注入队列, 窃取
+   * */
+  bool popTask(Worker* self, FiberAndThread& ft);
+
+  /**
+   * @brief 放入指定线程但该线程的工作线程还没开始运行的任务
+   * @details 线程id属于本调度器时暂存起来, 等工作线程开始运行时取走;
+   *          不属于本调度器的线程id永远不会有工作线程, 去掉指定线程
+   * @return 需要唤醒的工作线程下标, TRICKLE_NONE表示已暂存,
+   *         TRICKLE_ANY表示去掉了指定线程, 由调用方按普通任务放入
+   * */
+  int pushPending(FiberAndThread& ft);
+
+  /**
+   * @brief 按优先级权重从本地队列取任务, 需要持有self->mutex
+   * */
+  bool popLocal(Worker* self, FiberAndThread& ft);
+
+  /**
+   * @brief 注入队列中是否有比本地队列优先级更高的任务, 需要持有self->mutex
+   * */
+  bool hasHigherInject(Worker* self);
+
+  /**
+   * @brief 从各优先级的注入队列批量取任务放入本地队列
+   * @return 是否有任务放入了本线程的队列
+   * */
+  bool popInject(Worker* self);
+
+  /**
+   * @brief 随机选择其它工作线程, 从最高的非空优先级窃取一半任务
+   * */
+  bool steal(Worker* self);
+
+  /// 注入队列入队, 任意线程
+  static void PushInject(InjectQueue& queue, InjectNode* node);
+  /// 注入队列出队, 需要持有m_injectConsumer
+  InjectNode* popInjectNode(InjectQueue& queue);
+
+  /// 线程id对应的工作线程
+  Worker* getWorker(int thread);
+  /// 当前线程在本调度器中的工作线程
+  Worker* getCurrentWorker();
+
  private:
   MutexType m_mutex;
   /// 线程池
   std::vector<Thread::ptr> m_threads;
-  /// 待执行的协程队列
-  std::list<FiberAndThread> m_fibers;
+  /// 工作线程队列, [0, m_threadCount)为线程池, use_caller时最后一个为调用线程
+  std::vector<Worker*> m_workers;
+  /// 每个优先级的注入队列, 只放不指定线程的任务
+  InjectQueue m_inject[PRIORITY_COUNT];
+  /// 线程id -> 工作线程开始运行前指定给它的任务, m_mutex保护
+  std::map<int, std::vector<FiberAndThread> > m_pending;
+  /// 每个优先级一轮能取的任务数
+  int m_weights[PRIORITY_COUNT];
+  /// 注入队列消费者标记
+  std::atomic_flag m_injectConsumer = ATOMIC_FLAG_INIT;
+  /// 所有队列中的任务数
+  std::atomic<size_t> m_taskCount = {0};
+  /// 专属队列和暂存的指定线程任务数
+  std::atomic<size_t> m_pinnedCount = {0};
+  /// 注入队列中的任务数
+  std::atomic<size_t> m_injectCount = {0};
   /// use_caller 为true时有效果，调度协程
   Fiber::ptr m_rootFiber;
   /// 协程调度器名称
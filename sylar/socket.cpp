@@ -64,7 +64,7 @@ Socket::~Socket() {
 }
 
 int64_t Socket::getSendTimeout() {
-  FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+  FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
   if (ctx) {
     return ctx->getTimeout(SO_SNDTIMEO);
   }
@@ -79,7 +79,7 @@ void Socket::setSendTimeout(uint64_t v) {
 }
 
 int64_t Socket::getRecvTimeout() {
-  FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+  FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
   if (ctx) {
     return ctx->getTimeout(SO_RCVTIMEO);
   }
@@ -132,7 +132,7 @@ Socket::ptr Socket::accept() {
 }
 
 bool Socket::init(int sock) {
-  FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
+  FdCtx* ctx = FdMgr::GetInstance()->get(sock);
   if (ctx && ctx->isSocket() && !ctx->isClose()) {
     m_sock = sock;
     m_isConnect = true;
@@ -440,6 +440,9 @@ bool Socket::cancelAll() {
 void Socket::initSock() {
   int val = 1;
   setOption(SOL_SOCKET, SO_REUSEADDR, val);
+  if (m_reusePort) {
+    setOption(SOL_SOCKET, SO_REUSEPORT, val);
+  }
   if (m_type == SOCK_STREAM) {
     setOption(IPPROTO_TCP, TCP_NODELAY, val);
   }
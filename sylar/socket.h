@@ -293,6 +293,14 @@ class Socket : public std::enable_shared_from_this<Socket>, Noncopyable {
 
   int getSocket() const { return m_sock; }
 
+  /**
+   * @brief 设置是否开启SO_REUSEPORT, 需要在bind之前设置
+   * @details 多个socket绑定同一地址, 由内核把新连接分散到各个socket
+   * */
+  void setReusePort(bool v) { m_reusePort = v; }
+
+  bool isReusePort() const { return m_reusePort; }
+
   /**
        * @brief 撤销读
        * */
@@ -340,6 +348,8 @@ class Socket : public std::enable_shared_from_this<Socket>, Noncopyable {
   int m_protocol;
   /// 是否连接
   bool m_isConnect;
+  /// 是否开启SO_REUSEPORT
+  bool m_reusePort = false;
   /// 本地地址
   Address::ptr m_localAddress;
   /// 远程地址
@@ -0,0 +1,324 @@
+#include "stack_allocator.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <fstream>
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
+
+static ConfigVar<std::string>::ptr g_stack_allocator =
+    Config::Lookup<std::string>("fiber.stack_allocator", "mmap",
+                                "fiber stack allocator, mmap or malloc");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_max_cached =
+    Config::Lookup<uint32_t>("fiber.stack_pool.max_cached", 128,
+                             "max cached fiber stacks per thread");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_trim_to =
+    Config::Lookup<uint32_t>("fiber.stack_pool.trim_to", 64,
+                             "cached fiber stacks kept after trimming");
+
+static ConfigVar<bool>::ptr g_stack_pool_guard_page = Config::Lookup<bool>(
+    "fiber.stack_pool.guard_page", true, "protect fiber stack bottom page");
+
+static ConfigVar<std::string>::ptr g_stack_pool_huge_page =
+    Config::Lookup<std::string>("fiber.stack_pool.huge_page", "none",
+                                "fiber stack huge page, none/thp/hugetlb");
+
+enum HugePageMode { HUGE_PAGE_NONE = 0, HUGE_PAGE_THP = 1, HUGE_PAGE_TLB = 2 };
+
+static std::atomic<bool> s_use_mmap{true};
+static std::atomic<uint32_t> s_max_cached{128};
+static std::atomic<uint32_t> s_trim_to{64};
+static std::atomic<bool> s_guard_page{true};
+static std::atomic<int> s_huge_page{HUGE_PAGE_NONE};
+static std::atomic<StackAllocator*> s_default{nullptr};
+
+static int ParseHugePage(const std::string& v) {
+  if (v == "thp") {
+    return HUGE_PAGE_THP;
+  } else if (v == "hugetlb") {
+    return HUGE_PAGE_TLB;
+  } else if (v != "none") {
+    SYLAR_LOG_ERROR(g_logger)
+        << "invalid fiber.stack_pool.huge_page=" << v << ", use none";
+  }
+  return HUGE_PAGE_NONE;
+}
+
+struct _StackAllocatorIniter {
+  _StackAllocatorIniter() {
+    s_use_mmap = g_stack_allocator->getValue() != "malloc";
+    s_max_cached = g_stack_pool_max_cached->getValue();
+    s_trim_to = g_stack_pool_trim_to->getValue();
+    s_guard_page = g_stack_pool_guard_page->getValue();
+    s_huge_page = ParseHugePage(g_stack_pool_huge_page->getValue());
+
+    g_stack_allocator->addListener(
+        [](const std::string& old_value, const std::string& new_value) {
+          SYLAR_LOG_INFO(g_logger) << "fiber.stack_allocator changed from "
+                                   << old_value << " to " << new_value;
+          s_use_mmap = new_value != "malloc";
+        });
+    g_stack_pool_max_cached->addListener(
+        [](const uint32_t& old_value, const uint32_t& new_value) {
+          s_max_cached = new_value;
+        });
+    g_stack_pool_trim_to->addListener(
+        [](const uint32_t& old_value, const uint32_t& new_value) {
+          s_trim_to = new_value;
+        });
+    g_stack_pool_guard_page->addListener(
+        [](const bool& old_value, const bool& new_value) {
+          s_guard_page = new_value;
+        });
+    g_stack_pool_huge_page->addListener(
+        [](const std::string& old_value, const std::string& new_value) {
+          s_huge_page = ParseHugePage(new_value);
+        });
+  }
+};
+
+static _StackAllocatorIniter s_stack_allocator_initer;
+
+static size_t GetPageSize() {
+  static size_t s_page_size = sysconf(_SC_PAGESIZE);
+  return s_page_size;
+}
+
+static size_t GetHugePageSize() {
+  static size_t s_huge_page_size = []() -> size_t {
+    std::ifstream ifs("/proc/meminfo");
+    std::string line;
+    while (std::getline(ifs, line)) {
+      size_t kb = 0;
+      if (sscanf(line.c_str(), "Hugepagesize: %zu kB", &kb) == 1 && kb) {
+        return kb * 1024;
+      }
+    }
+    return 2 * 1024 * 1024;
+  }();
+  return s_huge_page_size;
+}
+
+static size_t AlignUp(size_t v, size_t align) {
+  return (v + align - 1) / align * align;
+}
+
+/**
+ * @brief 栈顶之上的管理信息
+ * @details 映射布局: [保护页][栈 size 字节][StackTrailer], 释放时从这里读出
+ *          映射的起始地址和长度, 运行时修改配置也不会影响已分配的栈
+ * */
+struct StackTrailer {
+  void* base;
+  size_t length;
+  size_t size;
+  StackTrailer* next;
+};
+
+static StackTrailer* GetTrailer(void* vp, size_t size) {
+  return (StackTrailer*)((char*)vp + AlignUp(size, 16));
+}
+
+/**
+ * @brief 线程本地的空闲栈链表
+ * @details 只缓存同一种大小的栈(一般就是 fiber.stack_size), 其它大小直接归还系统
+ * */
+struct StackPool {
+  StackTrailer* head = nullptr;
+  size_t size = 0;
+  MmapStackAllocator::Stats stats;
+
+  ~StackPool();
+};
+
+static thread_local bool t_pool_destroyed = false;
+
+static StackPool* GetPool() {
+  if (t_pool_destroyed) {
+    return nullptr;
+  }
+  static thread_local StackPool t_pool;
+  return &t_pool;
+}
+
+StackPool::~StackPool() {
+  while (head) {
+    StackTrailer* t = head;
+    head = t->next;
+    munmap(t->base, t->length);
+  }
+  t_pool_destroyed = true;
+}
+
+StackAllocator* StackAllocator::GetDefault() {
+  StackAllocator* v = s_default;
+  if (v) {
+    return v;
+  }
+  if (s_use_mmap) {
+    return MmapStackAllocator::GetInstance();
+  }
+  return MallocStackAllocator::GetInstance();
+}
+
+void StackAllocator::SetDefault(StackAllocator* v) {
+  s_default = v;
+}
+
+MallocStackAllocator* MallocStackAllocator::GetInstance() {
+  static MallocStackAllocator s_instance;
+  return &s_instance;
+}
+
+void* MallocStackAllocator::alloc(size_t size) {
+  return malloc(size);
+}
+
+void MallocStackAllocator::dealloc(void* vp, size_t size) {
+  free(vp);
+}
+
+MmapStackAllocator* MmapStackAllocator::GetInstance() {
+  static MmapStackAllocator s_instance;
+  return &s_instance;
+}
+
+void* MmapStackAllocator::alloc(size_t size) {
+  StackPool* pool = GetPool();
+  if (pool && pool->head && pool->size == size) {
+    StackTrailer* t = pool->head;
+    pool->head = t->next;
+    t->next = nullptr;
+    --pool->stats.cached;
+    ++pool->stats.reused;
+    return (char*)t - AlignUp(size, 16);
+  }
+  return mapStack(size);
+}
+
+void MmapStackAllocator::dealloc(void* vp, size_t size) {
+  if (!vp) {
+    return;
+  }
+  StackPool* pool = GetPool();
+  uint32_t max_cached = s_max_cached;
+  if (!pool || max_cached == 0) {
+    unmapStack(vp, size);
+    return;
+  }
+  if (pool->size != size) {
+    if (pool->head) {
+      unmapStack(vp, size);
+      return;
+    }
+    pool->size = size;
+  }
+
+  StackTrailer* t = GetTrailer(vp, size);
+  t->next = pool->head;
+  pool->head = t;
+  ++pool->stats.cached;
+  if (pool->stats.cached > max_cached) {
+    trim(std::min<uint32_t>(s_trim_to, max_cached));
+  }
+}
+
+void MmapStackAllocator::trim(size_t keep) {
+  StackPool* pool = GetPool();
+  if (!pool) {
+    return;
+  }
+  while (pool->head && pool->stats.cached > keep) {
+    StackTrailer* t = pool->head;
+    pool->head = t->next;
+    --pool->stats.cached;
+    ++pool->stats.unmapped;
+    munmap(t->base, t->length);
+  }
+}
+
+MmapStackAllocator::Stats MmapStackAllocator::getStats() const {
+  StackPool* pool = GetPool();
+  return pool ? pool->stats : Stats();
+}
+
+void* MmapStackAllocator::mapStack(size_t size) {
+  size_t page = GetPageSize();
+  size_t length = AlignUp(page + AlignUp(size, 16) + sizeof(StackTrailer), page);
+  int huge_page = s_huge_page;
+  void* base = MAP_FAILED;
+  bool hugetlb = false;
+
+  if (huge_page == HUGE_PAGE_TLB) {
+    size_t huge_length = AlignUp(length, GetHugePageSize());
+    base = mmap(nullptr, huge_length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base != MAP_FAILED) {
+      length = huge_length;
+      hugetlb = true;
+    } else {
+      static std::atomic<bool> s_warned{false};
+      if (!s_warned.exchange(true)) {
+        SYLAR_LOG_WARN(g_logger) << "mmap MAP_HUGETLB fail errno=" << errno
+                                 << " errstr=" << strerror(errno)
+                                 << ", fallback to normal pages";
+      }
+    }
+  }
+
+  if (base == MAP_FAILED) {
+    base = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+      SYLAR_LOG_ERROR(g_logger) << "mmap fiber stack size=" << size
+                                << " fail errno=" << errno
+                                << " errstr=" << strerror(errno);
+      return nullptr;
+    }
+    if (huge_page == HUGE_PAGE_THP) {
+      madvise(base, length, MADV_HUGEPAGE);
+    }
+  }
+
+  // hugetlb 映射不能按普通页改保护属性, 此时没有保护页
+  if (s_guard_page && !hugetlb) {
+    if (mprotect(base, page, PROT_NONE)) {
+      SYLAR_LOG_ERROR(g_logger) << "mprotect fiber stack guard fail errno="
+                                << errno << " errstr=" << strerror(errno);
+    }
+  }
+
+  void* vp = (char*)base + page;
+  StackTrailer* t = GetTrailer(vp, size);
+  t->base = base;
+  t->length = length;
+  t->size = size;
+  t->next = nullptr;
+
+  StackPool* pool = GetPool();
+  if (pool) {
+    ++pool->stats.mapped;
+  }
+  return vp;
+}
+
+void MmapStackAllocator::unmapStack(void* vp, size_t size) {
+  StackTrailer* t = GetTrailer(vp, size);
+  SYLAR_ASSERT(t->size == size);
+  StackPool* pool = GetPool();
+  if (pool) {
+    ++pool->stats.unmapped;
+  }
+  munmap(t->base, t->length);
+}
+
+}  // namespace sylar
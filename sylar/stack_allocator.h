@@ -0,0 +1,118 @@
+/**
+ * @brief 协程栈内存分配器
+ * */
+#ifndef __SYLAR_STACK_ALLOCATOR_H__
+#define __SYLAR_STACK_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief 协程栈分配器接口
+ * @details 通过 StackAllocator::SetDefault 替换, 协程记录创建时使用的分配器,
+ *          释放时归还给同一个分配器
+ * */
+class StackAllocator : Noncopyable {
+ public:
+  virtual ~StackAllocator() {}
+
+  /**
+   * @brief 分配协程栈
+   * @param[in] size 栈大小
+   * @return 栈的最低可用地址, 失败返回nullptr
+   * */
+  virtual void* alloc(size_t size) = 0;
+
+  /**
+   * @brief 释放协程栈
+   * @param[in] vp alloc返回的地址
+   * @param[in] size 栈大小
+   * */
+  virtual void dealloc(void* vp, size_t size) = 0;
+
+  /**
+   * @brief 分配器名称
+   * */
+  virtual const char* getName() const = 0;
+
+  /**
+   * @brief 返回默认分配器(由 fiber.stack_allocator 配置决定)
+   * */
+  static StackAllocator* GetDefault();
+
+  /**
+   * @brief 设置默认分配器, 传nullptr恢复配置指定的分配器
+   * @attention 分配器必须比所有使用它的协程活得更久
+   * */
+  static void SetDefault(StackAllocator* v);
+};
+
+/**
+ * @brief 使用malloc/free的协程栈分配器
+ * */
+class MallocStackAllocator : public StackAllocator {
+ public:
+  static MallocStackAllocator* GetInstance();
+
+  void* alloc(size_t size) override;
+  void dealloc(void* vp, size_t size) override;
+  const char* getName() const override { return "malloc"; }
+};
+
+/**
+ * @brief 基于mmap的协程栈分配器
+ * @details 每个栈底部带一个PROT_NONE保护页, 栈溢出直接触发SIGSEGV而不是
+ *          悄悄踩坏堆. 释放的栈放入线程本地空闲链表, 下次同样大小的分配直接复用,
+ *          超过 fiber.stack_pool.max_cached 时裁剪到 fiber.stack_pool.trim_to
+ * */
+class MmapStackAllocator : public StackAllocator {
+ public:
+  /**
+   * @brief 统计信息
+   * */
+  struct Stats {
+    /// mmap 次数
+    uint64_t mapped = 0;
+    /// munmap 次数
+    uint64_t unmapped = 0;
+    /// 命中线程缓存的次数
+    uint64_t reused = 0;
+    /// 当前线程缓存中的栈数量
+    uint64_t cached = 0;
+  };
+
+  static MmapStackAllocator* GetInstance();
+
+  void* alloc(size_t size) override;
+  void dealloc(void* vp, size_t size) override;
+  const char* getName() const override { return "mmap"; }
+
+  /**
+   * @brief 释放当前线程缓存的栈, 只保留keep个
+   * */
+  void trim(size_t keep = 0);
+
+  /**
+   * @brief 返回当前线程的统计信息
+   * */
+  Stats getStats() const;
+
+ private:
+  /**
+   * @brief 映射一个新的栈
+   * */
+  void* mapStack(size_t size);
+
+  /**
+   * @brief 解除栈的映射
+   * */
+  void unmapStack(void* vp, size_t size);
+};
+
+}  // namespace sylar
+
+#endif
@@ -1,4 +1,6 @@
 #include "socket_stream.h"
+#include <limits.h>
+#include <sys/sendfile.h>
 
 namespace sylar {
 
@@ -55,6 +57,46 @@ int SocketStream::write(ByteArray::ptr ba, size_t length) {
   return rt;
 }
 
+int SocketStream::writevFixSize(iovec* iovs, size_t count) {
+  if (!isConnected()) {
+    return -1;
+  }
+  int64_t total = 0;
+  while (count > 0) {
+    int64_t len = m_socket->send(iovs, std::min<size_t>(count, IOV_MAX));
+    if (len <= 0) {
+      return len;
+    }
+    total += len;
+    //跳过已经写完的块, 调整写了一部分的块
+    while (count > 0 && (size_t)len >= iovs->iov_len) {
+      len -= iovs->iov_len;
+      ++iovs;
+      --count;
+    }
+    if (count > 0) {
+      iovs->iov_base = (char*)iovs->iov_base + len;
+      iovs->iov_len -= len;
+    }
+  }
+  return total;
+}
+
+int64_t SocketStream::sendFileFixSize(int fd, off_t offset, uint64_t length) {
+  if (!isConnected()) {
+    return -1;
+  }
+  uint64_t left = length;
+  while (left > 0) {
+    ssize_t len = sendfile(m_socket->getSocket(), fd, &offset, left);
+    if (len <= 0) {
+      return len;
+    }
+    left -= len;
+  }
+  return length;
+}
+
 void SocketStream::close() {
   if (m_socket) {
     m_socket->close();
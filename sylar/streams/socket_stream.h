@@ -27,6 +27,29 @@ class SocketStream : public Stream {
 
   virtual int write(ByteArray::ptr ba, size_t length) override;
 
+  /**
+   * @brief 用writev写完所有数据
+   * @param[in, out] iovs 数据块, 部分写入时会被修改
+   * @param[in] count 数据块个数
+   * @return
+   *      @retval >0 返回写入的总长度
+   *      @retval =0 被关闭
+   *      @retval <0 出现流错误
+   */
+  int writevFixSize(iovec* iovs, size_t count);
+
+  /**
+   * @brief 用sendfile把文件的一段直接发到socket, 不经过用户态
+   * @param[in] fd 文件句柄
+   * @param[in] offset 文件中的起始位置
+   * @param[in] length 长度
+   * @return
+   *      @retval >0 返回写入的总长度
+   *      @retval =0 被关闭或者文件提前结束
+   *      @retval <0 出现流错误
+   */
+  int64_t sendFileFixSize(int fd, off_t offset, uint64_t length);
+
   virtual void close() override;
 
   Socket::ptr getSocket() const { return m_socket; }
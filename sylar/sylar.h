@@ -8,6 +8,7 @@
 #include "macro.h"
 #include "scheduler.h"
 #include "singleton.h"
+#include "stack_allocator.h"
 #include "thread.h"
 #include "util.h"
 
@@ -1,4 +1,7 @@
 #include "tcp_server.h"
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
 #include "config.h"
 #include "log.h"
 
@@ -8,15 +11,88 @@ static sylar::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
     sylar::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2),
                           "tcp server read timeout");
 
+static sylar::ConfigVar<bool>::ptr g_tcp_server_shared_stack =
+    sylar::Config::Lookup("tcp_server.shared_stack", false,
+                          "tcp server handle client in shared stack fiber");
+
+static sylar::ConfigVar<bool>::ptr g_tcp_server_reactor =
+    sylar::Config::Lookup("tcp_server.reactor", false,
+                          "tcp server thread-per-core reactor mode");
+
+static sylar::ConfigVar<uint32_t>::ptr g_tcp_server_reactor_count =
+    sylar::Config::Lookup("tcp_server.reactor_count", (uint32_t)0,
+                          "tcp server reactor thread count, 0 means cpu count");
+
+static sylar::ConfigVar<bool>::ptr g_tcp_server_reactor_affinity =
+    sylar::Config::Lookup("tcp_server.reactor_affinity", false,
+                          "tcp server bind each reactor thread to one cpu");
+
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
 
+/**
+ * @brief reactor池, 进程内所有reactor模式的TcpServer共用
+ * @details 第一次使用时按配置创建, 不会销毁, reactor线程与进程同生命周期
+ */
+class ReactorPool {
+ public:
+  ReactorPool() {
+    size_t count = g_tcp_server_reactor_count->getValue();
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    sched_getaffinity(0, sizeof(cpus), &cpus);
+    if (count == 0) {
+      count = std::max(CPU_COUNT(&cpus), 1);
+    }
+    std::vector<int> cpu_ids;
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &cpus)) {
+        cpu_ids.push_back(i);
+      }
+    }
+    bool affinity = g_tcp_server_reactor_affinity->getValue();
+    for (size_t i = 0; i < count; ++i) {
+      IOManager::ptr reactor(
+          new IOManager(1, false, "reactor_" + std::to_string(i)));
+      if (affinity && !cpu_ids.empty()) {
+        int cpu = cpu_ids[i % cpu_ids.size()];
+        reactor->schedule([cpu]() {
+          cpu_set_t set;
+          CPU_ZERO(&set);
+          CPU_SET(cpu, &set);
+          int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+          if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "pthread_setaffinity_np cpu=" << cpu
+                                      << " rt=" << rt;
+          }
+        });
+      }
+      m_reactors.push_back(reactor);
+    }
+    SYLAR_LOG_INFO(g_logger) << "reactor pool count=" << count
+                             << " affinity=" << affinity;
+  }
+
+  const std::vector<IOManager::ptr>& getReactors() const { return m_reactors; }
+
+ private:
+  std::vector<IOManager::ptr> m_reactors;
+};
+
+static ReactorPool* GetReactorPool() {
+  //不析构: 退出时reactor上可能还有等待accept的协程, stop会一直等
+  static ReactorPool* s_pool = new ReactorPool;
+  return s_pool;
+}
+
 TcpServer::TcpServer(sylar::IOManager* worker, sylar::IOManager* accept_worker)
     : m_worker(worker),
       m_acceptWorker(accept_worker),
       m_recvTimeout(g_tcp_server_read_timeout->getValue()),
       m_name("sylar/1.0.0"),
       m_type("tcp"),
-      m_isStop(true) {
+      m_isStop(true),
+      m_sharedStack(g_tcp_server_shared_stack->getValue()),
+      m_reactorMode(g_tcp_server_reactor->getValue()) {
   std::cout << "------------------- TcpServer()----------------------------\n";
 }
 
@@ -38,26 +114,46 @@ bool TcpServer::bind(sylar::Address::ptr addr) {
 
 bool TcpServer::bind(const std::vector<Address::ptr>& addrs,
                      std::vector<Address::ptr>& fails) {
-  for (auto& addr : addrs) {
-    Socket::ptr sock = Socket::CreateTCP(addr);
-    if (!sock->bind(addr)) {
-      SYLAR_LOG_ERROR(g_logger)
-          << "bind fail errno = " << errno << "errstr = " << strerror(errno)
-          << "addr=[" << addr->toString() << "]";
-      fails.push_back(addr);
-      continue;
+  std::vector<IOManager*> reactors;
+  if (m_reactorMode) {
+    for (auto& i : GetReactorPool()->getReactors()) {
+      reactors.push_back(i.get());
     }
-    if (!sock->listen()) {
-      SYLAR_LOG_ERROR(g_logger)
-          << "listen fail errno = " << errno << "errstr = " << strerror(errno)
-          << "addr=[" << addr->toString() << "]";
-      fails.push_back(addr);
-      continue;
+  } else {
+    reactors.push_back(nullptr);
+  }
+  for (auto& addr : addrs) {
+    //端口为0时后续socket绑定到第一个socket分到的端口上
+    Address::ptr bind_addr = addr;
+    for (auto reactor : reactors) {
+      Socket::ptr sock = Socket::CreateTCP(addr);
+      sock->setReusePort(m_reactorMode);
+      if (!sock->bind(bind_addr)) {
+        SYLAR_LOG_ERROR(g_logger)
+            << "bind fail errno = " << errno << "errstr = " << strerror(errno)
+            << "addr=[" << addr->toString() << "]";
+        fails.push_back(addr);
+        break;
+      }
+      if (!sock->listen()) {
+        SYLAR_LOG_ERROR(g_logger)
+            << "listen fail errno = " << errno << "errstr = " << strerror(errno)
+            << "addr=[" << addr->toString() << "]";
+        fails.push_back(addr);
+        break;
+      }
+      m_socks.push_back(sock);
+      m_sockReactors.push_back(reactor);
+      //unix socket不支持SO_REUSEPORT, 只在第一个reactor上监听
+      if (addr->getFamily() == AF_UNIX) {
+        break;
+      }
+      bind_addr = sock->getLocalAddress();
     }
-    m_socks.push_back(sock);
   }
   if (!fails.empty()) {
     m_socks.clear();
+    m_sockReactors.clear();
     return false;
   }
   for (auto& i : m_socks) {
@@ -72,9 +168,11 @@ bool TcpServer::start() {
     return true;
   }
   m_isStop = false;
-  for (auto& sock : m_socks) {
-    m_acceptWorker->schedule(
-        std::bind(&TcpServer::startAccept, shared_from_this(), sock));
+  for (size_t i = 0; i < m_socks.size(); ++i) {
+    IOManager* accept_worker =
+        m_sockReactors[i] ? m_sockReactors[i] : m_acceptWorker;
+    accept_worker->schedule(
+        std::bind(&TcpServer::startAccept, shared_from_this(), m_socks[i]));
   }
   return true;
 }
@@ -84,6 +182,19 @@ bool TcpServer::start() {
 void TcpServer::stop() {
   m_isStop = true;
   auto self = shared_from_this();
+  if (m_reactorMode) {
+    //监听socket注册在各自的reactor上, 需要在那里取消
+    for (size_t i = 0; i < m_socks.size(); ++i) {
+      Socket::ptr sock = m_socks[i];
+      m_sockReactors[i]->schedule([sock]() {
+        sock->cancelAll();
+        sock->close();
+      });
+    }
+    m_socks.clear();
+    m_sockReactors.clear();
+    return;
+  }
   m_acceptWorker->schedule([this, self]() {
     for (auto& sock : m_socks) {
       sock->cancelAll();
@@ -98,12 +209,20 @@ void TcpServer::handleClient(Socket::ptr client) {
 }
 
 void TcpServer::startAccept(Socket::ptr sock) {
+  //reactor模式下新连接留在接受它的reactor上
+  IOManager* worker = m_reactorMode ? IOManager::GetThis() : m_worker;
   while (!m_isStop) {
     Socket::ptr Client = sock->accept();
     if (Client) {
       Client->setRecvTimeout(m_recvTimeout);
-      m_worker->schedule(
-          std::bind(&TcpServer::handleClient, shared_from_this(), Client));
+      if (m_sharedStack) {
+        worker->schedule(Fiber::ptr(new Fiber(
+            std::bind(&TcpServer::handleClient, shared_from_this(), Client), 0,
+            false, true)));
+      } else {
+        worker->schedule(
+            std::bind(&TcpServer::handleClient, shared_from_this(), Client));
+      }
     } else {
       SYLAR_LOG_ERROR(g_logger)
           << " accept errno" << errno << " errstr = " << strerror(errno);
@@ -116,7 +235,9 @@ std::string TcpServer::tostring(const std::string& prefix) {
   ss << prefix << "[type=" << m_type << " name = " << m_name
      << " worker = " << (m_worker ? m_worker->getName() : "")
      << " accept= " << (m_acceptWorker ? m_acceptWorker->getName() : "")
-     << " recv_timeout = " << m_recvTimeout << "]" << std::endl;
+     << " recv_timeout = " << m_recvTimeout
+     << " shared_stack = " << m_sharedStack
+     << " reactor = " << m_reactorMode << "]" << std::endl;
   std::string pfx = prefix.empty() ? "    " : prefix;
   for (auto& i : m_socks) {
     ss << pfx << pfx << *i << std::endl;
@@ -74,6 +74,30 @@ class TcpServer : public std::enable_shared_from_this<TcpServer>, Noncopyable {
 
   bool isStop() const { return m_isStop; }
 
+  /**
+   * @brief 新连接是否在共享栈协程中处理
+   * @details 适合大量长期空闲的连接, 见 Fiber 的 shared_stack 参数
+   */
+  bool isSharedStack() const { return m_sharedStack; }
+
+  void setSharedStack(bool v) { m_sharedStack = v; }
+
+  /**
+   * @brief 是否每个线程一个reactor
+   * @details 开启后忽略构造函数传入的调度器, 使用进程内共享的reactor池:
+   *          每个reactor是一个单线程的IOManager, 有自己的epoll,
+   *          每个监听地址在每个reactor上各有一个SO_REUSEPORT的socket,
+   *          新连接在接受它的reactor线程上处理直到关闭. 需要在bind之前设置
+   */
+  bool isReactorMode() const { return m_reactorMode; }
+
+  void setReactorMode(bool v) { m_reactorMode = v; }
+
+  /**
+   * @brief 返回监听socket, reactor模式下每个地址有多个
+   */
+  std::vector<Socket::ptr> getSocks() const { return m_socks; }
+
   virtual std::string tostring(const std::string& prefix = "");
 
  protected:
@@ -104,6 +128,12 @@ class TcpServer : public std::enable_shared_from_this<TcpServer>, Noncopyable {
   std::string m_type = "tcp";
   /// 服务是否停止
   bool m_isStop;
+  /// 连接处理协程是否使用共享栈
+  bool m_sharedStack;
+  /// 是否每个线程一个reactor
+  bool m_reactorMode;
+  /// reactor模式下监听socket所在的reactor, 与m_socks一一对应
+  std::vector<IOManager*> m_sockReactors;
 };
 
 }  // namespace sylar
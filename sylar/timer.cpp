@@ -1,14 +1,226 @@
 #include "timer.h"
+#include <algorithm>
+#include "config.h"
+#include "log.h"
 #include "util.h"
 
 namespace sylar {
 
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
+
+static ConfigVar<std::string>::ptr g_timer_backend =
+    Config::Lookup("timer.backend", std::string("set"),
+                   "timer manager backend, set or wheel");
+
+/**
+ * @brief 分层时间轮
+ * @details 精度1毫秒, 第0层256个槽, 第1~4层各64个槽, 覆盖2^32毫秒,
+ *          更远的定时器先放在最高层, 降级时重新计算位置.
+ *          槽位是侵入式双向链表, 添加/删除都是O(1),
+ *          高层的槽在低层转完一圈时逐级降级到低层
+ * */
+class TimingWheel {
+ public:
+  TimingWheel() { m_current = sylar::GetCurrentMS(); }
+
+  ~TimingWheel() {
+    std::vector<Timer::ptr> timers;
+    expireAll(timers);
+  }
+
+  bool empty() const { return m_count == 0; }
+
+  /**
+   * @brief 添加定时器, 到期时间为timer->m_next
+   * */
+  void add(Timer::ptr timer) {
+    if (m_count == 0) {
+      //空闲时不推进时间, 加入第一个定时器时直接对齐到当前时间
+      m_current = sylar::GetCurrentMS();
+    }
+    Timer* t = timer.get();
+    t->m_wheelRef.swap(timer);
+    place(t);
+    ++m_count;
+  }
+
+  /**
+   * @brief 删除定时器
+   * @return 定时器不在时间轮中返回nullptr, 否则返回时间轮持有的引用
+   * */
+  Timer::ptr remove(Timer* t) {
+    if (!t->m_wheelSlot) {
+      return nullptr;
+    }
+    unlink(t);
+    --m_count;
+    Timer::ptr rt;
+    rt.swap(t->m_wheelRef);
+    return rt;
+  }
+
+  /**
+   * @brief 最早到期的时间, 高层的槽返回降级的时间
+   * @return 没有定时器返回~0ull
+   * */
+  uint64_t nextExpire() const {
+    if (m_count == 0) {
+      return ~0ull;
+    }
+    for (uint64_t i = 0; i < SLOTS0; ++i) {
+      if (m_slots0[(m_current + i) & MASK0]) {
+        return m_current + i;
+      }
+    }
+    uint64_t rt = ~0ull;
+    for (int level = 1; level < LEVELS; ++level) {
+      int shift = Shift(level);
+      uint64_t unit = 1ull << shift;
+      uint64_t when = (m_current + unit - 1) & ~(unit - 1);
+      for (uint64_t k = 0; k < SLOTS; ++k, when += unit) {
+        if (m_slots[level - 1][(when >> shift) & MASK]) {
+          rt = std::min(rt, when);
+          break;
+        }
+      }
+    }
+    return rt;
+  }
+
+  /**
+   * @brief 推进到now_ms, 取出所有到期的定时器
+   * */
+  void expire(uint64_t now_ms, std::vector<Timer::ptr>& expired) {
+    while (m_current <= now_ms) {
+      if (m_count == 0) {
+        m_current = now_ms + 1;
+        break;
+      }
+      size_t idx = m_current & MASK0;
+      if (idx == 0) {
+        for (int level = 1; level < LEVELS; ++level) {
+          size_t i = (m_current >> Shift(level)) & MASK;
+          cascade(&m_slots[level - 1][i]);
+          if (i != 0) {
+            break;
+          }
+        }
+      }
+      takeAll(&m_slots0[idx], expired);
+      ++m_current;
+    }
+  }
+
+  /**
+   * @brief 取出所有定时器
+   * */
+  void expireAll(std::vector<Timer::ptr>& expired) {
+    for (size_t i = 0; i < SLOTS0; ++i) {
+      takeAll(&m_slots0[i], expired);
+    }
+    for (int level = 1; level < LEVELS; ++level) {
+      for (size_t i = 0; i < SLOTS; ++i) {
+        takeAll(&m_slots[level - 1][i], expired);
+      }
+    }
+  }
+
+ private:
+  static const int LEVELS = 5;
+  static const uint64_t SLOTS0 = 256;
+  static const uint64_t MASK0 = SLOTS0 - 1;
+  static const uint64_t SLOTS = 64;
+  static const uint64_t MASK = SLOTS - 1;
+
+  /// 第level层槽位对应的时间位移
+  static int Shift(int level) { return 8 + 6 * (level - 1); }
+
+  /**
+   * @brief 按到期时间放入对应层的槽
+   * */
+  void place(Timer* t) {
+    uint64_t expires = t->m_next < m_current ? m_current : t->m_next;
+    uint64_t delta = expires - m_current;
+    Timer** slot = nullptr;
+    if (delta < SLOTS0) {
+      slot = &m_slots0[expires & MASK0];
+    } else {
+      if (delta >= (1ull << Shift(LEVELS))) {
+        expires = m_current + (1ull << Shift(LEVELS)) - 1;
+      }
+      for (int level = 1; level < LEVELS; ++level) {
+        if (delta < (1ull << Shift(level + 1)) || level == LEVELS - 1) {
+          slot = &m_slots[level - 1][(expires >> Shift(level)) & MASK];
+          break;
+        }
+      }
+    }
+    t->m_wheelSlot = slot;
+    t->m_wheelPrev = nullptr;
+    t->m_wheelNext = *slot;
+    if (*slot) {
+      (*slot)->m_wheelPrev = t;
+    }
+    *slot = t;
+  }
+
+  void unlink(Timer* t) {
+    if (t->m_wheelPrev) {
+      t->m_wheelPrev->m_wheelNext = t->m_wheelNext;
+    } else {
+      *t->m_wheelSlot = t->m_wheelNext;
+    }
+    if (t->m_wheelNext) {
+      t->m_wheelNext->m_wheelPrev = t->m_wheelPrev;
+    }
+    t->m_wheelPrev = nullptr;
+    t->m_wheelNext = nullptr;
+    t->m_wheelSlot = nullptr;
+  }
+
+  /**
+   * @brief 高层的槽降级, 重新放入低层
+   * */
+  void cascade(Timer** slot) {
+    Timer* t = *slot;
+    *slot = nullptr;
+    while (t) {
+      Timer* next = t->m_wheelNext;
+      place(t);
+      t = next;
+    }
+  }
+
+  void takeAll(Timer** slot, std::vector<Timer::ptr>& expired) {
+    Timer* t = *slot;
+    *slot = nullptr;
+    while (t) {
+      Timer* next = t->m_wheelNext;
+      t->m_wheelPrev = nullptr;
+      t->m_wheelNext = nullptr;
+      t->m_wheelSlot = nullptr;
+      expired.push_back(std::move(t->m_wheelRef));
+      --m_count;
+      t = next;
+    }
+  }
+
+ private:
+  /// 下一个要处理的时间(毫秒)
+  uint64_t m_current = 0;
+  /// 定时器数量
+  size_t m_count = 0;
+  /// 第0层, 每槽1毫秒
+  Timer* m_slots0[SLOTS0] = {nullptr};
+  /// 第1~4层, 每槽2^(8+6*(level-1))毫秒
+  Timer* m_slots[LEVELS - 1][SLOTS] = {{nullptr}};
+};
+
 bool Timer::cancel() {
   TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
   if (m_cb) {
     m_cb = nullptr;
-    auto it = m_manager->m_timers.find(shared_from_this());
-    m_manager->m_timers.erase(it);
+    m_manager->removeTimer(this);
     return true;
   }
   return false;
@@ -19,13 +231,12 @@ bool Timer::refresh() {
   if (!m_cb) {
     return false;
   }
-  auto it = m_manager->m_timers.find(shared_from_this());
-  if (it == m_manager->m_timers.end()) {
+  Timer::ptr self = shared_from_this();
+  if (!m_manager->removeTimer(this)) {
     return false;
   }
-  m_manager->m_timers.erase(it);
   m_next = sylar::GetCurrentMS() + m_ms;
-  m_manager->m_timers.insert(shared_from_this());
+  m_manager->insertTimer(self);
   return true;
 }
 
@@ -37,11 +248,10 @@ bool Timer::reset(uint64_t ms, bool from_now) {
   if (!m_cb) {
     return false;
   }
-  auto it = m_manager->m_timers.find(shared_from_this());
-  if (it == m_manager->m_timers.end()) {
+  Timer::ptr self = shared_from_this();
+  if (!m_manager->removeTimer(this)) {
     return false;
   }
-  m_manager->m_timers.erase(it);
   uint64_t start = 0;
   if (from_now) {
     start = sylar::GetCurrentMS();
@@ -50,7 +260,7 @@ bool Timer::reset(uint64_t ms, bool from_now) {
   }
   m_ms = ms;
   m_next = start + m_ms;
-  m_manager->addTimer(shared_from_this(), lock);
+  m_manager->addTimer(self, lock);
   return true;
 }
 
@@ -83,6 +293,13 @@ bool Timer::Comparator::operator()(const Timer::ptr lhs,
 
 TimerManager::TimerManager() {
   m_previouseTime = sylar::GetCurrentMS();
+  const std::string& backend = g_timer_backend->getValue();
+  if (backend == "wheel") {
+    m_wheel.reset(new TimingWheel);
+  } else if (backend != "set") {
+    SYLAR_LOG_WARN(g_logger) << "unknown timer.backend=" << backend
+                             << ", use set";
+  }
 }
 
 TimerManager::~TimerManager() {}
@@ -109,6 +326,16 @@ Timer::ptr TimerManager::addConditionTimer(uint64_t ms,
   return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recuring);
 }
 uint64_t TimerManager::getNextTimer() {
+  if (m_wheel) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_trickled = false;
+    m_wheelDeadline = m_wheel->nextExpire();
+    if (m_wheelDeadline == ~0ull) {
+      return ~0ull;
+    }
+    uint64_t now_ms = sylar::GetCurrentMS();
+    return now_ms >= m_wheelDeadline ? 0 : m_wheelDeadline - now_ms;
+  }
   RWMutexType::ReadLock lock(m_mutex);
   m_trickled = false;
   if (m_timers.empty()) {
@@ -126,45 +353,75 @@ uint64_t TimerManager::getNextTimer() {
 void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs) {
   uint64_t now_ms = sylar::GetCurrentMS();
   std::vector<Timer::ptr> expired;
-  {
-    RWMutexType::ReadLock lock(m_mutex);
-    if (m_timers.empty()) {
-      return;
-    }
+  if (!hasTimer()) {
+    return;
   }
 
   RWMutexType::WriteLock lock(m_mutex);
-  if (m_timers.empty()) {
-    return;
-  }
+  if (m_wheel) {
+    if (m_wheel->empty()) {
+      return;
+    }
+    if (detectClockRollover(now_ms)) {
+      m_wheel->expireAll(expired);
+    } else {
+      m_wheel->expire(now_ms, expired);
+    }
+  } else {
+    if (m_timers.empty()) {
+      return;
+    }
 
-  bool rollower = detectClockRollover(now_ms);
-  if (!rollower && (*m_timers.begin())->m_next > now_ms) {
-    return;
-  }
+    bool rollower = detectClockRollover(now_ms);
+    if (!rollower && (*m_timers.begin())->m_next > now_ms) {
+      return;
+    }
 
-  Timer::ptr now_timer(new Timer(now_ms));
-  auto it = rollower ? m_timers.end() : m_timers.lower_bound(now_timer);
-  while (it != m_timers.end() && (*it)->m_next == now_ms) {
-    ++it;
+    Timer::ptr now_timer(new Timer(now_ms));
+    auto it = rollower ? m_timers.end() : m_timers.lower_bound(now_timer);
+    while (it != m_timers.end() && (*it)->m_next == now_ms) {
+      ++it;
+    }
+    expired.insert(expired.begin(), m_timers.begin(), it);
+    m_timers.erase(m_timers.begin(), it);
   }
-  expired.insert(expired.begin(), m_timers.begin(), it);
-  m_timers.erase(m_timers.begin(), it);
   cbs.reserve(expired.size());
   for (auto& timer : expired) {
     cbs.push_back(timer->m_cb);
     if (timer->m_recurring) {
       timer->m_next = now_ms + timer->m_ms;
-      m_timers.insert(timer);
+      insertTimer(timer);
     } else {
       timer->m_cb = nullptr;
     }
   }
 }
 
+bool TimerManager::removeTimer(Timer* timer) {
+  if (m_wheel) {
+    return !!m_wheel->remove(timer);
+  }
+  auto it = m_timers.find(timer->shared_from_this());
+  if (it == m_timers.end()) {
+    return false;
+  }
+  m_timers.erase(it);
+  return true;
+}
+
+bool TimerManager::insertTimer(Timer::ptr timer) {
+  if (m_wheel) {
+    //比idle等待到的时间更早才需要唤醒
+    bool at_front = timer->m_next < m_wheelDeadline;
+    m_wheel->add(timer);
+    return at_front;
+  }
+  auto it = m_timers.insert(timer).first;
+  return it == m_timers.begin();
+}
+
 void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-  auto it = m_timers.insert(val).first;
-  bool at_front = (it == m_timers.begin()) && !m_trickled;
+  bool at_front = insertTimer(val) && !m_trickled;
   if (at_front) {
     m_trickled = true;
   }
@@ -184,7 +441,7 @@ bool TimerManager::detectClockRollover(uint64_t now_ms) {
 
 bool TimerManager::hasTimer() {
   RWMutexType::ReadLock lock(m_mutex);
-  return !m_timers.empty();
+  return m_wheel ? !m_wheel->empty() : !m_timers.empty();
 }
 
 }  // namespace sylar
\ No newline at end of file
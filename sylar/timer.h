@@ -1,6 +1,7 @@
 #ifndef __SYLAR_TIMER_H__
 #define __SYLAR_TIMER_H__
 
+#include <functional>
 #include <memory>
 #include <set>
 #include <vector>
@@ -10,9 +11,11 @@
 namespace sylar {
 
 class TimerManager;
+class TimingWheel;
 
 class Timer : public std::enable_shared_from_this<Timer> {
   friend class TimerManager;
+  friend class TimingWheel;
 
  public:
   typedef std::shared_ptr<Timer> ptr;
@@ -40,6 +43,14 @@ class Timer : public std::enable_shared_from_this<Timer> {
   std::function<void()> m_cb;
   /// 定时器管理器
   TimerManager* m_manager = nullptr;
+  /// 时间轮槽位链表的前一个定时器
+  Timer* m_wheelPrev = nullptr;
+  /// 时间轮槽位链表的后一个定时器
+  Timer* m_wheelNext = nullptr;
+  /// 所在时间轮槽位的链表头, 不在时间轮中时为空
+  Timer** m_wheelSlot = nullptr;
+  /// 在时间轮中时持有自身的引用
+  Timer::ptr m_wheelRef;
 };
 
 class TimerManager {
@@ -48,6 +59,11 @@ class TimerManager {
  public:
   typedef RWMutex RWMutexType;
 
+  /**
+   * @brief 构造函数
+   * @details 根据配置timer.backend选择定时器的实现:
+   *          set 有序集合, 增删O(log n); wheel 分层时间轮, 增删O(1)
+   * */
   TimerManager();
   virtual ~TimerManager();
 
@@ -63,6 +79,10 @@ class TimerManager {
    * */
   void listExpiredCb(std::vector<std::function<void()>>& cbs);
   bool hasTimer();
+  /**
+   * @brief 是否使用时间轮
+   * */
+  bool isTimingWheel() const { return !!m_wheel; }
 
  protected:
   virtual void onTimerInsertedAtFront() = 0;
@@ -74,11 +94,27 @@ class TimerManager {
   * */
   bool detectClockRollover(uint64_t now_ms);
 
+  /**
+   * @brief 从容器中移除定时器, 需要持有写锁
+   * @return 定时器不在容器中时返回false
+   * */
+  bool removeTimer(Timer* timer);
+
+  /**
+   * @brief 把定时器放入容器, 需要持有写锁
+   * @return 是否成为最早到期的定时器
+   * */
+  bool insertTimer(Timer::ptr timer);
+
  private:
   /// 锁
   RWMutexType m_mutex;
   /// 定时器的集合
   std::set<Timer::ptr, Timer::Comparator> m_timers;
+  /// 时间轮, 为空时使用m_timers
+  std::unique_ptr<TimingWheel> m_wheel;
+  /// 时间轮模式下idle等待到的时间
+  uint64_t m_wheelDeadline = ~0ull;
   /// 是否触发onTimerInsertedAtFront
   bool m_trickled = false;
   /// 上次的执行时间
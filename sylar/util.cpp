@@ -1,13 +1,32 @@
 #include "util.h"
 #include <execinfo.h>
+#include <openssl/sha.h>
 #include <sys/time.h>
 #include "fiber.h"
 #include "log.h"
 
 namespace sylar {
 sylar::Logger::ptr g_logger = SYLAR_LOG_NEAME("system");
+
+/// 缓存的线程id, 避免每次都走gettid系统调用
+static thread_local pid_t t_thread_id = 0;
+
+static void ResetThreadId() {
+  t_thread_id = 0;
+}
+
+struct ThreadIdIniter {
+  //fork出的子进程线程id变了, 需要重新获取
+  ThreadIdIniter() { pthread_atfork(nullptr, nullptr, &ResetThreadId); }
+};
+
+static ThreadIdIniter s_thread_id_initer;
+
 pid_t GetThreadId() {
-  return syscall(SYS_gettid);
+  if (t_thread_id == 0) {
+    t_thread_id = syscall(SYS_gettid);
+  }
+  return t_thread_id;
 }
 uint32_t GetFiberId() {
   return sylar::Fiber::GetFiberId();
@@ -53,4 +72,78 @@ uint64_t GetCurrentUS() {
   return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
 }
 
+std::string Base64Encode(const void* data, size_t len) {
+  static const char* s_table =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const unsigned char* src = (const unsigned char*)data;
+  std::string rt;
+  rt.reserve((len + 2) / 3 * 4);
+  size_t i = 0;
+  for (; i + 2 < len; i += 3) {
+    uint32_t v = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+    rt += s_table[v >> 18];
+    rt += s_table[(v >> 12) & 0x3f];
+    rt += s_table[(v >> 6) & 0x3f];
+    rt += s_table[v & 0x3f];
+  }
+  if (i < len) {
+    uint32_t v = src[i] << 16;
+    if (i + 1 < len) {
+      v |= src[i + 1] << 8;
+    }
+    rt += s_table[v >> 18];
+    rt += s_table[(v >> 12) & 0x3f];
+    rt += i + 1 < len ? s_table[(v >> 6) & 0x3f] : '=';
+    rt += '=';
+  }
+  return rt;
+}
+
+std::string Base64Encode(const std::string& data) {
+  return Base64Encode(data.c_str(), data.size());
+}
+
+bool Base64Decode(const std::string& data, std::string& out) {
+  out.clear();
+  out.reserve(data.size() / 4 * 3 + 2);
+  uint32_t v = 0;
+  int bits = 0;
+  for (size_t i = 0; i < data.size(); ++i) {
+    char c = data[i];
+    int n;
+    if (c >= 'A' && c <= 'Z') {
+      n = c - 'A';
+    } else if (c >= 'a' && c <= 'z') {
+      n = c - 'a' + 26;
+    } else if (c >= '0' && c <= '9') {
+      n = c - '0' + 52;
+    } else if (c == '+' || c == '-') {
+      n = 62;
+    } else if (c == '/' || c == '_') {
+      n = 63;
+    } else if (c == '=') {
+      break;
+    } else {
+      return false;
+    }
+    v = (v << 6) | n;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out += (char)(v >> bits);
+    }
+  }
+  return true;
+}
+
+std::string Sha1Sum(const void* data, size_t len) {
+  std::string rt(SHA_DIGEST_LENGTH, '\0');
+  SHA1((const unsigned char*)data, len, (unsigned char*)&rt[0]);
+  return rt;
+}
+
+std::string Sha1Sum(const std::string& data) {
+  return Sha1Sum(data.c_str(), data.size());
+}
+
 }  // namespace sylar
\ No newline at end of file
@@ -23,6 +23,28 @@ std::string BacktraceToString(int size = 64, int skip = 2,
 uint64_t GetCurrentMS();
 /// 时间us
 uint64_t GetCurrentUS();
+
+/**
+ * @brief base64编码(标准字母表, 带=填充)
+ */
+std::string Base64Encode(const void* data, size_t len);
+
+std::string Base64Encode(const std::string& data);
+
+/**
+ * @brief base64解码, 同时接受标准和URL安全的字母表, 填充可以省略
+ * @param[out] out 解码结果
+ * @return 有非法字符时返回false
+ */
+bool Base64Decode(const std::string& data, std::string& out);
+
+/**
+ * @brief 计算SHA1
+ * @return 20字节的二进制摘要
+ */
+std::string Sha1Sum(const void* data, size_t len);
+
+std::string Sha1Sum(const std::string& data);
 }  // namespace sylar
 
 #endif  // __SYLAR_UTIL_H__
\ No newline at end of file
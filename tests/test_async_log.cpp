@@ -0,0 +1,180 @@
+#include <unistd.h>
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 只计数的Appender, 可以模拟慢速磁盘
+ * */
+class CountLogAppender : public sylar::LogAppender {
+ public:
+  typedef std::shared_ptr<CountLogAppender> ptr;
+  CountLogAppender(int sleep_us = 0) : m_sleepUs(sleep_us) {}
+
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {
+    if (m_sleepUs) {
+      usleep(m_sleepUs);
+    }
+    ++m_count[level];
+    ++m_total;
+  }
+  std::string toYamlString() override { return "type: CountLogAppender"; }
+
+  uint64_t m_count[sylar::LogLevel::FATAL + 1] = {0};
+  uint64_t m_total = 0;
+  int m_sleepUs;
+};
+
+/**
+ * @brief 多个线程同时写, BLOCK策略下一条都不能少
+ * */
+void test_block(int threads, int count) {
+  sylar::Logger::ptr logger(new sylar::Logger("async_block"));
+  CountLogAppender::ptr counter(new CountLogAppender);
+  sylar::AsyncLogAppender::ptr async(new sylar::AsyncLogAppender(counter, 64));
+  logger->addAppender(async);
+
+  std::vector<sylar::Thread::ptr> thrs;
+  for (int i = 0; i < threads; ++i) {
+    thrs.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [logger, count]() {
+          for (int n = 0; n < count; ++n) {
+            SYLAR_LOG_INFO(logger) << "block " << n;
+          }
+        },
+        "block_" + std::to_string(i))));
+  }
+  for (auto& i : thrs) {
+    i->join();
+  }
+  async->flush();
+  SYLAR_LOG_INFO(g_logger) << "block written=" << counter->m_total
+                           << " dropped=" << async->getDropCount();
+  SYLAR_ASSERT(counter->m_total == (uint64_t)threads * count);
+  SYLAR_ASSERT(async->getDropCount() == 0);
+}
+
+/**
+ * @brief 慢速Appender, 队列很快写满
+ * */
+void test_drop() {
+  sylar::Logger::ptr logger(new sylar::Logger("async_drop"));
+  CountLogAppender::ptr counter(new CountLogAppender(100));
+  sylar::AsyncLogAppender::ptr async(new sylar::AsyncLogAppender(
+      counter, 16, sylar::AsyncLogAppender::DROP));
+  logger->addAppender(async);
+  for (int i = 0; i < 1000; ++i) {
+    SYLAR_LOG_INFO(logger) << "drop " << i;
+  }
+  async->flush();
+  SYLAR_LOG_INFO(g_logger) << "drop written=" << counter->m_total
+                           << " dropped=" << async->getDropCount();
+  SYLAR_ASSERT(async->getDropCount() > 0);
+  SYLAR_ASSERT(counter->m_total + async->getDropCount() == 1000);
+
+  //drop_low: 只丢弃低于WARN的日志
+  counter.reset(new CountLogAppender(100));
+  async.reset(new sylar::AsyncLogAppender(
+      counter, 16, sylar::AsyncLogAppender::DROP_LOW, sylar::LogLevel::WARN));
+  logger->clearAppenders();
+  logger->addAppender(async);
+  for (int i = 0; i < 1000; ++i) {
+    if (i % 50 == 0) {
+      SYLAR_LOG_ERROR(logger) << "drop_low " << i;
+    } else {
+      SYLAR_LOG_INFO(logger) << "drop_low " << i;
+    }
+  }
+  async->flush();
+  SYLAR_LOG_INFO(g_logger)
+      << "drop_low written=" << counter->m_total
+      << " dropped info=" << async->getDropCount(sylar::LogLevel::INFO)
+      << " error=" << async->getDropCount(sylar::LogLevel::ERROR);
+  SYLAR_ASSERT(async->getDropCount(sylar::LogLevel::INFO) > 0);
+  SYLAR_ASSERT(async->getDropCount(sylar::LogLevel::ERROR) == 0);
+  SYLAR_ASSERT(counter->m_count[sylar::LogLevel::ERROR] == 20);
+}
+
+/**
+ * @brief 调用方看到的每条日志耗时, 同步文件输出 vs 异步文件输出
+ * */
+void bench(bool async, int threads, int count) {
+  sylar::Logger::ptr logger(new sylar::Logger("async_bench"));
+  sylar::LogAppender::ptr file(
+      new sylar::FileLogAppender("/tmp/sylar_async_log_bench.txt"));
+  sylar::AsyncLogAppender::ptr wrapper;
+  if (async) {
+    wrapper.reset(new sylar::AsyncLogAppender(
+        file, 8192, sylar::AsyncLogAppender::BLOCK));
+    logger->addAppender(wrapper);
+  } else {
+    logger->addAppender(file);
+  }
+
+  uint64_t begin = sylar::GetCurrentUS();
+  std::vector<sylar::Thread::ptr> thrs;
+  for (int i = 0; i < threads; ++i) {
+    thrs.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [logger, count]() {
+          for (int n = 0; n < count; ++n) {
+            SYLAR_LOG_INFO(logger) << "bench message " << n;
+          }
+        },
+        "bench_" + std::to_string(i))));
+  }
+  for (auto& i : thrs) {
+    i->join();
+  }
+  uint64_t used = sylar::GetCurrentUS() - begin;
+  if (wrapper) {
+    wrapper->flush();
+  }
+  uint64_t total = sylar::GetCurrentUS() - begin;
+  SYLAR_LOG_INFO(g_logger) << "bench async=" << async << " threads=" << threads
+                           << " logs=" << threads * count << " caller="
+                           << used * 1000.0 / (threads * count) << "ns/log"
+                           << " total=" << total << "us";
+}
+
+/**
+ * @brief 通过logs配置开启异步输出
+ * */
+void test_config() {
+  YAML::Node root = YAML::Load(R"(
+logs:
+  - name: async_conf
+    level: info
+    formatter: '%d%T%m%n'
+    appenders:
+      - type: FileLogAppender
+        file: /tmp/sylar_async_log_conf.txt
+        async: true
+        capacity: 1000
+        overflow: drop_low
+        overflow_level: error
+)");
+  sylar::Config::LoadFromYaml(root);
+  auto logger = SYLAR_LOG_NEAME("async_conf");
+  SYLAR_LOG_INFO(logger) << "hello async";
+  std::string yaml = logger->toYamlString();
+  SYLAR_LOG_INFO(g_logger) << yaml;
+  SYLAR_ASSERT(yaml.find("async: true") != std::string::npos);
+  SYLAR_ASSERT(yaml.find("overflow: drop_low") != std::string::npos);
+  SYLAR_ASSERT(yaml.find("capacity: 1024") != std::string::npos);
+}
+
+int main(int argc, char** argv) {
+  int count = argc > 1 ? atoi(argv[1]) : 100000;
+  test_block(4, count / 4);
+  test_drop();
+  for (bool async : {false, true}) {
+    bench(async, 4, count / 4);
+  }
+  test_config();
+  return 0;
+}
@@ -0,0 +1,145 @@
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include "sylar/http/caching_servlet.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+typedef sylar::http::CachingServlet CachingServlet;
+
+/// 后端执行的次数
+static std::atomic<int> s_calls{0};
+
+/**
+ * @brief 慢的后端, 响应体带上调用序号, 按查询串设置Cache-Control
+ */
+static sylar::http::Servlet::ptr make_backend() {
+  return sylar::http::Servlet::ptr(new sylar::http::FunctionServlet(
+      [](sylar::http::HttpRequest::ptr req, sylar::http::HttpResponse::ptr rsp,
+         sylar::http::HttpSession::ptr session) {
+        int n = ++s_calls;
+        //hook后的usleep只挂起当前协程, 让其他请求同时未命中
+        usleep(50 * 1000);
+        const std::string& query = req->getQuery();
+        if (query == "nostore") {
+          rsp->setHeader("Cache-Control", "no-store");
+        } else if (query == "short") {
+          rsp->setHeader("Cache-Control", "max-age=1");
+        } else if (query == "lang") {
+          rsp->setHeader("Vary", "Accept-Language");
+        }
+        rsp->setHeader("Content-Type", "text/plain");
+        rsp->setBody("call " + std::to_string(n) + " " +
+                     req->getHeader("accept-language"));
+        return 0;
+      }));
+}
+
+static sylar::http::HttpResponse::ptr get(CachingServlet::ptr slt,
+                                          const std::string& query,
+                                          const std::string& lang = "",
+                                          sylar::http::HttpMethod method =
+                                              sylar::http::HttpMethod::GET) {
+  sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+  req->setMethod(method);
+  req->setPath("/api/list");
+  req->setQuery(query);
+  if (!lang.empty()) {
+    req->setHeader("Accept-Language", lang);
+  }
+  sylar::http::HttpResponse::ptr rsp(new sylar::http::HttpResponse(0x11));
+  slt->handle(req, rsp, nullptr);
+  return rsp;
+}
+
+void test_cache() {
+  CachingServlet::ptr slt(new CachingServlet(make_backend(), 10 * 1000,
+                                             1024 * 1024, {"Accept-Language"}));
+  s_calls = 0;
+  std::string body = get(slt, "a")->getBody();
+  SYLAR_ASSERT(get(slt, "a")->getBody() == body);
+  SYLAR_ASSERT(get(slt, "b")->getBody() != body);
+  SYLAR_ASSERT(s_calls == 2 && slt->getHits() == 1);
+
+  //HEAD命中只带GET的长度, 没有消息体
+  auto head = get(slt, "a", "", sylar::http::HttpMethod::HEAD);
+  SYLAR_ASSERT(head->getBody().empty());
+  SYLAR_ASSERT(head->getHeader("content-length") ==
+               std::to_string(body.size()));
+  std::string header;
+  head->serializeHeader(header);
+  std::transform(header.begin(), header.end(), header.begin(), ::tolower);
+  SYLAR_ASSERT(header.find("content-length") ==
+               header.rfind("content-length"));
+  SYLAR_ASSERT(s_calls == 2 && slt->getHits() == 2);
+
+  //Vary的头部参与了键
+  auto zh = get(slt, "lang", "zh");
+  auto en = get(slt, "lang", "en");
+  SYLAR_ASSERT(zh->getBody() != en->getBody());
+  SYLAR_ASSERT(get(slt, "lang", "zh")->getBody() == zh->getBody());
+  SYLAR_ASSERT(s_calls == 4);
+
+  //no-store不缓存
+  get(slt, "nostore");
+  get(slt, "nostore");
+  SYLAR_ASSERT(s_calls == 6);
+
+  //max-age=1由定时器删除
+  get(slt, "short");
+  size_t size = slt->size();
+  SYLAR_ASSERT(get(slt, "short")->getHeader("age") == "0");
+  usleep(1200 * 1000);
+  SYLAR_ASSERT(slt->size() == size - 1);
+  get(slt, "short");
+  SYLAR_ASSERT(s_calls == 8);
+  SYLAR_LOG_INFO(g_logger) << "cache hits=" << slt->getHits()
+                           << " misses=" << slt->getMisses();
+  //取消过期定时器, IOManager不用等它们
+  slt->clear();
+}
+
+void test_single_flight() {
+  CachingServlet::ptr slt(new CachingServlet(make_backend(), 10 * 1000));
+  s_calls = 0;
+  std::atomic<int> done{0};
+  std::string bodies[20];
+  for (int i = 0; i < 20; ++i) {
+    sylar::IOManager::GetThis()->schedule([slt, i, &done, &bodies]() {
+      bodies[i] = get(slt, "flight")->getBody();
+      ++done;
+    });
+  }
+  while (done < 20) {
+    usleep(10 * 1000);
+  }
+  for (int i = 1; i < 20; ++i) {
+    SYLAR_ASSERT(bodies[i] == bodies[0]);
+  }
+  SYLAR_ASSERT(s_calls == 1);
+  SYLAR_ASSERT(slt->getCoalesced() == 19);
+  SYLAR_LOG_INFO(g_logger) << "20 concurrent misses, backend calls="
+                           << s_calls << " coalesced="
+                           << slt->getCoalesced();
+  slt->clear();
+}
+
+int main(int argc, char** argv) {
+  sylar::IOManager iom(2, false, "cache");
+  iom.schedule([]() {
+    SYLAR_ASSERT(CachingServlet::ParseTtl("", 5) == 5);
+    SYLAR_ASSERT(CachingServlet::ParseTtl("public, max-age=60", 5) == 60000);
+    SYLAR_ASSERT(CachingServlet::ParseTtl("max-age=60, s-maxage=10", 5) ==
+                 10000);
+    SYLAR_ASSERT(CachingServlet::ParseTtl("max-age=60, no-store", 5) == 0);
+    SYLAR_ASSERT(CachingServlet::ParseTtl("private", 5) == 0);
+    test_cache();
+    test_single_flight();
+    SYLAR_LOG_INFO(g_logger) << "test_caching_servlet ok";
+  });
+  return 0;
+}
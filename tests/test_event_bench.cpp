@@ -0,0 +1,73 @@
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include "sylar/config.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<bool>::ptr g_persistent =
+    sylar::Config::Lookup<bool>("iomanager.persistent_event");
+
+/// 线程数
+static const int THREADS = 4;
+/// 每个线程的pipe数
+static const int PIPES = 64;
+/// 每个pipe添加/取消的轮数
+static const int ROUNDS = 2000;
+
+/**
+ * @brief 多个线程同时对各自的句柄addEvent/cancelEvent
+ * @details 句柄是相邻的, 事件上下文共用缓存行或者查找要加全局锁时,
+ *          线程之间会互相干扰
+ */
+void bench(bool persistent) {
+  g_persistent->setValue(persistent);
+  std::atomic<uint64_t> ops{0};
+  std::atomic<uint64_t> triggered{0};
+  uint64_t begin = 0;
+  std::vector<int> fds(THREADS * PIPES * 2);
+  {
+    sylar::IOManager iom(THREADS, false, "bench");
+    for (int i = 0; i < THREADS * PIPES; ++i) {
+      SYLAR_ASSERT(pipe(&fds[i * 2]) == 0);
+    }
+    begin = sylar::GetCurrentUS();
+    for (int t = 0; t < THREADS; ++t) {
+      iom.schedule([&iom, &fds, &ops, &triggered, t]() {
+        for (int r = 0; r < ROUNDS; ++r) {
+          //轮流使用每个线程的句柄, 相邻的句柄在不同线程上
+          for (int p = 0; p < PIPES; ++p) {
+            int fd = fds[(p * THREADS + t) * 2];
+            SYLAR_ASSERT(
+                iom.addEvent(fd, sylar::IOManager::READ, [&triggered]() {
+                  ++triggered;
+                }) == 0);
+            SYLAR_ASSERT(iom.cancelEvent(fd, sylar::IOManager::READ));
+          }
+        }
+        ops += ROUNDS * PIPES;
+      });
+    }
+  }
+  uint64_t used = sylar::GetCurrentUS() - begin;
+  for (int fd : fds) {
+    close(fd);
+  }
+  SYLAR_ASSERT(triggered == ops);
+  SYLAR_LOG_INFO(g_logger) << "persistent_event=" << persistent << " "
+                           << THREADS << " threads " << ops
+                           << " addEvent+cancelEvent: " << used << "us, "
+                           << used * 1000.0 / ops << "ns/op";
+}
+
+int main(int argc, char** argv) {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::WARN);
+  bench(false);
+  bench(true);
+  return 0;
+}
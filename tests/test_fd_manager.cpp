@@ -0,0 +1,74 @@
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "sylar/fd_manager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+void test_generation() {
+  sylar::FdManager* mgr = sylar::FdMgr::GetInstance();
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  SYLAR_ASSERT(fd >= 0);
+  SYLAR_ASSERT(mgr->get(fd) == nullptr);
+  sylar::FdCtx* ctx = mgr->get(fd, true);
+  SYLAR_ASSERT(ctx && ctx->isSocket() && !ctx->isClose());
+  SYLAR_ASSERT(ctx->getSysNonblock());
+  uint32_t gen = ctx->getGeneration();
+  SYLAR_ASSERT(gen & 1);
+  SYLAR_ASSERT(mgr->get(fd) == ctx);
+  SYLAR_ASSERT(mgr->get(fd, true)->getGeneration() == gen);
+
+  //关闭后旧指针能发现, 复用同一个槽位时代数变化
+  mgr->del(fd);
+  close(fd);
+  SYLAR_ASSERT(mgr->get(fd) == nullptr);
+  SYLAR_ASSERT(ctx->isClose() && ctx->getGeneration() == gen + 1);
+  int fd2 = socket(AF_INET, SOCK_STREAM, 0);
+  SYLAR_ASSERT(fd2 == fd);
+  SYLAR_ASSERT(mgr->get(fd2, true) == ctx);
+  SYLAR_ASSERT(!ctx->isClose() && ctx->getGeneration() == gen + 2);
+  mgr->del(fd2);
+  close(fd2);
+
+  SYLAR_ASSERT(mgr->get(-1, true) == nullptr);
+  SYLAR_ASSERT(mgr->get(sylar::FdManager::MAX_FD, true) == nullptr);
+}
+
+void bench_get() {
+  sylar::FdManager* mgr = sylar::FdMgr::GetInstance();
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  mgr->get(fd, true);
+  const int N = 10000000;
+  std::vector<sylar::Thread::ptr> thrs;
+  uint64_t begin = sylar::GetCurrentUS();
+  for (int i = 0; i < 4; ++i) {
+    thrs.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [mgr, fd]() {
+          uint64_t timeout = 0;
+          for (int j = 0; j < N; ++j) {
+            timeout += mgr->get(fd)->getTimeout(SO_RCVTIMEO);
+          }
+          SYLAR_ASSERT(timeout == (uint64_t)-1 * N);
+        },
+        "bench_" + std::to_string(i))));
+  }
+  for (auto& i : thrs) {
+    i->join();
+  }
+  uint64_t used = sylar::GetCurrentUS() - begin;
+  SYLAR_LOG_INFO(g_logger) << "4 threads x " << N << " get(): " << used
+                           << "us, " << used * 1000.0 / N / 4 << "ns/op";
+  mgr->del(fd);
+  close(fd);
+}
+
+int main(int argc, char** argv) {
+  test_generation();
+  bench_get();
+  SYLAR_LOG_INFO(g_logger) << "test_fd_manager ok";
+  return 0;
+}
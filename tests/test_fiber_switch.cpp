@@ -0,0 +1,43 @@
+#include "sylar/fiber.h"
+#include "sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 协程切换延迟测试
+ * @details 主协程与子协程之间 call/back 往返 count 次, 一次往返是两次切换
+ * */
+void bench_switch(uint64_t count) {
+  sylar::Fiber::GetThis();
+  sylar::Fiber* raw = nullptr;
+  sylar::Fiber::ptr fiber(new sylar::Fiber(
+      [&raw, count]() {
+        for (uint64_t i = 0; i < count; ++i) {
+          raw->back();
+        }
+      },
+      0, true));
+  raw = fiber.get();
+
+  uint64_t ts = sylar::GetCurrentUS();
+  for (uint64_t i = 0; i <= count; ++i) {
+    fiber->call();
+  }
+  uint64_t used = sylar::GetCurrentUS() - ts;
+  SYLAR_ASSERT(fiber->getState() == sylar::Fiber::TERM);
+
+  SYLAR_LOG_INFO(g_logger) << "backend=" << sylar::FiberContext::GetBackend()
+                           << " round_trips=" << count << " used=" << used
+                           << "us per_switch="
+                           << used * 1000.0 / (count * 2) << "ns";
+}
+
+int main(int argc, char** argv) {
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::INFO);
+  uint64_t count = 1000000;
+  if (argc > 1) {
+    count = atoll(argv[1]);
+  }
+  bench_switch(count);
+  return 0;
+}
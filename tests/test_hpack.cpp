@@ -0,0 +1,200 @@
+#include "sylar/http/hpack.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+typedef sylar::http::HPack HPack;
+
+static std::string from_hex(const std::string& hex) {
+  std::string rt;
+  for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+    rt += (char)strtol(hex.substr(i, 2).c_str(), nullptr, 16);
+  }
+  return rt;
+}
+
+static bool decode(HPack& hpack, const std::string& hex,
+                   HPack::HeaderList& headers) {
+  std::string data = from_hex(hex);
+  headers.clear();
+  return hpack.decode((const uint8_t*)data.data(), data.size(), headers);
+}
+
+/**
+ * @brief RFC 7541 附录C.4, 使用Huffman的三个连续请求
+ * */
+void test_rfc_requests() {
+  HPack hpack;
+  HPack::HeaderList headers;
+  SYLAR_ASSERT(decode(hpack, "828684418cf1e3c2e5f23a6ba0ab90f4ff", headers));
+  SYLAR_ASSERT(headers.size() == 4);
+  SYLAR_ASSERT(headers[0].first == ":method" && headers[0].second == "GET");
+  SYLAR_ASSERT(headers[3].first == ":authority" &&
+               headers[3].second == "www.example.com");
+  SYLAR_ASSERT(hpack.getTableSize() == 57);
+
+  SYLAR_ASSERT(decode(hpack, "828684be5886a8eb10649cbf", headers));
+  SYLAR_ASSERT(headers.size() == 5);
+  SYLAR_ASSERT(headers[3].second == "www.example.com");
+  SYLAR_ASSERT(headers[4].first == "cache-control" &&
+               headers[4].second == "no-cache");
+  SYLAR_ASSERT(hpack.getTableSize() == 110);
+
+  SYLAR_ASSERT(decode(hpack,
+                      "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+                      headers));
+  SYLAR_ASSERT(headers.size() == 5);
+  SYLAR_ASSERT(headers[1].second == "https");
+  SYLAR_ASSERT(headers[2].second == "/index.html");
+  SYLAR_ASSERT(headers[4].first == "custom-key" &&
+               headers[4].second == "custom-value");
+  SYLAR_ASSERT(hpack.getTableSize() == 164);
+}
+
+/**
+ * @brief RFC 7541 附录C.6, 动态表只有256字节时的淘汰
+ * */
+void test_rfc_eviction() {
+  HPack hpack(256);
+  HPack::HeaderList headers;
+  SYLAR_ASSERT(decode(hpack,
+                      "488264025885aec3771a4b6196d07abe941054d444a8200595040b"
+                      "8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+                      headers));
+  SYLAR_ASSERT(headers.size() == 4);
+  SYLAR_ASSERT(headers[0].second == "302");
+  SYLAR_ASSERT(headers[2].second == "Mon, 21 Oct 2013 20:13:21 GMT");
+  SYLAR_ASSERT(headers[3].second == "https://www.example.com");
+  SYLAR_ASSERT(hpack.getTableSize() == 222);
+  SYLAR_ASSERT(decode(hpack, "4883640effc1c0bf", headers));
+  SYLAR_ASSERT(headers[0].second == "307");
+  SYLAR_ASSERT(headers[3].second == "https://www.example.com");
+  SYLAR_ASSERT(hpack.getTableSize() == 222);
+}
+
+void test_invalid() {
+  HPack hpack;
+  HPack::HeaderList headers;
+  //索引0和超出范围的索引
+  SYLAR_ASSERT(!decode(hpack, "80", headers));
+  SYLAR_ASSERT(!decode(hpack, "ff00", headers));
+  //字符串长度超出数据
+  SYLAR_ASSERT(!decode(hpack, "400a61", headers));
+  //大小更新超过上限, 或者出现在字段之后
+  SYLAR_ASSERT(!decode(hpack, "3fe21f", headers));
+  SYLAR_ASSERT(!decode(hpack, "8220", headers));
+  //Huffman填充不是全1
+  std::string out;
+  SYLAR_ASSERT(!HPack::HuffmanDecode((const uint8_t*)"\xf1\xe3\xc2\xe5\xf2\x3a"
+                                     "\x6b\xa0\xab\x90\xf4\xfe",
+                                     12, out));
+}
+
+/**
+ * @brief 重复引用动态表的大条目, 解码出的头部超过上限
+ * */
+void test_list_limit() {
+  HPack encoder;
+  HPack decoder;
+  decoder.setMaxListSize(16 * 1024);
+  HPack::HeaderList bomb(100, {"x-bomb", std::string(900, 'b')});
+  std::string block;
+  encoder.encode(bomb, block);
+  SYLAR_ASSERT(block.size() < 1024);
+  HPack::HeaderList headers;
+  bool too_large = false;
+  SYLAR_ASSERT(decoder.decode((const uint8_t*)block.data(), block.size(),
+                              headers, &too_large));
+  SYLAR_ASSERT(too_large && headers.size() == 17);
+  //超过上限的块也完整解码, 动态表和编码方一致
+  SYLAR_ASSERT(decoder.getTableSize() == encoder.getTableSize());
+  block.clear();
+  encoder.encode(HPack::HeaderList(2, bomb[0]), block);
+  headers.clear();
+  SYLAR_ASSERT(decoder.decode((const uint8_t*)block.data(), block.size(),
+                              headers, &too_large));
+  SYLAR_ASSERT(!too_large && headers.size() == 2 && headers[1] == bomb[0]);
+  //不要求返回too_large时超过上限是解码错误
+  block.clear();
+  encoder.encode(bomb, block);
+  SYLAR_ASSERT(!decoder.decode((const uint8_t*)block.data(), block.size(),
+                               headers));
+}
+
+/**
+ * @brief 编码再解码得到原样的头部, 重复的头部第二次只用一个字节的索引
+ * */
+void test_roundtrip() {
+  HPack encoder;
+  HPack decoder;
+  HPack::HeaderList headers = {{":status", "200"},
+                               {"content-type", "application/json"},
+                               {"server", "sylar/1.0"},
+                               {"content-length", "1234"},
+                               {"x-trace", std::string(100, 'z')}};
+  std::string first;
+  encoder.encode(headers, first);
+  std::string second;
+  encoder.encode(headers, second);
+  SYLAR_ASSERT(second.size() < first.size());
+  HPack::HeaderList out;
+  SYLAR_ASSERT(decoder.decode((const uint8_t*)first.data(), first.size(), out));
+  SYLAR_ASSERT(decoder.decode((const uint8_t*)second.data(), second.size(),
+                              out));
+  SYLAR_ASSERT(out.size() == headers.size() * 2);
+  for (size_t i = 0; i < out.size(); ++i) {
+    SYLAR_ASSERT(out[i] == headers[i % headers.size()]);
+  }
+  SYLAR_LOG_INFO(g_logger) << "hpack first=" << first.size()
+                           << " second=" << second.size();
+
+  //对方把表大小改成0, 下一个块开头带上大小更新
+  encoder.setMaxTableSize(0);
+  std::string third;
+  encoder.encode(headers, third);
+  SYLAR_ASSERT((uint8_t)third[0] == 0x20);
+  out.clear();
+  SYLAR_ASSERT(decoder.decode((const uint8_t*)third.data(), third.size(), out));
+  SYLAR_ASSERT(out == headers);
+  SYLAR_ASSERT(decoder.getTableSize() == 0);
+}
+
+void test_huffman() {
+  std::string all;
+  for (int i = 0; i < 256; ++i) {
+    all += (char)i;
+  }
+  std::string encoded;
+  HPack::HuffmanEncode(all, encoded);
+  SYLAR_ASSERT(encoded.size() == HPack::HuffmanLength(all));
+  std::string decoded;
+  SYLAR_ASSERT(HPack::HuffmanDecode((const uint8_t*)encoded.data(),
+                                    encoded.size(), decoded));
+  SYLAR_ASSERT(decoded == all);
+
+  std::string text = "GET /index.html accept-encoding: gzip, deflate, br";
+  encoded.clear();
+  HPack::HuffmanEncode(text, encoded);
+  uint64_t begin = sylar::GetCurrentUS();
+  for (int i = 0; i < 100000; ++i) {
+    decoded.clear();
+    HPack::HuffmanDecode((const uint8_t*)encoded.data(), encoded.size(),
+                         decoded);
+  }
+  SYLAR_LOG_INFO(g_logger) << "huffman decode " << text.size() << " bytes: "
+                           << (sylar::GetCurrentUS() - begin) / 100
+                           << "ns";
+}
+
+int main(int argc, char** argv) {
+  test_rfc_requests();
+  test_rfc_eviction();
+  test_invalid();
+  test_list_limit();
+  test_roundtrip();
+  test_huffman();
+  SYLAR_LOG_INFO(g_logger) << "test_hpack ok";
+  return 0;
+}
@@ -0,0 +1,462 @@
+#include <arpa/inet.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <map>
+#include "sylar/http/hpack.h"
+#include "sylar/http/http2_session.h"
+#include "sylar/http/http_server.h"
+#include "sylar/sylar.h"
+#include "test_server.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+typedef sylar::http::Http2FrameHead H2;
+typedef sylar::http::HPack HPack;
+
+struct Frame {
+  uint8_t type;
+  uint8_t flags;
+  uint32_t id;
+  std::string payload;
+};
+
+static std::string frame(uint8_t type, uint8_t flags, uint32_t id,
+                         const std::string& payload) {
+  std::string rt;
+  rt += (char)(payload.size() >> 16);
+  rt += (char)(payload.size() >> 8);
+  rt += (char)payload.size();
+  rt += (char)type;
+  rt += (char)flags;
+  rt += (char)(id >> 24);
+  rt += (char)(id >> 16);
+  rt += (char)(id >> 8);
+  rt += (char)id;
+  return rt + payload;
+}
+
+static std::string uint32_str(uint32_t v) {
+  std::string rt;
+  rt += (char)(v >> 24);
+  rt += (char)(v >> 16);
+  rt += (char)(v >> 8);
+  rt += (char)v;
+  return rt;
+}
+
+/**
+ * @brief 把一个HEADERS帧的头部块拆成HEADERS加CONTINUATION, 每帧最多size字节
+ * */
+static std::string split_headers(const std::string& headers, size_t size) {
+  uint8_t flags = headers[4] & ~H2::END_HEADERS;
+  uint32_t id = ((uint8_t)headers[5] << 24 | (uint8_t)headers[6] << 16 |
+                 (uint8_t)headers[7] << 8 | (uint8_t)headers[8]);
+  std::string block = headers.substr(9);
+  std::string rt;
+  for (size_t pos = 0; pos < block.size(); pos += size) {
+    bool last = pos + size >= block.size();
+    rt += frame(pos == 0 ? H2::HEADERS : H2::CONTINUATION,
+                (pos == 0 ? flags : 0) | (last ? H2::END_HEADERS : 0), id,
+                block.substr(pos, size));
+  }
+  return rt;
+}
+
+static const std::string s_preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+/**
+ * @brief 不经过hook的阻塞客户端
+ * */
+class Client {
+ public:
+  Client(sockaddr_in addr) {
+    m_sock = socket(AF_INET, SOCK_STREAM, 0);
+    int rt = connect(m_sock, (const sockaddr*)&addr, sizeof(addr));
+    SYLAR_ASSERT2(rt == 0, strerror(errno));
+  }
+
+  ~Client() { close(m_sock); }
+
+  void send(const std::string& data) {
+    SYLAR_ASSERT(::send(m_sock, data.c_str(), data.size(), 0) ==
+                 (ssize_t)data.size());
+  }
+
+  std::string request(uint32_t id, const std::string& method,
+                      const std::string& path, bool end_stream,
+                      const HPack::HeaderList& extra = HPack::HeaderList()) {
+    HPack::HeaderList headers = {{":method", method},
+                                 {":scheme", "http"},
+                                 {":path", path},
+                                 {":authority", "localhost"}};
+    headers.insert(headers.end(), extra.begin(), extra.end());
+    std::string block;
+    m_encoder.encode(headers, block);
+    return frame(H2::HEADERS,
+                 H2::END_HEADERS | (end_stream ? H2::END_STREAM : 0), id,
+                 block);
+  }
+
+  /**
+   * @brief 读一帧, 连接关闭返回false
+   * */
+  bool read(Frame& f) {
+    while (true) {
+      if (m_buf.size() >= 9) {
+        size_t len = ((uint8_t)m_buf[0] << 16) | ((uint8_t)m_buf[1] << 8) |
+                     (uint8_t)m_buf[2];
+        if (m_buf.size() >= 9 + len) {
+          f.type = m_buf[3];
+          f.flags = m_buf[4];
+          f.id = ((uint8_t)m_buf[5] << 24 | (uint8_t)m_buf[6] << 16 |
+                  (uint8_t)m_buf[7] << 8 | (uint8_t)m_buf[8]) &
+                 0x7fffffff;
+          f.payload = m_buf.substr(9, len);
+          m_buf.erase(0, 9 + len);
+          return true;
+        }
+      }
+      if (!recvMore()) {
+        return false;
+      }
+    }
+  }
+
+  /**
+   * @brief 收一次数据追加到缓存
+   * */
+  bool recvMore() {
+    char buf[16384];
+    ssize_t rt = recv(m_sock, buf, sizeof(buf), 0);
+    if (rt <= 0) {
+      return false;
+    }
+    m_buf.append(buf, rt);
+    return true;
+  }
+
+  /**
+   * @brief 在timeout毫秒内是否有数据可读
+   * */
+  bool readable(int timeout) {
+    if (!m_buf.empty()) {
+      return true;
+    }
+    pollfd pfd = {m_sock, POLLIN, 0};
+    return poll(&pfd, 1, timeout) > 0;
+  }
+
+  std::string& buffer() { return m_buf; }
+
+  HPack& decoder() { return m_decoder; }
+
+ private:
+  int m_sock;
+  std::string m_buf;
+  HPack m_encoder;
+  HPack m_decoder;
+};
+
+struct Response {
+  HPack::HeaderList headers;
+  std::string body;
+  bool ended = false;
+
+  std::string get(const std::string& name) const {
+    for (auto& i : headers) {
+      if (i.first == name) {
+        return i.second;
+      }
+    }
+    return "";
+  }
+};
+
+/**
+ * @brief 读帧直到count个流结束, 处理SETTINGS/PING
+ * */
+static void read_responses(Client& client, std::map<uint32_t, Response>& rsps,
+                           size_t count, bool* ping_ack = nullptr) {
+  size_t ended = 0;
+  Frame f;
+  while (ended < count && client.read(f)) {
+    if (f.type == H2::HEADERS) {
+      SYLAR_ASSERT(f.flags & H2::END_HEADERS);
+      SYLAR_ASSERT(client.decoder().decode((const uint8_t*)f.payload.data(),
+                                           f.payload.size(),
+                                           rsps[f.id].headers));
+    } else if (f.type == H2::DATA) {
+      rsps[f.id].body += f.payload;
+    } else if (f.type == H2::PING) {
+      SYLAR_ASSERT(f.flags & H2::ACK);
+      if (ping_ack) {
+        *ping_ack = f.payload == "12345678";
+      }
+    }
+    if ((f.type == H2::HEADERS || f.type == H2::DATA) &&
+        (f.flags & H2::END_STREAM)) {
+      rsps[f.id].ended = true;
+      ++ended;
+    }
+  }
+  SYLAR_ASSERT(ended == count);
+}
+
+/**
+ * @brief 一个连接上同时发出多个请求, 响应按流分开
+ * */
+void test_multiplex(sockaddr_in addr) {
+  Client client(addr);
+  std::string req = s_preface + frame(H2::SETTINGS, 0, 0, "");
+  req += client.request(1, "GET", "/hello?a=1", true);
+  req += client.request(3, "POST", "/echo", false);
+  req += frame(H2::DATA, 0, 3, "pay");
+  req += client.request(5, "GET", "/stream", true);
+  req += frame(H2::DATA, H2::END_STREAM, 3, "load");
+  req += frame(H2::PING, 0, 0, "12345678");
+  client.send(req);
+
+  std::map<uint32_t, Response> rsps;
+  bool ping_ack = false;
+  read_responses(client, rsps, 3, &ping_ack);
+  SYLAR_ASSERT(ping_ack);
+  SYLAR_ASSERT(rsps[1].get(":status") == "200");
+  SYLAR_ASSERT(rsps[1].body == "GET /hello a=1");
+  SYLAR_ASSERT(rsps[1].get("content-length") == "14");
+  SYLAR_ASSERT(rsps[1].get("connection").empty());
+  SYLAR_ASSERT(rsps[1].get("x-middleware") == "1");
+  SYLAR_ASSERT(rsps[3].body == "payload");
+  SYLAR_ASSERT(rsps[5].get("content-type") == "text/plain");
+  SYLAR_ASSERT(rsps[5].body == "abcd");
+
+  //同一个连接上的第二轮请求, 响应头部用动态表索引
+  client.send(client.request(7, "GET", "/hello", true) +
+              client.request(9, "GET", "/none", true));
+  rsps.clear();
+  read_responses(client, rsps, 2);
+  SYLAR_ASSERT(rsps[7].body == "GET /hello ");
+  SYLAR_ASSERT(rsps[9].get(":status") == "404");
+}
+
+/**
+ * @brief 流的窗口只有1000字节, 发完后等WINDOW_UPDATE
+ * */
+void test_flow_control(sockaddr_in addr) {
+  Client client(addr);
+  std::string settings = std::string("\x00\x04", 2) + uint32_str(1000);
+  client.send(s_preface + frame(H2::SETTINGS, 0, 0, settings) +
+              client.request(1, "GET", "/big", true));
+  std::map<uint32_t, Response> rsps;
+  Frame f;
+  while (rsps[1].body.size() < 1000 && client.read(f)) {
+    if (f.type == H2::HEADERS) {
+      client.decoder().decode((const uint8_t*)f.payload.data(),
+                              f.payload.size(), rsps[1].headers);
+    } else if (f.type == H2::DATA) {
+      rsps[1].body += f.payload;
+    }
+  }
+  SYLAR_ASSERT(rsps[1].body.size() == 1000);
+  //窗口用完, 服务端不能再发
+  while (client.readable(100)) {
+    SYLAR_ASSERT(client.read(f));
+    SYLAR_ASSERT(f.type != H2::DATA);
+  }
+  client.send(frame(H2::WINDOW_UPDATE, 0, 0, uint32_str(1000000)) +
+              frame(H2::WINDOW_UPDATE, 0, 1, uint32_str(1000000)));
+  read_responses(client, rsps, 1);
+  SYLAR_ASSERT(rsps[1].body == std::string(100000, 'x'));
+}
+
+/**
+ * @brief 头部块解码失败是连接错误, 回复GOAWAY后关闭
+ * */
+void test_error(sockaddr_in addr) {
+  Client client(addr);
+  client.send(s_preface + frame(H2::SETTINGS, 0, 0, "") +
+              frame(H2::HEADERS, H2::END_HEADERS | H2::END_STREAM, 1,
+                    std::string("\x80", 1)));
+  Frame f;
+  bool goaway = false;
+  while (client.read(f)) {
+    if (f.type == H2::GOAWAY) {
+      goaway = f.payload.substr(4) == uint32_str(H2::COMPRESSION_ERROR);
+    }
+  }
+  SYLAR_ASSERT(goaway);
+}
+
+/**
+ * @brief 重复引用动态表里的大头部, 解码后超过通告的头部列表上限,
+ *        只拒绝这个流, 连接上的其他请求照常处理
+ * */
+void test_header_limit(sockaddr_in addr) {
+  Client client(addr);
+  HPack::HeaderList bomb(100, {"x-bomb", std::string(900, 'b')});
+  //动态表有状态, 按顺序编码
+  std::string req = s_preface + frame(H2::SETTINGS, 0, 0, "");
+  req += client.request(1, "GET", "/hello", true, bomb);
+  req += client.request(3, "GET", "/hello", true);
+  client.send(req);
+  bool advertised = false;
+  bool reset = false;
+  bool ended = false;
+  Frame f;
+  while (!(reset && ended) && client.read(f)) {
+    if (f.type == H2::SETTINGS && !(f.flags & H2::ACK)) {
+      for (size_t i = 0; i + 6 <= f.payload.size(); i += 6) {
+        if (f.payload[i + 1] == H2::MAX_HEADER_LIST_SIZE) {
+          advertised = f.payload.substr(i + 2, 4) == uint32_str(64 * 1024);
+        }
+      }
+    } else if (f.type == H2::RST_STREAM && f.id == 1) {
+      reset = f.payload == uint32_str(H2::ENHANCE_YOUR_CALM);
+    } else if (f.type == H2::HEADERS) {
+      HPack::HeaderList headers;
+      SYLAR_ASSERT(client.decoder().decode((const uint8_t*)f.payload.data(),
+                                           f.payload.size(), headers));
+    }
+    if (f.id == 3 && (f.flags & H2::END_STREAM)) {
+      ended = true;
+    }
+  }
+  SYLAR_ASSERT(advertised && reset && ended);
+}
+
+/**
+ * @brief 拆到CONTINUATION的头部块和单个HEADERS帧一样按头部列表上限处理,
+ *        超过上限只拒绝这个流, 连接上的其它流不受影响
+ * */
+void test_continuation(sockaddr_in addr) {
+  Client client(addr);
+  std::string cookie;
+  for (int i = 0; cookie.size() < 5000; ++i) {
+    cookie += "k" + std::to_string(i) + "=" + std::to_string(i * 7919) + "; ";
+  }
+  HPack::HeaderList big;
+  for (int i = 0; i < 80; ++i) {
+    std::string value;
+    for (int j = 0; j < 1000; ++j) {
+      value += (char)('!' + (i * 31 + j * 17) % 90);
+    }
+    big.push_back({"x-big-" + std::to_string(i), value});
+  }
+  std::string req = s_preface + frame(H2::SETTINGS, 0, 0, "");
+  req += split_headers(client.request(1, "GET", "/hello", true,
+                                      {{"cookie", cookie}}),
+                       1000);
+  req += split_headers(client.request(3, "GET", "/hello", true, big), 16000);
+  req += client.request(5, "GET", "/hello", true);
+  client.send(req);
+  bool reset = false;
+  std::map<uint32_t, Response> rsps;
+  Frame f;
+  while (!(rsps[1].ended && rsps[5].ended) && client.read(f)) {
+    SYLAR_ASSERT(f.type != H2::GOAWAY);
+    if (f.type == H2::RST_STREAM) {
+      SYLAR_ASSERT(f.id == 3);
+      reset = f.payload == uint32_str(H2::ENHANCE_YOUR_CALM);
+    } else if (f.type == H2::HEADERS) {
+      SYLAR_ASSERT(client.decoder().decode((const uint8_t*)f.payload.data(),
+                                           f.payload.size(),
+                                           rsps[f.id].headers));
+    } else if (f.type == H2::DATA) {
+      rsps[f.id].body += f.payload;
+    }
+    if (f.flags & H2::END_STREAM) {
+      rsps[f.id].ended = true;
+    }
+  }
+  SYLAR_ASSERT(reset);
+  SYLAR_ASSERT(rsps[1].get(":status") == "200");
+  SYLAR_ASSERT(rsps[5].body == "GET /hello ");
+}
+
+/**
+ * @brief HTTP/1.1升级到h2c, 升级请求的响应在流1上
+ * */
+void test_upgrade(sockaddr_in addr) {
+  Client client(addr);
+  //HTTP2-Settings: SETTINGS_MAX_CONCURRENT_STREAMS=100
+  client.send(
+      "GET /hello HTTP/1.1\r\nHost: localhost\r\n"
+      "Connection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\n"
+      "HTTP2-Settings: AAMAAABk\r\n\r\n" +
+      s_preface + frame(H2::SETTINGS, 0, 0, ""));
+  //先收101的响应头, 之后才是帧
+  std::string& buf = client.buffer();
+  while (buf.find("\r\n\r\n") == std::string::npos) {
+    SYLAR_ASSERT(client.recvMore());
+  }
+  SYLAR_ASSERT(buf.compare(0, 12, "HTTP/1.1 101") == 0);
+  buf.erase(0, buf.find("\r\n\r\n") + 4);
+  std::map<uint32_t, Response> rsps;
+  read_responses(client, rsps, 1);
+  SYLAR_ASSERT(rsps[1].body == "GET /hello ");
+}
+
+/**
+ * @brief 重写handle的分发器, 给所有响应加上头部
+ * */
+class MiddlewareDispatch : public sylar::http::ServletDispatch {
+ public:
+  int32_t handle(sylar::http::HttpRequest::ptr request,
+                 sylar::http::HttpResponse::ptr response,
+                 sylar::http::HttpSession::ptr session) override {
+    response->setHeader("X-Middleware", "1");
+    return ServletDispatch::handle(request, response, session);
+  }
+};
+
+int main(int argc, char** argv) {
+  sylar::http::HttpServer::ptr server;
+  sylar::IOManager iom(1, false, "h2");
+  sockaddr_in addr = start_server(iom, [&server]() {
+    server.reset(new sylar::http::HttpServer(true));
+    server->setServletDispatch(
+        sylar::http::ServletDispatch::ptr(new MiddlewareDispatch));
+    auto sd = server->getServletDispatch();
+    sd->addServlet("/hello", [](sylar::http::HttpRequest::ptr req,
+                                sylar::http::HttpResponse::ptr rsp,
+                                sylar::http::HttpSession::ptr session) {
+      rsp->setBody(sylar::http::HttpMethodToString(req->getMethod()) +
+                   std::string(" ") + req->getPath() + " " + req->getQuery());
+      return 0;
+    });
+    sd->addServlet("/echo", [](sylar::http::HttpRequest::ptr req,
+                               sylar::http::HttpResponse::ptr rsp,
+                               sylar::http::HttpSession::ptr session) {
+      rsp->setBody(req->getBody());
+      return 0;
+    });
+    sd->addServlet("/big", [](sylar::http::HttpRequest::ptr req,
+                              sylar::http::HttpResponse::ptr rsp,
+                              sylar::http::HttpSession::ptr session) {
+      rsp->setBody(std::string(100000, 'x'));
+      return 0;
+    });
+    //流式响应的servlet在HTTP/2上不用修改
+    sd->addServlet("/stream", [](sylar::http::HttpRequest::ptr req,
+                                 sylar::http::HttpResponse::ptr rsp,
+                                 sylar::http::HttpSession::ptr session) {
+      rsp->setHeader("Content-Type", "text/plain");
+      session->sendResponseHeader(rsp, "ab", 2);
+      session->sendChunk("cd", 2);
+      return 0;
+    });
+    return server;
+  });
+
+  test_multiplex(addr);
+  test_flow_control(addr);
+  test_error(addr);
+  test_header_limit(addr);
+  test_continuation(addr);
+  test_upgrade(addr);
+
+  server->stop();
+  SYLAR_LOG_INFO(g_logger) << "test_http2 ok";
+  return 0;
+}
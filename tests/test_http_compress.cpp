@@ -0,0 +1,164 @@
+#include <string.h>
+#include <zlib.h>
+#include "sylar/http/http_compress.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+typedef sylar::http::HttpCompressor HttpCompressor;
+
+/**
+ * @brief 用zlib自动识别gzip/zlib格式解压
+ * */
+static std::string inflate_all(const std::string& data) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  inflateInit2(&zs, 15 + 32);
+  std::string out;
+  char buf[16384];
+  zs.next_in = (Bytef*)data.data();
+  zs.avail_in = data.size();
+  int rt = Z_OK;
+  while (rt == Z_OK) {
+    zs.next_out = (Bytef*)buf;
+    zs.avail_out = sizeof(buf);
+    rt = inflate(&zs, Z_NO_FLUSH);
+    out.append(buf, sizeof(buf) - zs.avail_out);
+  }
+  inflateEnd(&zs);
+  SYLAR_ASSERT(rt == Z_STREAM_END);
+  return out;
+}
+
+void test_negotiate() {
+  SYLAR_ASSERT(HttpCompressor::Negotiate("") == HttpCompressor::IDENTITY);
+  SYLAR_ASSERT(HttpCompressor::Negotiate("gzip, deflate, br") ==
+               HttpCompressor::GZIP);
+  SYLAR_ASSERT(HttpCompressor::Negotiate("deflate") ==
+               HttpCompressor::DEFLATE);
+  SYLAR_ASSERT(HttpCompressor::Negotiate("gzip;q=0, deflate;q=0.5") ==
+               HttpCompressor::DEFLATE);
+  SYLAR_ASSERT(HttpCompressor::Negotiate("br") == HttpCompressor::IDENTITY);
+  SYLAR_ASSERT(HttpCompressor::Negotiate("*") == HttpCompressor::GZIP);
+  SYLAR_ASSERT(HttpCompressor::Negotiate("gzip;q=0, *") ==
+               HttpCompressor::IDENTITY);
+}
+
+static std::string make_json(int n) {
+  std::string json = "[";
+  for (int i = 0; i < n; ++i) {
+    json += "{\"id\":" + std::to_string(i) +
+            ",\"name\":\"user" + std::to_string(i) +
+            "\",\"active\":true,\"tags\":[\"a\",\"b\"]},";
+  }
+  json.back() = ']';
+  return json;
+}
+
+static sylar::http::HttpResponse::ptr make_response(const std::string& body,
+                                                    const std::string& type) {
+  sylar::http::HttpResponse::ptr rsp(new sylar::http::HttpResponse);
+  rsp->setHeader("Content-Type", type);
+  rsp->setBody(body);
+  return rsp;
+}
+
+void test_compress() {
+  HttpCompressor* compressor = sylar::http::HttpCompressorMgr::GetInstance();
+  compressor->resetStats();
+  compressor->clearCache();
+  sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+  req->setHeader("Accept-Encoding", "gzip, deflate");
+
+  std::string json = make_json(200);
+  auto rsp = make_response(json, "application/json; charset=utf-8");
+  rsp->setHeader("ETag", "\"abc\"");
+  SYLAR_ASSERT(compressor->compress(req, rsp));
+  SYLAR_ASSERT(rsp->getHeader("content-encoding") == "gzip");
+  SYLAR_ASSERT(rsp->getHeader("vary") == "Accept-Encoding");
+  SYLAR_ASSERT(rsp->getHeader("etag") == "\"abc-gzip\"");
+  SYLAR_ASSERT(rsp->getBody().size() * 5 < json.size());
+  SYLAR_ASSERT(inflate_all(rsp->getBody()) == json);
+
+  //相同的ETag用缓存
+  rsp = make_response(json, "application/json");
+  rsp->setHeader("ETag", "\"abc\"");
+  SYLAR_ASSERT(compressor->compress(req, rsp));
+  SYLAR_ASSERT(inflate_all(rsp->getBody()) == json);
+  auto stats = compressor->getStats();
+  SYLAR_ASSERT(stats.responses == 2 && stats.cacheHits == 1);
+  SYLAR_ASSERT(stats.bytesIn == json.size() * 2);
+
+  //没有ETag时按内容
+  for (int i = 0; i < 2; ++i) {
+    rsp = make_response(json, "application/json");
+    SYLAR_ASSERT(compressor->compress(req, rsp));
+    SYLAR_ASSERT(inflate_all(rsp->getBody()) == json);
+  }
+  stats = compressor->getStats();
+  SYLAR_ASSERT(stats.responses == 4 && stats.cacheHits == 2);
+  //长度相同内容不同的响应体不会用到别人的压缩结果
+  std::string other = json;
+  other[json.size() / 2] = '#';
+  rsp = make_response(other, "application/json");
+  SYLAR_ASSERT(compressor->compress(req, rsp));
+  SYLAR_ASSERT(inflate_all(rsp->getBody()) == other);
+  stats = compressor->getStats();
+  SYLAR_ASSERT(stats.responses == 5 && stats.cacheHits == 2);
+  SYLAR_LOG_INFO(g_logger) << "json " << json.size() << " bytes: "
+                           << stats.toString();
+
+  req->setHeader("Accept-Encoding", "deflate");
+  rsp = make_response(json, "text/plain");
+  SYLAR_ASSERT(compressor->compress(req, rsp));
+  SYLAR_ASSERT(rsp->getHeader("content-encoding") == "deflate");
+  SYLAR_ASSERT(inflate_all(rsp->getBody()) == json);
+
+  //太小, 类型不在列表里, 已经编码过, 客户端不接受
+  rsp = make_response("{}", "application/json");
+  SYLAR_ASSERT(!compressor->compress(req, rsp));
+  rsp = make_response(json, "image/png");
+  SYLAR_ASSERT(!compressor->compress(req, rsp));
+  SYLAR_ASSERT(rsp->getHeader("vary").empty());
+  rsp = make_response(json, "text/plain");
+  rsp->setHeader("Content-Encoding", "br");
+  SYLAR_ASSERT(!compressor->compress(req, rsp));
+  req->setHeader("Accept-Encoding", "identity");
+  rsp = make_response(json, "text/plain");
+  SYLAR_ASSERT(!compressor->compress(req, rsp));
+  SYLAR_ASSERT(rsp->getBody() == json);
+  SYLAR_ASSERT(rsp->getHeader("vary") == "Accept-Encoding");
+}
+
+void bench_cache() {
+  HttpCompressor* compressor = sylar::http::HttpCompressorMgr::GetInstance();
+  compressor->clearCache();
+  sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+  req->setHeader("Accept-Encoding", "gzip");
+  std::string json = make_json(500);
+  std::string out;
+  uint64_t begin = sylar::GetCurrentUS();
+  for (int i = 0; i < 100; ++i) {
+    HttpCompressor::Compress(HttpCompressor::GZIP, json.data(), json.size(), 6,
+                             out);
+  }
+  uint64_t raw = sylar::GetCurrentUS() - begin;
+  begin = sylar::GetCurrentUS();
+  for (int i = 0; i < 100; ++i) {
+    compressor->compress(req, make_response(json, "application/json"));
+  }
+  uint64_t cached = sylar::GetCurrentUS() - begin;
+  SYLAR_LOG_INFO(g_logger) << "100 x " << json.size()
+                           << " bytes: deflate=" << raw << "us cached="
+                           << cached << "us";
+}
+
+int main(int argc, char** argv) {
+  test_negotiate();
+  test_compress();
+  bench_cache();
+  SYLAR_LOG_INFO(g_logger) << "test_http_compress ok";
+  return 0;
+}
@@ -1,5 +1,6 @@
 #include "sylar/http/http_parser.h"
 #include "sylar/log.h"
+#include "sylar/macro.h"
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
 
@@ -22,6 +23,52 @@ void test_request() {
   SYLAR_LOG_INFO(g_logger) << tmp;
 }
 
+/**
+ * @brief 分两次收到的请求, 字段直接引用接收缓存
+ */
+void test_request_view() {
+  sylar::http::HttpRequestParser parser;
+  std::string tmp = test_request_data;
+  const char* data = tmp.c_str();
+  //第一次只收到一半, 头部字段跨越两次读取
+  size_t half = 30;
+  size_t nparse = parser.execute(data, half, 0);
+  SYLAR_ASSERT(!parser.hasError() && !parser.isFinished());
+  nparse += parser.execute(data, tmp.size(), nparse);
+  SYLAR_ASSERT(!parser.hasError() && parser.isFinished());
+  SYLAR_ASSERT(parser.getContentLenght() == 10);
+
+  auto req = parser.getData();
+  req->setBodyView(sylar::http::StringView(data + nparse, 10));
+  SYLAR_ASSERT(req->getPathView().data() >= data &&
+               req->getPathView().data() < data + tmp.size());
+  SYLAR_ASSERT(req->getBodyView().data() == data + nparse);
+  SYLAR_ASSERT(req->getHeaderView("host") == "www.baidu.com");
+  SYLAR_ASSERT(req->getBody() == "1234567890");
+
+  //materialize之后不再依赖原缓存
+  req->materialize();
+  tmp.assign(tmp.size(), 'x');
+  SYLAR_ASSERT(req->getHeader("HOST") == "www.baidu.com");
+  SYLAR_ASSERT(req->getPath() == "/");
+  SYLAR_ASSERT(req->getBody() == "1234567890");
+  SYLAR_LOG_INFO(g_logger) << req->toString();
+
+  //请求对象还被外面持有时, reset换一个新对象, 原对象不受影响
+  parser.reset();
+  SYLAR_ASSERT(parser.getData() != req);
+  SYLAR_ASSERT(req->getHeader("host") == "www.baidu.com");
+  SYLAR_ASSERT(req->getBody() == "1234567890");
+
+  //没有其他引用时复用同一个请求对象
+  sylar::http::HttpRequest* raw = parser.getData().get();
+  parser.getData()->setHeader("host", "www.baidu.com");
+  req.reset();
+  parser.reset();
+  SYLAR_ASSERT(parser.getData().get() == raw);
+  SYLAR_ASSERT(parser.getData()->getHeaders().empty());
+}
+
 const char test_response_data[] =
     "HTTP/1.1 200 OK\r\n"
     "Date: Tue, 04 Jun 2019 15:43:56 GMT\r\n"
@@ -55,6 +102,8 @@ void test_reponse() {
 int main(int argv, char** argc) {
   test_request();
   SYLAR_LOG_INFO(g_logger) << "----------------------------";
+  test_request_view();
+  SYLAR_LOG_INFO(g_logger) << "----------------------------";
   test_reponse();
   return 0;
 }
\ No newline at end of file
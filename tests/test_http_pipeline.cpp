@@ -0,0 +1,111 @@
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "sylar/http/http_server.h"
+#include "sylar/sylar.h"
+#include "test_server.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 不经过hook的阻塞客户端, 一次发出所有请求, 收到count个响应后返回
+ * */
+static std::string run_client(sockaddr_in addr, const std::string& reqs,
+                              int count) {
+  int sock = connect_send(addr, reqs);
+  std::string rsps;
+  char buf[4096];
+  int recvs = 0;
+  while (true) {
+    int n = 0;
+    size_t pos = 0;
+    while ((pos = rsps.find("HTTP/1.1 200", pos)) != std::string::npos) {
+      ++n;
+      ++pos;
+    }
+    if (n >= count && rsps.size() >= 3 &&
+        rsps.compare(rsps.size() - 3, 3, "end") == 0) {
+      break;
+    }
+    int rt = recv(sock, buf, sizeof(buf), 0);
+    SYLAR_ASSERT(rt > 0);
+    rsps.append(buf, rt);
+    ++recvs;
+  }
+  close(sock);
+  SYLAR_LOG_INFO(g_logger) << "responses=" << count << " bytes=" << rsps.size()
+                           << " recv calls=" << recvs;
+  return rsps;
+}
+
+/**
+ * @brief 重写handle的分发器, 给所有响应加上头部
+ * */
+class MiddlewareDispatch : public sylar::http::ServletDispatch {
+ public:
+  int32_t handle(sylar::http::HttpRequest::ptr request,
+                 sylar::http::HttpResponse::ptr response,
+                 sylar::http::HttpSession::ptr session) override {
+    response->setHeader("X-Middleware", "1");
+    return ServletDispatch::handle(request, response, session);
+  }
+};
+
+int main(int argc, char** argv) {
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::INFO);
+  sylar::http::HttpServer::ptr server;
+  sylar::IOManager iom(1, false, "http");
+  sockaddr_in addr = start_server(iom, [&server]() {
+    server.reset(new sylar::http::HttpServer(true));
+    server->setServletDispatch(
+        sylar::http::ServletDispatch::ptr(new MiddlewareDispatch));
+    auto sd = server->getServletDispatch();
+    //响应内容是请求路径和消息体, 以end结尾方便客户端判断
+    sd->addServlet("/echo", [](sylar::http::HttpRequest::ptr req,
+                               sylar::http::HttpResponse::ptr rsp,
+                               sylar::http::HttpSession::ptr session) {
+      rsp->setBody(req->getQuery() + ":" +
+                   std::to_string(req->getBodyView().size()) + ":end");
+      return 0;
+    });
+    return server;
+  });
+
+  //三个请求在一个包里, 响应按顺序返回
+  std::string reqs;
+  for (int i = 0; i < 3; ++i) {
+    reqs += "GET /echo?" + std::to_string(i) +
+            " HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+  }
+  std::string rsps = run_client(addr, reqs, 3);
+  SYLAR_ASSERT(rsps.find("0:0:end") < rsps.find("1:0:end"));
+  SYLAR_ASSERT(rsps.find("1:0:end") < rsps.find("2:0:end"));
+  SYLAR_ASSERT(rsps.find("X-Middleware: 1") != std::string::npos);
+
+  //消息体超过接收缓存时缓存扩大, 之后的请求不受影响
+  uint64_t buff_size =
+      sylar::http::HttpRequestParser::GetHttpRequestBufferSize();
+  std::string body(3 * buff_size, 'x');
+  reqs = "POST /echo?big HTTP/1.1\r\nConnection: keep-alive\r\n"
+         "Content-Length: " +
+         std::to_string(body.size()) + "\r\n\r\n" + body +
+         "GET /echo?after HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+  rsps = run_client(addr, reqs, 2);
+  SYLAR_ASSERT(rsps.find("big:" + std::to_string(body.size()) + ":end") !=
+               std::string::npos);
+  SYLAR_ASSERT(rsps.find("after:0:end") != std::string::npos);
+
+  //后面的请求解析失败时连接关闭, 前面请求排队的响应也要发出去
+  reqs.clear();
+  for (int i = 0; i < 2; ++i) {
+    reqs += "GET /echo?ok" + std::to_string(i) +
+            " HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+  }
+  reqs += "NOT AN HTTP REQUEST\r\n\r\n";
+  rsps = run_client(addr, reqs, 2);
+  SYLAR_ASSERT(rsps.find("ok0:0:end") < rsps.find("ok1:0:end"));
+
+  server->stop();
+  return 0;
+}
@@ -0,0 +1,146 @@
+#include <fnmatch.h>
+#include "sylar/http/router.h"
+#include "sylar/http/servlet.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 只有名字的servlet, 用来区分匹配结果
+ */
+class NamedServlet : public sylar::http::Servlet {
+ public:
+  NamedServlet(const std::string& name) : Servlet(name) {}
+  int32_t handle(sylar::http::HttpRequest::ptr request,
+                 sylar::http::HttpResponse::ptr response,
+                 sylar::http::HttpSession::ptr session) override {
+    return 0;
+  }
+};
+
+static sylar::http::Servlet::ptr S(const std::string& name) {
+  return sylar::http::Servlet::ptr(new NamedServlet(name));
+}
+
+/**
+ * @brief 匹配path, 返回servlet名字和参数
+ */
+static std::string match(const sylar::http::RadixRouter& router,
+                         const std::string& path) {
+  sylar::http::RadixRouter::Params params;
+  auto slt = router.match(path, &params);
+  std::string rt = slt ? slt->getName() : "null";
+  for (auto& i : params) {
+    rt += " " + i.first + "=" + i.second;
+  }
+  return rt;
+}
+
+void test_match() {
+  sylar::http::RadixRouter router;
+  router.add("/", S("root"));
+  router.add("/user", S("user"));
+  router.add("/user/list", S("list"));
+  router.add("/user/:id", S("user_id"));
+  router.add("/user/:id/info", S("info"));
+  router.add("/user/:id/book/:book", S("book"));
+  router.add("/users", S("users"));
+  router.add("/static/*", S("static"));
+  router.add("/user/:id/*", S("user_any"));
+  SYLAR_ASSERT(!router.add("/user/:name/x", S("conflict")));
+  router.addGlob("/sylar/*", S("glob"));
+  router.addGlob("/a/*.html", S("html"));
+  router.addGlob("/sylar/*", S("glob2"));
+
+  SYLAR_ASSERT(match(router, "/") == "root");
+  SYLAR_ASSERT(match(router, "/user") == "user");
+  SYLAR_ASSERT(match(router, "/users") == "users");
+  SYLAR_ASSERT(match(router, "/use") == "null");
+  //普通段优先于参数
+  SYLAR_ASSERT(match(router, "/user/list") == "list");
+  SYLAR_ASSERT(match(router, "/user/lis") == "user_id id=lis");
+  SYLAR_ASSERT(match(router, "/user/42") == "user_id id=42");
+  SYLAR_ASSERT(match(router, "/user/42/info") == "info id=42");
+  SYLAR_ASSERT(match(router, "/user/42/book/7") == "book id=42 book=7");
+  //参数后面的段都不匹配时回退到通配
+  SYLAR_ASSERT(match(router, "/user/42/other/x") == "user_any id=42 *=other/x");
+  SYLAR_ASSERT(match(router, "/user/list/x") == "user_any id=list *=x");
+  SYLAR_ASSERT(match(router, "/static/") == "static *=");
+  SYLAR_ASSERT(match(router, "/static/js/a.js") == "static *=js/a.js");
+  SYLAR_ASSERT(match(router, "/sylar/xx") == "glob2 *=xx");
+  SYLAR_ASSERT(match(router, "/a/b/c.html") == "html");
+  SYLAR_ASSERT(match(router, "/a/b/c.htm") == "null");
+}
+
+/**
+ * @brief 分发器对同一个请求只查一次路由, 修改路径或者换分发器时重新查
+ */
+void test_dispatch_cache() {
+  sylar::http::ServletDispatch sd;
+  sd.addServlet("/user/:id", S("user_id"));
+  sd.addServlet("/other", S("other"));
+  sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+  req->setPath("/user/42");
+  SYLAR_ASSERT(!sd.isStreamRequest(req));
+  SYLAR_ASSERT(req->getParam("id") == "42");
+  //删掉路由后还是第一次匹配的结果, 说明handle没有再查
+  sd.delServlet("/user/:id");
+  SYLAR_ASSERT(sd.getMatchServlet(req)->getName() == "user_id");
+
+  sylar::http::ServletDispatch other;
+  other.addServlet("/user/:id", S("other_user"));
+  SYLAR_ASSERT(other.getMatchServlet(req)->getName() == "other_user");
+
+  req->setPath("/other");
+  SYLAR_ASSERT(sd.getMatchServlet(req)->getName() == "other");
+}
+
+/**
+ * @brief 400个路由, 对比逐个fnmatch的查找开销
+ */
+void bench(int count) {
+  sylar::http::RadixRouter router;
+  std::vector<std::string> globs;
+  for (int i = 0; i < 400; ++i) {
+    std::string prefix = "/api/v" + std::to_string(i % 4) + "/module" +
+                         std::to_string(i);
+    router.add(prefix + "/:id", S("m" + std::to_string(i)));
+    router.addGlob(prefix + "/static/*", S("s" + std::to_string(i)));
+    globs.push_back(prefix + "/static/*");
+  }
+  std::vector<std::string> paths = {"/api/v3/module399/static/a.js",
+                                    "/api/v1/module201/1234", "/not/found"};
+
+  uint64_t begin = sylar::GetCurrentUS();
+  size_t hits = 0;
+  for (int i = 0; i < count; ++i) {
+    hits += router.match(paths[i % paths.size()]) != nullptr;
+  }
+  uint64_t trie = sylar::GetCurrentUS() - begin;
+
+  begin = sylar::GetCurrentUS();
+  size_t fnhits = 0;
+  for (int i = 0; i < count; ++i) {
+    for (auto& g : globs) {
+      if (!fnmatch(g.c_str(), paths[i % paths.size()].c_str(), 0)) {
+        ++fnhits;
+        break;
+      }
+    }
+  }
+  uint64_t fn = sylar::GetCurrentUS() - begin;
+  SYLAR_ASSERT(hits == (size_t)(count - count / 3));
+  SYLAR_LOG_INFO(g_logger) << "routes=800 lookups=" << count
+                           << " trie=" << trie * 1000.0 / count << "ns/lookup"
+                           << " fnmatch=" << fn * 1000.0 / count
+                           << "ns/lookup";
+}
+
+int main(int argc, char** argv) {
+  test_match();
+  test_dispatch_cache();
+  bench(argc > 1 ? atoi(argv[1]) : 300000);
+  return 0;
+}
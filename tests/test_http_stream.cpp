@@ -0,0 +1,117 @@
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "sylar/http/http_server.h"
+#include "sylar/sylar.h"
+#include "test_server.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 把数据按chunk大小编码成chunked格式
+ * */
+static std::string chunked(const std::string& data, size_t chunk) {
+  std::string rt;
+  char head[32];
+  for (size_t i = 0; i < data.size(); i += chunk) {
+    size_t len = std::min(chunk, data.size() - i);
+    snprintf(head, sizeof(head), "%zx;ext=1\r\n", len);
+    rt += head + data.substr(i, len) + "\r\n";
+  }
+  return rt + "0\r\nX-Trailer: 1\r\n\r\n";
+}
+
+int main(int argc, char** argv) {
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::INFO);
+  sylar::http::HttpServer::ptr server;
+  sylar::IOManager iom(1, false, "http");
+  sockaddr_in addr = start_server(iom, [&server]() {
+    server.reset(new sylar::http::HttpServer(true));
+    auto sd = server->getServletDispatch();
+    //边读边统计上传的字节数, 不把消息体放进内存
+    sylar::http::Servlet::ptr upload(new sylar::http::FunctionServlet(
+        [](sylar::http::HttpRequest::ptr req,
+           sylar::http::HttpResponse::ptr rsp,
+           sylar::http::HttpSession::ptr session) {
+          char buf[1000];
+          uint64_t total = 0;
+          int64_t rt = 0;
+          while ((rt = session->readBody(buf, sizeof(buf))) > 0) {
+            total += rt;
+          }
+          SYLAR_ASSERT(rt == 0);
+          SYLAR_ASSERT(req->getBody().empty());
+          rsp->setBody("upload:" + std::to_string(total) + ":end");
+          return 0;
+        }));
+    upload->setStreamBody(true);
+    sd->addServlet("/upload", upload);
+    //流式读取但是不读消息体
+    sylar::http::Servlet::ptr ignore(new sylar::http::FunctionServlet(
+        [](sylar::http::HttpRequest::ptr req,
+           sylar::http::HttpResponse::ptr rsp,
+           sylar::http::HttpSession::ptr session) {
+          rsp->setBody("ignore:end");
+          return 0;
+        }));
+    ignore->setStreamBody(true);
+    sd->addServlet("/ignore", ignore);
+    //没设置流式读取, 消息体整个放在请求里
+    sd->addServlet("/echo", [](sylar::http::HttpRequest::ptr req,
+                               sylar::http::HttpResponse::ptr rsp,
+                               sylar::http::HttpSession::ptr session) {
+      rsp->setBody("echo:" + std::to_string(req->getBodyView().size()) +
+                   ":end");
+      return 0;
+    });
+    //分段生成响应
+    sd->addServlet("/download", [](sylar::http::HttpRequest::ptr req,
+                                   sylar::http::HttpResponse::ptr rsp,
+                                   sylar::http::HttpSession::ptr session) {
+      session->sendResponseHeader(rsp);
+      for (int i = 0; i < 3; ++i) {
+        std::string part = "part" + std::to_string(i);
+        session->sendChunk(part.c_str(), part.size());
+      }
+      return 0;
+    });
+    return server;
+  });
+
+  std::string data(100000, 'x');
+  const std::string keepalive =
+      "Connection: keep-alive\r\nTransfer-Encoding: chunked\r\n\r\n";
+  //chunked上传到流式servlet和普通servlet, 后面跟一个流水线请求
+  std::string req = "POST /upload HTTP/1.1\r\n" + keepalive +
+                    chunked(data, 3000) + "POST /echo HTTP/1.1\r\n" +
+                    keepalive + chunked(data, 777) +
+                    "GET /download HTTP/1.1\r\n\r\n";
+  std::string rsp = run_client(addr, req);
+  SYLAR_LOG_INFO(g_logger) << rsp;
+  size_t upload = rsp.find("upload:100000:end");
+  size_t echo = rsp.find("echo:100000:end");
+  size_t download = rsp.find("transfer-encoding: chunked\r\n\r\n"
+                             "5\r\npart0\r\n5\r\npart1\r\n5\r\npart2\r\n"
+                             "0\r\n\r\n");
+  SYLAR_ASSERT(upload != std::string::npos);
+  SYLAR_ASSERT(echo != std::string::npos && echo > upload);
+  SYLAR_ASSERT(download != std::string::npos && download > echo);
+
+  //Content-Length的消息体同样可以流式读取; servlet没读的消息体被跳过,
+  //不影响下一个请求
+  const std::string length =
+      "Connection: keep-alive\r\nContent-Length: 100000\r\n\r\n";
+  req = "POST /upload HTTP/1.1\r\n" + length + data +
+        "POST /ignore HTTP/1.1\r\n" + length + data +
+        "POST /ignore HTTP/1.1\r\n" + keepalive + chunked(data, 5000) +
+        "GET /echo HTTP/1.1\r\n\r\n";
+  rsp = run_client(addr, req);
+  size_t ignore = rsp.find("ignore:end");
+  SYLAR_ASSERT(rsp.find("upload:100000:end") < ignore);
+  SYLAR_ASSERT(rsp.find("ignore:end", ignore + 1) != std::string::npos);
+  SYLAR_ASSERT(rsp.find("echo:0:end") != std::string::npos);
+
+  server->stop();
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "sylar/hook.h"
+#include "sylar/iomanager.h"
+#include "sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<std::string>::ptr g_backend =
+    sylar::Config::Lookup<std::string>("iomanager.backend");
+
+/**
+ * @brief 创建监听127.0.0.1随机端口的socket
+ * */
+static int listen_any(sockaddr_in& addr) {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = 0;
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr.s_addr);
+  SYLAR_ASSERT(!bind(sock, (const sockaddr*)&addr, sizeof(addr)));
+  SYLAR_ASSERT(!listen(sock, 16));
+  socklen_t len = sizeof(addr);
+  getsockname(sock, (sockaddr*)&addr, &len);
+  return sock;
+}
+
+void ping_pong_client(sockaddr_in addr, int rounds) {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  int rt = connect(sock, (const sockaddr*)&addr, sizeof(addr));
+  SYLAR_ASSERT2(rt == 0, strerror(errno));
+  for (int i = 0; i < rounds; ++i) {
+    char head[4];
+    char body[4];
+    memcpy(head, &i, sizeof(i));
+    memcpy(body, "ping", 4);
+    iovec iov[2];
+    iov[0].iov_base = head;
+    iov[0].iov_len = sizeof(head);
+    iov[1].iov_base = body;
+    iov[1].iov_len = sizeof(body);
+    rt = writev(sock, iov, 2);
+    SYLAR_ASSERT(rt == 8);
+    memset(head, 0, sizeof(head));
+    memset(body, 0, sizeof(body));
+    rt = readv(sock, iov, 2);
+    SYLAR_ASSERT(rt == 8);
+    SYLAR_ASSERT(!memcmp(head, &i, sizeof(i)));
+    SYLAR_ASSERT(!memcmp(body, "ping", 4));
+  }
+  close(sock);
+}
+
+/**
+ * @brief 一个连接上的乒乓, 服务端用read/write, 客户端用writev/readv
+ * */
+void test_ping_pong(int rounds) {
+  sylar::IOManager iom(1, false, "uring");
+  SYLAR_LOG_INFO(g_logger) << "backend=" << g_backend->getValue()
+                           << " io_uring=" << iom.isIOUring();
+
+  uint64_t begin = sylar::GetCurrentUS();
+  //在协程里创建socket, 才会被hook管理
+  iom.schedule([rounds]() {
+    sockaddr_in addr;
+    int lsock = listen_any(addr);
+    sylar::IOManager::GetThis()->schedule(
+        std::bind(&ping_pong_client, addr, rounds));
+
+    int conn = accept(lsock, nullptr, nullptr);
+    SYLAR_ASSERT(conn >= 0);
+    char buf[64];
+    for (int i = 0; i < rounds; ++i) {
+      int rt = read(conn, buf, sizeof(buf));
+      SYLAR_ASSERT2(rt == 8, std::to_string(rt) + " " + strerror(errno));
+      rt = write(conn, buf, rt);
+      SYLAR_ASSERT(rt == 8);
+    }
+    close(conn);
+    close(lsock);
+  });
+  iom.Stop();
+  uint64_t used = sylar::GetCurrentUS() - begin;
+  SYLAR_LOG_INFO(g_logger) << "ping_pong rounds=" << rounds << " used=" << used
+                           << "us " << (double)used / rounds << "us/round";
+}
+
+/**
+ * @brief 接收超时返回ETIMEDOUT, 关闭句柄唤醒等待中的接收
+ * */
+void test_timeout_and_close() {
+  sylar::IOManager iom(1, false, "uring");
+  iom.schedule([]() {
+    sockaddr_in addr;
+    int lsock = listen_any(addr);
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int rt = connect(sock, (const sockaddr*)&addr, sizeof(addr));
+    SYLAR_ASSERT(rt == 0);
+    int conn = accept(lsock, nullptr, nullptr);
+    SYLAR_ASSERT(conn >= 0);
+
+    timeval tv = {0, 100 * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char buf[16];
+    uint64_t begin = sylar::GetCurrentMS();
+    rt = recv(sock, buf, sizeof(buf), 0);
+    uint64_t used = sylar::GetCurrentMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "recv timeout rt=" << rt << " errno=" << errno
+                             << " used=" << used << "ms";
+    SYLAR_ASSERT(rt == -1 && errno == ETIMEDOUT);
+    SYLAR_ASSERT(used >= 90);
+
+    sylar::IOManager::GetThis()->addTimer(50, [conn]() { close(conn); });
+    rt = recv(conn, buf, sizeof(buf), 0);
+    SYLAR_LOG_INFO(g_logger) << "recv after close rt=" << rt
+                             << " errno=" << errno;
+    SYLAR_ASSERT(rt == -1 && errno == EBADF);
+    close(sock);
+    close(lsock);
+  });
+}
+
+int main(int argc, char** argv) {
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::INFO);
+  int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+  g_backend->setValue("epoll");
+  test_ping_pong(rounds);
+  g_backend->setValue("io_uring");
+  test_ping_pong(rounds);
+  test_timeout_and_close();
+  return 0;
+}
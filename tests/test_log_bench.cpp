@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <atomic>
+#include <iomanip>
+#include <new>
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/// 统计当前线程的堆分配次数
+static thread_local uint64_t t_allocs = 0;
+
+void* operator new(size_t size) {
+  ++t_allocs;
+  void* p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+/**
+ * @brief 什么都不写的Appender, 只测日志事件本身的开销
+ * */
+class NullLogAppender : public sylar::LogAppender {
+ public:
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {}
+  std::string toYamlString() override { return "type: NullLogAppender"; }
+};
+
+/**
+ * @brief 记录最后一条日志内容
+ * */
+class LastLogAppender : public sylar::LogAppender {
+ public:
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {
+    m_last = event->getContent();
+  }
+  std::string toYamlString() override { return "type: LastLogAppender"; }
+  std::string m_last;
+};
+
+/**
+ * @brief 超过内置缓冲区的日志改用堆内存, 之后的短日志不受影响
+ * */
+void test_overflow() {
+  sylar::Logger::ptr logger(new sylar::Logger("overflow"));
+  std::shared_ptr<LastLogAppender> last(new LastLogAppender);
+  logger->addAppender(last);
+  std::string big(3000, 'x');
+  SYLAR_LOG_INFO(logger) << big << "end";
+  SYLAR_ASSERT(last->m_last == big + "end");
+  SYLAR_LOG_FMT_INFO(logger, "%s%d", big.c_str(), 42);
+  SYLAR_ASSERT(last->m_last == big + "42");
+  SYLAR_LOG_INFO(logger) << "short";
+  SYLAR_ASSERT(last->m_last == "short");
+}
+
+/**
+ * @brief 复用的日志事件不沿用上一条日志设置的格式
+ * */
+void test_format_reset() {
+  sylar::Logger::ptr logger(new sylar::Logger("format"));
+  std::shared_ptr<LastLogAppender> last(new LastLogAppender);
+  logger->addAppender(last);
+  //超过每线程缓存的事件个数, 保证用到设置过格式的事件
+  for (int i = 0; i < 64; ++i) {
+    SYLAR_LOG_INFO(logger) << std::hex << std::showbase << std::setprecision(2)
+                           << std::setfill('*') << std::left << 255 << " "
+                           << std::setw(4) << 1 << " " << 3.14159;
+    SYLAR_ASSERT(last->m_last == "0xff 0x1* 3.1");
+    SYLAR_LOG_INFO(logger) << 255 << " " << 3.14159 << " " << true;
+    SYLAR_ASSERT(last->m_last == "255 3.14159 1");
+  }
+}
+
+/**
+ * @brief 每个线程写count条日志, 输出每线程每秒行数和每行堆分配次数
+ * @param[in] name 测试名
+ * @param[in] appender 输出目标
+ * */
+void bench(const std::string& name, sylar::LogAppender::ptr appender,
+           int threads, int count) {
+  sylar::Logger::ptr logger(new sylar::Logger("bench"));
+  logger->addAppender(appender);
+  std::atomic<uint64_t> used_us{0};
+  std::atomic<uint64_t> allocs{0};
+
+  std::vector<sylar::Thread::ptr> thrs;
+  for (int i = 0; i < threads; ++i) {
+    thrs.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [logger, count, &used_us, &allocs]() {
+          //预热, 让线程缓存先建立起来
+          SYLAR_LOG_INFO(logger) << "warm up";
+          uint64_t a = t_allocs;
+          uint64_t begin = sylar::GetCurrentUS();
+          for (int n = 0; n < count; ++n) {
+            SYLAR_LOG_INFO(logger) << "request done path=/index.html status="
+                                   << 200 << " used=" << n;
+          }
+          used_us += sylar::GetCurrentUS() - begin;
+          allocs += t_allocs - a;
+        },
+        "bench_" + std::to_string(i))));
+  }
+  for (auto& i : thrs) {
+    i->join();
+  }
+  double per_thread = (double)count * threads * 1000000 / used_us;
+  SYLAR_LOG_INFO(g_logger) << name << " threads=" << threads
+                           << " lines/s/thread=" << (uint64_t)per_thread
+                           << " allocs/line="
+                           << (double)allocs / ((uint64_t)count * threads);
+}
+
+int main(int argc, char** argv) {
+  int count = argc > 1 ? atoi(argv[1]) : 500000;
+  test_overflow();
+  test_format_reset();
+  for (int threads : {1, 4}) {
+    bench("null", sylar::LogAppender::ptr(new NullLogAppender), threads,
+          count);
+    bench("file", sylar::LogAppender::ptr(
+                      new sylar::FileLogAppender("/dev/null")),
+          threads, count / 5);
+  }
+  return 0;
+}
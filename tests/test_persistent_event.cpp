@@ -0,0 +1,105 @@
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "sylar/hook.h"
+#include "sylar/iomanager.h"
+#include "sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<bool>::ptr g_persistent =
+    sylar::Config::Lookup<bool>("iomanager.persistent_event");
+
+static std::atomic<uint64_t> s_epoll_ctl{0};
+static std::atomic<uint64_t> s_epoll_wait{0};
+
+/// 覆盖libc的epoll_ctl/epoll_wait, 统计系统调用次数
+extern "C" {
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
+  typedef int (*fun)(int, int, int, struct epoll_event*);
+  static fun f = (fun)dlsym(RTLD_NEXT, "epoll_ctl");
+  ++s_epoll_ctl;
+  return f(epfd, op, fd, event);
+}
+
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents,
+               int timeout) {
+  typedef int (*fun)(int, struct epoll_event*, int, int);
+  static fun f = (fun)dlsym(RTLD_NEXT, "epoll_wait");
+  ++s_epoll_wait;
+  return f(epfd, events, maxevents, timeout);
+}
+}
+
+void client(sockaddr_in addr, int rounds) {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  int rt = connect(sock, (const sockaddr*)&addr, sizeof(addr));
+  SYLAR_ASSERT2(rt == 0, strerror(errno));
+  char buf[64] = "GET / HTTP/1.1\r\n\r\n";
+  for (int i = 0; i < rounds; ++i) {
+    rt = send(sock, buf, 32, 0);
+    SYLAR_ASSERT(rt == 32);
+    rt = recv(sock, buf, sizeof(buf), 0);
+    SYLAR_ASSERT(rt == 32);
+  }
+  close(sock);
+}
+
+/**
+ * @brief 请求/响应乒乓, 每轮双方各阻塞一次
+ * */
+void test_ping_pong(int rounds) {
+  uint64_t ctl = s_epoll_ctl;
+  uint64_t wait = s_epoll_wait;
+  uint64_t begin = sylar::GetCurrentUS();
+  {
+    sylar::IOManager iom(1, false, "pingpong");
+    iom.schedule([rounds]() {
+      int lsock = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr.s_addr);
+      SYLAR_ASSERT(!bind(lsock, (const sockaddr*)&addr, sizeof(addr)));
+      SYLAR_ASSERT(!listen(lsock, 16));
+      socklen_t len = sizeof(addr);
+      getsockname(lsock, (sockaddr*)&addr, &len);
+      sylar::IOManager::GetThis()->schedule(std::bind(&client, addr, rounds));
+
+      int conn = accept(lsock, nullptr, nullptr);
+      SYLAR_ASSERT(conn >= 0);
+      char buf[64];
+      for (int i = 0; i < rounds; ++i) {
+        int rt = recv(conn, buf, sizeof(buf), 0);
+        SYLAR_ASSERT(rt == 32);
+        rt = send(conn, buf, rt, 0);
+        SYLAR_ASSERT(rt == 32);
+      }
+      //对端关闭后读到0
+      SYLAR_ASSERT(recv(conn, buf, sizeof(buf), 0) == 0);
+      close(conn);
+      close(lsock);
+    });
+  }
+  uint64_t used = sylar::GetCurrentUS() - begin;
+  ctl = s_epoll_ctl - ctl;
+  wait = s_epoll_wait - wait;
+  SYLAR_LOG_INFO(g_logger) << "persistent_event=" << g_persistent->getValue()
+                           << " rounds=" << rounds
+                           << " epoll_ctl/request=" << (double)ctl / rounds
+                           << " epoll_wait/request=" << (double)wait / rounds
+                           << " used=" << (double)used / rounds << "us/request";
+}
+
+int main(int argc, char** argv) {
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::INFO);
+  int rounds = argc > 1 ? atoi(argv[1]) : 50000;
+  g_persistent->setValue(false);
+  test_ping_pong(rounds);
+  g_persistent->setValue(true);
+  test_ping_pong(rounds);
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <set>
+#include "sylar/sylar.h"
+#include "sylar/tcp_server.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<bool>::ptr g_reactor =
+    sylar::Config::Lookup<bool>("tcp_server.reactor");
+static sylar::ConfigVar<uint32_t>::ptr g_reactor_count =
+    sylar::Config::Lookup<uint32_t>("tcp_server.reactor_count");
+
+/**
+ * @brief 每收到一个请求回复处理它的线程id
+ * */
+class ThreadEchoServer : public sylar::TcpServer {
+ public:
+  ThreadEchoServer() : sylar::TcpServer(nullptr, nullptr) {}
+
+ protected:
+  void handleClient(sylar::Socket::ptr client) override {
+    char buf[16];
+    while (client->recv(buf, sizeof(buf)) > 0) {
+      pid_t tid = sylar::GetThreadId();
+      if (client->send(&tid, sizeof(tid)) != sizeof(tid)) {
+        break;
+      }
+    }
+    client->close();
+  }
+};
+
+/**
+ * @brief 不经过hook的阻塞客户端, 记录每个请求由哪个线程处理
+ * */
+static std::set<pid_t> run_client(sockaddr_in addr, int rounds) {
+  std::set<pid_t> tids;
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  int rt = connect(sock, (const sockaddr*)&addr, sizeof(addr));
+  SYLAR_ASSERT2(rt == 0, strerror(errno));
+  for (int i = 0; i < rounds; ++i) {
+    SYLAR_ASSERT(send(sock, "ping", 4, 0) == 4);
+    pid_t tid = 0;
+    SYLAR_ASSERT(recv(sock, &tid, sizeof(tid), MSG_WAITALL) == sizeof(tid));
+    tids.insert(tid);
+  }
+  close(sock);
+  return tids;
+}
+
+int main(int argc, char** argv) {
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::INFO);
+  int conns = argc > 1 ? atoi(argv[1]) : 32;
+  g_reactor->setValue(true);
+  g_reactor_count->setValue(4);
+
+  sylar::TcpServer::ptr server(new ThreadEchoServer);
+  sockaddr_in addr;
+  {
+    //监听socket要在协程里创建, 才会被hook设为非阻塞
+    sylar::IOManager iom(1, false, "main");
+    iom.schedule([server, &addr]() {
+      auto any = sylar::Address::LookupAny("127.0.0.1:0");
+      std::vector<sylar::Address::ptr> addrs{any}, fails;
+      SYLAR_ASSERT(server->bind(addrs, fails));
+      SYLAR_ASSERT(server->start());
+      SYLAR_LOG_INFO(g_logger) << server->tostring();
+      socklen_t len = sizeof(addr);
+      getsockname(server->getSocks()[0]->getSocket(), (sockaddr*)&addr, &len);
+    });
+  }
+
+  std::set<pid_t> all;
+  for (int i = 0; i < conns; ++i) {
+    auto tids = run_client(addr, 10);
+    //连接一直留在接受它的reactor上
+    SYLAR_ASSERT(tids.size() == 1);
+    all.insert(*tids.begin());
+  }
+  SYLAR_LOG_INFO(g_logger) << "connections=" << conns
+                           << " reactors used=" << all.size();
+  SYLAR_ASSERT(all.size() > 1);
+  server->stop();
+  return 0;
+}
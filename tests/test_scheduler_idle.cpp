@@ -0,0 +1,129 @@
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/mutex.h"
+#include "sylar/scheduler.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/// 线程数
+static const int THREADS = 4;
+/// 唤醒延迟的轮数
+static const int ROUNDS = 2000;
+
+/**
+ * @brief 进程占用的CPU时间, 微秒
+ */
+static uint64_t cpu_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 所有线程空闲时占用的CPU
+ */
+void test_idle_cpu(sylar::Scheduler& sc) {
+  usleep(100 * 1000);
+  uint64_t cpu = cpu_us();
+  uint64_t begin = sylar::GetCurrentUS();
+  usleep(1000 * 1000);
+  cpu = cpu_us() - cpu;
+  uint64_t used = sylar::GetCurrentUS() - begin;
+  SYLAR_LOG_INFO(g_logger) << THREADS << " idle threads used " << cpu
+                           << "us cpu in " << used << "us";
+  //空闲线程在futex上休眠, 不再空转
+  SYLAR_ASSERT(cpu < used / 10);
+}
+
+/**
+ * @brief 所有线程空闲时放入一个任务, 统计到任务开始执行的延迟
+ */
+void test_latency(sylar::Scheduler& sc) {
+  sylar::Semaphore sem;
+  uint64_t total = 0;
+  uint64_t cpu = cpu_us();
+  for (int i = 0; i < ROUNDS; ++i) {
+    usleep(100);
+    uint64_t begin = sylar::GetCurrentUS();
+    uint64_t start = 0;
+    sc.schedule([&sem, &start]() {
+      start = sylar::GetCurrentUS();
+      sem.notify();
+    });
+    sem.wait();
+    total += start - begin;
+  }
+  SYLAR_LOG_INFO(g_logger) << "wakeup latency: " << total / ROUNDS
+                           << "us avg, cpu " << cpu_us() - cpu << "us";
+}
+
+/**
+ * @brief 任务之间互相调度, 指定线程的任务要叫醒对应的线程
+ */
+void test_pinned(sylar::Scheduler& sc) {
+  sylar::Semaphore sem;
+  std::atomic<int> done{0};
+  std::atomic<int> wrong{0};
+  for (int i = 0; i < THREADS; ++i) {
+    sc.schedule([&sc, &sem, &done, &wrong]() {
+      int tid = sylar::GetThreadId();
+      for (int j = 0; j < 100; ++j) {
+        sc.schedule(
+            [&sem, &done, &wrong, tid]() {
+              if (sylar::GetThreadId() != tid) {
+                ++wrong;
+              }
+              if (++done == THREADS * 100) {
+                sem.notify();
+              }
+            },
+            tid);
+      }
+    });
+  }
+  sem.wait();
+  SYLAR_ASSERT(wrong == 0);
+}
+
+/**
+ * @brief use_caller时指定给调用线程的任务在Stop()前暂存, 不让其它线程空转;
+ *        指定给不属于调度器的线程时在任意线程执行
+ */
+void test_pending() {
+  sylar::Scheduler sc(THREADS, true, "pending");
+  sc.Start();
+  int tid = sylar::GetThreadId();
+  std::atomic<int> ran{0};
+  sc.schedule(
+      [&ran, tid]() {
+        SYLAR_ASSERT(sylar::GetThreadId() == tid);
+        ++ran;
+      },
+      tid);
+  sylar::Semaphore sem;
+  sc.schedule([&sem]() { sem.notify(); }, 0x7fffffff);
+  sem.wait();
+  test_idle_cpu(sc);
+  SYLAR_ASSERT(ran == 0);
+  sc.Stop();
+  SYLAR_ASSERT(ran == 1);
+}
+
+int main(int argc, char** argv) {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::WARN);
+  sylar::Scheduler sc(THREADS, false, "idle");
+  sc.Start();
+  test_idle_cpu(sc);
+  test_latency(sc);
+  test_pinned(sc);
+  test_idle_cpu(sc);
+  sc.Stop();
+  test_pending();
+  SYLAR_LOG_INFO(g_logger) << "test_scheduler_idle ok";
+  return 0;
+}
@@ -0,0 +1,167 @@
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/mutex.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+typedef sylar::Scheduler Scheduler;
+
+/// 每个优先级的任务数
+static const int TASKS = 30;
+
+/**
+ * @brief 工作线程被占住时放入三个优先级的任务, 检查按权重轮流执行
+ */
+void test_order() {
+  Scheduler sc(1, false, "order");
+  sc.Start();
+  sylar::Semaphore started;
+  sylar::Semaphore release;
+  sylar::Semaphore done;
+  sylar::Mutex mutex;
+  std::vector<int> order;
+  sc.schedule([&started, &release]() {
+    started.notify();
+    release.wait();
+  });
+  started.wait();
+  const Scheduler::Priority prios[] = {Scheduler::BACKGROUND, Scheduler::NORMAL,
+                                       Scheduler::INTERACTIVE};
+  for (auto p : prios) {
+    for (int i = 0; i < TASKS; ++i) {
+      sc.schedule(
+          [&mutex, &order, &done, p]() {
+            SYLAR_ASSERT(Scheduler::GetCurrentPriority() == p);
+            sylar::Mutex::Lock lock(mutex);
+            order.push_back(p);
+            if (order.size() == TASKS * 3) {
+              done.notify();
+            }
+          },
+          -1, p);
+    }
+  }
+  release.notify();
+  done.wait();
+  sc.Stop();
+
+  std::string str;
+  for (auto i : order) {
+    str += "INB"[i];
+  }
+  //一轮: 8个INTERACTIVE, 4个NORMAL, 1个BACKGROUND,
+  //占住线程的任务用掉了第一轮的一个NORMAL
+  SYLAR_ASSERT(str.substr(0, 12) == "IIIIIIIINNNB");
+  SYLAR_ASSERT(str.substr(12, 13) == "IIIIIIIINNNNB");
+  SYLAR_LOG_INFO(g_logger) << "order: " << str;
+}
+
+/**
+ * @brief IO事件和定时器唤醒的协程沿用原来的优先级
+ */
+void test_inherit() {
+  sylar::IOManager iom(2, false, "inherit");
+  int fds[2];
+  SYLAR_ASSERT(pipe(fds) == 0);
+  sylar::Semaphore done;
+  iom.schedule(
+      [&iom, &done, fds]() {
+        SYLAR_ASSERT(Scheduler::GetCurrentPriority() == Scheduler::INTERACTIVE);
+        //回调形式的事件按添加时的优先级调度
+        iom.addEvent(fds[0], sylar::IOManager::READ, [&done]() {
+          SYLAR_ASSERT(Scheduler::GetCurrentPriority() ==
+                       Scheduler::INTERACTIVE);
+          done.notify();
+        });
+        //函数调度沿用当前任务的优先级
+        iom.schedule([]() {
+          SYLAR_ASSERT(Scheduler::GetCurrentPriority() ==
+                       Scheduler::INTERACTIVE);
+        });
+        usleep(10 * 1000);
+        SYLAR_ASSERT(Scheduler::GetCurrentPriority() == Scheduler::INTERACTIVE);
+        SYLAR_ASSERT(write(fds[1], "x", 1) == 1);
+      },
+      -1, Scheduler::INTERACTIVE);
+  done.wait();
+  char c;
+  SYLAR_ASSERT(read(fds[0], &c, 1) == 1);
+
+  iom.schedule(
+      [&iom, &done, fds]() {
+        //等待可读时挂起协程, 可读后按原优先级恢复
+        iom.addEvent(fds[0], sylar::IOManager::READ);
+        sylar::Fiber::YieldToHold();
+        SYLAR_ASSERT(Scheduler::GetCurrentPriority() == Scheduler::BACKGROUND);
+        done.notify();
+      },
+      -1, Scheduler::BACKGROUND);
+  usleep(10 * 1000);
+  SYLAR_ASSERT(write(fds[1], "y", 1) == 1);
+  done.wait();
+  SYLAR_ASSERT(read(fds[0], &c, 1) == 1);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+/**
+ * @brief 大量普通任务排队时放入INTERACTIVE任务, 和排在队尾的NORMAL任务比较
+ */
+void bench_latency() {
+  const int JOBS = 2000;
+  const int PINGS = 200;
+  sylar::IOManager iom(2, false, "latency");
+  std::atomic<int> jobs{0};
+  for (int i = 0; i < JOBS; ++i) {
+    iom.schedule([&jobs]() {
+      //模拟200us的计算
+      uint64_t end = sylar::GetCurrentUS() + 200;
+      while (sylar::GetCurrentUS() < end)
+        ;
+      ++jobs;
+    });
+  }
+  sylar::Semaphore sem;
+  uint64_t start = 0;
+  uint64_t total = 0;
+  uint64_t max = 0;
+  for (int i = 0; i < PINGS; ++i) {
+    uint64_t begin = sylar::GetCurrentUS();
+    iom.schedule(
+        [&sem, &start]() {
+          start = sylar::GetCurrentUS();
+          sem.notify();
+        },
+        -1, Scheduler::INTERACTIVE);
+    sem.wait();
+    total += start - begin;
+    max = std::max(max, start - begin);
+  }
+  SYLAR_LOG_INFO(g_logger) << "interactive latency behind " << JOBS
+                           << " jobs: avg " << total / PINGS << "us max "
+                           << max << "us, jobs done " << jobs;
+  int left = JOBS - jobs;
+  uint64_t begin = sylar::GetCurrentUS();
+  iom.schedule([&sem, &start]() {
+    start = sylar::GetCurrentUS();
+    sem.notify();
+  });
+  sem.wait();
+  SYLAR_LOG_INFO(g_logger) << "normal latency behind " << left
+                           << " jobs: " << start - begin << "us";
+}
+
+int main(int argc, char** argv) {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::WARN);
+  test_order();
+  test_inherit();
+  bench_latency();
+  SYLAR_LOG_INFO(g_logger) << "test_scheduler_priority ok";
+  return 0;
+}
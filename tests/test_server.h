@@ -0,0 +1,63 @@
+#ifndef __SYLAR_TEST_SERVER_H__
+#define __SYLAR_TEST_SERVER_H__
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "sylar/sylar.h"
+
+/**
+ * @brief 在iom的协程里创建服务器, 监听127.0.0.1的随机端口
+ * @param[in] create 创建并配置服务器, TcpServer默认使用当前协程的IOManager
+ * @return 服务器的监听地址, 服务器已经开始accept
+ * */
+inline sockaddr_in start_server(sylar::IOManager& iom,
+                                std::function<sylar::TcpServer::ptr()> create) {
+  sockaddr_in addr;
+  sylar::Semaphore started;
+  iom.schedule([&create, &addr, &started]() {
+    sylar::TcpServer::ptr server = create();
+    auto any = sylar::Address::LookupAny("127.0.0.1:0");
+    std::vector<sylar::Address::ptr> addrs{any}, fails;
+    SYLAR_ASSERT(server->bind(addrs, fails));
+    SYLAR_ASSERT(server->start());
+    socklen_t len = sizeof(addr);
+    getsockname(server->getSocks()[0]->getSocket(), (sockaddr*)&addr, &len);
+    started.notify();
+  });
+  started.wait();
+  return addr;
+}
+
+/**
+ * @brief 不经过hook的阻塞连接, 连上后发出data
+ * @return socket, 由调用方关闭
+ * */
+inline int connect_send(sockaddr_in addr, const std::string& data) {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  int rt = connect(sock, (const sockaddr*)&addr, sizeof(addr));
+  SYLAR_ASSERT2(rt == 0, strerror(errno));
+  SYLAR_ASSERT(send(sock, data.c_str(), data.size(), 0) == (int)data.size());
+  return sock;
+}
+
+/**
+ * @brief 发出请求后一直读到对端关闭
+ * */
+inline std::string run_client(sockaddr_in addr, const std::string& req) {
+  int sock = connect_send(addr, req);
+  std::string rsp;
+  char buf[4096];
+  int rt = 0;
+  while ((rt = recv(sock, buf, sizeof(buf), 0)) > 0) {
+    rsp.append(buf, rt);
+  }
+  close(sock);
+  return rsp;
+}
+
+#endif
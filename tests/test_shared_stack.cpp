@@ -0,0 +1,57 @@
+#include <unistd.h>
+#include "sylar/iomanager.h"
+#include "sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_ok{0};
+static std::atomic<int> s_fail{0};
+
+/**
+ * @brief 在栈上写入数据, 挂起后检查是否被其它协程破坏
+ * */
+void run_in_fiber(int id) {
+  char buf[4096];
+  for (size_t i = 0; i < sizeof(buf); ++i) {
+    buf[i] = (char)(id + i);
+  }
+  int tid = sylar::GetThreadId();
+  for (int n = 0; n < 3; ++n) {
+    usleep(10 * 1000);
+    if (tid != sylar::GetThreadId()) {
+      ++s_fail;
+      return;
+    }
+  }
+  for (size_t i = 0; i < sizeof(buf); ++i) {
+    if (buf[i] != (char)(id + i)) {
+      ++s_fail;
+      return;
+    }
+  }
+  ++s_ok;
+}
+
+void test_shared_stack(int count) {
+  {
+    sylar::IOManager iom(2, false, "shared");
+    for (int i = 0; i < count; ++i) {
+      iom.schedule(sylar::Fiber::ptr(new sylar::Fiber(
+          std::bind(&run_in_fiber, i), 0, false, true)));
+    }
+    iom.addTimer(15, []() {
+      SYLAR_LOG_INFO(g_logger)
+          << "fibers=" << sylar::Fiber::TotalFibers()
+          << " saved_bytes=" << sylar::Fiber::TotalSharedStackSaved();
+    });
+  }
+  SYLAR_LOG_INFO(g_logger) << "ok=" << s_ok << " fail=" << s_fail;
+  SYLAR_ASSERT(s_ok == count);
+  SYLAR_ASSERT(sylar::Fiber::TotalSharedStackSaved() == 0);
+}
+
+int main(int argc, char** argv) {
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::INFO);
+  test_shared_stack(argc > 1 ? atoi(argv[1]) : 10000);
+  return 0;
+}
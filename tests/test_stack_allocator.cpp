@@ -0,0 +1,57 @@
+#include "sylar/iomanager.h"
+#include "sylar/stack_allocator.h"
+#include "sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+void test_pool() {
+  sylar::MmapStackAllocator* alloc = sylar::MmapStackAllocator::GetInstance();
+  std::vector<void*> stacks;
+  for (int i = 0; i < 10; ++i) {
+    stacks.push_back(alloc->alloc(128 * 1024));
+  }
+  for (auto i : stacks) {
+    alloc->dealloc(i, 128 * 1024);
+  }
+  for (int i = 0; i < 10; ++i) {
+    void* vp = alloc->alloc(128 * 1024);
+    SYLAR_ASSERT(vp);
+    memset(vp, 0, 128 * 1024);
+    alloc->dealloc(vp, 128 * 1024);
+  }
+  auto stats = alloc->getStats();
+  SYLAR_LOG_INFO(g_logger) << "mapped=" << stats.mapped
+                           << " unmapped=" << stats.unmapped
+                           << " reused=" << stats.reused
+                           << " cached=" << stats.cached;
+  SYLAR_ASSERT(stats.mapped == 10);
+  SYLAR_ASSERT(stats.reused == 10);
+}
+
+void test_fiber() {
+  static int s_count = 0;
+  if (++s_count < 10000) {
+    sylar::IOManager::GetThis()->schedule(&test_fiber);
+  }
+}
+
+void test_churn() {
+  uint64_t ts = sylar::GetCurrentMS();
+  {
+    sylar::IOManager iom(2, false);
+    for (int i = 0; i < 4; ++i) {
+      iom.schedule(&test_fiber);
+    }
+  }
+  SYLAR_LOG_INFO(g_logger) << "fiber churn used " << sylar::GetCurrentMS() - ts
+                           << "ms allocator="
+                           << sylar::StackAllocator::GetDefault()->getName();
+}
+
+int main(int argc, char** argv) {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::INFO);
+  test_pool();
+  test_churn();
+  return 0;
+}
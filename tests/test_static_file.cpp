@@ -0,0 +1,194 @@
+#include <arpa/inet.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fstream>
+#include "sylar/http/http_server.h"
+#include "sylar/http/static_file_servlet.h"
+#include "sylar/sylar.h"
+#include "test_server.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+typedef sylar::http::StaticFileServlet StaticFileServlet;
+
+static std::string get(sockaddr_in addr, const std::string& path,
+                       const std::string& headers = "") {
+  return run_client(addr, "GET " + path + " HTTP/1.1\r\n" + headers + "\r\n");
+}
+
+static std::string body(const std::string& rsp) {
+  size_t pos = rsp.find("\r\n\r\n");
+  SYLAR_ASSERT(pos != std::string::npos);
+  return rsp.substr(pos + 4);
+}
+
+static void write_file(const std::string& path, const std::string& data) {
+  std::ofstream ofs(path, std::ios::binary);
+  ofs << data;
+}
+
+void test_helpers() {
+  uint64_t b = 0, e = 0;
+  SYLAR_ASSERT(StaticFileServlet::ParseRange("bytes=0-99", 1000, b, e) == 1);
+  SYLAR_ASSERT(b == 0 && e == 100);
+  SYLAR_ASSERT(StaticFileServlet::ParseRange("bytes=900-", 1000, b, e) == 1);
+  SYLAR_ASSERT(b == 900 && e == 1000);
+  SYLAR_ASSERT(StaticFileServlet::ParseRange("bytes=-100", 1000, b, e) == 1);
+  SYLAR_ASSERT(b == 900 && e == 1000);
+  SYLAR_ASSERT(StaticFileServlet::ParseRange("bytes=500-5000", 1000, b, e) ==
+               1);
+  SYLAR_ASSERT(b == 500 && e == 1000);
+  SYLAR_ASSERT(StaticFileServlet::ParseRange("bytes=1000-", 1000, b, e) == -1);
+  SYLAR_ASSERT(StaticFileServlet::ParseRange("bytes=0-1,5-6", 1000, b, e) ==
+               0);
+  SYLAR_ASSERT(StaticFileServlet::ParseRange("bytes=9-1", 1000, b, e) == 0);
+  SYLAR_ASSERT(StaticFileServlet::ParseRange("items=0-1", 1000, b, e) == 0);
+
+  std::string date = StaticFileServlet::HttpDate(784111777);
+  SYLAR_ASSERT2(date == "Sun, 06 Nov 1994 08:49:37 GMT", date);
+  SYLAR_ASSERT(StaticFileServlet::ParseHttpDate(date) == 784111777);
+  SYLAR_ASSERT(StaticFileServlet::ParseHttpDate("yesterday") == -1);
+
+  SYLAR_ASSERT(strcmp(StaticFileServlet::GetContentType("/a/b.CSS"),
+                      "text/css; charset=utf-8") == 0);
+  SYLAR_ASSERT(strcmp(StaticFileServlet::GetContentType("/a.b/c"),
+                      "application/octet-stream") == 0);
+}
+
+/**
+ * @brief 对端已经断开时发送失败, 响应要标记为关闭, 不能继续复用连接
+ * */
+void test_send_fail(const std::string& root) {
+  signal(SIGPIPE, SIG_IGN);
+  auto listener = sylar::Socket::CreateTCPSocket();
+  SYLAR_ASSERT(listener->bind(sylar::Address::LookupAny("127.0.0.1:0")) &&
+               listener->listen());
+  sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  getsockname(listener->getSocket(), (sockaddr*)&addr, &len);
+  StaticFileServlet::ptr slt(new StaticFileServlet("/static/", root));
+  for (auto path : {"/static/small.txt", "/static/big.bin"}) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    SYLAR_ASSERT(connect(sock, (const sockaddr*)&addr, sizeof(addr)) == 0);
+    auto client = listener->accept();
+    //RST断开, 之后的发送直接失败
+    linger lg = {1, 0};
+    setsockopt(sock, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    close(sock);
+    usleep(10 * 1000);
+    sylar::http::HttpSession::ptr session(
+        new sylar::http::HttpSession(client));
+    sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+    req->setPath(path);
+    sylar::http::HttpResponse::ptr rsp(
+        new sylar::http::HttpResponse(0x11, false));
+    slt->handle(req, rsp, session);
+    SYLAR_ASSERT(rsp->isClose());
+  }
+}
+
+int main(int argc, char** argv) {
+  test_helpers();
+
+  char tmpl[] = "/tmp/sylar_static_XXXXXX";
+  std::string root = mkdtemp(tmpl);
+  std::string big(1024 * 1024 + 7, '\0');
+  for (size_t i = 0; i < big.size(); ++i) {
+    big[i] = 'a' + i % 26;
+  }
+  write_file(root + "/small.txt", "hello world");
+  write_file(root + "/big.bin", big);
+  write_file(root + "/app.js", "plain");
+  write_file(root + "/app.js.gz", "gzipped");
+  mkdir((root + "/dir").c_str(), 0755);
+  write_file(root + "/dir/index.html", "<html></html>");
+  test_send_fail(root);
+
+  sylar::http::HttpServer::ptr server;
+  sylar::IOManager iom(1, false, "http");
+  sockaddr_in addr = start_server(iom, [&server, root]() {
+    server.reset(new sylar::http::HttpServer(true));
+    server->getServletDispatch()->addGlobServlet(
+        "/static/" "*",
+        sylar::http::Servlet::ptr(new StaticFileServlet("/static/", root)));
+    return server;
+  });
+
+  //小文件走内存缓存
+  std::string rsp = get(addr, "/static/small.txt");
+  SYLAR_LOG_INFO(g_logger) << rsp;
+  SYLAR_ASSERT(rsp.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+  SYLAR_ASSERT(body(rsp) == "hello world");
+  size_t pos = rsp.find("ETag: ");
+  SYLAR_ASSERT(pos != std::string::npos);
+  std::string etag = rsp.substr(pos + 6, rsp.find("\r\n", pos) - pos - 6);
+  SYLAR_ASSERT(body(get(addr, "/static/small.txt")) == "hello world");
+
+  //条件请求
+  rsp = get(addr, "/static/small.txt", "If-None-Match: W/" + etag + "\r\n");
+  SYLAR_ASSERT(rsp.compare(0, 12, "HTTP/1.1 304") == 0);
+  SYLAR_ASSERT(body(rsp).empty());
+  pos = rsp.find("Last-Modified: ");
+  std::string mtime = rsp.substr(pos + 15, rsp.find("\r\n", pos) - pos - 15);
+  rsp = get(addr, "/static/small.txt", "If-Modified-Since: " + mtime + "\r\n");
+  SYLAR_ASSERT(rsp.compare(0, 12, "HTTP/1.1 304") == 0);
+
+  //大文件走sendfile
+  rsp = get(addr, "/static/big.bin");
+  SYLAR_ASSERT(body(rsp) == big);
+  rsp = get(addr, "/static/big.bin", "Range: bytes=1000-1999\r\n");
+  SYLAR_ASSERT(rsp.compare(0, 12, "HTTP/1.1 206") == 0);
+  SYLAR_ASSERT(rsp.find("Content-Range: bytes 1000-1999/" +
+                        std::to_string(big.size())) != std::string::npos);
+  SYLAR_ASSERT(body(rsp) == big.substr(1000, 1000));
+  rsp = get(addr, "/static/small.txt", "Range: bytes=-5\r\n");
+  SYLAR_ASSERT(body(rsp) == "world");
+  rsp = get(addr, "/static/small.txt", "Range: bytes=100-\r\n");
+  SYLAR_ASSERT(rsp.compare(0, 12, "HTTP/1.1 416") == 0);
+  //If-Range不匹配, 发送整个文件
+  rsp = get(addr, "/static/small.txt",
+            "Range: bytes=0-1\r\nIf-Range: \"stale\"\r\n");
+  SYLAR_ASSERT(body(rsp) == "hello world");
+
+  //预压缩文件
+  rsp = get(addr, "/static/app.js", "Accept-Encoding: gzip, br\r\n");
+  SYLAR_ASSERT(rsp.find("Content-Encoding: gzip") != std::string::npos);
+  SYLAR_ASSERT(rsp.find("application/javascript") != std::string::npos);
+  SYLAR_ASSERT(body(rsp) == "gzipped");
+  rsp = get(addr, "/static/app.js");
+  SYLAR_ASSERT(rsp.find("Vary: Accept-Encoding") != std::string::npos);
+  SYLAR_ASSERT(body(rsp) == "plain");
+
+  SYLAR_ASSERT(body(get(addr, "/static/dir/")) == "<html></html>");
+  rsp = run_client(addr, "HEAD /static/big.bin HTTP/1.1\r\n\r\n");
+  SYLAR_ASSERT(body(rsp).empty());
+  SYLAR_ASSERT(rsp.find("Content-Length: " + std::to_string(big.size())) !=
+               std::string::npos);
+  SYLAR_ASSERT(get(addr, "/static/../etc/passwd").compare(0, 12,
+                                                          "HTTP/1.1 404") ==
+               0);
+  SYLAR_ASSERT(get(addr, "/static/%2e%2e/etc/passwd")
+                   .compare(0, 12, "HTTP/1.1 404") == 0);
+  SYLAR_ASSERT(get(addr, "/static/none").compare(0, 12, "HTTP/1.1 404") == 0);
+  rsp = run_client(addr, "POST /static/small.txt HTTP/1.1\r\n\r\n");
+  SYLAR_ASSERT(rsp.compare(0, 12, "HTTP/1.1 405") == 0);
+  //keep-alive连接上没有消息体的404要带长度, 下一个响应才能分开
+  rsp = run_client(addr,
+                   "GET /static/none HTTP/1.1\r\n"
+                   "Connection: keep-alive\r\n\r\n"
+                   "GET /static/small.txt HTTP/1.1\r\n"
+                   "Connection: close\r\n\r\n");
+  SYLAR_ASSERT(rsp.compare(0, 12, "HTTP/1.1 404") == 0);
+  pos = rsp.find("\r\n\r\n");
+  SYLAR_ASSERT(rsp.substr(0, pos).find("content-length: 0") !=
+               std::string::npos);
+  SYLAR_ASSERT(rsp.compare(pos + 4, 12, "HTTP/1.1 200") == 0);
+  SYLAR_ASSERT(body(rsp.substr(pos + 4)) == "hello world");
+
+  server->stop();
+  SYLAR_LOG_INFO(g_logger) << "test_static_file ok";
+  return 0;
+}
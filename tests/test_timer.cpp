@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include "sylar/sylar.h"
+#include "sylar/timer.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<std::string>::ptr g_backend =
+    sylar::Config::Lookup<std::string>("timer.backend");
+
+/**
+ * @brief 不依赖IOManager的定时器管理器, 手动取到期的回调
+ * */
+class TestTimerManager : public sylar::TimerManager {
+ public:
+  void onTimerInsertedAtFront() override {}
+};
+
+/**
+ * @brief 随机超时的定时器, 取消一半, 剩下的不能早于到期时间执行
+ * */
+void test_expire(int count) {
+  TestTimerManager mgr;
+  std::vector<uint64_t> deadlines(count);
+  std::vector<sylar::Timer::ptr> timers(count);
+  int fired = 0;
+  int early = 0;
+  for (int i = 0; i < count; ++i) {
+    uint64_t ms = rand() % 600;
+    deadlines[i] = sylar::GetCurrentMS() + ms;
+    timers[i] = mgr.addTimer(ms, [i, &deadlines, &fired, &early]() {
+      ++fired;
+      if (sylar::GetCurrentMS() < deadlines[i]) {
+        ++early;
+      }
+    });
+  }
+  //跨过第0层的超时, 需要降级
+  mgr.addTimer(100 * 1000, []() { SYLAR_ASSERT(false); });
+  int cancelled = 0;
+  for (int i = 0; i < count; i += 2) {
+    cancelled += timers[i]->cancel();
+  }
+  int recurring = 0;
+  auto rtimer = mgr.addTimer(50, [&recurring]() { ++recurring; }, true);
+
+  while (fired < count - cancelled) {
+    uint64_t next = mgr.getNextTimer();
+    SYLAR_ASSERT(next != ~0ull);
+    usleep(std::min(next, (uint64_t)5) * 1000);
+    std::vector<std::function<void()>> cbs;
+    mgr.listExpiredCb(cbs);
+    for (auto& cb : cbs) {
+      cb();
+    }
+  }
+  rtimer->cancel();
+  SYLAR_LOG_INFO(g_logger) << "backend=" << g_backend->getValue()
+                           << " fired=" << fired << " cancelled=" << cancelled
+                           << " early=" << early << " recurring=" << recurring;
+  SYLAR_ASSERT(early == 0);
+  SYLAR_ASSERT(recurring >= 8);
+  SYLAR_ASSERT(mgr.hasTimer());
+}
+
+/**
+ * @brief 模拟do_io: 每个连接一个接收超时, 反复添加/刷新/取消
+ * */
+void bench(int count) {
+  TestTimerManager mgr;
+  std::vector<sylar::Timer::ptr> timers(count);
+  std::shared_ptr<int> cond(new int(0));
+
+  uint64_t t0 = sylar::GetCurrentUS();
+  for (int i = 0; i < count; ++i) {
+    timers[i] = mgr.addConditionTimer(5000 + i % 30000, []() {}, cond);
+  }
+  uint64_t t1 = sylar::GetCurrentUS();
+  for (int i = 0; i < count; ++i) {
+    timers[i]->refresh();
+  }
+  uint64_t t2 = sylar::GetCurrentUS();
+  for (int i = 0; i < count; ++i) {
+    timers[i]->cancel();
+  }
+  uint64_t t3 = sylar::GetCurrentUS();
+  //添加之后立刻取消, 与数据已就绪的recv相同
+  for (int i = 0; i < count; ++i) {
+    timers[i] = mgr.addConditionTimer(5000 + i % 30000, []() {}, cond);
+  }
+  uint64_t t4 = sylar::GetCurrentUS();
+  for (int i = 0; i < count; ++i) {
+    mgr.addConditionTimer(3000, []() {}, cond)->cancel();
+  }
+  uint64_t t5 = sylar::GetCurrentUS();
+
+  SYLAR_LOG_INFO(g_logger)
+      << "backend=" << g_backend->getValue() << " timers=" << count
+      << " add=" << (t1 - t0) * 1000.0 / count << "ns"
+      << " refresh=" << (t2 - t1) * 1000.0 / count << "ns"
+      << " cancel=" << (t3 - t2) * 1000.0 / count << "ns"
+      << " add_cancel(with " << count
+      << " pending)=" << (t5 - t4) * 1000.0 / count << "ns";
+}
+
+int main(int argc, char** argv) {
+  int count = argc > 1 ? atoi(argv[1]) : 200000;
+  for (auto backend : {"set", "wheel"}) {
+    g_backend->setValue(backend);
+    test_expire(2000);
+    bench(count);
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include <unistd.h>
+#include <atomic>
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/mutex.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/// 线程数
+static const int THREADS = 4;
+/// 单个任务的轮数
+static const int ROUNDS = 2000;
+/// 突发任务的批数
+static const int BURSTS = 200;
+/// 每批的任务数
+static const int BURST_SIZE = 16;
+
+/**
+ * @brief 所有线程空闲时从外部放入一个任务, 统计到任务开始执行的延迟
+ * @param[in] thread 指定执行的线程, -1表示任意线程
+ */
+static void bench_latency(sylar::IOManager& iom, int thread) {
+  sylar::Semaphore sem;
+  uint64_t total = 0;
+  for (int i = 0; i < ROUNDS; ++i) {
+    //等线程都回到休眠
+    usleep(100);
+    uint64_t begin = sylar::GetCurrentUS();
+    uint64_t start = 0;
+    iom.schedule(
+        [&sem, &start]() {
+          start = sylar::GetCurrentUS();
+          sem.notify();
+        },
+        thread);
+    sem.wait();
+    total += start - begin;
+  }
+  SYLAR_LOG_INFO(g_logger) << (thread == -1 ? "any thread" : "pinned thread")
+                           << " wakeup latency: " << total / ROUNDS
+                           << "us avg";
+}
+
+/**
+ * @brief 一次放入一批短任务, 统计唤醒了多少次, 多少次醒来没事做
+ */
+static void bench_burst(sylar::IOManager& iom) {
+  std::atomic<int> done{0};
+  uint64_t wakeups = iom.getWakeups();
+  uint64_t futile = iom.getFutileWakeups();
+  uint64_t begin = sylar::GetCurrentUS();
+  for (int i = 0; i < BURSTS; ++i) {
+    for (int j = 0; j < BURST_SIZE; ++j) {
+      iom.schedule([&done]() { ++done; });
+    }
+    while (done < (i + 1) * BURST_SIZE) {
+      usleep(50);
+    }
+  }
+  uint64_t used = sylar::GetCurrentUS() - begin;
+  SYLAR_LOG_INFO(g_logger) << BURSTS << " bursts x " << BURST_SIZE
+                           << " tasks: " << used << "us, wakeups="
+                           << iom.getWakeups() - wakeups
+                           << " futile=" << iom.getFutileWakeups() - futile;
+}
+
+int main(int argc, char** argv) {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::WARN);
+  sylar::IOManager iom(THREADS, false, "wakeup");
+  //取一个工作线程的id
+  sylar::Semaphore sem;
+  int tid = -1;
+  iom.schedule([&sem, &tid]() {
+    tid = sylar::GetThreadId();
+    sem.notify();
+  });
+  sem.wait();
+
+  bench_latency(iom, -1);
+  bench_latency(iom, tid);
+  bench_burst(iom);
+  SYLAR_LOG_INFO(g_logger) << "total wakeups=" << iom.getWakeups()
+                           << " futile=" << iom.getFutileWakeups();
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include "sylar/iomanager.h"
+#include "sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_done{0};
+static std::atomic<uint64_t> s_pinned_fail{0};
+
+/**
+ * @brief 每个任务再派生两个子任务, 直到深度用完
+ * */
+void spawn(int depth) {
+  s_done++;
+  if (depth > 0) {
+    sylar::Scheduler::GetThis()->schedule(std::bind(&spawn, depth - 1));
+    sylar::Scheduler::GetThis()->schedule(std::bind(&spawn, depth - 1));
+  }
+}
+
+void pinned(int tid, int left) {
+  if (tid != sylar::GetThreadId()) {
+    ++s_pinned_fail;
+  }
+  s_done++;
+  if (left > 0) {
+    sylar::Scheduler::GetThis()->schedule(std::bind(&pinned, tid, left - 1),
+                                          tid);
+  }
+}
+
+/**
+ * @brief 协程之间互相唤醒(走LIFO槽)
+ * */
+void ping_pong(int n) {
+  sylar::Fiber::ptr self = sylar::Fiber::GetThis();
+  for (int i = 0; i < n; ++i) {
+    s_done++;
+    sylar::Scheduler::GetThis()->schedule(self);
+    sylar::Fiber::YieldToHold();
+  }
+}
+
+void run(int threads, int depth) {
+  s_done = 0;
+  uint64_t ts = sylar::GetCurrentMS();
+  {
+    sylar::IOManager iom(threads, false, "ws");
+    for (int i = 0; i < 8; ++i) {
+      iom.schedule(std::bind(&spawn, depth));
+      iom.schedule([]() {
+        pinned(sylar::GetThreadId(), 1000);
+      });
+      iom.schedule(std::bind(&ping_pong, 10000));
+    }
+  }
+  uint64_t expect = 8 * (((uint64_t)1 << (depth + 1)) - 1) + 8 * 1001 +
+                    8 * 10000;
+  SYLAR_LOG_INFO(g_logger) << "threads=" << threads << " tasks=" << s_done
+                           << " used=" << sylar::GetCurrentMS() - ts << "ms";
+  SYLAR_ASSERT(s_done == expect);
+  SYLAR_ASSERT(s_pinned_fail == 0);
+}
+
+int main(int argc, char** argv) {
+  SYLAR_LOG_NEAME("system")->setLevel(sylar::LogLevel::WARN);
+  int depth = argc > 1 ? atoi(argv[1]) : 16;
+  for (int threads : {1, 2, 4, 8}) {
+    run(threads, depth);
+  }
+  return 0;
+}
@@ -0,0 +1,336 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "sylar/http/ws_server.h"
+#include "sylar/sylar.h"
+#include "test_server.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 逐字节异或, 作为WSMask的对照
+ * */
+static void naive_mask(uint8_t* data, size_t len, const uint8_t key[4],
+                       size_t offset) {
+  for (size_t i = 0; i < len; ++i) {
+    data[i] ^= key[(offset + i) & 3];
+  }
+}
+
+void test_mask() {
+  const uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+  std::string data(1000, '\0');
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = i * 7;
+  }
+  for (size_t len : {0, 1, 3, 7, 8, 15, 16, 17, 33, 999}) {
+    for (size_t offset : {0, 1, 2, 3}) {
+      std::string a = data.substr(0, len);
+      std::string b = a;
+      sylar::http::WSMask(&a[0], len, key, offset);
+      naive_mask((uint8_t*)&b[0], len, key, offset);
+      SYLAR_ASSERT(a == b);
+    }
+  }
+
+  std::string big(1024 * 1024, 'x');
+  uint64_t begin = sylar::GetCurrentUS();
+  for (int i = 0; i < 100; ++i) {
+    naive_mask((uint8_t*)&big[0], big.size(), key, 0);
+  }
+  uint64_t naive = sylar::GetCurrentUS() - begin;
+  begin = sylar::GetCurrentUS();
+  for (int i = 0; i < 100; ++i) {
+    sylar::http::WSMask(&big[0], big.size(), key);
+  }
+  uint64_t simd = sylar::GetCurrentUS() - begin;
+  SYLAR_LOG_INFO(g_logger) << "mask 100MB naive=" << naive << "us wsmask="
+                           << simd << "us";
+}
+
+void test_utf8() {
+  using sylar::http::WSIsUtf8;
+  const char* good[] = {"", "hello world, plain ascii", "h\xc3\xa9llo",
+                        "\xe4\xb8\xad\xe6\x96\x87", "\xef\xbf\xbd",
+                        "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf"};
+  for (auto i : good) {
+    SYLAR_ASSERT2(WSIsUtf8(i, strlen(i)), i);
+  }
+  //非法起始字节, 过长编码, 代理区, 超出U+10FFFF, 截断, 缺少后续字节
+  const char* bad[] = {"\xff",
+                       "\x80",
+                       "\xc0\xaf",
+                       "\xe0\x80\xaf",
+                       "\xed\xa0\x80",
+                       "\xf4\x90\x80\x80",
+                       "12345678\xe4\xb8",
+                       "\xc3(",
+                       "\xf0\x9f\x98("};
+  for (auto i : bad) {
+    SYLAR_ASSERT2(!WSIsUtf8(i, strlen(i)), i);
+  }
+}
+
+void test_accept_key() {
+  //RFC 6455 1.3的例子
+  std::string accept = sylar::Base64Encode(sylar::Sha1Sum(
+      std::string("dGhlIHNhbXBsZSBub25jZQ==") +
+      "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+  SYLAR_ASSERT2(accept == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", accept);
+  SYLAR_ASSERT(sylar::Base64Encode("f") == "Zg==");
+  SYLAR_ASSERT(sylar::Base64Encode("fo") == "Zm8=");
+  SYLAR_ASSERT(sylar::Base64Encode("foo") == "Zm9v");
+}
+
+/**
+ * @brief 客户端发送的帧, 带掩码
+ * */
+static std::string client_frame(int opcode, const std::string& payload,
+                                bool fin = true, bool rsv1 = false) {
+  const uint8_t key[4] = {0xa1, 0xb2, 0xc3, 0xd4};
+  std::string rt;
+  rt += (char)((fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | opcode);
+  if (payload.size() < 126) {
+    rt += (char)(0x80 | payload.size());
+  } else if (payload.size() <= 0xffff) {
+    rt += (char)(0x80 | 126);
+    rt += (char)(payload.size() >> 8);
+    rt += (char)payload.size();
+  } else {
+    rt += (char)(0x80 | 127);
+    for (int i = 7; i >= 0; --i) {
+      rt += (char)(payload.size() >> (i * 8));
+    }
+  }
+  rt.append((const char*)key, 4);
+  std::string data = payload;
+  naive_mask((uint8_t*)&data[0], data.size(), key, 0);
+  return rt + data;
+}
+
+/**
+ * @brief raw deflate加上Z_SYNC_FLUSH, 去掉结尾的00 00 ff ff
+ * */
+static std::string deflate_raw(const std::string& data) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  deflateInit2(&zs, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+  std::string out(data.size() + 64, '\0');
+  zs.next_in = (Bytef*)data.data();
+  zs.avail_in = data.size();
+  zs.next_out = (Bytef*)&out[0];
+  zs.avail_out = out.size();
+  deflate(&zs, Z_SYNC_FLUSH);
+  out.resize(out.size() - zs.avail_out - 4);
+  deflateEnd(&zs);
+  return out;
+}
+
+struct ServerFrame {
+  int opcode;
+  bool rsv1;
+  std::string payload;
+};
+
+/**
+ * @brief 解析服务端发来的帧(不带掩码)
+ * */
+static std::vector<ServerFrame> parse_frames(const std::string& data) {
+  std::vector<ServerFrame> rt;
+  size_t pos = 0;
+  while (pos + 2 <= data.size()) {
+    ServerFrame f;
+    f.opcode = data[pos] & 0x0f;
+    f.rsv1 = data[pos] & 0x40;
+    SYLAR_ASSERT(!(data[pos + 1] & 0x80));
+    uint64_t len = data[pos + 1] & 0x7f;
+    pos += 2;
+    size_t n = len == 126 ? 2 : (len == 127 ? 8 : 0);
+    if (n) {
+      len = 0;
+      for (size_t i = 0; i < n; ++i) {
+        len = (len << 8) | (uint8_t)data[pos + i];
+      }
+      pos += n;
+    }
+    f.payload = data.substr(pos, len);
+    pos += len;
+    rt.push_back(f);
+  }
+  return rt;
+}
+
+/**
+ * @brief 进程的常驻内存, KB
+ * */
+static size_t rss_kb() {
+  size_t pages = 0;
+  size_t rss = 0;
+  FILE* fp = fopen("/proc/self/statm", "r");
+  SYLAR_ASSERT(fp && fscanf(fp, "%zu %zu", &pages, &rss) == 2);
+  fclose(fp);
+  return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ * @brief 帧头声明的长度不能让服务端在数据到达前就分配内存
+ * */
+void test_declared_size(sockaddr_in addr, const std::string& handshake) {
+  const uint64_t declared = 30 * 1024 * 1024;
+  std::string req = handshake + "\r\n" + std::string("\x82\xff", 2);
+  for (int i = 7; i >= 0; --i) {
+    req += (char)(declared >> (i * 8));
+  }
+  req += std::string(4, '\0') + "0123456789";
+  size_t before = rss_kb();
+  int sock = connect_send(addr, req);
+  usleep(200 * 1000);
+  size_t after = rss_kb();
+  size_t grown = after > before ? after - before : 0;
+  close(sock);
+  SYLAR_LOG_INFO(g_logger) << "declared " << declared << " bytes, rss grew "
+                           << grown << "KB";
+  SYLAR_ASSERT(grown < 8 * 1024);
+}
+
+int main(int argc, char** argv) {
+  test_mask();
+  test_utf8();
+  test_accept_key();
+
+  sylar::http::WSServer::ptr server;
+  sylar::IOManager iom(1, false, "ws");
+  sockaddr_in addr = start_server(iom, [&server]() {
+    server.reset(new sylar::http::WSServer);
+    //原样回复收到的消息
+    server->getWSServletDispatch()->addServlet(
+        "/echo", [](sylar::http::HttpRequest::ptr header,
+                    sylar::http::WSFrameMessage::ptr msg,
+                    sylar::http::WSSession::ptr session) {
+          return session->sendMessage(msg) > 0 ? 0 : 1;
+        });
+    return server;
+  });
+
+  const std::string handshake =
+      "GET /echo HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n"
+      "Connection: keep-alive, Upgrade\r\n"
+      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+      "Sec-WebSocket-Version: 13\r\n";
+  std::string big(200000, 'b');
+  //握手后紧跟着: 普通消息, 中间夹着ping的分片消息, 大消息, 关闭
+  std::string req = handshake + "\r\n" +
+                    client_frame(sylar::http::WSFrameHead::TEXT_FRAME,
+                                 "hello") +
+                    client_frame(sylar::http::WSFrameHead::TEXT_FRAME, "frag",
+                                 false) +
+                    client_frame(sylar::http::WSFrameHead::PING, "p") +
+                    client_frame(sylar::http::WSFrameHead::CONTINUE, "ment") +
+                    client_frame(sylar::http::WSFrameHead::BIN_FRAME, big) +
+                    client_frame(sylar::http::WSFrameHead::CLOSE,
+                                 std::string("\x03\xe8", 2));
+  std::string rsp = run_client(addr, req);
+  SYLAR_ASSERT(rsp.compare(0, 12, "HTTP/1.1 101") == 0);
+  SYLAR_ASSERT(rsp.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") !=
+               std::string::npos);
+  SYLAR_ASSERT(rsp.find("Sec-WebSocket-Extensions") == std::string::npos);
+  auto frames = parse_frames(rsp.substr(rsp.find("\r\n\r\n") + 4));
+  SYLAR_ASSERT(frames.size() == 5);
+  SYLAR_ASSERT(frames[0].payload == "hello");
+  SYLAR_ASSERT(frames[1].opcode == sylar::http::WSFrameHead::PONG);
+  SYLAR_ASSERT(frames[1].payload == "p");
+  SYLAR_ASSERT(frames[2].payload == "fragment");
+  SYLAR_ASSERT(frames[3].opcode == sylar::http::WSFrameHead::BIN_FRAME);
+  SYLAR_ASSERT(frames[3].payload == big);
+  SYLAR_ASSERT(frames[4].opcode == sylar::http::WSFrameHead::CLOSE);
+
+  //permessage-deflate: 压缩的消息解压后回复, 回复也是压缩的
+  std::string text;
+  for (int i = 0; i < 100; ++i) {
+    text += "message " + std::to_string(i) + " ";
+  }
+  req = handshake +
+        "Sec-WebSocket-Extensions: permessage-deflate; "
+        "client_max_window_bits\r\n\r\n" +
+        client_frame(sylar::http::WSFrameHead::TEXT_FRAME, deflate_raw(text),
+                     true, true) +
+        client_frame(sylar::http::WSFrameHead::TEXT_FRAME, "tiny") +
+        client_frame(sylar::http::WSFrameHead::CLOSE, "");
+  rsp = run_client(addr, req);
+  SYLAR_ASSERT(rsp.find("Sec-WebSocket-Extensions: permessage-deflate") !=
+               std::string::npos);
+  frames = parse_frames(rsp.substr(rsp.find("\r\n\r\n") + 4));
+  SYLAR_ASSERT(frames.size() == 3);
+  SYLAR_ASSERT(frames[0].rsv1 && frames[0].payload.size() < text.size());
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  inflateInit2(&zs, -15);
+  std::string in = frames[0].payload + std::string("\x00\x00\xff\xff", 4);
+  std::string out(text.size() * 2, '\0');
+  zs.next_in = (Bytef*)in.data();
+  zs.avail_in = in.size();
+  zs.next_out = (Bytef*)&out[0];
+  zs.avail_out = out.size();
+  inflate(&zs, Z_SYNC_FLUSH);
+  out.resize(out.size() - zs.avail_out);
+  inflateEnd(&zs);
+  SYLAR_ASSERT(out == text);
+  //小消息不压缩
+  SYLAR_ASSERT(!frames[1].rsv1 && frames[1].payload == "tiny");
+
+  //没有掩码是协议错误, 回复1002
+  req = handshake + "\r\n" + std::string("\x81\x02hi", 4);
+  rsp = run_client(addr, req);
+  frames = parse_frames(rsp.substr(rsp.find("\r\n\r\n") + 4));
+  SYLAR_ASSERT(frames.size() == 1);
+  SYLAR_ASSERT(frames[0].payload == std::string("\x03\xea", 2));
+
+  //分片消息后跟一个声明超长的延续帧: 最高位为1是协议错误(1002),
+  //否则超过消息上限(1009), 都不能因为长度相加溢出而写越界
+  const uint64_t lens[] = {0xfffffffffffffffbull, 0x7ffffffffffffffbull};
+  const char* codes[] = {"\x03\xea", "\x03\xf1"};
+  for (int i = 0; i < 2; ++i) {
+    std::string cont("\x00\xff", 2);
+    for (int j = 7; j >= 0; --j) {
+      cont += (char)(lens[i] >> (j * 8));
+    }
+    cont += std::string(4, '\0') + "0123456789";
+    req = handshake + "\r\n" +
+          client_frame(sylar::http::WSFrameHead::TEXT_FRAME, "0123456789",
+                       false) +
+          cont;
+    rsp = run_client(addr, req);
+    frames = parse_frames(rsp.substr(rsp.find("\r\n\r\n") + 4));
+    SYLAR_ASSERT(frames.size() == 1);
+    SYLAR_ASSERT(frames[0].opcode == sylar::http::WSFrameHead::CLOSE);
+    SYLAR_ASSERT(frames[0].payload == std::string(codes[i], 2));
+  }
+
+  //文本消息必须是UTF-8, 字符可以跨分片, 不合法时回复1007
+  req = handshake + "\r\n" +
+        client_frame(sylar::http::WSFrameHead::TEXT_FRAME, "h\xc3", false) +
+        client_frame(sylar::http::WSFrameHead::CONTINUE, "\xa9llo") +
+        client_frame(sylar::http::WSFrameHead::TEXT_FRAME, "bad \xff");
+  rsp = run_client(addr, req);
+  frames = parse_frames(rsp.substr(rsp.find("\r\n\r\n") + 4));
+  SYLAR_ASSERT(frames.size() == 2);
+  SYLAR_ASSERT(frames[0].payload == "h\xc3\xa9llo");
+  SYLAR_ASSERT(frames[1].opcode == sylar::http::WSFrameHead::CLOSE);
+  SYLAR_ASSERT(frames[1].payload == std::string("\x03\xef", 2));
+
+  //只发一个声明30MB的帧头, 内存按收到的数据增长
+  test_declared_size(addr, handshake);
+
+  //不是升级请求
+  rsp = run_client(addr, "GET /echo HTTP/1.1\r\n\r\n");
+  SYLAR_ASSERT(rsp.compare(0, 12, "HTTP/1.1 400") == 0);
+  rsp = run_client(addr, "GET /none" + handshake.substr(9) + "\r\n");
+  SYLAR_ASSERT(rsp.compare(0, 12, "HTTP/1.1 404") == 0);
+
+  server->stop();
+  SYLAR_LOG_INFO(g_logger) << "test_ws_server ok";
+  return 0;
+}